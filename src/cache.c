@@ -0,0 +1,154 @@
+#include "cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_NODES (GF_CACHE_BLOCK * GF_CACHE_BLOCK)
+
+
+int gf_init_block_cache(gf_block_cache *cache, const gf_struct *gf, int nblocks) {
+    int k, slots;
+
+    cache->gf = gf;
+    cache->nsets = (nblocks + GF_CACHE_WAYS - 1) / GF_CACHE_WAYS;
+    if (cache->nsets < 1)
+        cache->nsets = 1;
+    slots = cache->nsets * GF_CACHE_WAYS;
+
+    cache->nbx = (gf->grid.nx + GF_CACHE_BLOCK - 1) / GF_CACHE_BLOCK;
+    cache->ids = (long *)malloc(slots * sizeof(long));
+    cache->used = (unsigned long *)calloc(slots, sizeof(unsigned long));
+    cache->blocks = (gf_float *)malloc((size_t)slots * BLOCK_NODES * sizeof(gf_float));
+    cache->clock = 0;
+    cache->last_id = -1;
+    cache->last = NULL;
+    cache->hits = cache->misses = cache->failed = 0;
+
+    if (cache->ids == NULL || cache->used == NULL || cache->blocks == NULL) {
+        gf_free_block_cache(cache);
+        return -1;
+    }
+
+    for (k = 0; k < slots; k++)
+        cache->ids[k] = -1;
+    return 0;
+}
+
+
+void gf_free_block_cache(gf_block_cache *cache) {
+    free(cache->ids);
+    free(cache->used);
+    free(cache->blocks);
+    cache->ids = NULL;
+    cache->used = NULL;
+    cache->blocks = NULL;
+}
+
+
+/* Returns -1, with the block all GF_NULL_VAL, if a row fails to read. */
+static
+int gf_cache_fill(gf_block_cache *cache, long bi, long bj, gf_float *block) {
+    const gf_grid *g = &cache->gf->grid;
+    long ii, ii0 = bi * GF_CACHE_BLOCK, jj0 = bj * GF_CACHE_BLOCK;
+    long w = GF_CACHE_BLOCK, r, c;
+
+    if (jj0 + w > g->nx)
+        w = g->nx - jj0;
+
+    for (r = 0; r < GF_CACHE_BLOCK; r++) {
+        ii = ii0 + r;
+        if (ii >= g->ny) {
+            for (c = 0; c < GF_CACHE_BLOCK; c++)
+                block[r * GF_CACHE_BLOCK + c] = GF_NULL_VAL;
+            continue;
+        }
+        if (gf_get_line(ii, jj0, jj0 + w, cache->gf, block + r * GF_CACHE_BLOCK) != 0) {
+            for (c = 0; c < BLOCK_NODES; c++)
+                block[c] = GF_NULL_VAL;
+            return -1;
+        }
+        for (c = w; c < GF_CACHE_BLOCK; c++)
+            block[r * GF_CACHE_BLOCK + c] = GF_NULL_VAL;
+    }
+    return 0;
+}
+
+
+const gf_float *gf_cache_block(gf_block_cache *cache, long ii, long jj) {
+    long bi = ii / GF_CACHE_BLOCK, bj = jj / GF_CACHE_BLOCK;
+    long id = bi * cache->nbx + bj;
+    unsigned long h;
+    int k, set, slot, victim;
+
+    if (id == cache->last_id) {
+        cache->hits++;
+        return cache->last;
+    }
+
+    /* Fibonacci hashing spreads neighboring blocks across sets. */
+    h = (unsigned long)id * 11400714819323198485ul;
+    set = (int)((h >> 17) % (unsigned long)cache->nsets);
+    slot = set * GF_CACHE_WAYS;
+
+    cache->clock++;
+    victim = slot;
+    for (k = slot; k < slot + GF_CACHE_WAYS; k++) {
+        if (cache->ids[k] == id) {
+            cache->used[k] = cache->clock;
+            cache->hits++;
+            cache->last_id = id;
+            cache->last = cache->blocks + (size_t)k * BLOCK_NODES;
+            return cache->last;
+        }
+        if (cache->used[k] < cache->used[victim])
+            victim = k;
+    }
+
+    cache->misses++;
+    cache->ids[victim] = id;
+    cache->used[victim] = cache->clock;
+    cache->last_id = id;
+    cache->last = cache->blocks + (size_t)victim * BLOCK_NODES;
+    if (gf_cache_fill(cache, bi, bj, (gf_float *)cache->last) != 0) {
+        /* Hand back the nulls once, but read again next time. */
+        cache->failed++;
+        cache->ids[victim] = -1;
+        cache->used[victim] = 0;
+        cache->last_id = -1;
+    }
+    return cache->last;
+}
+
+
+gf_float gf_cache_value(gf_block_cache *cache, long ii, long jj) {
+    const gf_float *block;
+
+    if (ii < 0 || jj < 0 || ii >= cache->gf->grid.ny || jj >= cache->gf->grid.nx)
+        return GF_NULL_VAL;
+
+    block = gf_cache_block(cache, ii, jj);
+    return block[(ii % GF_CACHE_BLOCK) * GF_CACHE_BLOCK + jj % GF_CACHE_BLOCK];
+}
+
+
+void gf_cache_quad(gf_block_cache *cache, long ii, long jj, gf_float *quad) {
+    const gf_float *block;
+    long r = ii % GF_CACHE_BLOCK, c = jj % GF_CACHE_BLOCK;
+
+    /* Common case: all four nodes in one block. */
+    if (ii >= 0 && jj >= 0 && r < GF_CACHE_BLOCK - 1 && c < GF_CACHE_BLOCK - 1 &&
+        ii + 1 < cache->gf->grid.ny && jj + 1 < cache->gf->grid.nx)
+    {
+        block = gf_cache_block(cache, ii, jj) + r * GF_CACHE_BLOCK + c;
+        quad[0] = block[0];
+        quad[1] = block[1];
+        quad[2] = block[GF_CACHE_BLOCK];
+        quad[3] = block[GF_CACHE_BLOCK + 1];
+        return;
+    }
+
+    quad[0] = gf_cache_value(cache, ii, jj);
+    quad[1] = gf_cache_value(cache, ii, jj + 1);
+    quad[2] = gf_cache_value(cache, ii + 1, jj);
+    quad[3] = gf_cache_value(cache, ii + 1, jj + 1);
+}
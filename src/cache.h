@@ -0,0 +1,61 @@
+#ifndef GF_CACHE_H
+#define GF_CACHE_H
+
+#include "gridfloat.h"
+
+/* Side (in nodes) of a cached block. */
+#define GF_CACHE_BLOCK 64
+
+/* Blocks per set. Sets are picked by hashing the block id; within a
+   set the least recently used block is evicted. */
+#define GF_CACHE_WAYS 4
+
+/**
+ * Read-through cache of square blocks of source nodes, for access
+ * patterns that are local but not row-ordered (scattered points,
+ * paths, searches). Not thread-safe: give each thread its own.
+ *
+ * Values come back exactly as from gf_get_line (NODATA as
+ * GF_NULL_VAL). Blocks hanging off the right or bottom edge of the
+ * source are padded with GF_NULL_VAL. A block that fails to read comes
+ * back all GF_NULL_VAL, is not kept, and counts in failed; callers
+ * check failed once their lookups are done.
+ */
+typedef struct gf_block_cache {
+    const gf_struct *gf;
+    int nsets;
+    long nbx;               /* Blocks across the source */
+    long *ids;              /* nsets * GF_CACHE_WAYS block ids, -1 if empty */
+    unsigned long *used;    /* Last-use stamps, parallel to ids */
+    unsigned long clock;
+    gf_float *blocks;       /* GF_CACHE_BLOCK^2 nodes per slot */
+    long last_id;           /* Most recent block, checked first */
+    const gf_float *last;
+    long hits;
+    long misses;
+    long failed;            /* Block reads that failed */
+} gf_block_cache;
+
+/* nblocks is rounded up to a multiple of GF_CACHE_WAYS. */
+int gf_init_block_cache(gf_block_cache *cache, const gf_struct *gf, int nblocks);
+
+void gf_free_block_cache(gf_block_cache *cache);
+
+/**
+ * Block holding node (ii, jj). Returns a pointer to its first node;
+ * node (ii, jj) is at [(ii % GF_CACHE_BLOCK) * GF_CACHE_BLOCK +
+ * jj % GF_CACHE_BLOCK]. Valid until the next call.
+ */
+const gf_float *gf_cache_block(gf_block_cache *cache, long ii, long jj);
+
+/* Value of node (ii, jj); GF_NULL_VAL outside the source. */
+gf_float gf_cache_value(gf_block_cache *cache, long ii, long jj);
+
+/**
+ * The four nodes around (ii, jj) in gf_bilinear order: (ii, jj),
+ * (ii, jj+1), (ii+1, jj), (ii+1, jj+1). Nodes outside the source are
+ * GF_NULL_VAL.
+ */
+void gf_cache_quad(gf_block_cache *cache, long ii, long jj, gf_float *quad);
+
+#endif
@@ -0,0 +1,928 @@
+#include "calc.h"
+#include "linear.h"
+#include "pool.h"
+#include "stencil.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Row chunk each instruction runs over; sized so a program's stack
+   stays in L1. */
+#define CL_CHUNK 256
+#define CL_LANES 4       /* SSE/NEON width, so no ABI flags are needed */
+#define CL_NV (CL_CHUNK / CL_LANES)
+
+typedef float cl_vec __attribute__((vector_size(CL_LANES * sizeof(float))));
+typedef int32_t cl_mask __attribute__((vector_size(CL_LANES * sizeof(float))));
+
+#define CL_SPLAT(x) {x, x, x, x}
+
+enum {
+    CL_INPUT, CL_CONST,
+    /* Unary */
+    CL_NEG, CL_NOT, CL_ISNULL, CL_ABS, CL_SQRT, CL_EXP, CL_LOG, CL_LOG10,
+    CL_SIN, CL_COS, CL_TAN, CL_ASIN, CL_ACOS, CL_ATAN, CL_FLOOR, CL_CEIL,
+    CL_ROUND,
+    /* Binary */
+    CL_ADD, CL_SUB, CL_MUL, CL_DIV, CL_MOD, CL_POW, CL_ATAN2, CL_MIN, CL_MAX,
+    CL_LT, CL_LE, CL_GT, CL_GE, CL_EQ, CL_NE, CL_AND, CL_OR,
+    /* Ternary */
+    CL_SELECT
+};
+
+typedef struct gf_calc_op {
+    int code;
+    int arg;        /* Input index */
+    float value;    /* Constant */
+} gf_calc_op;
+
+typedef struct cl_func {
+    const char *name;
+    int code;
+    int nargs;
+} cl_func;
+
+static const cl_func cl_funcs[] = {
+    {"abs", CL_ABS, 1}, {"sqrt", CL_SQRT, 1}, {"exp", CL_EXP, 1},
+    {"log", CL_LOG, 1}, {"log10", CL_LOG10, 1}, {"sin", CL_SIN, 1},
+    {"cos", CL_COS, 1}, {"tan", CL_TAN, 1}, {"asin", CL_ASIN, 1},
+    {"acos", CL_ACOS, 1}, {"atan", CL_ATAN, 1}, {"floor", CL_FLOOR, 1},
+    {"ceil", CL_CEIL, 1}, {"round", CL_ROUND, 1}, {"isnull", CL_ISNULL, 1},
+    {"atan2", CL_ATAN2, 2}, {"min", CL_MIN, 2}, {"max", CL_MAX, 2},
+    {"pow", CL_POW, 2},
+    {NULL, 0, 0}
+};
+
+
+/* Recursive-descent parser state. */
+typedef struct cl_parser {
+    const char *expr;
+    const char *p;
+    int ninputs;
+    char *const *names;
+    gf_calc_prog *prog;
+    int sp;
+    int err;
+} cl_parser;
+
+
+static
+void cl_error(cl_parser *ps, const char *msg) {
+    if (!ps->err)
+        fprintf(stderr, "gf_calc_compile: %s at column %d of '%s'\n", msg,
+            (int)(ps->p - ps->expr) + 1, ps->expr);
+    ps->err = 1;
+}
+
+
+static
+void cl_emit(cl_parser *ps, int code, int arg, float value) {
+    gf_calc_prog *prog = ps->prog;
+
+    if (prog->nops == prog->cap) {
+        prog->cap = prog->cap ? 2 * prog->cap : 16;
+        prog->ops = (gf_calc_op *)realloc(prog->ops, prog->cap * sizeof(gf_calc_op));
+    }
+    prog->ops[prog->nops].code = code;
+    prog->ops[prog->nops].arg = arg;
+    prog->ops[prog->nops].value = value;
+    prog->nops++;
+
+    if (code == CL_INPUT || code == CL_CONST)
+        ps->sp++;
+    else if (code == CL_SELECT)
+        ps->sp -= 2;
+    else if (code >= CL_ADD)
+        ps->sp--;
+    if (ps->sp > prog->depth)
+        prog->depth = ps->sp;
+}
+
+
+static
+void cl_space(cl_parser *ps) {
+    while (isspace((unsigned char)*ps->p))
+        ps->p++;
+}
+
+
+/* Consume tok (after any space) if it is next. */
+static
+int cl_accept(cl_parser *ps, const char *tok) {
+    size_t n = strlen(tok);
+
+    cl_space(ps);
+    if (strncmp(ps->p, tok, n) != 0)
+        return 0;
+    ps->p += n;
+    return 1;
+}
+
+
+static
+void cl_expect(cl_parser *ps, const char *tok) {
+    if (!cl_accept(ps, tok)) {
+        char msg[32];
+        snprintf(msg, sizeof(msg), "expected '%s'", tok);
+        cl_error(ps, msg);
+    }
+}
+
+
+static void cl_cond(cl_parser *ps);
+static void cl_unary(cl_parser *ps);
+
+
+static
+void cl_call(cl_parser *ps, const char *name, size_t len) {
+    const cl_func *f;
+    int k;
+
+    for (f = cl_funcs; f->name != NULL; f++)
+        if (strlen(f->name) == len && strncmp(f->name, name, len) == 0)
+            break;
+    if (f->name == NULL) {
+        cl_error(ps, "unknown function");
+        return;
+    }
+    for (k = 0; k < f->nargs && !ps->err; k++) {
+        if (k > 0)
+            cl_expect(ps, ",");
+        cl_cond(ps);
+    }
+    cl_expect(ps, ")");
+    cl_emit(ps, f->code, 0, 0.0f);
+}
+
+
+static
+void cl_atom(cl_parser *ps) {
+    const char *name;
+    char *end;
+    size_t len;
+    int k;
+
+    cl_space(ps);
+    if (cl_accept(ps, "(")) {
+        cl_cond(ps);
+        cl_expect(ps, ")");
+    } else if (isdigit((unsigned char)*ps->p) || *ps->p == '.') {
+        cl_emit(ps, CL_CONST, 0, (float)strtod(ps->p, &end));
+        if (end == ps->p)
+            cl_error(ps, "bad number");
+        ps->p = end;
+    } else if (isalpha((unsigned char)*ps->p) || *ps->p == '_') {
+        name = ps->p;
+        while (isalnum((unsigned char)*ps->p) || *ps->p == '_')
+            ps->p++;
+        len = ps->p - name;
+        if (cl_accept(ps, "(")) {
+            cl_call(ps, name, len);
+            return;
+        }
+        for (k = 0; k < ps->ninputs; k++)
+            if (strlen(ps->names[k]) == len && strncmp(ps->names[k], name, len) == 0)
+                break;
+        if (k < ps->ninputs)
+            cl_emit(ps, CL_INPUT, k, 0.0f);
+        else if (len == 6 && strncmp(name, "nodata", 6) == 0)
+            cl_emit(ps, CL_CONST, 0, NAN);
+        else if (len == 2 && strncmp(name, "pi", 2) == 0)
+            cl_emit(ps, CL_CONST, 0, (float)PI);
+        else {
+            ps->p = name;
+            cl_error(ps, "unknown name");
+        }
+    } else {
+        cl_error(ps, *ps->p ? "unexpected character" : "unexpected end");
+    }
+}
+
+
+static
+void cl_power(cl_parser *ps) {
+    cl_atom(ps);
+    if (cl_accept(ps, "^")) {
+        cl_unary(ps);
+        cl_emit(ps, CL_POW, 0, 0.0f);
+    }
+}
+
+
+static
+void cl_unary(cl_parser *ps) {
+    if (cl_accept(ps, "-")) {
+        cl_unary(ps);
+        cl_emit(ps, CL_NEG, 0, 0.0f);
+    } else if (cl_accept(ps, "+")) {
+        cl_unary(ps);
+    } else if (cl_space(ps), ps->p[0] == '!' && ps->p[1] != '=') {
+        ps->p++;
+        cl_unary(ps);
+        cl_emit(ps, CL_NOT, 0, 0.0f);
+    } else {
+        cl_power(ps);
+    }
+}
+
+
+static
+void cl_product(cl_parser *ps) {
+    int code;
+
+    cl_unary(ps);
+    while (!ps->err) {
+        if (cl_accept(ps, "*"))
+            code = CL_MUL;
+        else if (cl_accept(ps, "/"))
+            code = CL_DIV;
+        else if (cl_accept(ps, "%"))
+            code = CL_MOD;
+        else
+            break;
+        cl_unary(ps);
+        cl_emit(ps, code, 0, 0.0f);
+    }
+}
+
+
+static
+void cl_sum(cl_parser *ps) {
+    int code;
+
+    cl_product(ps);
+    while (!ps->err) {
+        if (cl_accept(ps, "+"))
+            code = CL_ADD;
+        else if (cl_accept(ps, "-"))
+            code = CL_SUB;
+        else
+            break;
+        cl_product(ps);
+        cl_emit(ps, code, 0, 0.0f);
+    }
+}
+
+
+static
+void cl_compare(cl_parser *ps) {
+    int code;
+
+    cl_sum(ps);
+    while (!ps->err) {
+        /* Two-character operators first. */
+        if (cl_accept(ps, "<="))
+            code = CL_LE;
+        else if (cl_accept(ps, ">="))
+            code = CL_GE;
+        else if (cl_accept(ps, "=="))
+            code = CL_EQ;
+        else if (cl_accept(ps, "!="))
+            code = CL_NE;
+        else if (cl_accept(ps, "<"))
+            code = CL_LT;
+        else if (cl_accept(ps, ">"))
+            code = CL_GT;
+        else
+            break;
+        cl_sum(ps);
+        cl_emit(ps, code, 0, 0.0f);
+    }
+}
+
+
+static
+void cl_and(cl_parser *ps) {
+    cl_compare(ps);
+    while (!ps->err && cl_accept(ps, "&&")) {
+        cl_compare(ps);
+        cl_emit(ps, CL_AND, 0, 0.0f);
+    }
+}
+
+
+static
+void cl_or(cl_parser *ps) {
+    cl_and(ps);
+    while (!ps->err && cl_accept(ps, "||")) {
+        cl_and(ps);
+        cl_emit(ps, CL_OR, 0, 0.0f);
+    }
+}
+
+
+static
+void cl_cond(cl_parser *ps) {
+    cl_or(ps);
+    if (!ps->err && cl_accept(ps, "?")) {
+        cl_cond(ps);
+        cl_expect(ps, ":");
+        cl_cond(ps);
+        cl_emit(ps, CL_SELECT, 0, 0.0f);
+    }
+}
+
+
+int gf_calc_compile(const char *expr, int ninputs, char *const *names,
+    gf_calc_prog *prog)
+{
+    cl_parser ps;
+
+    memset(prog, 0, sizeof(gf_calc_prog));
+    prog->ninputs = ninputs;
+
+    ps.expr = ps.p = expr;
+    ps.ninputs = ninputs;
+    ps.names = names;
+    ps.prog = prog;
+    ps.sp = 0;
+    ps.err = 0;
+
+    cl_cond(&ps);
+    cl_space(&ps);
+    if (!ps.err && *ps.p != '\0')
+        cl_error(&ps, "unexpected character");
+    if (ps.err) {
+        gf_free_calc_prog(prog);
+        return -1;
+    }
+    return 0;
+}
+
+
+void gf_free_calc_prog(gf_calc_prog *prog) {
+    free(prog->ops);
+    memset(prog, 0, sizeof(gf_calc_prog));
+}
+
+
+/**
+ * Rows of one input on the target grid. Aligned inputs are read at
+ * their stride; the rest keep the two source lines around the current
+ * row, which consecutive target rows mostly share.
+ */
+typedef struct cl_reader {
+    const gf_struct *gf;
+    const gf_grid *grid;
+    int aligned;
+    long ii0, jj0;
+    int si, sj;
+    int j_start, j_end;     /* Aligned: target columns on the source */
+    long *jj;               /* Resampled: left column per target column */
+    double *wx;
+    long span0, span1;      /* Source columns read, [span0, span1) */
+    gf_float *lines[2];
+    long line_ii[2];
+} cl_reader;
+
+
+static
+void cl_init_reader(cl_reader *r, const gf_struct *gf, const gf_grid *grid) {
+    const gf_grid *from = &gf->grid;
+    double x, tol = 1e-9;
+    long j;
+
+    memset(r, 0, sizeof(cl_reader));
+    r->gf = gf;
+    r->grid = grid;
+    r->line_ii[0] = r->line_ii[1] = -1;
+    r->aligned = gf_grid_aligned(from, grid, &r->ii0, &r->jj0, &r->si, &r->sj);
+
+    if (r->aligned) {
+        r->j_start = r->jj0 >= 0 ? 0 : (int)((-r->jj0 + r->sj - 1) / r->sj);
+        r->j_end = grid->nx;
+        if (r->jj0 + (long)(r->j_end - 1) * r->sj > from->nx - 1)
+            r->j_end = (int)((from->nx - 1 - r->jj0) / r->sj) + 1;
+        if (r->j_end < r->j_start)
+            r->j_end = r->j_start;
+        r->span0 = r->jj0 + (long)r->j_start * r->sj;
+        r->span1 = r->j_end > r->j_start ? r->jj0 + (long)(r->j_end - 1) * r->sj + 1 : r->span0;
+        if (r->sj > 1 && r->span1 > r->span0)
+            r->lines[0] = (gf_float *)malloc((r->span1 - r->span0) * sizeof(gf_float));
+        return;
+    }
+
+    r->jj = (long *)malloc(grid->nx * sizeof(long));
+    r->wx = (double *)malloc(grid->nx * sizeof(double));
+    r->span0 = from->nx;
+    r->span1 = 0;
+    for (j = 0; j < grid->nx; j++) {
+        x = (grid->left + j * grid->dx - from->left) / from->dx;
+        if (x < -tol || x > from->nx - 1 + tol || from->nx < 2) {
+            r->jj[j] = -1;
+            continue;
+        }
+        r->jj[j] = x < 0.0 ? 0 : (long)x;
+        if (r->jj[j] > from->nx - 2)
+            r->jj[j] = from->nx - 2;
+        r->wx[j] = x - r->jj[j];
+        if (r->jj[j] < r->span0)
+            r->span0 = r->jj[j];
+        if (r->jj[j] + 2 > r->span1)
+            r->span1 = r->jj[j] + 2;
+    }
+    if (r->span1 > r->span0) {
+        r->lines[0] = (gf_float *)malloc((r->span1 - r->span0) * sizeof(gf_float));
+        r->lines[1] = (gf_float *)malloc((r->span1 - r->span0) * sizeof(gf_float));
+    }
+}
+
+
+static
+void cl_free_reader(cl_reader *r) {
+    free(r->jj);
+    free(r->wx);
+    free(r->lines[0]);
+    free(r->lines[1]);
+}
+
+
+/* Source line ii, resampled case; NULL if it could not be read. */
+static
+gf_float *cl_line(cl_reader *r, long ii) {
+    gf_float *swap;
+
+    if (r->line_ii[0] == ii)
+        return r->lines[0];
+    if (r->line_ii[1] != ii) {
+        /* Evict the line the caller is done with (the upper one). */
+        swap = r->lines[0];
+        r->lines[0] = r->lines[1];
+        r->lines[1] = swap;
+        r->line_ii[0] = r->line_ii[1];
+        r->line_ii[1] = ii;
+        if (gf_get_line(ii, r->span0, r->span1, r->gf, r->lines[1]) != 0) {
+            r->line_ii[1] = -1;
+            return NULL;
+        }
+    }
+    return r->lines[1];
+}
+
+
+/* Target row i into row (nulls as NaN). Returns 0, or -1 if the file
+could not be read. */
+static
+int cl_read_row(cl_reader *r, long i, float *row) {
+    const gf_grid *from = &r->gf->grid, *grid = r->grid;
+    gf_float quad[4], *l0, *l1, val;
+    double y, w[2];
+    long ii, j, jj;
+
+    for (j = 0; j < grid->nx; j++)
+        row[j] = NAN;
+
+    if (r->aligned) {
+        ii = r->ii0 + i * r->si;
+        if (ii < 0 || ii >= from->ny || r->j_end == r->j_start)
+            return 0;
+        if (r->sj == 1) {
+            if (gf_get_line(ii, r->span0, r->span1, r->gf, row + r->j_start) != 0)
+                return -1;
+        } else {
+            if (gf_get_line(ii, r->span0, r->span1, r->gf, r->lines[0]) != 0)
+                return -1;
+            for (j = r->j_start; j < r->j_end; j++)
+                row[j] = r->lines[0][(j - r->j_start) * r->sj];
+        }
+        for (j = r->j_start; j < r->j_end; j++)
+            if (row[j] == (gf_float)GF_NULL_VAL)
+                row[j] = NAN;
+        return 0;
+    }
+
+    y = (from->top - (grid->top - i * grid->dy)) / from->dy;
+    if (r->span1 <= r->span0 || from->ny < 2 || y < -1e-9 || y > from->ny - 1 + 1e-9)
+        return 0;
+    ii = y < 0.0 ? 0 : (long)y;
+    if (ii > from->ny - 2)
+        ii = from->ny - 2;
+    w[0] = y - ii;
+    if ((l0 = cl_line(r, ii)) == NULL || (l1 = cl_line(r, ii + 1)) == NULL)
+        return -1;
+
+    for (j = 0; j < grid->nx; j++) {
+        if ((jj = r->jj[j]) < 0)
+            continue;
+        jj -= r->span0;
+        quad[0] = l0[jj];
+        quad[1] = l0[jj + 1];
+        quad[2] = l1[jj];
+        quad[3] = l1[jj + 1];
+        w[1] = r->wx[j];
+        gf_bilinear_interpolate_kernel(quad, from, w, NULL, NULL, &val);
+        row[j] = val == (gf_float)GF_NULL_VAL ? NAN : val;
+    }
+    return 0;
+}
+
+
+typedef struct cl_job {
+    const gf_calc_prog *prog;
+    const gf_struct *inputs;
+    const gf_grid *grid;
+    int nbands;
+    gf_calc_row *row_done;
+    void *xtras;
+    gf_float *data;
+    unsigned char *used;
+    int failed;
+} cl_job;
+
+
+static
+void *cl_alloc_vecs(size_t n) {
+    void *p = NULL;
+
+    if (posix_memalign(&p, sizeof(cl_vec), n * sizeof(cl_vec)) != 0)
+        return NULL;
+    return p;
+}
+
+
+/* 1 (or 0) where m is set (or not), NaN where x or y is. */
+static inline
+cl_vec cl_truth(cl_mask m, cl_vec x, cl_vec y) {
+    const cl_vec one = CL_SPLAT(1.0f), nan = CL_SPLAT(NAN);
+    cl_mask n = (x != x) | (y != y);
+
+    return (cl_vec)((m & ~n & (cl_mask)one) | (n & (cl_mask)nan));
+}
+
+
+/* x where m is set, else y; NaN where n is set. */
+static inline
+cl_vec cl_blend(cl_mask m, cl_vec x, cl_vec y, cl_mask n) {
+    const cl_vec nan = CL_SPLAT(NAN);
+
+    return (cl_vec)((((m & (cl_mask)x) | (~m & (cl_mask)y)) & ~n) | (n & (cl_mask)nan));
+}
+
+
+#define CL_UNARY(expr) do { \
+        x = st[sp - 1]; r = scratch + (sp - 1) * CL_NV; \
+        for (v = 0; v < CL_NV; v++) r[v] = (expr); \
+        st[sp - 1] = r; } while (0)
+
+#define CL_UNARY_F(f) do { \
+        xs = (const float *)st[sp - 1]; rs = (float *)(scratch + (sp - 1) * CL_NV); \
+        for (v = 0; v < CL_CHUNK; v++) rs[v] = f(xs[v]); \
+        st[sp - 1] = (cl_vec *)rs; } while (0)
+
+#define CL_BINARY(expr) do { \
+        x = st[sp - 2]; y = st[sp - 1]; r = scratch + (sp - 2) * CL_NV; \
+        for (v = 0; v < CL_NV; v++) r[v] = (expr); \
+        st[sp - 2] = r; sp--; } while (0)
+
+#define CL_BINARY_F(f) do { \
+        xs = (const float *)st[sp - 2]; ys = (const float *)st[sp - 1]; \
+        rs = (float *)(scratch + (sp - 2) * CL_NV); \
+        for (v = 0; v < CL_CHUNK; v++) rs[v] = f(xs[v], ys[v]); \
+        st[sp - 2] = (cl_vec *)rs; sp--; } while (0)
+
+#define CL_NANS(x, y) (((x) != (x)) | ((y) != (y)))
+
+
+/**
+ * Run the program over one chunk. in[k] and consts hold the chunk's
+ * input values and one splatted chunk per CL_CONST instruction, in
+ * program order. Returns the result (in scratch or an input).
+ */
+static
+const cl_vec *cl_eval(const gf_calc_prog *prog, cl_vec *const *in,
+    const cl_vec *consts, cl_vec *scratch, const cl_vec **st)
+{
+    const gf_calc_op *op = prog->ops, *end = prog->ops + prog->nops;
+    const cl_vec *x, *y, *c;
+    const float *xs, *ys;
+    const cl_vec zero = CL_SPLAT(0.0f), one = CL_SPLAT(1.0f);
+    cl_vec *r;
+    float *rs;
+    int sp = 0, v;
+
+    for (; op < end; op++) {
+        switch (op->code) {
+        case CL_INPUT:
+            st[sp++] = in[op->arg];
+            break;
+        case CL_CONST:
+            st[sp++] = consts;
+            consts += CL_NV;
+            break;
+        case CL_NEG: CL_UNARY(-x[v]); break;
+        case CL_NOT: CL_UNARY(cl_truth(x[v] == zero, x[v], x[v])); break;
+        case CL_ISNULL: CL_UNARY((cl_vec)((x[v] != x[v]) & (cl_mask)one)); break;
+        case CL_ABS: CL_UNARY((cl_vec)((cl_mask)x[v] & 0x7fffffff)); break;
+        case CL_SQRT: CL_UNARY_F(sqrtf); break;
+        case CL_EXP: CL_UNARY_F(expf); break;
+        case CL_LOG: CL_UNARY_F(logf); break;
+        case CL_LOG10: CL_UNARY_F(log10f); break;
+        case CL_SIN: CL_UNARY_F(sinf); break;
+        case CL_COS: CL_UNARY_F(cosf); break;
+        case CL_TAN: CL_UNARY_F(tanf); break;
+        case CL_ASIN: CL_UNARY_F(asinf); break;
+        case CL_ACOS: CL_UNARY_F(acosf); break;
+        case CL_ATAN: CL_UNARY_F(atanf); break;
+        case CL_FLOOR: CL_UNARY_F(floorf); break;
+        case CL_CEIL: CL_UNARY_F(ceilf); break;
+        case CL_ROUND: CL_UNARY_F(roundf); break;
+        case CL_ADD: CL_BINARY(x[v] + y[v]); break;
+        case CL_SUB: CL_BINARY(x[v] - y[v]); break;
+        case CL_MUL: CL_BINARY(x[v] * y[v]); break;
+        case CL_DIV: CL_BINARY(x[v] / y[v]); break;
+        case CL_MOD: CL_BINARY_F(fmodf); break;
+        case CL_POW: CL_BINARY_F(powf); break;
+        case CL_ATAN2: CL_BINARY_F(atan2f); break;
+        case CL_MIN: CL_BINARY(cl_blend(x[v] < y[v], x[v], y[v], CL_NANS(x[v], y[v]))); break;
+        case CL_MAX: CL_BINARY(cl_blend(x[v] > y[v], x[v], y[v], CL_NANS(x[v], y[v]))); break;
+        case CL_LT: CL_BINARY(cl_truth(x[v] < y[v], x[v], y[v])); break;
+        case CL_LE: CL_BINARY(cl_truth(x[v] <= y[v], x[v], y[v])); break;
+        case CL_GT: CL_BINARY(cl_truth(x[v] > y[v], x[v], y[v])); break;
+        case CL_GE: CL_BINARY(cl_truth(x[v] >= y[v], x[v], y[v])); break;
+        case CL_EQ: CL_BINARY(cl_truth(x[v] == y[v], x[v], y[v])); break;
+        case CL_NE: CL_BINARY(cl_truth(x[v] != y[v], x[v], y[v])); break;
+        case CL_AND: CL_BINARY(cl_truth((x[v] != zero) & (y[v] != zero), x[v], y[v])); break;
+        case CL_OR: CL_BINARY(cl_truth((x[v] != zero) | (y[v] != zero), x[v], y[v])); break;
+        case CL_SELECT:
+            c = st[sp - 3];
+            x = st[sp - 2];
+            y = st[sp - 1];
+            r = scratch + (sp - 3) * CL_NV;
+            for (v = 0; v < CL_NV; v++)
+                r[v] = cl_blend(c[v] != zero, x[v], y[v], c[v] != c[v]);
+            st[sp - 3] = r;
+            sp -= 2;
+            break;
+        }
+    }
+    return st[0];
+}
+
+
+static
+void cl_band_task(int b, void *arg) {
+    cl_job *job = (cl_job *)arg;
+    const gf_calc_prog *prog = job->prog;
+    const gf_grid *grid = job->grid;
+    int ninputs = prog->ninputs, nchunks = (grid->nx + CL_CHUNK - 1) / CL_CHUNK;
+    int i_start, i_end, i, k, c, o, e, n, nconsts = 0;
+    cl_reader *readers;
+    cl_vec **rows, **in, *consts, *scratch;
+    const cl_vec **st;
+    const cl_vec *res;
+    gf_float *out;
+    const float *rf;
+
+    gf_stencil_band(grid, b, job->nbands, &i_start, &i_end);
+    if (i_start >= i_end)
+        return;
+
+    for (o = 0; o < prog->nops; o++)
+        nconsts += prog->ops[o].code == CL_CONST;
+
+    readers = (cl_reader *)calloc(ninputs, sizeof(cl_reader));
+    rows = (cl_vec **)calloc(ninputs, sizeof(cl_vec *));
+    in = (cl_vec **)calloc(ninputs, sizeof(cl_vec *));
+    consts = (cl_vec *)cl_alloc_vecs((size_t)(nconsts > 0 ? nconsts : 1) * CL_NV);
+    scratch = (cl_vec *)cl_alloc_vecs((size_t)(prog->depth > 0 ? prog->depth : 1) * CL_NV);
+    st = (const cl_vec **)malloc((prog->depth > 0 ? prog->depth : 1) * sizeof(cl_vec *));
+    out = (gf_float *)malloc(grid->nx * sizeof(gf_float));
+
+    for (o = 0, n = 0; o < prog->nops; o++) {
+        if (prog->ops[o].code != CL_CONST)
+            continue;
+        for (e = 0; e < CL_CHUNK; e++)
+            ((float *)(consts + n * CL_NV))[e] = prog->ops[o].value;
+        n++;
+    }
+    for (k = 0; k < ninputs; k++) {
+        if (!job->used[k])
+            continue;
+        cl_init_reader(&readers[k], &job->inputs[k], grid);
+        rows[k] = (cl_vec *)cl_alloc_vecs((size_t)nchunks * CL_NV);
+        /* Padding past nx stays zero. */
+        memset(rows[k], 0, (size_t)nchunks * CL_CHUNK * sizeof(float));
+    }
+
+    for (i = i_start; i < i_end; i++) {
+        for (k = 0; k < ninputs; k++)
+            if (job->used[k] && cl_read_row(&readers[k], i, (float *)rows[k]) != 0)
+                break;
+        if (k < ninputs) {
+            __sync_fetch_and_add(&job->failed, 1);
+            break;
+        }
+
+        for (c = 0; c < nchunks; c++) {
+            for (k = 0; k < ninputs; k++)
+                in[k] = rows[k] + c * CL_NV;
+            res = cl_eval(prog, in, consts, scratch, st);
+            rf = (const float *)res;
+            n = grid->nx - c * CL_CHUNK < CL_CHUNK ? grid->nx - c * CL_CHUNK : CL_CHUNK;
+            for (e = 0; e < n; e++)
+                out[c * CL_CHUNK + e] = rf[e] != rf[e] ? GF_NULL_VAL : rf[e];
+        }
+
+        if (job->data != NULL)
+            memcpy(job->data + (long)i * grid->nx, out, grid->nx * sizeof(gf_float));
+        if (job->row_done != NULL && (*job->row_done)(b, i, out, job->xtras) != 0)
+            __sync_fetch_and_add(&job->failed, 1);
+    }
+
+    for (k = 0; k < ninputs; k++) {
+        if (!job->used[k])
+            continue;
+        cl_free_reader(&readers[k]);
+        free(rows[k]);
+    }
+    free(readers);
+    free(rows);
+    free(in);
+    free(consts);
+    free(scratch);
+    free(st);
+    free(out);
+}
+
+
+int gf_calc_run(const gf_calc_prog *prog, const gf_struct *inputs,
+    const gf_grid *grid, int nbands, gf_calc_row *row_done, void *xtras,
+    gf_float *data)
+{
+    cl_job job;
+    int o;
+
+    if (prog->nops == 0 || grid->nx < 1 || grid->ny < 1)
+        return -1;
+
+    job.prog = prog;
+    job.inputs = inputs;
+    job.grid = grid;
+    job.nbands = nbands > 1 ? nbands : 1;
+    job.row_done = row_done;
+    job.xtras = xtras;
+    job.data = data;
+    job.failed = 0;
+    job.used = (unsigned char *)calloc(prog->ninputs > 0 ? prog->ninputs : 1, 1);
+    for (o = 0; o < prog->nops; o++)
+        if (prog->ops[o].code == CL_INPUT)
+            job.used[prog->ops[o].arg] = 1;
+
+    gf_parallel_for(job.nbands, job.nbands, &cl_band_task, (void *)&job);
+
+    free(job.used);
+    return job.failed ? -1 : 0;
+}
+
+
+typedef struct cl_save {
+    int fd;
+    long nx;
+} cl_save;
+
+
+static
+int cl_save_row(int band, int i, const gf_float *row, void *xtras) {
+    cl_save *s = (cl_save *)xtras;
+    size_t len = s->nx * sizeof(gf_float);
+
+    return pwrite(s->fd, row, len, (off_t)i * len) == (ssize_t)len ? 0 : -1;
+}
+
+
+/* Header and data file descriptor for prefix. */
+static
+int cl_create(const gf_grid *grid, const char *prefix) {
+    char filename[2048];
+    gf_grid g = *grid;
+
+    snprintf(filename, sizeof(filename), "%s.hdr", prefix);
+    if (gf_write_hdr(&g, filename) != 0)
+        return -1;
+    snprintf(filename, sizeof(filename), "%s.flt", prefix);
+    return open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+
+int gf_calc_save(const gf_calc_prog *prog, const gf_struct *inputs,
+    const gf_grid *grid, const char *prefix)
+{
+    cl_save s;
+    int err;
+
+    if ((s.fd = cl_create(grid, prefix)) < 0)
+        return -1;
+    s.nx = grid->nx;
+
+    err = gf_calc_run(prog, inputs, grid, gf_num_threads(), &cl_save_row, &s, NULL);
+    if (close(s.fd) != 0)
+        err = -1;
+    return err;
+}
+
+
+typedef struct cl_volumes {
+    const gf_grid *grid;
+    double lod;
+    cl_save save;           /* fd < 0 for none */
+    gf_volume_stats *bands;
+} cl_volumes;
+
+
+static
+int cl_volume_row(int band, int i, const gf_float *row, void *xtras) {
+    cl_volumes *vol = (cl_volumes *)xtras;
+    gf_volume_stats *s = &vol->bands[band];
+    const gf_grid *g = vol->grid;
+    double dxm, dym, cut = 0.0, fill = 0.0, z;
+    long j;
+
+    if (vol->save.fd >= 0 && cl_save_row(band, i, row, &vol->save) != 0)
+        return -1;
+
+    gf_lengths(g->top - i * g->dy, g->left, g->dy, g->dx, 0.0, &dxm, &dym);
+    for (j = 0; j < g->nx; j++) {
+        if (row[j] == (gf_float)GF_NULL_VAL)
+            continue;
+        z = row[j];
+        if (s->count++ == 0 || z < s->min)
+            s->min = z;
+        if (s->count == 1 || z > s->max)
+            s->max = z;
+        if (fabs(z) < vol->lod)
+            continue;
+        s->changed++;
+        if (z < 0.0)
+            cut -= z;
+        else
+            fill += z;
+    }
+    s->cut += cut * dxm * dym;
+    s->fill += fill * dxm * dym;
+    return 0;
+}
+
+
+int gf_calc_volumes(const gf_calc_prog *prog, const gf_struct *inputs,
+    const gf_grid *grid, double lod, const char *prefix,
+    gf_volume_stats *stats)
+{
+    cl_volumes vol;
+    gf_volume_stats *s;
+    int b, nbands = gf_num_threads(), err;
+
+    vol.grid = grid;
+    vol.lod = lod;
+    vol.save.nx = grid->nx;
+    vol.save.fd = -1;
+    if (prefix != NULL && (vol.save.fd = cl_create(grid, prefix)) < 0)
+        return -1;
+    vol.bands = (gf_volume_stats *)calloc(nbands, sizeof(gf_volume_stats));
+
+    err = gf_calc_run(prog, inputs, grid, nbands, &cl_volume_row, &vol, NULL);
+    if (vol.save.fd >= 0 && close(vol.save.fd) != 0)
+        err = -1;
+
+    /* Bands in order, so the totals do not depend on timing. */
+    memset(stats, 0, sizeof(gf_volume_stats));
+    for (b = 0; b < nbands; b++) {
+        s = &vol.bands[b];
+        if (s->count == 0)
+            continue;
+        if (stats->count == 0 || s->min < stats->min)
+            stats->min = s->min;
+        if (stats->count == 0 || s->max > stats->max)
+            stats->max = s->max;
+        stats->count += s->count;
+        stats->changed += s->changed;
+        stats->cut += s->cut;
+        stats->fill += s->fill;
+    }
+    free(vol.bands);
+    return err;
+}
+
+
+int gf_dem_difference(const gf_struct *after, const gf_struct *before,
+    const gf_grid *grid, double lod, const char *prefix,
+    gf_volume_stats *stats)
+{
+    char *names[2] = {"after", "before"};
+    gf_struct inputs[2];
+    gf_calc_prog prog;
+    int err;
+
+    if (gf_calc_compile("after - before", 2, names, &prog) != 0)
+        return -1;
+    inputs[0] = *after;
+    inputs[1] = *before;
+    err = gf_calc_volumes(&prog, inputs, grid != NULL ? grid : &after->grid,
+        lod, prefix, stats);
+    gf_free_calc_prog(&prog);
+    return err;
+}
@@ -0,0 +1,132 @@
+#ifndef GF_CALC_H
+#define GF_CALC_H
+
+#include "gridfloat.h"
+
+/**
+ * Raster algebra.
+ *
+ * Expressions over named inputs are compiled to a small stack
+ * bytecode, then run over a target grid a row at a time. Each input
+ * row is cropped and strided straight from its file when the target
+ * grid lies on its nodes (see gf_grid_aligned) and bilinearly
+ * resampled otherwise, with gf_bilinear_interpolate's NODATA handling;
+ * points off an input are null.
+ * Instructions work on chunks of a row at once, with the arithmetic in
+ * SIMD vectors, and bands of rows run on separate threads. Nothing but
+ * a few rows per input and band is ever held in memory.
+ *
+ * Syntax, loosest binding first:
+ *
+ *   c ? x : y               select
+ *   ||  &&                  logical (1 or 0)
+ *   <  <=  >  >=  ==  !=    comparison (1 or 0)
+ *   +  -
+ *   *  /  %
+ *   -x  !x                  negation, logical not
+ *   x ^ y                   power (right-associative)
+ *
+ * plus parentheses, numbers, input names, the constants 'nodata' and
+ * 'pi', and the functions abs, sqrt, exp, log, log10, sin, cos, tan,
+ * asin, acos, atan, atan2, floor, ceil, round, min, max, pow and
+ * isnull. For example '(a - b) * 3.28' or 'a > 1500 ? a : nodata'.
+ *
+ * NODATA propagates: any operation with a null operand is null, except
+ * isnull() (1 for null, else 0) and the branch of ?: not taken.
+ */
+
+struct gf_calc_op;
+
+/**
+ * Compiled expression.
+ *
+ * @ops, @nops - Bytecode.
+ * @depth - Stack slots needed to run it.
+ * @ninputs - Inputs it was compiled against (not all need be used).
+ */
+typedef struct gf_calc_prog {
+    struct gf_calc_op *ops;
+    int nops;
+    int cap;
+    int depth;
+    int ninputs;
+} gf_calc_prog;
+
+/**
+ * Compile expr, where names[k] refers to input k. Returns 0, or -1
+ * after printing what is wrong (and where) to stderr.
+ */
+int gf_calc_compile(const char *expr, int ninputs, char *const *names,
+    gf_calc_prog *prog);
+
+void gf_free_calc_prog(gf_calc_prog *prog);
+
+/**
+ * Called once each target row is complete, from the thread running
+ * its band. Null points are GF_NULL_VAL.
+ */
+typedef int (gf_calc_row)(int band, int i, const gf_float *row, void *xtras);
+
+/**
+ * Evaluate prog over grid, with input k read from inputs[k] (inputs
+ * need not be aligned with each other or with grid). Rows are split
+ * into nbands bands run in parallel (zero or one runs on the calling
+ * thread, in row order); a band index is passed to row_done so that
+ * reductions can keep per-band state in xtras.
+ *
+ * If data is non-NULL it receives grid->nx * grid->ny values, top row
+ * first. row_done may be NULL.
+ */
+int gf_calc_run(const gf_calc_prog *prog, const gf_struct *inputs,
+    const gf_grid *grid, int nbands, gf_calc_row *row_done, void *xtras,
+    gf_float *data);
+
+/**
+ * Evaluate prog over grid into GridFloat prefix.{hdr,flt}, each band
+ * writing its rows in place as they are done.
+ */
+int gf_calc_save(const gf_calc_prog *prog, const gf_struct *inputs,
+    const gf_grid *grid, const char *prefix);
+
+/**
+ * Volumes between a surface change and zero.
+ *
+ * @count - Nodes with data.
+ * @changed - Nodes whose change is at least the detection limit.
+ * @cut - Volume (m^3) removed: the sum of -value * cell area over
+ *      changed nodes below zero.
+ * @fill - Volume (m^3) added, over changed nodes above zero.
+ * @min, @max - Extremes of the change.
+ */
+typedef struct gf_volume_stats {
+    long count;
+    long changed;
+    double cut;
+    double fill;
+    double min;
+    double max;
+} gf_volume_stats;
+
+/**
+ * Evaluate prog over grid as a change in elevation (m) and reduce it
+ * to cut/fill volumes, each band keeping its own totals until the end.
+ * Changes smaller in magnitude than lod (a level of detection) count
+ * toward neither. Cell areas come from gf_lengths at each row's
+ * latitude. If prefix is not NULL the change is also streamed to
+ * GridFloat prefix.{hdr,flt}.
+ */
+int gf_calc_volumes(const gf_calc_prog *prog, const gf_struct *inputs,
+    const gf_grid *grid, double lod, const char *prefix,
+    gf_volume_stats *stats);
+
+/**
+ * DEM of difference: after - before over grid (after's own grid if
+ * NULL), with before resampled onto it when the two are not aligned.
+ * Memory is a few rows per thread, whatever the size of the inputs.
+ * See gf_calc_volumes.
+ */
+int gf_dem_difference(const gf_struct *after, const gf_struct *before,
+    const gf_grid *grid, double lod, const char *prefix,
+    gf_volume_stats *stats);
+
+#endif
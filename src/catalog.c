@@ -0,0 +1,826 @@
+#include "catalog.h"
+#include "pool.h"
+#include "crawl.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define CT_MAGIC "GFCATLG"
+#define CT_VERSION 2
+
+#define CT_PATH 4096
+
+/*
+ * File layout: a ct_header, then the tile, directory and node tables
+ * and the string table (NUL-terminated paths from the top, without
+ * extensions for tiles), each at an 8-byte aligned offset.
+ */
+typedef struct ct_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t tile_size;     /* Record sizes, to catch other layouts */
+    uint32_t dir_size;
+    uint32_t node_size;
+    uint32_t ntiles;
+    uint32_t ndirs;
+    uint32_t nnodes;
+    int32_t own_dir;        /* Directory holding the catalog, or -1 */
+    int64_t sec;            /* mtime of the catalog as written */
+    int64_t nsec;
+    uint64_t tiles_off;
+    uint64_t dirs_off;
+    uint64_t nodes_off;
+    uint64_t strings_off;
+    uint64_t size;
+} ct_header;
+
+typedef struct ct_tile {
+    gf_grid grid;
+    float null_value;
+    uint32_t name;
+    char byte_order[64];    /* As gf_struct's */
+} ct_tile;
+
+/* Tiles of a directory are contiguous, directories in crawl order
+(the top first). */
+typedef struct ct_dir {
+    int64_t sec;
+    int64_t nsec;
+    uint32_t name;
+    int32_t parent;
+    uint32_t first_tile;
+    uint32_t ntiles;
+} ct_dir;
+
+typedef struct ct_node {
+    gf_bounds bounds;
+    int32_t tile;           /* Leaves; -1 above */
+    int32_t pad;
+} ct_node;
+
+/* A validated catalog image, mapped or in memory. */
+typedef struct ct_image {
+    const ct_header *h;
+    const ct_tile *tiles;
+    const ct_dir *dirs;
+    const ct_node *nodes;
+    const char *strings;
+} ct_image;
+
+
+static
+uint64_t ct_align(uint64_t off) {
+    return (off + 7) & ~(uint64_t)7;
+}
+
+
+/* Nodes in a packed R-tree over n leaves. */
+static
+long ct_tree_nodes(long n) {
+    long total = n;
+
+    while (n > 1) {
+        n = (n + NODE_SIZE - 1) / NODE_SIZE;
+        total += n;
+    }
+    return total;
+}
+
+
+/* Join root, rel and ext into path (CT_PATH bytes). Returns 0, or -1
+(reported on stderr) if the result does not fit. */
+static
+int ct_join(char *path, const char *root, const char *rel, const char *ext) {
+    size_t len = strlen(root);
+    int n;
+
+    if (rel[0] == '\0')
+        n = snprintf(path, CT_PATH, "%s%s", root, ext);
+    else
+        n = snprintf(path, CT_PATH, "%s%s%s%s", root,
+            len > 0 && root[len - 1] == '/' ? "" : "/", rel, ext);
+    if (n < 0 || n >= CT_PATH) {
+        fprintf(stderr, "gf_open_db_catalog: path too long under '%s'\n", root);
+        return -1;
+    }
+    return 0;
+}
+
+
+static
+int ct_view(const void *base, size_t size, ct_image *im) {
+    const ct_header *h = (const ct_header *)base;
+    uint64_t nstr;
+    uint32_t k;
+
+    if (size < sizeof(ct_header) || memcmp(h->magic, CT_MAGIC, 8) != 0 ||
+        h->version != CT_VERSION || h->tile_size != sizeof(ct_tile) ||
+        h->dir_size != sizeof(ct_dir) || h->node_size != sizeof(ct_node) ||
+        h->size != size || h->ndirs == 0 ||
+        h->nnodes != (uint64_t)ct_tree_nodes(h->ntiles))
+        return -1;
+    if (h->tiles_off + (uint64_t)h->ntiles * sizeof(ct_tile) > size ||
+        h->dirs_off + (uint64_t)h->ndirs * sizeof(ct_dir) > size ||
+        h->nodes_off + (uint64_t)h->nnodes * sizeof(ct_node) > size ||
+        h->strings_off >= size || ((h->tiles_off | h->dirs_off | h->nodes_off) & 7))
+        return -1;
+
+    im->h = h;
+    im->tiles = (const ct_tile *)((const char *)base + h->tiles_off);
+    im->dirs = (const ct_dir *)((const char *)base + h->dirs_off);
+    im->nodes = (const ct_node *)((const char *)base + h->nodes_off);
+    im->strings = (const char *)base + h->strings_off;
+
+    /* Every name must end inside the string table. */
+    nstr = size - h->strings_off;
+    if (im->strings[nstr - 1] != '\0')
+        return -1;
+    for (k = 0; k < h->ntiles; k++)
+        if (im->tiles[k].name >= nstr)
+            return -1;
+    for (k = 0; k < h->ndirs; k++)
+        if (im->dirs[k].name >= nstr || (uint64_t)im->dirs[k].first_tile +
+                im->dirs[k].ntiles > h->ntiles || im->dirs[k].parent >= (int32_t)k ||
+                (k > 0 && im->dirs[k].parent < 0))
+            return -1;
+    for (k = 0; k < h->ntiles; k++)
+        if (im->nodes[k].tile < 0 || (uint32_t)im->nodes[k].tile >= h->ntiles)
+            return -1;
+    return 0;
+}
+
+
+/* Directory d has changed since the catalog was written: its mtime
+differs, or it was modified so close to the catalog being written
+that a later change in the same clock tick would not show (as git
+treats racily clean files). The catalog's own directory was stamped
+after the catalog was in place and is exempt. */
+static
+int ct_stale(const ct_image *im, int d, const struct stat *st) {
+    const ct_dir *dir = &im->dirs[d];
+
+    if (dir->sec != (int64_t)st->st_mtim.tv_sec || dir->nsec != (int64_t)st->st_mtim.tv_nsec)
+        return 1;
+    if (d == im->h->own_dir)
+        return 0;
+    return dir->sec > im->h->sec || (dir->sec == im->h->sec && dir->nsec >= im->h->nsec);
+}
+
+
+typedef struct ct_builder {
+    const char *root;
+    const ct_image *old;    /* Catalog being refreshed, or NULL */
+    int *old_sorted;        /* Old directories by name */
+    int *old_start;         /* Children of old directory d are */
+    int *old_child;         /* old_child[old_start[d]..old_start[d + 1]) */
+    ct_tile *tiles;
+    long ntiles;
+    long tcap;
+    ct_dir *dirs;
+    long ndirs;
+    long dcap;
+    char *strings;
+    size_t nstr;
+    size_t scap;
+    long *pending;          /* Tiles whose headers are still to parse */
+    long npending;
+    long pcap;
+    unsigned char *bad;     /* Tiles whose headers did not parse */
+} ct_builder;
+
+
+static
+uint32_t ct_add_string(ct_builder *b, const char *s) {
+    size_t len = strlen(s) + 1;
+    uint32_t off = (uint32_t)b->nstr;
+
+    while (b->nstr + len > b->scap) {
+        b->scap = b->scap ? 2 * b->scap : 4096;
+        b->strings = (char *)realloc(b->strings, b->scap);
+    }
+    memcpy(b->strings + b->nstr, s, len);
+    b->nstr += len;
+    return off;
+}
+
+
+static
+ct_tile *ct_add_tile(ct_builder *b) {
+    if (b->ntiles == b->tcap) {
+        b->tcap = b->tcap ? 2 * b->tcap : 64;
+        b->tiles = (ct_tile *)realloc(b->tiles, b->tcap * sizeof(ct_tile));
+    }
+    return &b->tiles[b->ntiles++];
+}
+
+
+static
+long ct_add_dir(ct_builder *b, const char *rel, long parent, const struct stat *st) {
+    ct_dir *dir;
+
+    if (b->ndirs == b->dcap) {
+        b->dcap = b->dcap ? 2 * b->dcap : 16;
+        b->dirs = (ct_dir *)realloc(b->dirs, b->dcap * sizeof(ct_dir));
+    }
+    dir = &b->dirs[b->ndirs];
+    dir->sec = st->st_mtim.tv_sec;
+    dir->nsec = st->st_mtim.tv_nsec;
+    dir->name = ct_add_string(b, rel);
+    dir->parent = (int32_t)parent;
+    dir->first_tile = (uint32_t)b->ntiles;
+    dir->ntiles = 0;
+    return b->ndirs++;
+}
+
+
+typedef struct ct_entry {
+    char *name;
+    int index;              /* Old directory */
+} ct_entry;
+
+static
+int ct_cmp_entry(const void *a, const void *b) {
+    return strcmp(((const ct_entry *)a)->name, ((const ct_entry *)b)->name);
+}
+
+
+/* Index the old catalog's directories by name and by parent. */
+static
+void ct_index_old(ct_builder *b) {
+    const ct_image *im = b->old;
+    int d, n = (int)im->h->ndirs, *fill;
+    ct_entry *byname;
+
+    byname = (ct_entry *)malloc(n * sizeof(ct_entry));
+    for (d = 0; d < n; d++) {
+        byname[d].name = (char *)im->strings + im->dirs[d].name;
+        byname[d].index = d;
+    }
+    qsort(byname, n, sizeof(ct_entry), ct_cmp_entry);
+    b->old_sorted = (int *)malloc(n * sizeof(int));
+    for (d = 0; d < n; d++)
+        b->old_sorted[d] = byname[d].index;
+    free(byname);
+
+    b->old_start = (int *)calloc(n + 1, sizeof(int));
+    b->old_child = (int *)malloc(n * sizeof(int));
+    fill = (int *)malloc((n + 1) * sizeof(int));
+    for (d = 1; d < n; d++)
+        b->old_start[im->dirs[d].parent + 1]++;
+    for (d = 0; d < n; d++)
+        b->old_start[d + 1] += b->old_start[d];
+    memcpy(fill, b->old_start, (n + 1) * sizeof(int));
+    for (d = 1; d < n; d++)
+        b->old_child[fill[im->dirs[d].parent]++] = d;
+    free(fill);
+}
+
+
+static
+int ct_find_old(const ct_builder *b, const char *rel) {
+    const ct_image *im = b->old;
+    int lo = 0, hi, mid, c;
+
+    if (im == NULL)
+        return -1;
+    hi = (int)im->h->ndirs - 1;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        c = strcmp(rel, im->strings + im->dirs[b->old_sorted[mid]].name);
+        if (c == 0)
+            return b->old_sorted[mid];
+        if (c < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+
+/* A directory of the crawl: reused from the old catalog, or listed. */
+typedef struct ct_walk {
+    char *rel;
+    struct ct_walk *parent;
+    struct stat st;
+    int found;              /* Is (still) a directory */
+    int old;                /* Fresh old directory, or -1 */
+    gf_dir_listing list;
+    long index;             /* In the builder, once assembled */
+} ct_walk;
+
+static
+ct_walk *ct_new_walk(ct_walk *parent, const char *name) {
+    ct_walk *w = (ct_walk *)calloc(1, sizeof(ct_walk));
+
+    w->parent = parent;
+    w->old = -1;
+    if (parent == NULL || parent->rel[0] == '\0') {
+        w->rel = strdup(name);
+    } else {
+        w->rel = (char *)malloc(strlen(parent->rel) + strlen(name) + 2);
+        sprintf(w->rel, "%s/%s", parent->rel, name);
+    }
+    return w;
+}
+
+/* Stat one directory; if the old catalog has it fresh, descend into its
+recorded subdirectories, otherwise list it. Runs on any crawling
+thread, and only reads the builder. */
+static
+int ct_walk_visit(gf_crawl *crawl, void *item, void *arg) {
+    const ct_builder *b = (const ct_builder *)arg;
+    const ct_image *im = b->old;
+    ct_walk *w = (ct_walk *)item;
+    char path[CT_PATH];
+    const char *name;
+    long k;
+    int c, err;
+
+    if (ct_join(path, b->root, w->rel, "") != 0)
+        return -1;
+    if (stat(path, &w->st) != 0 || !S_ISDIR(w->st.st_mode))
+        return 0;
+    w->found = 1;
+
+    w->old = ct_find_old(b, w->rel);
+    if (w->old >= 0 && !ct_stale(im, w->old, &w->st)) {
+        for (c = b->old_start[w->old]; c < b->old_start[w->old + 1]; c++) {
+            name = im->strings + im->dirs[b->old_child[c]].name;
+            gf_crawl_push(crawl, ct_new_walk(w, strrchr(name, '/') != NULL ?
+                strrchr(name, '/') + 1 : name));
+        }
+        return 0;
+    }
+
+    w->old = -1;
+    if ((err = gf_list_dir(path, &w->list)) != 0)
+        return err;
+    /* Refuse the crawl now rather than cut a header path short later. */
+    for (k = 0; k < w->list.ntiles; k++) {
+        if (strlen(path) + strlen(w->list.tiles[k]) + 6 > CT_PATH) {
+            fprintf(stderr, "gf_open_db_catalog: path too long under '%s'\n", path);
+            return -1;
+        }
+    }
+    for (k = 0; k < w->list.ndirs; k++)
+        gf_crawl_push(crawl, ct_new_walk(w, w->list.dirs[k]));
+    return 0;
+}
+
+static
+int ct_cmp_walk(const void *a, const void *b) {
+    return strcmp((*(ct_walk * const *)a)->rel, (*(ct_walk * const *)b)->rel);
+}
+
+/* Record the directories found, in path order (so parents come first),
+with their tiles: carried over from the old catalog, or left for
+ct_parse_pending. */
+static
+int ct_assemble(ct_builder *b, ct_walk **walks, long n) {
+    const ct_image *im = b->old;
+    const ct_tile *src;
+    char rel[CT_PATH];
+    ct_tile *tile;
+    ct_walk *w;
+    long d, i, k;
+
+    qsort(walks, n, sizeof(ct_walk *), ct_cmp_walk);
+    for (i = 0; i < n; i++) {
+        w = walks[i];
+        if (!w->found)
+            continue;
+        d = ct_add_dir(b, w->rel, w->parent != NULL ? w->parent->index : -1, &w->st);
+        w->index = d;
+
+        if (w->old >= 0) {
+            for (k = 0; k < (long)im->dirs[w->old].ntiles; k++) {
+                src = &im->tiles[im->dirs[w->old].first_tile + k];
+                tile = ct_add_tile(b);
+                *tile = *src;
+                tile->name = ct_add_string(b, im->strings + src->name);
+            }
+            b->dirs[d].ntiles = im->dirs[w->old].ntiles;
+            continue;
+        }
+
+        for (k = 0; k < w->list.ntiles; k++) {
+            if (ct_join(rel, w->rel, w->list.tiles[k], "") != 0)
+                return -1;
+            if (b->npending == b->pcap) {
+                b->pcap = b->pcap ? 2 * b->pcap : 64;
+                b->pending = (long *)realloc(b->pending, b->pcap * sizeof(long));
+            }
+            b->pending[b->npending++] = b->ntiles;
+            tile = ct_add_tile(b);
+            memset((void *)tile, 0, sizeof(ct_tile));
+            tile->name = ct_add_string(b, rel);
+            b->dirs[d].ntiles++;
+        }
+    }
+    return 0;
+}
+
+
+/* Crawl the tree in parallel, reusing what the old catalog has fresh,
+and fill the builder. */
+static
+int ct_crawl(ct_builder *b) {
+    void **walks;
+    long n, i;
+    int err;
+
+    err = gf_crawl_run(ct_new_walk(NULL, ""), 0, ct_walk_visit, b, &walks, &n);
+    if (err == 0)
+        err = ct_assemble(b, (ct_walk **)walks, n);
+    for (i = 0; i < n; i++) {
+        gf_free_dir_listing(&((ct_walk *)walks[i])->list);
+        free(((ct_walk *)walks[i])->rel);
+        free(walks[i]);
+    }
+    free(walks);
+    return err;
+}
+
+
+static
+void ct_free_builder(ct_builder *b) {
+    free(b->old_sorted);
+    free(b->old_start);
+    free(b->old_child);
+    free(b->tiles);
+    free(b->dirs);
+    free(b->strings);
+    free(b->pending);
+    free(b->bad);
+}
+
+
+#define CT_PARSE_CHUNK 64
+
+static
+void ct_parse_task(int i, void *arg) {
+    ct_builder *b = (ct_builder *)arg;
+    char path[CT_PATH];
+    ct_tile *tile;
+    gf_struct gf;
+    long k, end = (i + 1) * (long)CT_PARSE_CHUNK;
+
+    if (end > b->npending)
+        end = b->npending;
+    for (k = i * (long)CT_PARSE_CHUNK; k < end; k++) {
+        tile = &b->tiles[b->pending[k]];
+        memset((void *)&gf, 0, sizeof(gf_struct));
+        if (ct_join(path, b->root, b->strings + tile->name, ".hdr") != 0 ||
+            gf_parse_hdr(path, &gf) != 0) {
+            b->bad[b->pending[k]] = 1;
+            continue;
+        }
+        tile->grid = gf.grid;
+        tile->null_value = gf.null_value;
+        memcpy(tile->byte_order, gf.byte_order, sizeof(tile->byte_order));
+    }
+}
+
+
+/* Parse the headers of the rescanned directories, several at once:
+on cold or remote storage each is a round trip. */
+static
+void ct_parse_pending(ct_builder *b) {
+    b->bad = (unsigned char *)calloc(b->ntiles > 0 ? b->ntiles : 1, 1);
+    gf_parallel_for((int)((b->npending + CT_PARSE_CHUNK - 1) / CT_PARSE_CHUNK),
+        gf_db_crawl_threads(0), ct_parse_task, b);
+}
+
+
+/* Leave out the tiles whose headers did not parse, and record their
+directories with an mtime no directory has, so the next open rescans
+them rather than trusting the catalog. */
+static
+void ct_drop_bad(ct_builder *b) {
+    ct_dir *dir;
+    long d, k, end, kept = 0;
+
+    for (d = 0; d < b->ndirs; d++) {
+        dir = &b->dirs[d];
+        end = (long)dir->first_tile + dir->ntiles;
+        for (k = dir->first_tile, dir->first_tile = (uint32_t)kept; k < end; k++) {
+            if (b->bad[k]) {
+                dir->sec = -1;
+                dir->nsec = -1;
+                continue;
+            }
+            b->tiles[kept++] = b->tiles[k];
+        }
+        dir->ntiles = (uint32_t)(kept - dir->first_tile);
+    }
+    b->ntiles = kept;
+}
+
+
+/* Pack the Hilbert R-tree over the builder's tiles, leaves first. */
+static
+void ct_pack_tree(const ct_builder *b, ct_node *nodes) {
+    gf_db tmp;
+    gf_rtree_node *levels[64], *node;
+    long k, sizes[64], n;
+    int nlevels = 0, l;
+
+    if (b->ntiles == 0)
+        return;
+
+    gf_init_db(&tmp);
+    tmp.count = (int)b->ntiles;
+    tmp.tiles = (gf_struct *)calloc(b->ntiles, sizeof(gf_struct));
+    for (k = 0; k < b->ntiles; k++)
+        tmp.tiles[k].grid = b->tiles[k].grid;
+    gf_db_build_rtree(&tmp);
+
+    /* Level arrays hang off the first child, root level first. */
+    for (node = tmp.tree; node != NULL; node = node->children[0])
+        levels[nlevels++] = node;
+    for (l = 0, n = b->ntiles; l < nlevels; l++) {
+        sizes[nlevels - 1 - l] = n;
+        n = (n + NODE_SIZE - 1) / NODE_SIZE;
+    }
+
+    for (l = nlevels - 1; l >= 0; l--) {
+        for (k = 0; k < sizes[l]; k++) {
+            nodes->bounds = levels[l][k].bounds;
+            nodes->tile = levels[l][k].gf != NULL ? (int32_t)(levels[l][k].gf - tmp.tiles) : -1;
+            nodes->pad = 0;
+            nodes++;
+        }
+    }
+
+    gf_free_rtree(tmp.tree);
+    free(tmp.tiles);
+}
+
+
+/* Lay the builder out as a catalog image in one malloc'd buffer. */
+static
+char *ct_pack(const ct_builder *b, int own_dir, size_t *size) {
+    ct_header h;
+    char *buf;
+
+    memset((void *)&h, 0, sizeof(ct_header));
+    memcpy(h.magic, CT_MAGIC, 8);
+    h.version = CT_VERSION;
+    h.tile_size = sizeof(ct_tile);
+    h.dir_size = sizeof(ct_dir);
+    h.node_size = sizeof(ct_node);
+    h.ntiles = (uint32_t)b->ntiles;
+    h.ndirs = (uint32_t)b->ndirs;
+    h.nnodes = (uint32_t)ct_tree_nodes(b->ntiles);
+    h.own_dir = own_dir;
+    h.tiles_off = ct_align(sizeof(ct_header));
+    h.dirs_off = ct_align(h.tiles_off + (uint64_t)h.ntiles * sizeof(ct_tile));
+    h.nodes_off = ct_align(h.dirs_off + (uint64_t)h.ndirs * sizeof(ct_dir));
+    h.strings_off = ct_align(h.nodes_off + (uint64_t)h.nnodes * sizeof(ct_node));
+    h.size = h.strings_off + b->nstr;
+
+    if ((buf = (char *)calloc(1, h.size)) == NULL)
+        return NULL;
+    memcpy(buf, &h, sizeof(ct_header));
+    memcpy(buf + h.tiles_off, b->tiles, h.ntiles * sizeof(ct_tile));
+    memcpy(buf + h.dirs_off, b->dirs, h.ndirs * sizeof(ct_dir));
+    ct_pack_tree(b, (ct_node *)(buf + h.nodes_off));
+    memcpy(buf + h.strings_off, b->strings, b->nstr);
+
+    *size = h.size;
+    return buf;
+}
+
+
+static
+int ct_write_all(int fd, const char *buf, size_t len, off_t off) {
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = pwrite(fd, buf, len, off)) <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+
+/* Write the image to catalog (through a temporary file and a rename,
+so readers never see half a catalog), stamping its mtime into the
+header, and then the mtime its own directory has afterwards. */
+static
+int ct_write(const char *root, const char *catalog, char *buf) {
+    ct_header *h = (ct_header *)buf;
+    ct_dir *own;
+    char tmp[CT_PATH + 32], path[CT_PATH];
+    struct stat st;
+    int fd;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", catalog, (long)getpid()) >= (int)sizeof(tmp))
+        return -1;
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+    if (ct_write_all(fd, buf, h->size, 0) != 0 || fstat(fd, &st) != 0)
+        goto fail;
+    h->sec = st.st_mtim.tv_sec;
+    h->nsec = st.st_mtim.tv_nsec;
+    if (ct_write_all(fd, buf, sizeof(ct_header), 0) != 0 || rename(tmp, catalog) != 0)
+        goto fail;
+
+    if (h->own_dir >= 0) {
+        own = (ct_dir *)(buf + h->dirs_off) + h->own_dir;
+        if (ct_join(path, root, buf + h->strings_off + own->name, "") == 0 &&
+            stat(path, &st) == 0) {
+            own->sec = st.st_mtim.tv_sec;
+            own->nsec = st.st_mtim.tv_nsec;
+            ct_write_all(fd, (const char *)own, sizeof(ct_dir),
+                (off_t)(h->dirs_off + h->own_dir * sizeof(ct_dir)));
+        }
+    }
+    close(fd);
+    return 0;
+
+fail:
+    close(fd);
+    unlink(tmp);
+    return -1;
+}
+
+
+/* Fill db from a catalog image, which it keeps (and frees or unmaps in
+gf_close_db). */
+static
+int ct_load(gf_db *db, const char *root, void *base, size_t size, int mapped) {
+    ct_image im;
+    gf_rtree_node *levels[64], *node;
+    const ct_node *src;
+    gf_struct *gf;
+    long k, n, sizes[64], len = 0;
+    int nlevels, l, j;
+    char *p;
+
+    if (ct_view(base, size, &im) != 0)
+        return -1;
+    /* Every path must fit ct_join, which then cannot fail below. */
+    for (k = 0; k < (long)im.h->ntiles; k++)
+        if (strlen(root) + strlen(im.strings + im.tiles[k].name) + 6 > CT_PATH)
+            return -1;
+
+    n = im.h->ntiles;
+    db->catalog = base;
+    db->catalog_size = size;
+    db->catalog_mapped = mapped;
+    db->count = (int)n;
+    db->tiles = (gf_struct *)calloc(n > 0 ? n : 1, sizeof(gf_struct));
+    db->flts = (gf_lazy_flt *)calloc(n > 0 ? n : 1, sizeof(gf_lazy_flt));
+
+    for (k = 0; k < n; k++)
+        len += strlen(root) + strlen(im.strings + im.tiles[k].name) + 6;
+    db->paths = p = (char *)malloc(len + 1);
+
+    for (k = 0; k < n; k++) {
+        gf = &db->tiles[k];
+        gf->grid = im.tiles[k].grid;
+        gf->null_value = im.tiles[k].null_value;
+        memcpy(gf->byte_order, im.tiles[k].byte_order, sizeof(im.tiles[k].byte_order));
+        gf->lazy = &db->flts[k];
+        ct_join(p, root, im.strings + im.tiles[k].name, ".flt");
+        db->flts[k].path = p;
+        p += strlen(p) + 1;
+    }
+
+    /* Rebuild the pointer tree one malloc per level, as
+    gf_build_rtree_level does, so gf_free_rtree can free it. */
+    if (n == 0)
+        return 0;
+    for (nlevels = 0, k = n; ; k = (k + NODE_SIZE - 1) / NODE_SIZE) {
+        sizes[nlevels++] = k;
+        if (k == 1)
+            break;
+    }
+    src = im.nodes;
+    for (l = 0; l < nlevels; l++) {
+        levels[l] = (gf_rtree_node *)calloc(sizes[l], sizeof(gf_rtree_node));
+        for (k = 0; k < sizes[l]; k++, src++) {
+            node = &levels[l][k];
+            node->bounds = src->bounds;
+            if (l == 0) {
+                node->gf = &db->tiles[src->tile];
+                continue;
+            }
+            for (j = 0; j < NODE_SIZE && NODE_SIZE * k + j < sizes[l - 1]; j++)
+                node->children[j] = &levels[l - 1][NODE_SIZE * k + j];
+        }
+    }
+    db->tree = levels[nlevels - 1];
+    return 0;
+}
+
+
+/* Crawl root (reusing what it can of old), and write and load the
+result. */
+static
+int ct_build(const char *root, const char *catalog, int own, const ct_image *old, gf_db *db) {
+    ct_builder b;
+    struct stat st;
+    char *buf;
+    size_t size;
+    int err;
+
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "gf_open_db_catalog: invalid directory\n");
+        return 1;
+    }
+
+    memset((void *)&b, 0, sizeof(ct_builder));
+    b.root = root;
+    b.old = old;
+    if (old != NULL)
+        ct_index_old(&b);
+
+    if ((err = ct_crawl(&b)) != 0) {
+        ct_free_builder(&b);
+        return err;
+    }
+    ct_parse_pending(&b);
+    ct_drop_bad(&b);
+
+    buf = ct_pack(&b, own ? 0 : -1, &size);
+    ct_free_builder(&b);
+    if (buf == NULL)
+        return -1;
+
+    err = ct_write(root, catalog, buf);
+    if (db == NULL) {
+        free(buf);
+        return err;
+    }
+    if ((err = ct_load(db, root, buf, size, 0)) != 0)
+        free(buf);
+    return err;
+}
+
+
+int gf_open_db_catalog(const char *dirpath, const char *catalog, gf_db *db) {
+    char path[CT_PATH], dir[CT_PATH];
+    struct stat st;
+    ct_image im;
+    void *base = NULL;
+    size_t size = 0;
+    int fd, err, fresh = 0;
+    uint32_t d;
+
+    gf_init_db(db);
+    if (catalog == NULL) {
+        if (ct_join(path, dirpath, GF_CATALOG_NAME, "") != 0)
+            return -1;
+        catalog = path;
+    }
+
+    /* Fresh if every directory is as recorded: one stat each. */
+    if ((fd = open(catalog, O_RDONLY)) >= 0) {
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = st.st_size;
+            base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED)
+                base = NULL;
+        }
+        close(fd);
+    }
+    if (base != NULL && ct_view(base, size, &im) == 0) {
+        for (d = 0, fresh = 1; d < im.h->ndirs && fresh; d++) {
+            fresh = ct_join(dir, dirpath, im.strings + im.dirs[d].name, "") == 0 &&
+                stat(dir, &st) == 0 && !ct_stale(&im, (int)d, &st);
+        }
+        if (fresh && ct_load(db, dirpath, base, size, 1) == 0)
+            return 0;
+        err = ct_build(dirpath, catalog, catalog == path, fresh ? NULL : &im, db);
+    } else {
+        err = ct_build(dirpath, catalog, catalog == path, NULL, db);
+    }
+
+    if (base != NULL)
+        munmap(base, size);
+    return err;
+}
+
+
+int gf_rebuild_catalog(const char *dirpath, const char *catalog) {
+    char path[CT_PATH];
+
+    if (catalog == NULL) {
+        if (ct_join(path, dirpath, GF_CATALOG_NAME, "") != 0)
+            return -1;
+        catalog = path;
+    }
+    return ct_build(dirpath, catalog, catalog == path, NULL, NULL);
+}
@@ -0,0 +1,54 @@
+#ifndef GF_CATALOG_H
+#define GF_CATALOG_H
+
+#include "db.h"
+
+/**
+ * Persistent database catalog.
+ *
+ * A catalog is one binary file holding, for a directory tree of
+ * GridFloat tiles, every tile's parsed header and path, every
+ * directory's path and mtime, and the Hilbert-packed R-tree over the
+ * tiles (leaves first, each level's node i the parent of nodes
+ * NODE_SIZE * i.. of the level below, as gf_build_rtree_level groups
+ * them). It is mmap'd as is: opening a database from a fresh catalog
+ * costs one stat per directory and no header parsing, and the .flt
+ * files are only opened when a tile is first read (see gf_lazy_flt).
+ *
+ * The catalog is fresh while no directory's mtime differs from the
+ * one recorded. Adding, removing or renaming a tile touches its
+ * directory, which is then rescanned and its headers reparsed; the
+ * records of every other directory are carried over as they are.
+ * Rescans list directories and parse headers on several threads at
+ * once (see crawl.h).
+ * A tile whose header does not parse is reported and left out, and
+ * its directory is rescanned on every open until the header is fixed.
+ * Headers edited in place do not touch their directory and go
+ * unnoticed; call gf_rebuild_catalog after such edits.
+ *
+ * Catalogs are native-endian and tied to the build's gf_grid layout;
+ * one written by a different build is simply rebuilt.
+ */
+
+/* Default catalog name, kept at the top of the database. */
+#define GF_CATALOG_NAME ".gfcatalog"
+
+/**
+ * gf_open_db through a catalog. catalog is the catalog's path, or NULL
+ * for dirpath/GF_CATALOG_NAME. A missing, foreign or stale catalog is
+ * (incrementally) rebuilt and rewritten; if it cannot be written the
+ * database is still opened from the rebuilt image in memory.
+ *
+ * Returns 0, or nonzero if the directory could not be crawled (a path
+ * under it too long included).
+ */
+int gf_open_db_catalog(const char *dirpath, const char *catalog, gf_db *db);
+
+/**
+ * Crawl dirpath from scratch, ignoring any catalog there is, and write
+ * its catalog (NULL for dirpath/GF_CATALOG_NAME). Returns 0, or
+ * nonzero on failure.
+ */
+int gf_rebuild_catalog(const char *dirpath, const char *catalog);
+
+#endif
@@ -0,0 +1,682 @@
+#include "contour.h"
+#include "quadratic.h"
+#include "stencil.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * Every crossing is named by a 64-bit key: the level index (biased to
+ * stay positive, so no key is zero) above the edge it lies on. Edge
+ * (r, j, 0) joins nodes (r, j) and (r, j + 1); edge (r, j, 1) joins
+ * (r, j) and (r + 1, j). The two cells that share an edge compute the
+ * same key and the same point, which is what the stitching relies on.
+ */
+#define CN_EDGE_BITS 41
+#define CN_LEVEL_BIAS (1L << 22)
+
+#define CN_EDGE_MASK ((((uint64_t)1) << CN_EDGE_BITS) - 1)
+
+/* Cell sides, in the order top, right, bottom, left. */
+#define CN_TOP 0
+#define CN_RIGHT 1
+#define CN_BOTTOM 2
+#define CN_LEFT 3
+
+/**
+ * Sides joined by the segments of each marching-squares case, where
+ * the case bits are (top-left, top-right, bottom-right, bottom-left)
+ * at or above the level, most significant first. Saddles (5 and 10)
+ * are resolved at run time.
+ */
+static const signed char cn_cases[16][2] = {
+    {-1, -1}, {CN_LEFT, CN_BOTTOM}, {CN_BOTTOM, CN_RIGHT}, {CN_LEFT, CN_RIGHT},
+    {CN_TOP, CN_RIGHT}, {-1, -1}, {CN_TOP, CN_BOTTOM}, {CN_TOP, CN_LEFT},
+    {CN_TOP, CN_LEFT}, {CN_TOP, CN_BOTTOM}, {-1, -1}, {CN_TOP, CN_RIGHT},
+    {CN_LEFT, CN_RIGHT}, {CN_BOTTOM, CN_RIGHT}, {CN_LEFT, CN_BOTTOM}, {-1, -1}
+};
+
+
+/**
+ * An open polyline, kept as a deque of points in pts[2 * lo, 2 * hi)
+ * so it can grow at either end. key[0] and key[1] name the crossings
+ * at its front and back.
+ */
+typedef struct cn_line {
+    double level;
+    double *pts;
+    int lo;
+    int hi;
+    int cap;
+    uint64_t key[2];
+} cn_line;
+
+
+/**
+ * Open lines plus a hash (linear probing) from the key of each open
+ * end to 2 * line index + end (0 front, 1 back). Lines that can no
+ * longer grow go to out.
+ */
+typedef struct cn_stitch {
+    cn_line *lines;
+    int nlines;
+    int cap;
+    uint64_t *hkeys;
+    int *hvals;
+    size_t hcap;
+    size_t hcount;
+    gf_contours *out;
+} cn_stitch;
+
+
+typedef struct cn_band {
+    cn_stitch st;
+    gf_contours out;
+    float *first;       /* First row of the band, for the seam above */
+    float *prev;        /* Last row seen */
+    int i_first;
+    int i_last;
+} cn_band;
+
+
+typedef struct cn_job {
+    const gf_grid *grid;
+    const gf_contour_opts *opts;
+    cn_band *bands;
+} cn_job;
+
+
+void gf_init_contour_opts(gf_contour_opts *opts, double interval) {
+    opts->interval = interval;
+    opts->base = 0.0;
+}
+
+
+static
+size_t cn_hash(const cn_stitch *st, uint64_t key) {
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (st->hcap - 1);
+}
+
+
+static
+size_t cn_slot(const cn_stitch *st, uint64_t key) {
+    size_t h = cn_hash(st, key);
+
+    while (st->hkeys[h] != 0 && st->hkeys[h] != key)
+        h = (h + 1) & (st->hcap - 1);
+    return h;
+}
+
+
+static
+int cn_get(const cn_stitch *st, uint64_t key) {
+    size_t h = cn_slot(st, key);
+    return st->hkeys[h] == key ? st->hvals[h] : -1;
+}
+
+
+static
+void cn_put(cn_stitch *st, uint64_t key, int val);
+
+
+static
+void cn_grow_hash(cn_stitch *st) {
+    uint64_t *keys = st->hkeys;
+    int *vals = st->hvals;
+    size_t h, cap = st->hcap;
+
+    st->hcap = cap ? 2 * cap : 256;
+    st->hkeys = (uint64_t *)calloc(st->hcap, sizeof(uint64_t));
+    st->hvals = (int *)malloc(st->hcap * sizeof(int));
+    st->hcount = 0;
+    for (h = 0; h < cap; h++)
+        if (keys[h] != 0)
+            cn_put(st, keys[h], vals[h]);
+    free(keys);
+    free(vals);
+}
+
+
+static
+void cn_put(cn_stitch *st, uint64_t key, int val) {
+    size_t h;
+
+    if (2 * (st->hcount + 1) > st->hcap)
+        cn_grow_hash(st);
+    h = cn_slot(st, key);
+    if (st->hkeys[h] == 0)
+        st->hcount++;
+    st->hkeys[h] = key;
+    st->hvals[h] = val;
+}
+
+
+/* Delete with backward shifting, so probes never need tombstones. */
+static
+void cn_del(cn_stitch *st, uint64_t key) {
+    size_t mask = st->hcap - 1, h = cn_slot(st, key), k, home;
+
+    if (st->hkeys[h] == 0)
+        return;
+    st->hkeys[h] = 0;
+    st->hcount--;
+    for (k = (h + 1) & mask; st->hkeys[k] != 0; k = (k + 1) & mask) {
+        home = cn_hash(st, st->hkeys[k]);
+        /* Move k into the hole unless its home lies in (h, k]. */
+        if (((k - home) & mask) >= ((k - h) & mask)) {
+            st->hkeys[h] = st->hkeys[k];
+            st->hvals[h] = st->hvals[k];
+            st->hkeys[k] = 0;
+            h = k;
+        }
+    }
+}
+
+
+static
+void cn_init_stitch(cn_stitch *st, gf_contours *out) {
+    memset(st, 0, sizeof(cn_stitch));
+    st->out = out;
+    cn_grow_hash(st);
+}
+
+
+static
+void cn_free_stitch(cn_stitch *st) {
+    int l;
+
+    for (l = 0; l < st->nlines; l++)
+        free(st->lines[l].pts);
+    free(st->lines);
+    free(st->hkeys);
+    free(st->hvals);
+}
+
+
+/* Point both ends of line l at it in the hash. */
+static
+void cn_index(cn_stitch *st, int l) {
+    cn_put(st, st->lines[l].key[0], 2 * l);
+    cn_put(st, st->lines[l].key[1], 2 * l + 1);
+}
+
+
+/* Append a line that already owns its points. */
+static
+int cn_add_line(cn_stitch *st, const cn_line *line) {
+    if (st->nlines == st->cap) {
+        st->cap = st->cap ? 2 * st->cap : 64;
+        st->lines = (cn_line *)realloc(st->lines, st->cap * sizeof(cn_line));
+    }
+    st->lines[st->nlines] = *line;
+    cn_index(st, st->nlines);
+    return st->nlines++;
+}
+
+
+/* Forget line l (swap-remove); its ends must already be unhashed. */
+static
+void cn_remove(cn_stitch *st, int l) {
+    int last = --st->nlines;
+
+    if (l != last) {
+        st->lines[l] = st->lines[last];
+        cn_index(st, l);
+    }
+}
+
+
+/* Push a point onto the front (end 0) or back (end 1) of a line. */
+static
+void cn_push(cn_line *line, int end, const double *p) {
+    int n = line->hi - line->lo, cap, lo;
+    double *pts;
+
+    if ((end == 0 && line->lo == 0) || (end == 1 && line->hi == line->cap)) {
+        cap = 2 * (n + 2);
+        lo = (cap - n) / 2;
+        pts = (double *)malloc(2 * cap * sizeof(double));
+        memcpy(pts + 2 * lo, line->pts + 2 * line->lo, 2 * n * sizeof(double));
+        free(line->pts);
+        line->pts = pts;
+        line->cap = cap;
+        line->lo = lo;
+        line->hi = lo + n;
+    }
+    if (end == 0) {
+        line->lo--;
+        memcpy(line->pts + 2 * line->lo, p, 2 * sizeof(double));
+    } else {
+        memcpy(line->pts + 2 * line->hi, p, 2 * sizeof(double));
+        line->hi++;
+    }
+}
+
+
+static
+void cn_reverse(cn_line *line) {
+    double t[2], *a = line->pts + 2 * line->lo, *b = line->pts + 2 * (line->hi - 1);
+    uint64_t k;
+
+    for (; a < b; a += 2, b -= 2) {
+        memcpy(t, a, sizeof(t));
+        memcpy(a, b, sizeof(t));
+        memcpy(b, t, sizeof(t));
+    }
+    k = line->key[0];
+    line->key[0] = line->key[1];
+    line->key[1] = k;
+}
+
+
+static
+void cn_emit(gf_contours *out, double level, double *pts, int n, int closed) {
+    gf_contour *c;
+
+    if (out->count == out->cap) {
+        out->cap = out->cap ? 2 * out->cap : 64;
+        out->lines = (gf_contour *)realloc(out->lines, out->cap * sizeof(gf_contour));
+    }
+    c = out->lines + out->count++;
+    c->level = level;
+    c->n = n;
+    c->lnglat = pts;
+    c->closed = closed;
+}
+
+
+/* Move line l to the output. */
+static
+void cn_finish(cn_stitch *st, int l, int closed) {
+    cn_line *line = st->lines + l;
+    int n = line->hi - line->lo;
+
+    cn_del(st, line->key[0]);
+    cn_del(st, line->key[1]);
+    memmove(line->pts, line->pts + 2 * line->lo, 2 * n * sizeof(double));
+    cn_emit(st->out, line->level, (double *)realloc(line->pts, 2 * n * sizeof(double)),
+        n, closed);
+    cn_remove(st, l);
+}
+
+
+/* Stitch in the segment between crossings ka (at pa) and kb (at pb). */
+static
+void cn_segment(cn_stitch *st, double level, uint64_t ka, const double *pa,
+    uint64_t kb, const double *pb)
+{
+    int va = cn_get(st, ka), vb = cn_get(st, kb), la, lb, k;
+    uint64_t kt;
+    const double *pt;
+    double first[2];
+    cn_line line, *p, *q;
+
+    if (va < 0 && vb < 0) {
+        line.level = level;
+        line.cap = 4;
+        line.pts = (double *)malloc(2 * line.cap * sizeof(double));
+        line.lo = 1;
+        line.hi = 3;
+        memcpy(line.pts + 2, pa, 2 * sizeof(double));
+        memcpy(line.pts + 4, pb, 2 * sizeof(double));
+        line.key[0] = ka;
+        line.key[1] = kb;
+        cn_add_line(st, &line);
+    } else if (va < 0 || vb < 0) {
+        /* Extend the line that ends at a (swapping if it is b). */
+        if (va < 0) {
+            va = vb;
+            kt = ka; ka = kb; kb = kt;
+            pt = pa; pa = pb; pb = pt;
+        }
+        p = st->lines + (va >> 1);
+        cn_del(st, ka);
+        cn_push(p, va & 1, pb);
+        p->key[va & 1] = kb;
+        cn_put(st, kb, va);
+    } else {
+        la = va >> 1;
+        lb = vb >> 1;
+        cn_del(st, ka);
+        cn_del(st, kb);
+        p = st->lines + la;
+        if (la == lb) {
+            /* Close the ring on its first point. */
+            memcpy(first, p->pts + 2 * p->lo, sizeof(first));
+            cn_push(p, 1, first);
+            cn_finish(st, la, 1);
+            return;
+        }
+        /* Join, with a at the back of p and b at the front of q. */
+        q = st->lines + lb;
+        if ((va & 1) == 0)
+            cn_reverse(p);
+        if ((vb & 1) == 1)
+            cn_reverse(q);
+        for (k = q->lo; k < q->hi; k++)
+            cn_push(p, 1, q->pts + 2 * k);
+        p->key[1] = q->key[1];
+        free(q->pts);
+        cn_index(st, la);
+        cn_remove(st, lb);
+    }
+}
+
+
+static
+uint64_t cn_key(long k, long r, long j, int dir, int nx) {
+    return ((uint64_t)(k + CN_LEVEL_BIAS) << CN_EDGE_BITS) |
+        ((((uint64_t)r * nx + j) << 1) | dir);
+}
+
+
+/**
+ * Crossing of the level on one side of cell (r, j), whose corner
+ * values are z[] in case-bit order (top-left, top-right, bottom-right,
+ * bottom-left).
+ */
+static
+uint64_t cn_crossing(const gf_grid *grid, long k, double level, long r, long j,
+    const double *z, int side, double *p)
+{
+    static const signed char ends[4][2] = {{0, 1}, {1, 2}, {3, 2}, {0, 3}};
+    double a = z[ends[side][0]], b = z[ends[side][1]];
+    double t = (level - a) / (b - a);
+
+    switch (side) {
+    case CN_TOP:
+        p[0] = grid->left + (j + t) * grid->dx;
+        p[1] = grid->top - r * grid->dy;
+        return cn_key(k, r, j, 0, grid->nx);
+    case CN_RIGHT:
+        p[0] = grid->left + (j + 1) * grid->dx;
+        p[1] = grid->top - (r + t) * grid->dy;
+        return cn_key(k, r, j + 1, 1, grid->nx);
+    case CN_BOTTOM:
+        p[0] = grid->left + (j + t) * grid->dx;
+        p[1] = grid->top - (r + 1) * grid->dy;
+        return cn_key(k, r + 1, j, 0, grid->nx);
+    default:
+        p[0] = grid->left + j * grid->dx;
+        p[1] = grid->top - (r + t) * grid->dy;
+        return cn_key(k, r, j, 1, grid->nx);
+    }
+}
+
+
+static
+void cn_cell_segment(cn_stitch *st, const gf_grid *grid, long k, double level,
+    long r, long j, const double *z, int side_a, int side_b)
+{
+    double pa[2], pb[2];
+    uint64_t ka, kb;
+
+    ka = cn_crossing(grid, k, level, r, j, z, side_a, pa);
+    kb = cn_crossing(grid, k, level, r, j, z, side_b, pb);
+    cn_segment(st, level, ka, pa, kb, pb);
+}
+
+
+/* Marching squares over the row of cells between rows r and r + 1. */
+static
+void cn_march(cn_stitch *st, const gf_grid *grid, const gf_contour_opts *opts,
+    int r, const float *top, const float *bottom)
+{
+    double z[4], zmin, zmax, level;
+    long j, k, k0, k1;
+    int c, n;
+
+    for (j = 0; j + 1 < grid->nx; j++) {
+        z[0] = top[j];
+        z[1] = top[j + 1];
+        z[2] = bottom[j + 1];
+        z[3] = bottom[j];
+        if (z[0] == GF_NULL_VAL || z[1] == GF_NULL_VAL ||
+                z[2] == GF_NULL_VAL || z[3] == GF_NULL_VAL)
+            continue;
+
+        zmin = zmax = z[0];
+        for (c = 1; c < 4; c++) {
+            if (z[c] < zmin)
+                zmin = z[c];
+            if (z[c] > zmax)
+                zmax = z[c];
+        }
+        k0 = (long)ceil((zmin - opts->base) / opts->interval);
+        k1 = (long)floor((zmax - opts->base) / opts->interval);
+        if (k0 < 1 - CN_LEVEL_BIAS)
+            k0 = 1 - CN_LEVEL_BIAS;
+        if (k1 >= CN_LEVEL_BIAS)
+            k1 = CN_LEVEL_BIAS - 1;
+
+        for (k = k0; k <= k1; k++) {
+            level = opts->base + k * opts->interval;
+            for (c = 0, n = 0; n < 4; n++)
+                c = (c << 1) | (z[n] >= level);
+
+            if (c == 5 || c == 10) {
+                /* Saddle: if the center is high the highs connect. */
+                if ((0.25 * (z[0] + z[1] + z[2] + z[3]) >= level) == (c == 5)) {
+                    cn_cell_segment(st, grid, k, level, r, j, z, CN_TOP, CN_LEFT);
+                    cn_cell_segment(st, grid, k, level, r, j, z, CN_BOTTOM, CN_RIGHT);
+                } else {
+                    cn_cell_segment(st, grid, k, level, r, j, z, CN_TOP, CN_RIGHT);
+                    cn_cell_segment(st, grid, k, level, r, j, z, CN_LEFT, CN_BOTTOM);
+                }
+            } else if (cn_cases[c][0] >= 0) {
+                cn_cell_segment(st, grid, k, level, r, j, z, cn_cases[c][0], cn_cases[c][1]);
+            }
+        }
+    }
+}
+
+
+/* Whether a crossing is on a horizontal edge of row r. */
+static
+int cn_on_row(uint64_t key, int r, int nx) {
+    uint64_t edge = key & CN_EDGE_MASK;
+    return (edge & 1) == 0 && (long)((edge >> 1) / nx) == r;
+}
+
+
+static
+int cn_kernel(const gf_window *win, const gf_grid *from_grid, double *w,
+    double *latlng, void *xtras, void *data_ptr)
+{
+    gf_float nine[3][3];
+    int r, c;
+
+    for (r = 0; r < 3; ++r)
+        for (c = 0; c < 3; ++c)
+            nine[r][c] = GF_WIN(win, r - 1, c - 1);
+    if (!gf_fill_nulls_3x3(nine))
+        *(float *)data_ptr = GF_NULL_VAL;
+    else
+        *(float *)data_ptr = (float)gf_biquadratic_value(nine, w);
+    return 0;
+}
+
+
+static
+int cn_null(void *xtras, void *data_ptr) {
+    *(float *)data_ptr = GF_NULL_VAL;
+    return 0;
+}
+
+
+/**
+ * Called with each finished row of a band: march the cells above it,
+ * then retire lines with no end left on this row (where the next row
+ * of cells continues them) or on the band's first row (where the seam
+ * merge may).
+ */
+static
+int cn_row_done(int band, int i, void *row, void *xtras) {
+    cn_job *job = (cn_job *)xtras;
+    cn_band *b = job->bands + band;
+    cn_stitch *st = &b->st;
+    int nx = job->grid->nx, l;
+    cn_line *line;
+
+    if (b->i_first < 0) {
+        b->i_first = i;
+        memcpy(b->first, row, nx * sizeof(float));
+    } else {
+        cn_march(st, job->grid, job->opts, i - 1, b->prev, (const float *)row);
+        for (l = st->nlines - 1; l >= 0; l--) {
+            line = st->lines + l;
+            if (!cn_on_row(line->key[0], i, nx) && !cn_on_row(line->key[1], i, nx) &&
+                    !cn_on_row(line->key[0], b->i_first, nx) &&
+                    !cn_on_row(line->key[1], b->i_first, nx))
+                cn_finish(st, l, 0);
+        }
+    }
+    memcpy(b->prev, row, nx * sizeof(float));
+    b->i_last = i;
+    return 0;
+}
+
+
+int gf_contour_lines(const gf_struct *gf, const gf_grid *to_grid,
+    const gf_contour_opts *opts, gf_contours *out)
+{
+    gf_stencil st;
+    cn_job job;
+    cn_stitch seams;
+    cn_band *b, *next;
+    int nbands, k, l, ret;
+
+    memset(out, 0, sizeof(gf_contours));
+    if (opts->interval <= 0.0)
+        return -1;
+    if (to_grid->nx < 2 || to_grid->ny < 2)
+        return -2;
+
+    nbands = gf_num_threads();
+    if (nbands > to_grid->ny)
+        nbands = to_grid->ny;
+
+    job.grid = to_grid;
+    job.opts = opts;
+    job.bands = (cn_band *)calloc(nbands, sizeof(cn_band));
+    for (k = 0; k < nbands; k++) {
+        b = job.bands + k;
+        cn_init_stitch(&b->st, &b->out);
+        b->first = (float *)malloc(to_grid->nx * sizeof(float));
+        b->prev = (float *)malloc(to_grid->nx * sizeof(float));
+        b->i_first = b->i_last = -1;
+    }
+
+    gf_init_stencil(&st, 3, 3, &cn_kernel, (void *)&job, sizeof(float));
+    st.set_null = &cn_null;
+    st.row_done = &cn_row_done;
+    st.nbands = nbands;
+    ret = gf_stencil_run(gf, to_grid, &st, NULL) != 0 ? -3 : 0;
+
+    /* Gather finished lines in band order, then stitch the open ones
+       across the rows of cells between bands. */
+    cn_init_stitch(&seams, out);
+    for (k = 0; k < nbands; k++) {
+        b = job.bands + k;
+        for (l = 0; l < b->out.count; l++)
+            cn_emit(out, b->out.lines[l].level, b->out.lines[l].lnglat,
+                b->out.lines[l].n, b->out.lines[l].closed);
+        free(b->out.lines);
+        for (l = 0; l < b->st.nlines; l++)
+            cn_add_line(&seams, b->st.lines + l);
+        b->st.nlines = 0;
+    }
+    for (k = 0, b = NULL; k < nbands; k++) {
+        next = job.bands + k;
+        if (next->i_first < 0)
+            continue;
+        if (b != NULL)
+            cn_march(&seams, to_grid, opts, b->i_last, b->prev, next->first);
+        b = next;
+    }
+    while (seams.nlines > 0)
+        cn_finish(&seams, seams.nlines - 1, 0);
+    cn_free_stitch(&seams);
+
+    for (k = 0; k < nbands; k++) {
+        b = job.bands + k;
+        cn_free_stitch(&b->st);
+        free(b->first);
+        free(b->prev);
+    }
+    free(job.bands);
+    return ret;
+}
+
+
+void gf_free_contours(gf_contours *c) {
+    int l;
+
+    for (l = 0; l < c->count; l++)
+        free(c->lines[l].lnglat);
+    free(c->lines);
+    c->lines = NULL;
+    c->count = c->cap = 0;
+}
+
+
+int gf_write_contours_geojson(FILE *fp, const gf_contours *c) {
+    const gf_contour *line;
+    int l, k;
+
+    fprintf(fp, "{\"type\":\"FeatureCollection\",\"features\":[");
+    for (l = 0; l < c->count; l++) {
+        line = c->lines + l;
+        fprintf(fp, "%s\n{\"type\":\"Feature\",\"properties\":{\"elevation\":%.10g},"
+            "\"geometry\":{\"type\":\"LineString\",\"coordinates\":[",
+            l > 0 ? "," : "", line->level);
+        for (k = 0; k < line->n; k++)
+            fprintf(fp, "%s[%.8f,%.8f]", k > 0 ? "," : "",
+                line->lnglat[2 * k], line->lnglat[2 * k + 1]);
+        fprintf(fp, "]}}");
+    }
+    fprintf(fp, "\n]}\n");
+    return ferror(fp) ? -1 : 0;
+}
+
+
+int gf_write_contours_binary(FILE *fp, const gf_contours *c) {
+    const gf_contour *line;
+    uint32_t head[2] = {1, (uint32_t)c->count}, counts[2];
+    int l;
+
+    fwrite("GFCN", 1, 4, fp);
+    fwrite(head, sizeof(uint32_t), 2, fp);
+    for (l = 0; l < c->count; l++) {
+        line = c->lines + l;
+        counts[0] = (uint32_t)line->closed;
+        counts[1] = (uint32_t)line->n;
+        fwrite(&line->level, sizeof(double), 1, fp);
+        fwrite(counts, sizeof(uint32_t), 2, fp);
+        fwrite(line->lnglat, sizeof(double), 2 * line->n, fp);
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+
+int gf_save_contours(const gf_contours *c, const char *filename) {
+    size_t len = strlen(filename);
+    FILE *fp;
+    int ret;
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+        return -1;
+    if ((len > 8 && !strcmp(filename + len - 8, ".geojson")) ||
+            (len > 5 && !strcmp(filename + len - 5, ".json")))
+        ret = gf_write_contours_geojson(fp, c);
+    else
+        ret = gf_write_contours_binary(fp, c);
+    if (fclose(fp) != 0)
+        ret = -1;
+    return ret;
+}
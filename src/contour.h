@@ -0,0 +1,74 @@
+#ifndef GF_CONTOUR_H
+#define GF_CONTOUR_H
+
+#include "gridfloat.h"
+
+/**
+ * Contour levels: base + k * interval for every integer k.
+ */
+typedef struct gf_contour_opts {
+    double interval;
+    double base;
+} gf_contour_opts;
+
+void gf_init_contour_opts(gf_contour_opts *opts, double interval);
+
+/**
+ * One contour polyline.
+ *
+ * @level - Elevation of the line.
+ * @n - Number of vertices.
+ * @lnglat - 2 * n doubles: lng0, lat0, lng1, lat1, ... (GeoJSON order).
+ * @closed - 1 for a ring, whose last vertex repeats its first.
+ */
+typedef struct gf_contour {
+    double level;
+    int n;
+    double *lnglat;
+    int closed;
+} gf_contour;
+
+typedef struct gf_contours {
+    int count;
+    int cap;
+    gf_contour *lines;
+} gf_contours;
+
+/**
+ * Contour lines of the biquadratic surface sampled on to_grid, by
+ * marching squares over the rows the stencil engine streams out.
+ * Only two rows per band are held at a time, so memory beyond the
+ * output is O(to_grid->nx). Crossing segments are stitched into
+ * polylines as each row of cells completes, and lines that can no
+ * longer grow are moved to the output right away.
+ *
+ * Row bands run in parallel. Lines still open at a band's first or
+ * last row are merged across the seams once every band is done.
+ *
+ * Cells with a null corner are skipped, so lines end at voids and at
+ * the edges of to_grid. Saddle cells are split by their mean value.
+ *
+ * Returns 0, -1 for a nonpositive interval, -2 if to_grid is smaller
+ * than 2x2, or -3 if the source could not be streamed.
+ */
+int gf_contour_lines(const gf_struct *gf, const gf_grid *to_grid,
+    const gf_contour_opts *opts, gf_contours *out);
+
+void gf_free_contours(gf_contours *c);
+
+/* GeoJSON FeatureCollection of LineStrings with an "elevation" property. */
+int gf_write_contours_geojson(FILE *fp, const gf_contours *c);
+
+/**
+ * Compact binary form, in host byte order (as the .flt files are read
+ * and written):
+ *   "GFCN", uint32 version (1), uint32 line count, then per line:
+ *   float64 level, uint32 closed, uint32 n, n * (float64 lng, float64 lat).
+ * A reader on another host tells the order from the version word.
+ */
+int gf_write_contours_binary(FILE *fp, const gf_contours *c);
+
+/* Pick the format from the extension: .geojson/.json or binary. */
+int gf_save_contours(const gf_contours *c, const char *filename);
+
+#endif
@@ -0,0 +1,213 @@
+#include "crawl.h"
+#include "db.h"
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+typedef struct cw_entry {
+    char *name;
+    int type;               /* d_type */
+} cw_entry;
+
+static
+int cw_cmp_entry(const void *a, const void *b) {
+    return strcmp(((const cw_entry *)a)->name, ((const cw_entry *)b)->name);
+}
+
+/* Append a copy of name[0..len); the array doubles at powers of two. */
+static
+void cw_push_name(char ***names, long *n, const char *name, size_t len) {
+    if ((*n & (*n - 1)) == 0)
+        *names = (char **)realloc(*names, (*n ? 2 * *n : 1) * sizeof(char *));
+    (*names)[*n] = (char *)malloc(len + 1);
+    memcpy((*names)[*n], name, len);
+    (*names)[*n][len] = '\0';
+    (*n)++;
+}
+
+static
+char *cw_join(const char *dir, const char *name, const char *ext) {
+    size_t len = strlen(dir);
+    char *path = (char *)malloc(len + strlen(name) + strlen(ext) + 2);
+
+    strcpy(path, dir);
+    if (len == 0 || path[len - 1] != '/')
+        strcat(path, "/");
+    strcat(path, name);
+    strcat(path, ext);
+    return path;
+}
+
+
+int gf_list_dir(const char *path, gf_dir_listing *l) {
+    DIR *dir;
+    struct dirent *ent;
+    struct stat st;
+    cw_entry *ents = NULL, key;
+    char *child;
+    size_t len;
+    long k, n = 0, cap = 0;
+    int err = 0;
+
+    memset((void *)l, 0, sizeof(gf_dir_listing));
+    if ((dir = opendir(path)) == NULL) {
+        fprintf(stderr, "gf_list_dir: invalid directory '%s'\n", path);
+        return 1;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 64;
+            ents = (cw_entry *)realloc(ents, cap * sizeof(cw_entry));
+        }
+        ents[n].name = strdup(ent->d_name);
+        ents[n].type = ent->d_type;
+        if (ents[n].type == DT_UNKNOWN) {
+            child = cw_join(path, ents[n].name, "");
+            if (lstat(child, &st) == 0)
+                ents[n].type = S_ISDIR(st.st_mode) ? DT_DIR :
+                    S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            free(child);
+        }
+        n++;
+    }
+    closedir(dir);
+    qsort(ents, n, sizeof(cw_entry), cw_cmp_entry);
+
+    for (k = 0; k < n && err == 0; k++) {
+        len = strlen(ents[k].name);
+        if (ents[k].type == DT_DIR) {
+            cw_push_name(&l->dirs, &l->ndirs, ents[k].name, len);
+            continue;
+        }
+        if (ents[k].type != DT_REG || len <= 4 || strcmp(ents[k].name + len - 4, ".hdr") != 0)
+            continue;
+
+        key.name = strdup(ents[k].name);
+        strcpy(key.name + len - 4, ".flt");
+        if (bsearch(&key, ents, n, sizeof(cw_entry), cw_cmp_entry) == NULL) {
+            child = cw_join(path, key.name, "");
+            fprintf(stderr, "Could not locate data at '%s'\n", child);
+            free(child);
+            err = -1;
+        } else {
+            cw_push_name(&l->tiles, &l->ntiles, ents[k].name, len - 4);
+        }
+        free(key.name);
+    }
+
+    for (k = 0; k < n; k++)
+        free(ents[k].name);
+    free(ents);
+    return err;
+}
+
+
+void gf_free_dir_listing(gf_dir_listing *l) {
+    long k;
+
+    for (k = 0; k < l->ndirs; k++)
+        free(l->dirs[k]);
+    for (k = 0; k < l->ntiles; k++)
+        free(l->tiles[k]);
+    free(l->dirs);
+    free(l->tiles);
+    memset((void *)l, 0, sizeof(gf_dir_listing));
+}
+
+
+/*
+ * The stack holds directories waiting to be visited; all holds every
+ * one pushed. A worker finding the stack empty sleeps until another
+ * pushes more or the last busy one finishes.
+ */
+struct gf_crawl {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    void **stack;
+    long nstack;
+    long scap;
+    void **all;
+    long nall;
+    long acap;
+    int busy;
+    int err;
+    gf_crawl_visit *visit;
+    void *arg;
+};
+
+void gf_crawl_push(gf_crawl *c, void *dir) {
+    pthread_mutex_lock(&c->lock);
+    if (c->nstack == c->scap) {
+        c->scap = c->scap ? 2 * c->scap : 64;
+        c->stack = (void **)realloc(c->stack, c->scap * sizeof(void *));
+    }
+    if (c->nall == c->acap) {
+        c->acap = c->acap ? 2 * c->acap : 64;
+        c->all = (void **)realloc(c->all, c->acap * sizeof(void *));
+    }
+    c->stack[c->nstack++] = dir;
+    c->all[c->nall++] = dir;
+    pthread_cond_signal(&c->wake);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static
+void cw_task(int t, void *arg) {
+    gf_crawl *c = (gf_crawl *)arg;
+    void *dir;
+    int err;
+
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        while (c->nstack == 0 && c->busy > 0 && c->err == 0)
+            pthread_cond_wait(&c->wake, &c->lock);
+        if (c->nstack == 0 || c->err != 0)
+            break;
+        dir = c->stack[--c->nstack];
+        c->busy++;
+        pthread_mutex_unlock(&c->lock);
+
+        err = (*c->visit)(c, dir, c->arg);
+
+        pthread_mutex_lock(&c->lock);
+        c->busy--;
+        if (err != 0 && c->err == 0)
+            c->err = err;
+        if (c->busy == 0 || err != 0)
+            pthread_cond_broadcast(&c->wake);
+    }
+    pthread_cond_broadcast(&c->wake);
+    pthread_mutex_unlock(&c->lock);
+}
+
+int gf_crawl_run(void *root, int nthreads, gf_crawl_visit *visit, void *arg,
+    void ***dirs, long *ndirs)
+{
+    gf_crawl c;
+
+    memset((void *)&c, 0, sizeof(gf_crawl));
+    pthread_mutex_init(&c.lock, NULL);
+    pthread_cond_init(&c.wake, NULL);
+    c.visit = visit;
+    c.arg = arg;
+    gf_crawl_push(&c, root);
+
+    nthreads = gf_db_crawl_threads(nthreads);
+    gf_parallel_for(nthreads, nthreads, cw_task, &c);
+
+    pthread_cond_destroy(&c.wake);
+    pthread_mutex_destroy(&c.lock);
+    free(c.stack);
+    *dirs = c.all;
+    *ndirs = c.nall;
+    return c.err;
+}
@@ -0,0 +1,60 @@
+#ifndef GF_CRAWL_H
+#define GF_CRAWL_H
+
+/**
+ * Parallel directory crawls, shared by gf_db_load_tiles_opts and the
+ * catalog builder.
+ *
+ * Directories waiting to be visited sit on one stack shared by a pool
+ * of threads; visiting a directory pushes the subdirectories to descend
+ * into. On network-mounted or cold storage a crawl is dominated by
+ * metadata round trips, so several directories are listed at once.
+ */
+
+/**
+ * Names in one directory, each sorted: subdirectories, and tiles (the
+ * base names of .hdr files that have a .flt beside them).
+ */
+typedef struct gf_dir_listing {
+    char **dirs;
+    long ndirs;
+    char **tiles;
+    long ntiles;
+} gf_dir_listing;
+
+/**
+ * List directory path with one readdir pass (d_type, or an lstat where
+ * the file system does not fill it in). A header's .flt is looked up in
+ * the listing rather than stat'd.
+ *
+ * Returns 0, 1 if path cannot be opened, or -1 if a header has no .flt
+ * beside it (either reported on stderr). l is filled even on failure
+ * and must be freed.
+ */
+int gf_list_dir(const char *path, gf_dir_listing *l);
+
+void gf_free_dir_listing(gf_dir_listing *l);
+
+typedef struct gf_crawl gf_crawl;
+
+/**
+ * Visit one directory, as pushed, from any crawling thread. Push the
+ * subdirectories to descend into with gf_crawl_push. A nonzero return
+ * stops the crawl.
+ */
+typedef int (gf_crawl_visit)(gf_crawl *crawl, void *dir, void *arg);
+
+void gf_crawl_push(gf_crawl *crawl, void *dir);
+
+/**
+ * Crawl from root on gf_db_crawl_threads(nthreads) threads. Every
+ * directory pushed (root included) is handed back in *dirs, in no
+ * particular order, for the caller to free; after a failed crawl some
+ * of them were never visited.
+ *
+ * Returns 0, or the first nonzero visit return.
+ */
+int gf_crawl_run(void *root, int nthreads, gf_crawl_visit *visit, void *arg,
+    void ***dirs, long *ndirs);
+
+#endif
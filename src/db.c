@@ -2,21 +2,28 @@
 #include "rtree.h"
 #include "sort.h"
 #include "db.h"
+#include "catalog.h"
 #include "linear.h"
+#include "pool.h"
+#include "crawl.h"
 
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
-
-#define NUM_GF_ALLOC 32
+#include <sys/mman.h>
+#include <pthread.h>
 
 void gf_init_db(gf_db *db) {
     db->count = 0;
     db->tiles = NULL;
     db->tree = NULL;
+    db->catalog = NULL;
+    db->catalog_size = 0;
+    db->catalog_mapped = 0;
+    db->flts = NULL;
+    db->paths = NULL;
 }
 
 int gf_db_build_rtree(gf_db *db) {
@@ -61,88 +68,199 @@ int gf_db_build_rtree(gf_db *db) {
     return 0;
 }
 
-int gf_db_load_tiles(const char *path, gf_db *db) {
-    DIR *dir, *dir2;
-    struct dirent ent, ent2, *pent, *pent2;
-    struct stat st;
-    char subpath[256], flt[256], errbuf[256];
-    int baselen, err = 0;
+void gf_init_db_load_opts(gf_db_load_opts *opts) {
+    opts->nthreads = 0;
+    opts->progress = NULL;
+    opts->progress_arg = NULL;
+}
 
-    if ((dir = opendir(path)) == NULL) {
-        fprintf(stderr, "gf_db_load_tiles: invalid directory\n");
-        return 1;
-    }
 
-    readdir_r(dir, &ent, &pent);
-    while (pent != NULL) {
-        if (strcmp(ent.d_name, ".") == 0 || strcmp(ent.d_name, "..") == 0)
-            goto next;
+int gf_db_crawl_threads(int nthreads) {
+    if (nthreads > 0)
+        return nthreads;
+    nthreads = gf_num_threads();
+    return nthreads > GF_DB_CRAWL_THREADS ? nthreads : GF_DB_CRAWL_THREADS;
+}
 
-        strcpy(subpath, path);
-        if (subpath[strlen(subpath) - 1] != '/')
-            strcat(subpath, "/");
-        strcat(subpath, ent.d_name);
 
-        if ((err = lstat(subpath, &st)) != 0) {
-            sprintf(errbuf, "lstat path error on '%s'", ent.d_name);
-            perror(errbuf);
-            break;
-        }
+/* A directory of the crawl and what it holds. */
+typedef struct db_dir {
+    char *path;
+    gf_dir_listing list;
+} db_dir;
+
+typedef struct db_crawl {
+    pthread_mutex_t lock;   /* Guards the counts and progress calls */
+    long ndirs;
+    long ntiles;
+    const gf_db_load_opts *opts;
+} db_crawl;
+
+static
+char *db_join(const char *parent, const char *name) {
+    size_t len = strlen(parent);
+    char *path = (char *)malloc(len + strlen(name) + 2);
+
+    strcpy(path, parent);
+    if (name[0] != '\0' && (len == 0 || parent[len - 1] != '/'))
+        strcat(path, "/");
+    strcat(path, name);
+    return path;
+}
 
-        if (S_ISDIR(st.st_mode)) {
-            //printf("%s\n", subpath);
+static
+db_dir *db_new_dir(const char *parent, const char *name) {
+    db_dir *dir = (db_dir *)calloc(1, sizeof(db_dir));
 
-            /* recurse. */
-            if ((err = gf_db_load_tiles(subpath, db)) != 0)
-                break;
+    dir->path = db_join(parent, name);
+    return dir;
+}
 
-            goto next;
-        }
+static
+int db_visit(gf_crawl *crawl, void *item, void *arg) {
+    db_crawl *c = (db_crawl *)arg;
+    db_dir *dir = (db_dir *)item;
+    long k;
+    int err;
 
-        baselen = strlen(subpath) - 4;
-        if (S_ISREG(st.st_mode) && strcmp(subpath + baselen, ".hdr") == 0) {
-            strncpy(flt, subpath, baselen);
-            flt[baselen] = '\0';
-            strcat(flt, ".flt");
-
-            /* Check if float file exists. */
-            if ((err = lstat(flt, &st)) != 0) {
-                sprintf(errbuf, "Could not locate data at '%s'", flt);
-                perror(errbuf);
-                break;
-            }
-
-            if (db->count == 0) {
-                db->tiles = (gf_struct *)malloc(NUM_GF_ALLOC * sizeof(gf_struct));
-                printf("allocing\n");
-            }
-            else if (db->count % NUM_GF_ALLOC == 0) {
-                printf("reallocing\n");
-                db->tiles = (gf_struct *)realloc((void *)db->tiles,
-                    (db->count + NUM_GF_ALLOC) * sizeof(gf_struct));
-            }
-
-            gf_open(subpath, flt, &db->tiles[db->count++]);
-            printf("Opened tile:\n");
-            printf("  %s\n", subpath);
-            printf("  %s\n", flt);
-        }
+    if ((err = gf_list_dir(dir->path, &dir->list)) != 0)
+        return err;
+    for (k = 0; k < dir->list.ndirs; k++)
+        gf_crawl_push(crawl, db_new_dir(dir->path, dir->list.dirs[k]));
+
+    pthread_mutex_lock(&c->lock);
+    c->ndirs++;
+    c->ntiles += dir->list.ntiles;
+    if (c->opts->progress != NULL && c->ndirs % GF_DB_PROGRESS_DIRS == 0)
+        c->opts->progress(c->ndirs, c->ntiles, c->opts->progress_arg);
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+static
+int db_cmp_string(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
 
-next:
-        readdir_r(dir, &ent, &pent);
+
+/* Tiles (paths without extensions) opened DB_OPEN_CHUNK at a time. */
+typedef struct db_open_job {
+    char **bases;
+    gf_struct *tiles;
+    long n;
+    int failed;
+} db_open_job;
+
+#define DB_OPEN_CHUNK 64
+
+static
+void db_open_task(int i, void *arg) {
+    db_open_job *job = (db_open_job *)arg;
+    long k, end = (i + 1) * (long)DB_OPEN_CHUNK;
+    char *hdr, *flt;
+    size_t len;
+
+    if (end > job->n)
+        end = job->n;
+    for (k = i * (long)DB_OPEN_CHUNK; k < end; k++) {
+        len = strlen(job->bases[k]);
+        hdr = (char *)malloc(len + 5);
+        flt = (char *)malloc(len + 5);
+        sprintf(hdr, "%s.hdr", job->bases[k]);
+        sprintf(flt, "%s.flt", job->bases[k]);
+        memset((void *)&job->tiles[k], 0, sizeof(gf_struct));
+        if (gf_open(hdr, flt, &job->tiles[k]) != 0)
+            __sync_fetch_and_add(&job->failed, 1);
+        free(hdr);
+        free(flt);
     }
+}
 
 
-    closedir(dir);
+int gf_db_load_tiles_opts(const char *path, const gf_db_load_opts *opts, gf_db *db) {
+    gf_db_load_opts defaults;
+    db_crawl c;
+    db_open_job job;
+    struct stat st;
+    void **dirs;
+    db_dir *dir;
+    char **bases = NULL;
+    long ndirs, nbases = 0, d, k;
+    int nthreads, err;
+
+    if (opts == NULL) {
+        gf_init_db_load_opts(&defaults);
+        opts = &defaults;
+    }
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "gf_db_load_tiles: invalid directory\n");
+        return 1;
+    }
+    nthreads = gf_db_crawl_threads(opts->nthreads);
+
+    memset((void *)&c, 0, sizeof(db_crawl));
+    pthread_mutex_init(&c.lock, NULL);
+    c.opts = opts;
+    err = gf_crawl_run(db_new_dir(path, ""), nthreads, db_visit, &c, &dirs, &ndirs);
+    pthread_mutex_destroy(&c.lock);
+
+    if (err == 0) {
+        bases = (char **)malloc((c.ntiles > 0 ? c.ntiles : 1) * sizeof(char *));
+        for (d = 0; d < ndirs; d++) {
+            dir = (db_dir *)dirs[d];
+            for (k = 0; k < dir->list.ntiles; k++)
+                bases[nbases++] = db_join(dir->path, dir->list.tiles[k]);
+        }
+    }
+    for (d = 0; d < ndirs; d++) {
+        dir = (db_dir *)dirs[d];
+        gf_free_dir_listing(&dir->list);
+        free(dir->path);
+        free(dir);
+    }
+    free(dirs);
+
+    if (nbases > 0) {
+        /* Workers finish in any order; the tiles should not. */
+        qsort(bases, nbases, sizeof(char *), db_cmp_string);
+
+        db->tiles = (gf_struct *)realloc((void *)db->tiles,
+            (db->count + nbases) * sizeof(gf_struct));
+        job.bases = bases;
+        job.tiles = db->tiles + db->count;
+        job.n = nbases;
+        job.failed = 0;
+        gf_parallel_for((int)((nbases + DB_OPEN_CHUNK - 1) / DB_OPEN_CHUNK),
+            nthreads, db_open_task, &job);
+        if (job.failed) {
+            /* Failed opens leave their tile zeroed or half set; close
+            them all rather than let any into the tree. */
+            fprintf(stderr, "gf_db_load_tiles: %d tiles failed to open\n", job.failed);
+            for (k = 0; k < nbases; k++)
+                gf_close(&job.tiles[k]);
+            err = 1;
+        } else {
+            db->count += (int)nbases;
+        }
+    }
+    if (err == 0 && opts->progress != NULL)
+        opts->progress(c.ndirs, c.ntiles, opts->progress_arg);
+
+    for (k = 0; k < nbases; k++)
+        free(bases[k]);
+    free(bases);
     return err;
 }
 
+
+int gf_db_load_tiles(const char *path, gf_db *db) {
+    return gf_db_load_tiles_opts(path, NULL, db);
+}
+
 int gf_open_db(const char *path, gf_db *db) {
     int err;
 
-    gf_init_db(db);
-    ERR_RET(gf_db_load_tiles(path, db), err, "Problem loading tiles");
-    ERR_RET(gf_db_build_rtree(db), err, "Problem building tree");
+    ERR_RET(gf_open_db_catalog(path, NULL, db), err, "Problem loading tiles");
 
     return err;
 }
@@ -152,8 +270,17 @@ void gf_close_db(gf_db *db) {
     int i;
     for (i = 0; i < db->count; i++)
         gf_close(&db->tiles[i]);
+    for (i = 0; db->flts != NULL && i < db->count; i++)
+        if (db->flts[i].fp != NULL)
+            fclose(db->flts[i].fp);
     gf_free_rtree(db->tree);
     free(db->tiles);
+    free(db->flts);
+    free(db->paths);
+    if (db->catalog_mapped)
+        munmap(db->catalog, db->catalog_size);
+    else
+        free(db->catalog);
 }
 
 
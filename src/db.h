@@ -3,18 +3,73 @@
 
 #include "rtree.h"
 
+/**
+ * @catalog - Catalog image the db was opened from (see catalog.h), or
+ *      NULL. The tiles' .flt paths point into paths, and they read
+ *      through flts.
+ */
 typedef struct gf_db {
     gf_struct *tiles;
     int count;
     gf_rtree_node *tree;
+    void *catalog;
+    size_t catalog_size;
+    int catalog_mapped;     /* catalog is mmap'd, not malloc'd */
+    gf_lazy_flt *flts;
+    char *paths;
 } gf_db;
 
 void gf_init_db(gf_db *db);
 
+/* Crawling threads by default (crawls mostly wait on the file system). */
+#define GF_DB_CRAWL_THREADS 8
+
+/* Directories listed between progress reports. */
+#define GF_DB_PROGRESS_DIRS 256
+
+/**
+ * Options for gf_db_load_tiles_opts.
+ *
+ * @nthreads - Directories listed and headers parsed at once; 0 for
+ *      gf_db_crawl_threads(0).
+ * @progress - Called every GF_DB_PROGRESS_DIRS directories (from one
+ *      crawling thread at a time) with the directories listed and tiles
+ *      found so far, and once when the tiles are open. NULL for quiet.
+ */
+typedef struct gf_db_load_opts {
+    int nthreads;
+    void (*progress)(long ndirs, long ntiles, void *arg);
+    void *progress_arg;
+} gf_db_load_opts;
+
+void gf_init_db_load_opts(gf_db_load_opts *opts);
+
+/* nthreads if positive, else the larger of GF_DB_CRAWL_THREADS and
+gf_num_threads(). */
+int gf_db_crawl_threads(int nthreads);
+
+/**
+ * Append the tiles under dirpath to db. Directories are listed by a
+ * pool of threads sharing a stack of directories still to list (see
+ * crawl.h), and
+ * the headers found are then parsed and opened in parallel into one
+ * array sized for them all. Tiles come out sorted by path, whatever
+ * order the crawl found them in.
+ *
+ * Returns 0, or nonzero (and adds nothing) if a directory could not be
+ * listed, a header has no .flt beside it or a tile fails to open.
+ */
+int gf_db_load_tiles_opts(const char *dirpath, const gf_db_load_opts *opts, gf_db *db);
+
+/* gf_db_load_tiles_opts with default options. */
 int gf_db_load_tiles(const char *dirpath, gf_db *db);
 
 int gf_db_build_rtree(gf_db *db);
 
+/**
+ * Load the tiles under dirpath and their R-tree, through the catalog
+ * dirpath/GF_CATALOG_NAME, which is kept up to date (see catalog.h).
+ */
 int gf_open_db(const char *dirpath, gf_db *db);
 
 /*
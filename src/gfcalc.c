@@ -0,0 +1,257 @@
+#include "calc.h"
+#include "pool.h"
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <math.h>
+#include <string.h>
+
+
+#define MAX_INPUTS 26
+
+
+void print_usage(void) {
+    fprintf(stdout,
+        "Summary:\n"
+        "  Raster algebra over GridFloat files.\n"
+        "\n"
+        "Usage:\n"
+        "  gfcalc [<options>] <expression> [<name>=]<gridfloat> ...\n"
+        "\n"
+        "  Each input is a .flt or .hdr file or their shared prefix. It\n"
+        "  is referred to by name in the expression; unnamed inputs are\n"
+        "  a, b, c, ... in order. The result covers the first input's\n"
+        "  grid unless the options below change it. Other inputs are\n"
+        "  resampled (bilinearly) onto it when they are not aligned.\n"
+        "\n"
+        "Expressions:\n"
+        "  Operators, loosest binding first:\n"
+        "\n"
+        "      c ? x : y    ||    &&    < <= > >= == !=    + -    * / %%\n"
+        "      -x !x    x ^ y\n"
+        "\n"
+        "  Functions: abs sqrt exp log log10 sin cos tan asin acos atan\n"
+        "  atan2 floor ceil round min max pow isnull. Constants: nodata,\n"
+        "  pi. Anything computed from NODATA is NODATA; use isnull() to\n"
+        "  substitute for it.\n"
+        "\n"
+        "Options:\n"
+        "  -h:  Print this help message.\n"
+        "  -o:  Write the result to GridFloat files with this prefix\n"
+        "       (.hdr and .flt are appended), streaming rows to disk.\n"
+        "       Without -o the result is printed.\n"
+        "  -T:  Transpose the printed array (see gridfloat -T).\n"
+        "  -v:  Treat the result as a change in elevation (m), save it\n"
+        "       with -o (required) and print the cut (removed) and fill\n"
+        "       (added) volumes in m^3.\n"
+        "  -L:  Level of detection for -v: smaller changes count toward\n"
+        "       neither volume. Default: 0.\n"
+        "  -R:  Resolution of the result, e.g. '-R 128x256' (x first)\n"
+        "       or '-R 128'. Default: the first input's cell size.\n"
+        "  -l:  Left bound of the result.\n"
+        "  -r:  Right bound of the result.\n"
+        "  -b:  Bottom bound of the result.\n"
+        "  -t:  Top bound of the result.\n"
+        "  -B:  Bounds as LEFT,RIGHT,BOTTOM,TOP.\n"
+        "\n"
+        "Examples:\n"
+        "  gfcalc -o diff '(a - b) * 3.28' new.flt old.flt\n"
+        "  gfcalc -o high 'dem > 1500 ? dem : nodata' dem=n42w123\n"
+        "  gfcalc -v -L 0.3 -o dod 'new - old' new=2019 old=2012\n"
+    );
+}
+
+void fail(const char *msg) {
+    print_usage();
+    fprintf(stderr, "%s", msg);
+    exit(EXIT_FAILURE);
+}
+
+static struct option options[] = {
+	{ "help", no_argument, NULL, 'h' },
+	{ "output", required_argument, NULL, 'o' },
+	{ "transpose", no_argument, NULL, 'T' },
+	{ "volumes", no_argument, NULL, 'v' },
+	{ "lod", required_argument, NULL, 'L' },
+	{ "res", required_argument, NULL, 'R' },
+	{ "bounds", required_argument, NULL, 'B' },
+	{ "left", required_argument, NULL, 'l' },
+	{ "right", required_argument, NULL, 'r' },
+	{ "bottom", required_argument, NULL, 'b' },
+	{ "top", required_argument, NULL, 't' },
+	{ NULL, 0, 0, 0 }
+};
+
+#define BADLATLNG 1e9
+
+/* Open 'prefix', 'prefix.flt' or 'prefix.hdr'. */
+static
+int open_input(const char *fileish, gf_struct *gf) {
+    char hdr[2048], flt[2048];
+    size_t len = strlen(fileish);
+
+    if (len > 4 && (!strcmp(fileish + len - 4, ".flt") || !strcmp(fileish + len - 4, ".hdr")))
+        len -= 4;
+    if (len + 5 > sizeof(hdr))
+        return -1;
+    memcpy(hdr, fileish, len);
+    strcpy(hdr + len, ".hdr");
+    memcpy(flt, fileish, len);
+    strcpy(flt + len, ".flt");
+    return gf_open(hdr, flt, gf);
+}
+
+int main(int argc, char *argv[]) {
+    int n, count, k, ninputs, save = 0, xy = 0, volumes = 0;
+    double lod = 0.0;
+    gf_volume_stats vstats;
+    char savename[2048] = "", *expr, *arg, *eq;
+    char *names[MAX_INPUTS], letters[MAX_INPUTS][2];
+    gf_struct inputs[MAX_INPUTS];
+    gf_calc_prog prog;
+    gf_grid grid;
+    gf_bounds b;
+    gf_float *data;
+    double *b_view[4] = { &b.left, &b.right, &b.bottom, &b.top };
+    int res[2] = { 0, 0 };
+
+    b.left = b.right = b.top = b.bottom = BADLATLNG;
+
+    n = 0;
+	while (n >= 0) {
+		n = getopt_long(argc, argv, "ho:TvL:R:l:r:b:t:B:", options, NULL);
+		if (n < 0)
+			continue;
+		switch (n) {
+        case 'h':
+            print_usage();
+            exit(EXIT_SUCCESS);
+        case 'o':
+            save = 1;
+            strcpy(savename, optarg);
+            break;
+        case 'T':
+            xy = 1;
+            break;
+        case 'v':
+            volumes = 1;
+            break;
+        case 'L':
+            lod = atof(optarg);
+            break;
+        case 'R':
+            count = 0;
+            while (optarg != NULL && count < 2)
+                res[count++] = atoi(strsep(&optarg, "x"));
+            if (optarg != NULL || res[0] < 2 || (count == 2 && res[1] < 2)) {
+                fprintf(stderr, "Bad resolution. Example: '128x256' "
+                    "or '128' for 128x128\n");
+                exit(EXIT_FAILURE);
+            } else if (count == 1) {
+                res[1] = res[0];
+            }
+            break;
+        case 'l':
+            b.left = atof(optarg);
+            break;
+        case 'r':
+            b.right = atof(optarg);
+            break;
+        case 'b':
+            b.bottom = atof(optarg);
+            break;
+        case 't':
+            b.top = atof(optarg);
+            break;
+        case 'B':
+            count = 0;
+            while (optarg != NULL && count < 4)
+                *b_view[count++] = atof(strsep(&optarg, ","));
+            if (count != 4 || optarg != NULL) {
+                fprintf(stderr, "Bad -B option.\n  Example: "
+                    "'-113.0,-112.9,42,42.1'\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind < 2)
+        fail("Need an expression and at least one input.\n\n");
+    if (volumes && !save)
+        fail("-v needs -o.\n\n");
+    ninputs = argc - optind - 1;
+    if (ninputs > MAX_INPUTS)
+        fail("Too many inputs.\n\n");
+    expr = argv[optind];
+
+    for (k = 0; k < ninputs; k++) {
+        arg = argv[optind + 1 + k];
+        if ((eq = strchr(arg, '=')) != NULL) {
+            *eq = '\0';
+            names[k] = arg;
+            arg = eq + 1;
+        } else {
+            letters[k][0] = 'a' + k;
+            letters[k][1] = '\0';
+            names[k] = letters[k];
+        }
+        if (open_input(arg, &inputs[k]) != 0) {
+            fprintf(stderr, "Failed to open %s\n", arg);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (gf_calc_compile(expr, ninputs, names, &prog) != 0)
+        exit(EXIT_FAILURE);
+
+    /* Result grid: the first input's, with any bounds and resolution
+    asked for. */
+    grid = inputs[0].grid;
+    if (b.left != BADLATLNG)
+        grid.left = b.left;
+    if (b.right != BADLATLNG)
+        grid.right = b.right;
+    if (b.bottom != BADLATLNG)
+        grid.bottom = b.bottom;
+    if (b.top != BADLATLNG)
+        grid.top = b.top;
+    if (grid.left >= grid.right || grid.bottom >= grid.top)
+        fail("Empty bounds.\n\n");
+    if (res[0] > 0) {
+        grid.nx = res[0];
+        grid.ny = res[1];
+    } else {
+        grid.nx = (int)lround((grid.right - grid.left) / inputs[0].grid.dx) + 1;
+        grid.ny = (int)lround((grid.top - grid.bottom) / inputs[0].grid.dy) + 1;
+    }
+    gf_init_grid_bounds(&grid, grid.left, grid.right, grid.bottom, grid.top, grid.ny, grid.nx);
+
+    if (volumes) {
+        if (gf_calc_volumes(&prog, inputs, &grid, lod, savename, &vstats) != 0) {
+            fprintf(stderr, "Failed to write %s\n", savename);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stdout, "count\t%ld\nchanged\t%ld\ncut\t%f\nfill\t%f\nnet\t%f\n"
+            "min\t%f\nmax\t%f\n", vstats.count, vstats.changed, vstats.cut,
+            vstats.fill, vstats.fill - vstats.cut, vstats.min, vstats.max);
+    } else if (save) {
+        if (gf_calc_save(&prog, inputs, &grid, savename) != 0) {
+            fprintf(stderr, "Failed to write %s\n", savename);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        data = (gf_float *)malloc((long)grid.nx * grid.ny * sizeof(gf_float));
+        gf_calc_run(&prog, inputs, &grid, gf_num_threads(), NULL, NULL, data);
+        gf_print(&grid, data, xy);
+        free(data);
+    }
+
+    gf_free_calc_prog(&prog);
+    for (k = 0; k < ninputs; k++)
+        gf_close(&inputs[k]);
+    exit(EXIT_SUCCESS);
+}
@@ -3,117 +3,668 @@
 
 #include "gfpng.h"
 #include "quadratic.h"
+#include "sweep.h"
+#include "pool.h"
 
-static
-void write_row_callback(png_structp png_ptr, png_uint_32 row, int pass) {
-    // No op
-}
+#include <string.h>
+#include <zlib.h>
 
 int gf_relief_shade_kernel(gf_float nine[][3], const gf_grid *from_grid, double *w, double *latlng, void *xtras, void **data_ptr) {
-    int i;
     png_byte **shade_ptr = (png_byte **)data_ptr;
-    double grad[2] = {GF_NULL_VAL, GF_NULL_VAL}, *grad_view, n_surf[3], *n_sun, norm, shade;
+    double grad[2] = {GF_NULL_VAL, GF_NULL_VAL}, *grad_view;
 
     grad_view = grad;
 
-    n_sun = (double *)xtras;
-
     gf_biquadratic_gradient_kernel(nine, from_grid, w, latlng, (void *)NULL, (void **)&grad_view);
 
-    if (grad[0] == GF_NULL_VAL || grad[1] == GF_NULL_VAL) {
-        fprintf(stderr, "gf_relief_shade_kernel: Something wrong. Please report.\n");
+    /* No data under this pixel. */
+    if (grad[0] == GF_NULL_VAL || grad[1] == GF_NULL_VAL)
+        (*shade_ptr)[0] = 0;
+    else
+        (*shade_ptr)[0] = gf_shade(grad[0], grad[1], (double *)xtras);
+    shade_ptr[0]++;
+    return 0;
+}
+
+void gf_relief_shade(const gf_struct *gf, const gf_grid *grid, double *n_sun, const char *filename) {
+    gf_relief_opts opts;
+
+    gf_init_relief_opts(&opts, n_sun);
+    gf_relief_shade_opts(gf, grid, &opts, filename);
+}
+
+
+void gf_init_relief_opts(gf_relief_opts *opts, const double *n_sun) {
+    opts->n_sun = n_sun;
+    opts->shadows = 0;
+    opts->shadow_depth = 0.6;
+    opts->sky_dirs = 0;
+    opts->sky_weight = 0.7;
+    opts->ramp = NULL;
+    opts->tint_shade = 0.7;
+    opts->png = NULL;
+}
+
+
+/* Products computed once per grid, whatever the sun. */
+static
+float *gf_relief_sky(const gf_grid *grid, const float *elev, const gf_relief_opts *opts) {
+    float *svf;
+
+    if (opts->sky_dirs <= 0)
+        return NULL;
+    svf = (float *)malloc((long)grid->nx * grid->ny * sizeof(float));
+    gf_sky_view(grid, elev, opts->sky_dirs, svf);
+    return svf;
+}
+
+
+/* Darken Lambertian shade (or, with 4 channels, shaded RGBA color) by
+cast shadows and the sky-view factor. */
+static
+void gf_relief_finish(const gf_grid *grid, const float *elev, const double *n_sun,
+    const gf_relief_opts *opts, const float *svf, int channels, unsigned char *shade)
+{
+    long k, n = (long)grid->nx * grid->ny;
+    unsigned char *shadow;
+    float keep = (float)(1.0 - opts->shadow_depth), w = (float)opts->sky_weight;
+    int c, ncolor = channels < 3 ? channels : 3;
+
+    if (opts->shadows) {
+        shadow = (unsigned char *)malloc(n);
+        gf_cast_shadows(grid, elev, n_sun, shadow);
+        for (k = 0; k < n; k++)
+            if (shadow[k])
+                for (c = 0; c < ncolor; c++)
+                    shade[channels * k + c] = (png_byte)(keep * shade[channels * k + c]);
+        free(shadow);
+    }
+
+    if (svf != NULL) {
+        for (k = 0; k < n; k++)
+            if (svf[k] != (float)GF_NULL_VAL)
+                for (c = 0; c < ncolor; c++)
+                    shade[channels * k + c] = (png_byte)(shade[channels * k + c] *
+                        (1.0f - w + w * svf[k]));
+    }
+}
+
+
+/* Gray shade, or RGBA tint as RGB(A), to a PNG. */
+static
+int gf_relief_save(const gf_grid *grid, unsigned char *pixels, const gf_color_ramp *ramp,
+    const gf_png_opts *png, const char *filename)
+{
+    png_byte **rows;
+    int i, err, stride = ramp != NULL ? 4 : 1;
+
+    rows = (png_byte **)malloc(grid->ny * sizeof(png_byte *));
+    for (i = 0; i < grid->ny; ++i)
+        rows[i] = pixels + (long)stride * i * grid->nx;
+    err = gf_save_png_opts(grid->nx, grid->ny, rows, stride, ramp == NULL ?
+        PNG_COLOR_TYPE_GRAY : ramp->alpha ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB,
+        png, filename);
+    free(rows);
+    return err;
+}
+
+
+int gf_relief_shade_opts(const gf_struct *gf, const gf_grid *grid, const gf_relief_opts *opts, const char *filename) {
+    int err, channels;
+    long n = (long)grid->nx * grid->ny;
+    gf_data_xtras xtras;
+    gf_data data;
+    float *svf;
+
+    /* One pass over the source for shading (or tint) and elevations. */
+    memset((void *)&xtras, 0, sizeof(gf_data_xtras));
+    xtras.types = opts->ramp != NULL ? TINT : SHADE;
+    xtras.n_sun = opts->n_sun;
+    xtras.ramp = opts->ramp;
+    xtras.tint_shade = (float)opts->tint_shade;
+    if (opts->shadows || opts->sky_dirs > 0)
+        xtras.types |= ELEVATION;
+    gf_init_data(xtras.types, n, &data);
+    if (gf_biquadratic_data_opts(gf, grid, &xtras, &data) != 0) {
+        gf_free_data(&data);
         return -1;
     }
 
-    norm = sqrt(1.0 + grad[0] * grad[0] + grad[1] * grad[1]);
-    n_surf[0] = -grad[0] / norm;
-    n_surf[1] = -grad[1] / norm;
-    n_surf[2] = 1.0 / norm;
+    channels = opts->ramp != NULL ? 4 : 1;
+    svf = gf_relief_sky(grid, data.elev, opts);
+    gf_relief_finish(grid, data.elev, opts->n_sun, opts, svf, channels,
+        channels == 4 ? data.rgba : data.shade);
+    free(svf);
+
+    err = gf_relief_save(grid, channels == 4 ? data.rgba : data.shade, opts->ramp,
+        opts->png, filename);
+
+    gf_free_data(&data);
+    return err;
+}
 
-    shade = 0.0;
-    for (i = 0; i < 3; ++i) {
-        shade += n_sun[i] * n_surf[i];
+
+int gf_relief_shade_proj(const gf_struct *gf, const gf_proj_grid *pg, const gf_relief_opts *opts, const char *filename) {
+    int err;
+    gf_data_xtras xtras;
+    gf_data data;
+
+    memset((void *)&xtras, 0, sizeof(gf_data_xtras));
+    xtras.types = opts->ramp != NULL ? TINT : SHADE;
+    xtras.n_sun = opts->n_sun;
+    xtras.ramp = opts->ramp;
+    xtras.tint_shade = (float)opts->tint_shade;
+    gf_init_data(xtras.types, (long)pg->grid.nx * pg->grid.ny, &data);
+    if (gf_proj_biquadratic_data(gf, pg, &xtras, &data) != 0) {
+        gf_free_data(&data);
+        return -1;
     }
 
-    (*shade_ptr)[0] = (int)(255.0 * (shade > 0.0 ? shade : 0.0));
-    shade_ptr[0]++;
-    return 0;
+    err = gf_relief_save(&pg->grid, opts->ramp != NULL ? data.rgba : data.shade,
+        opts->ramp, opts->png, filename);
+
+    gf_free_data(&data);
+    return err;
 }
 
-static
-int gf_set_null_png_byte(void **data_ptr) {
-    png_byte **dptr = (png_byte **)data_ptr;
-    (*dptr)[0] = 0;
-    dptr[0]++;
+
+int gf_compute_normals(const gf_struct *gf, const gf_grid *grid, int keep_elev,
+    gf_normals *normals)
+{
+    long k, n = (long)grid->nx * grid->ny;
+    int types = GRADX | GRADY | (keep_elev ? ELEVATION : 0);
+    double inv;
+    gf_data data;
+
+    memset((void *)normals, 0, sizeof(gf_normals));
+    normals->n = n;
+    normals->x = (float *)malloc(n * sizeof(float));
+    normals->y = (float *)malloc(n * sizeof(float));
+    normals->z = (float *)malloc(n * sizeof(float));
+
+    gf_init_data(types, n, &data);
+    if (gf_biquadratic_data(gf, grid, types, NULL, &data) != 0) {
+        gf_free_data(&data);
+        gf_free_normals(normals);
+        return -1;
+    }
+
+    /* Normal is (-gradx, -grady, 1) / norm. */
+    for (k = 0; k < n; k++) {
+        if (data.gradx[k] == GF_NULL_VAL || data.grady[k] == GF_NULL_VAL) {
+            normals->x[k] = normals->y[k] = normals->z[k] = 0.0f;
+            continue;
+        }
+        inv = 1.0 / sqrt(1.0 + data.gradx[k] * data.gradx[k] + data.grady[k] * data.grady[k]);
+        normals->x[k] = (float)(-data.gradx[k] * inv);
+        normals->y[k] = (float)(-data.grady[k] * inv);
+        normals->z[k] = (float)inv;
+    }
+
+    /* Hand the elevations over rather than copying them. */
+    normals->elev = data.elev;
+    data.elev = NULL;
+    gf_free_data(&data);
     return 0;
 }
 
-void gf_relief_shade(const gf_struct *gf, const gf_grid *grid, double *n_sun, const char *filename) {
-    int i;
-    png_byte *shade, **shade_rows;
-    
-    shade = (png_byte *)malloc(grid->nx * grid->ny * sizeof(png_byte));
-    shade_rows = (png_byte **)malloc(grid->ny * sizeof(png_byte *));
 
-    gf_biquadratic(gf, grid, (void *)n_sun,
-        &gf_relief_shade_kernel, &gf_set_null_png_byte, (void *)shade);
+void gf_free_normals(gf_normals *normals) {
+    free(normals->x);
+    free(normals->y);
+    free(normals->z);
+    free(normals->elev);
+    memset((void *)normals, 0, sizeof(gf_normals));
+}
+
 
-    for (i = 0; i < grid->ny; ++i) {
-        shade_rows[i] = shade + i * grid->nx;
+void gf_shade_normals(const gf_normals *normals, const double *n_sun,
+    unsigned char *restrict shade)
+{
+    const float *restrict x = normals->x, *restrict y = normals->y,
+        *restrict z = normals->z;
+    const float sx = (float)n_sun[0], sy = (float)n_sun[1], sz = (float)n_sun[2];
+    long k, n = normals->n;
+    int v;
+
+    /* Branch-free (negative values clamp to 0 through the sign mask)
+    so the compiler can vectorize it. */
+    for (k = 0; k < n; k++) {
+        v = (int)(255.0f * (sx * x[k] + sy * y[k] + sz * z[k]));
+        shade[k] = (unsigned char)(v & ~(v >> 31));
+    }
+}
+
+
+typedef struct gf_frames_job {
+    const gf_grid *grid;
+    const gf_normals *normals;
+    const double *n_suns;
+    const gf_relief_opts *opts;
+    const float *svf;
+    const char *filename;
+    gf_png_opts png;
+    int failed;
+} gf_frames_job;
+
+
+static
+void gf_frame_task(int frame, void *arg) {
+    gf_frames_job *job = (gf_frames_job *)arg;
+    const gf_grid *grid = job->grid;
+    const double *n_sun = job->n_suns + 3 * frame;
+    const gf_color_ramp *ramp = job->opts->ramp;
+    unsigned char *shade, *rgba;
+    char name[2048];
+    const char *dot;
+    int len;
+    long k;
+
+    shade = (unsigned char *)malloc(job->normals->n);
+    gf_shade_normals(job->normals, n_sun, shade);
+    if (ramp != NULL) {
+        /* Tint from the elevations kept with the normals. */
+        rgba = (unsigned char *)malloc((size_t)job->normals->n * 4);
+        for (k = 0; k < job->normals->n; k++) {
+            if (job->normals->elev[k] == (float)GF_NULL_VAL)
+                memcpy(rgba + 4 * k, ramp->nodata, 4);
+            else
+                gf_tint(ramp, job->normals->elev[k], shade[k],
+                    (float)job->opts->tint_shade, rgba + 4 * k);
+        }
+        free(shade);
+        shade = rgba;
     }
+    gf_relief_finish(grid, job->normals->elev, n_sun, job->opts, job->svf,
+        ramp != NULL ? 4 : 1, shade);
 
-    gf_save_png(grid->nx, grid->ny, shade_rows, filename);
+    /* name_kkk.png */
+    dot = strrchr(job->filename, '.');
+    len = dot != NULL && strchr(dot, '/') == NULL ?
+        (int)(dot - job->filename) : (int)strlen(job->filename);
+    snprintf(name, sizeof(name), "%.*s_%03d%s", len, job->filename, frame,
+        job->filename + len);
+
+    if (gf_relief_save(grid, shade, ramp, &job->png, name) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
 
     free(shade);
-    free(shade_rows);
 }
 
 
-int gf_save_png(int nx, int ny, png_byte **data, const char *filename) {
+int gf_relief_shade_frames(const gf_struct *gf, const gf_grid *grid, int nframes,
+    const double *n_suns, const gf_relief_opts *opts, const char *filename)
+{
+    gf_normals normals;
+    gf_frames_job job;
+
+    if (gf_compute_normals(gf, grid, opts->shadows || opts->sky_dirs > 0 ||
+            opts->ramp != NULL, &normals) != 0)
+        return -1;
+
+    job.svf = gf_relief_sky(grid, normals.elev, opts);
+    job.grid = grid;
+    job.normals = &normals;
+    job.n_suns = n_suns;
+    job.opts = opts;
+    job.filename = filename;
+    job.failed = 0;
+    /* Frames encode side by side, so share the threads among them. */
+    if (opts->png != NULL)
+        job.png = *opts->png;
+    else
+        gf_init_png_opts(&job.png);
+    if (job.png.nthreads <= 0)
+        job.png.nthreads = gf_num_threads() > nframes ? gf_num_threads() / nframes : 1;
+    gf_parallel_for(nframes, 0, &gf_frame_task, (void *)&job);
 
+    free((void *)job.svf);
+    gf_free_normals(&normals);
+    return job.failed ? -1 : 0;
+}
+
+
+void gf_init_png_opts(gf_png_opts *opts) {
+    opts->level = 6;
+    opts->filter = GF_PNG_FILTER_ADAPTIVE;
+    opts->strip_rows = 0;
+    opts->nthreads = 0;
+}
+
+
+/* Input bytes per strip when strip_rows is 0, as in pigz. */
+#define PZ_STRIP_BYTES (128 * 1024)
+
+/* Deflate window: each strip is primed with this much input before it. */
+#define PZ_WINDOW 32768
+
+
+/**
+ * The encoder: rows are filtered, then deflated in strips, both on
+ * worker threads. Each strip is compressed by its own raw deflate
+ * stream, primed with the window of filtered bytes before it and ended
+ * on a sync flush (the last on a finish), so the byte-aligned pieces
+ * concatenate into one zlib stream. Each strip goes out as an IDAT
+ * chunk of its own, framed and CRC'd by its worker; the stream's
+ * Adler-32 is the strips' combined.
+ */
+typedef struct pz_job {
+    int nx, ny;
+    png_byte **rows;
+    int stride;             /* Bytes per input pixel */
+    int bpp;                /* Bytes per output pixel */
+    size_t rowbytes;        /* Filter byte plus pixels */
+    const gf_png_opts *opts;
+    unsigned char *filtered;
+    int strip_rows;
+    int nstrips;
+    unsigned char **chunks;
+    size_t *chunk_len;
+    uLong *adler;
+    int err;
+} pz_job;
+
+
+static inline
+unsigned char pz_paeth(int a, int b, int c) {
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return (unsigned char)a;
+    return (unsigned char)(pb <= pc ? b : c);
+}
+
+
+/* Filter n bytes of cur (prev is the row above, zeros for the first)
+into out[1..n], with the filter type in out[0]. */
+static
+void pz_filter(int type, const unsigned char *cur, const unsigned char *prev,
+    size_t n, int bpp, unsigned char *out)
+{
+    size_t k;
+    int a, b, c;
+
+    out[0] = (unsigned char)type;
+    out++;
+    for (k = 0; k < n; k++) {
+        a = k >= (size_t)bpp ? cur[k - bpp] : 0;
+        b = prev[k];
+        c = k >= (size_t)bpp ? prev[k - bpp] : 0;
+        switch (type) {
+        case GF_PNG_FILTER_SUB:
+            out[k] = (unsigned char)(cur[k] - a);
+            break;
+        case GF_PNG_FILTER_UP:
+            out[k] = (unsigned char)(cur[k] - b);
+            break;
+        case GF_PNG_FILTER_AVERAGE:
+            out[k] = (unsigned char)(cur[k] - ((a + b) >> 1));
+            break;
+        case GF_PNG_FILTER_PAETH:
+            out[k] = (unsigned char)(cur[k] - pz_paeth(a, b, c));
+            break;
+        default:
+            out[k] = cur[k];
+        }
+    }
+}
+
+
+/* Sum of filtered bytes taken as signed: libpng's adaptive heuristic. */
+static
+unsigned long pz_cost(const unsigned char *f, size_t n) {
+    unsigned long sum = 0;
+    size_t k;
+
+    for (k = 1; k <= n; k++)
+        sum += f[k] < 128 ? f[k] : 256 - f[k];
+    return sum;
+}
+
+
+/* Input row i packed to bpp bytes per pixel. */
+static
+void pz_pack(const pz_job *job, int i, unsigned char *out) {
+    const png_byte *row = job->rows[i];
+    int j, c;
+
+    if (job->stride == job->bpp) {
+        memcpy(out, row, job->rowbytes - 1);
+        return;
+    }
+    for (j = 0; j < job->nx; j++)
+        for (c = 0; c < job->bpp; c++)
+            out[j * job->bpp + c] = row[j * job->stride + c];
+}
+
+
+static
+void pz_filter_task(int strip, void *arg) {
+    pz_job *job = (pz_job *)arg;
+    size_t n = job->rowbytes - 1;
+    unsigned char *cur, *prev, *tmp, *trial, *out;
+    unsigned long cost, best;
+    int i, i0, i1, t;
+
+    i0 = strip * job->strip_rows;
+    i1 = i0 + job->strip_rows < job->ny ? i0 + job->strip_rows : job->ny;
+    cur = (unsigned char *)malloc(n);
+    prev = (unsigned char *)calloc(n, 1);
+    trial = (unsigned char *)malloc(job->rowbytes);
+    if (i0 > 0)
+        pz_pack(job, i0 - 1, prev);
+
+    for (i = i0; i < i1; i++) {
+        pz_pack(job, i, cur);
+        out = job->filtered + (size_t)i * job->rowbytes;
+        if (job->opts->filter != GF_PNG_FILTER_ADAPTIVE) {
+            pz_filter(job->opts->filter, cur, prev, n, job->bpp, out);
+        } else {
+            pz_filter(GF_PNG_FILTER_NONE, cur, prev, n, job->bpp, out);
+            best = pz_cost(out, n);
+            for (t = GF_PNG_FILTER_SUB; t <= GF_PNG_FILTER_PAETH; t++) {
+                pz_filter(t, cur, prev, n, job->bpp, trial);
+                if ((cost = pz_cost(trial, n)) < best) {
+                    best = cost;
+                    memcpy(out, trial, job->rowbytes);
+                }
+            }
+        }
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+
+    free(cur);
+    free(prev);
+    free(trial);
+}
+
+
+static
+void pz_put32(unsigned char *p, uLong v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+
+/* zlib header for a 32K window at level. */
+static
+void pz_zlib_header(int level, unsigned char *hdr) {
+    int flevel = level < 0 || level == 6 ? 2 : level < 2 ? 0 : level < 6 ? 1 : 3;
+
+    hdr[0] = 0x78;
+    hdr[1] = (unsigned char)(flevel << 6);
+    hdr[1] += 31 - (hdr[0] * 256 + hdr[1]) % 31;
+}
+
+
+static
+void pz_deflate_task(int strip, void *arg) {
+    pz_job *job = (pz_job *)arg;
+    z_stream zs;
+    unsigned char *in, *dict, *chunk;
+    size_t in_len, cap, head;
+    int i0, rows, last = strip == job->nstrips - 1, ret;
+
+    i0 = strip * job->strip_rows;
+    rows = i0 + job->strip_rows < job->ny ? job->strip_rows : job->ny - i0;
+    in = job->filtered + (size_t)i0 * job->rowbytes;
+    in_len = (size_t)rows * job->rowbytes;
+    job->adler[strip] = adler32(adler32(0L, Z_NULL, 0), in, (uInt)in_len);
+
+    memset((void *)&zs, 0, sizeof(z_stream));
+    if (deflateInit2(&zs, job->opts->level, Z_DEFLATED, -15, 8,
+        job->opts->filter == GF_PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED) != Z_OK)
+    {
+        job->err = -2;
+        return;
+    }
+    if (strip > 0) {
+        dict = in - job->filtered > PZ_WINDOW ? in - PZ_WINDOW : job->filtered;
+        deflateSetDictionary(&zs, dict, (uInt)(in - dict));
+    }
+
+    /* Chunk: length, "IDAT", (zlib header,) data, CRC. */
+    head = strip == 0 ? 10 : 8;
+    cap = head + deflateBound(&zs, in_len) + 16;
+    chunk = (unsigned char *)malloc(cap);
+    memcpy(chunk + 4, "IDAT", 4);
+    if (strip == 0)
+        pz_zlib_header(job->opts->level, chunk + 8);
+
+    zs.next_in = in;
+    zs.avail_in = (uInt)in_len;
+    zs.next_out = chunk + head;
+    zs.avail_out = (uInt)(cap - head - 4);
+    for (;;) {
+        ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (ret == Z_STREAM_ERROR || ret == Z_STREAM_END ||
+            (!last && zs.avail_in == 0 && zs.avail_out > 0))
+            break;
+        /* Out of room: not expected within deflateBound, but cheap. */
+        chunk = (unsigned char *)realloc(chunk, 2 * cap);
+        zs.next_out = chunk + head + zs.total_out;
+        zs.avail_out += (uInt)cap;
+        cap *= 2;
+    }
+    if (ret == Z_STREAM_ERROR)
+        job->err = -2;
+
+    job->chunk_len[strip] = head + zs.total_out + 4;
+    pz_put32(chunk, (uLong)(job->chunk_len[strip] - 12));
+    pz_put32(chunk + job->chunk_len[strip] - 4,
+        crc32(0L, chunk + 4, (uInt)(job->chunk_len[strip] - 8)));
+    job->chunks[strip] = chunk;
+    deflateEnd(&zs);
+}
+
+
+/* Write a chunk that is small enough to frame here. */
+static
+void pz_write_chunk(FILE *fp, const char *type, const unsigned char *data, size_t len) {
+    unsigned char buf[4];
+    uLong crc;
+
+    pz_put32(buf, (uLong)len);
+    fwrite(buf, 1, 4, fp);
+    fwrite(type, 1, 4, fp);
+    if (len > 0)
+        fwrite(data, 1, len, fp);
+    crc = crc32(0L, (const Bytef *)type, 4);
+    if (len > 0)
+        crc = crc32(crc, data, (uInt)len);
+    pz_put32(buf, crc);
+    fwrite(buf, 1, 4, fp);
+}
+
+
+int gf_save_png_opts(int nx, int ny, png_byte **data, int stride, int color_type,
+    const gf_png_opts *opts, const char *filename)
+{
+    static const unsigned char sig[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    gf_png_opts defaults;
+    pz_job job;
+    unsigned char ihdr[13], trailer[4];
+    uLong adler;
+    size_t total;
     FILE *fp;
-    png_structp png_ptr;
-    png_infop info_ptr;
+    int k;
+
+    if (opts == NULL) {
+        gf_init_png_opts(&defaults);
+        opts = &defaults;
+    }
+    memset((void *)&job, 0, sizeof(pz_job));
+    job.nx = nx;
+    job.ny = ny;
+    job.rows = data;
+    job.stride = stride;
+    job.bpp = color_type == PNG_COLOR_TYPE_RGBA ? 4 : color_type == PNG_COLOR_TYPE_RGB ? 3 :
+        color_type == PNG_COLOR_TYPE_GRAY_ALPHA ? 2 : 1;
+    if (nx <= 0 || ny <= 0 || stride < job.bpp)
+        return -3;
+    job.rowbytes = 1 + (size_t)nx * job.bpp;
+    job.opts = opts;
+    job.strip_rows = opts->strip_rows > 0 ? opts->strip_rows :
+        (int)(PZ_STRIP_BYTES / job.rowbytes) + 1;
+    job.nstrips = (ny + job.strip_rows - 1) / job.strip_rows;
 
     fp = fopen(filename, "wb");
     if (fp == NULL) {
         return -1;
     }
-    
-    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-        NULL, NULL, NULL);
 
-    if (png_ptr == NULL) {
-        fclose(fp);
-        return -2;
-    }
+    job.filtered = (unsigned char *)malloc((size_t)ny * job.rowbytes);
+    job.chunks = (unsigned char **)calloc(job.nstrips, sizeof(unsigned char *));
+    job.chunk_len = (size_t *)calloc(job.nstrips, sizeof(size_t));
+    job.adler = (uLong *)calloc(job.nstrips, sizeof(uLong));
+    gf_parallel_for(job.nstrips, opts->nthreads, &pz_filter_task, (void *)&job);
+    gf_parallel_for(job.nstrips, opts->nthreads, &pz_deflate_task, (void *)&job);
 
-    info_ptr = png_create_info_struct(png_ptr);
+    pz_put32(ihdr, (uLong)nx);
+    pz_put32(ihdr + 4, (uLong)ny);
+    ihdr[8] = 8;
+    ihdr[9] = (unsigned char)color_type;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    fwrite(sig, 1, 8, fp);
+    pz_write_chunk(fp, "IHDR", ihdr, 13);
 
-    if (!info_ptr) {
-        png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
-        fclose(fp);
-        return -3;
+    adler = job.adler[0];
+    for (k = 0; k < job.nstrips; k++) {
+        if (k > 0) {
+            total = (size_t)(k + 1 < job.nstrips ? job.strip_rows : ny - k * job.strip_rows) *
+                job.rowbytes;
+            adler = adler32_combine(adler, job.adler[k], (z_off_t)total);
+        }
+        if (job.chunks[k] != NULL)
+            fwrite(job.chunks[k], 1, job.chunk_len[k], fp);
+        free(job.chunks[k]);
     }
+    pz_put32(trailer, adler);
+    pz_write_chunk(fp, "IDAT", trailer, 4);
+    pz_write_chunk(fp, "IEND", NULL, 0);
+    if (ferror(fp))
+        job.err = -1;
+    if (fclose(fp) != 0)
+        job.err = -1;
 
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(fp);
-        return -4;
-    }
+    free(job.filtered);
+    free(job.chunks);
+    free(job.chunk_len);
+    free(job.adler);
+    return job.err;
+}
 
-    png_init_io(png_ptr, fp);
-    png_set_IHDR(png_ptr, info_ptr, nx, ny, 8, PNG_COLOR_TYPE_GRAY,
-        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
-        PNG_FILTER_TYPE_DEFAULT);
-    png_set_write_status_fn(png_ptr, &write_row_callback);
 
-    png_write_info(png_ptr, info_ptr);
-    png_write_image(png_ptr, data);
-    png_write_end(png_ptr, info_ptr);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
+int gf_save_png(int nx, int ny, png_byte **data, const char *filename) {
+    return gf_save_png_opts(nx, ny, data, 1, PNG_COLOR_TYPE_GRAY, NULL, filename);
+}
 
-    fclose(fp);
 
-    return 0;
+int gf_save_png_rgba(int nx, int ny, png_byte **data, int alpha, const char *filename) {
+    return gf_save_png_opts(nx, ny, data, 4, alpha ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB,
+        NULL, filename);
 }
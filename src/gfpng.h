@@ -4,6 +4,8 @@
 #include <png.h>
 
 #include "gridfloat.h"
+#include "ramp.h"
+#include "proj.h"
 
 int gf_relief_shade_kernel(
     gf_float nine[][3],
@@ -16,6 +18,149 @@ void gf_relief_shade(
     double *n_sun,
     const char *filename);
 
+/**
+ * PNG row filters, numbered as in the PNG spec. ADAPTIVE tries each on
+ * every row and keeps the one with the smallest sum of absolute
+ * (signed) bytes, as libpng does.
+ */
+typedef enum {
+    GF_PNG_FILTER_NONE = 0,
+    GF_PNG_FILTER_SUB,
+    GF_PNG_FILTER_UP,
+    GF_PNG_FILTER_AVERAGE,
+    GF_PNG_FILTER_PAETH,
+    GF_PNG_FILTER_ADAPTIVE
+} gf_png_filter;
+
+/**
+ * PNG encoder options.
+ *
+ * @level - zlib compression level, 0 (stored) to 9. Default: 6.
+ * @filter - Row filter. Default: ADAPTIVE.
+ * @strip_rows - Rows per independently deflated strip; 0 for about
+ *      128 KiB of pixels each. Smaller strips spread over more threads
+ *      but compress a little worse.
+ * @nthreads - Encoding threads; 0 for gf_num_threads().
+ */
+typedef struct gf_png_opts {
+    int level;
+    gf_png_filter filter;
+    int strip_rows;
+    int nthreads;
+} gf_png_opts;
+
+void gf_init_png_opts(gf_png_opts *opts);
+
+/**
+ * Relief rendering options.
+ *
+ * @n_sun - Unit vector toward the sun (east, north, up).
+ * @shadows - Nonzero to darken pixels in cast shadow (see
+ *      gf_cast_shadows) on top of the Lambertian shading.
+ * @shadow_depth - Fraction of the light taken away in shadow.
+ * @sky_dirs - Azimuths for the sky-view factor (see gf_sky_view); 0
+ *      for none.
+ * @sky_weight - How much the sky-view factor darkens the shading:
+ *      shade * (1 - sky_weight + sky_weight * svf).
+ * @ramp - Hypsometric tint: color each pixel by elevation and shade
+ *      the color, writing an RGB (or RGBA, see gf_color_ramp) image.
+ *      NULL for grayscale.
+ * @tint_shade - How much shading darkens the tint (see gf_tint).
+ * @png - Encoder options; NULL for the defaults.
+ */
+typedef struct gf_relief_opts {
+    const double *n_sun;
+    int shadows;
+    double shadow_depth;
+    int sky_dirs;
+    double sky_weight;
+    const gf_color_ramp *ramp;
+    double tint_shade;
+    const gf_png_opts *png;
+} gf_relief_opts;
+
+void gf_init_relief_opts(gf_relief_opts *opts, const double *n_sun);
+
+int gf_relief_shade_opts(
+    const gf_struct *gf,
+    const gf_grid *to_grid,
+    const gf_relief_opts *opts,
+    const char *filename);
+
+/**
+ * gf_relief_shade_opts onto a projected grid (see proj.h). Shading
+ * and tint are as on a geographic grid; opts->shadows and
+ * opts->sky_dirs are ignored. Returns 0, or nonzero if sampling or
+ * writing fails.
+ */
+int gf_relief_shade_proj(
+    const gf_struct *gf,
+    const gf_proj_grid *pg,
+    const gf_relief_opts *opts,
+    const char *filename);
+
+/**
+ * Unit surface normals of a grid, stored as three float planes so a
+ * shading pass is a straight dot product over contiguous arrays.
+ * Null points have a zero normal and shade black.
+ */
+typedef struct gf_normals {
+    long n;
+    float *x;
+    float *y;
+    float *z;
+    float *elev;    /* Only kept when asked for (for cast shadows) */
+} gf_normals;
+
+/**
+ * One gradient pass over to_grid, kept as normals (and elevations if
+ * keep_elev) for gf_shade_normals. Returns 0, or -1 (with nothing left
+ * to free) if the source could not be read.
+ */
+int gf_compute_normals(const gf_struct *gf, const gf_grid *to_grid, int keep_elev,
+    gf_normals *normals);
+
+void gf_free_normals(gf_normals *normals);
+
+/* Lambertian shade (0-255) of every normal, lit from n_sun. */
+void gf_shade_normals(const gf_normals *normals, const double *n_sun,
+    unsigned char *shade);
+
+/**
+ * Render nframes relief images of the same grid, frame k lit from
+ * n_suns[3k..3k+2], from a single gradient pass. Frame k is written to
+ * filename with "_kkk" inserted before the extension. Frames are
+ * shaded and encoded in parallel. opts->n_sun is ignored. Returns 0,
+ * or -1 if sampling or writing any frame fails.
+ */
+int gf_relief_shade_frames(
+    const gf_struct *gf,
+    const gf_grid *to_grid,
+    int nframes,
+    const double *n_suns,
+    const gf_relief_opts *opts,
+    const char *filename);
+
+/**
+ * Write an 8-bit PNG of the given color type (GRAY, GRAY_ALPHA, RGB or
+ * RGBA) from rows of stride bytes per pixel, of which the first
+ * 1-4 (by color type) are used.
+ *
+ * Rows are filtered and deflated in strips on worker threads, pigz
+ * style: each strip is its own deflate stream, primed with the 32 KiB
+ * before it and ended on a sync flush, so the pieces join into one
+ * valid zlib stream (their Adler-32s combined) and output scales with
+ * cores. Returns 0, or nonzero if the file could not be written.
+ */
+int gf_save_png_opts(int nx, int ny, png_byte **data, int stride, int color_type,
+    const gf_png_opts *opts, const char *filename);
+
 int gf_save_png(int nx, int ny, png_byte **data, const char *filename);
 
+/**
+ * Write rows of 4-byte RGBA pixels as an RGBA PNG, or as RGB (alpha
+ * dropped while encoding) if alpha is 0.
+ */
+int gf_save_png_rgba(int nx, int ny, png_byte **data, int alpha, const char *filename);
+
 #endif
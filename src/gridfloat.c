@@ -1,9 +1,15 @@
 #include "gridfloat.h"
+#include "transpose.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 
 /**
@@ -21,6 +27,27 @@ void gf_init_data(int types, size_t sz, gf_data *data) {
         data->grady = (double *)malloc(sz * sizeof(double));
     if (types & SHADE)
         data->shade = (unsigned char *)malloc(sz * sizeof(unsigned char));
+    if (types & TINT)
+        data->rgba = (unsigned char *)malloc(4 * sz * sizeof(unsigned char));
+}
+
+void gf_free_data(gf_data *data) {
+    free(data->elev);
+    free(data->gradx);
+    free(data->grady);
+    free(data->shade);
+    free(data->rgba);
+    memset((void *)data, 0, sizeof(gf_data));
+}
+
+unsigned char gf_shade(double gradx, double grady, const double *n_sun) {
+    double norm, shade;
+
+    /* Surface normal is (-gradx, -grady, 1) / norm. */
+    norm = sqrt(1.0 + gradx * gradx + grady * grady);
+    shade = (n_sun[2] - n_sun[0] * gradx - n_sun[1] * grady) / norm;
+
+    return (unsigned char)(255.0 * (shade > 0.0 ? shade : 0.0));
 }
 
 
@@ -91,6 +118,47 @@ void gf_cellsize_meters(gf_grid *grid, double *dxm, double *dym) {
     gf_lengths(lat, lng, grid->dy, grid->dx, 0.0, dxm, dym);
 }
 
+/* Snap a (fractional) source-node coordinate to the nearest integer.
+   Returns 0 if it is farther than GF_ALIGN_TOL from one. */
+static
+int gf_snap(double x, long *n) {
+    double r = floor(x + 0.5);
+    *n = (long)r;
+    return fabs(x - r) < GF_ALIGN_TOL;
+}
+
+int gf_grid_aligned(const gf_grid *from_grid, const gf_grid *to_grid,
+    long *ii0, long *jj0, int *si, int *sj)
+{
+    long ki, kj, last;
+
+    if (to_grid->nx < 2 || to_grid->ny < 2)
+        return 0;
+
+    if (!gf_snap(to_grid->dx / from_grid->dx, &kj) || kj < 1 ||
+        !gf_snap(to_grid->dy / from_grid->dy, &ki) || ki < 1)
+        return 0;
+
+    if (!gf_snap((to_grid->left - from_grid->left) / from_grid->dx, jj0) ||
+        !gf_snap((from_grid->top - to_grid->top) / from_grid->dy, ii0))
+        return 0;
+
+    /* The stride error accumulates across the grid; make sure the far
+       edges still land on nodes. */
+    if (!gf_snap((to_grid->left + (to_grid->nx - 1) * to_grid->dx -
+            from_grid->left) / from_grid->dx, &last) ||
+        last != *jj0 + (to_grid->nx - 1) * kj)
+        return 0;
+    if (!gf_snap((from_grid->top - (to_grid->top - (to_grid->ny - 1) *
+            to_grid->dy)) / from_grid->dy, &last) ||
+        last != *ii0 + (to_grid->ny - 1) * ki)
+        return 0;
+
+    *si = (int)ki;
+    *sj = (int)kj;
+    return 1;
+}
+
 int gf_parse_hdr(const char *hdr_file, gf_struct *gf) {
     FILE *fp;
     char line[LINE_BUF];
@@ -98,6 +166,8 @@ int gf_parse_hdr(const char *hdr_file, gf_struct *gf) {
     int result = 0;
     gf_grid *grid = &gf->grid;
 
+    gf->null_value = GF_NULL_VAL;
+
     fp = fopen(hdr_file, "r");
 
     if (fp == NULL) {
@@ -153,9 +223,84 @@ void gf_close(gf_struct *gf) {
     if (gf->flt != NULL) {
         fclose(gf->flt);
     }
+    free(gf->null_blocks);
+    gf->null_blocks = NULL;
+}
+
+/*
+ * Null summary file: a gf_nulls_header, then nbx * nby flags. It is
+ * stamped with the .flt's size and mtime and ignored once they change.
+ */
+#define GF_NULLS_MAGIC "GFNULLS"
+
+typedef struct gf_nulls_header {
+    char magic[8];
+    int32_t nbx;
+    int32_t nby;
+    int64_t flt_size;
+    int64_t flt_sec;
+    int64_t flt_nsec;
+} gf_nulls_header;
+
+/* Summary path for flt_file: its .flt replaced (or followed) by .nul. */
+static
+int gf_nulls_path(const char *flt_file, char *path, size_t size) {
+    size_t len = strlen(flt_file);
+
+    if (len > 4 && strcmp(flt_file + len - 4, ".flt") == 0)
+        len -= 4;
+    if (snprintf(path, size, "%.*s%s", (int)len, flt_file, GF_NULLS_EXT) >= (int)size)
+        return -1;
+    return 0;
+}
+
+static
+void gf_stamp_nulls(int fd, gf_nulls_header *h) {
+    struct stat st;
+
+    memset((void *)h, 0, sizeof(gf_nulls_header));
+    memcpy(h->magic, GF_NULLS_MAGIC, sizeof(GF_NULLS_MAGIC));
+    if (fstat(fd, &st) == 0) {
+        h->flt_size = st.st_size;
+        h->flt_sec = st.st_mtim.tv_sec;
+        h->flt_nsec = st.st_mtim.tv_nsec;
+    }
+}
+
+/* Load the summary saved beside flt_file, if it is there and current. */
+static
+void gf_load_nulls(gf_struct *gf, const char *flt_file) {
+    char path[4096];
+    gf_nulls_header want, got;
+    unsigned char *flags;
+    size_t n;
+    FILE *fp;
+
+    if (gf_nulls_path(flt_file, path, sizeof(path)) != 0 || (fp = fopen(path, "rb")) == NULL)
+        return;
+    gf_stamp_nulls(fileno(gf->flt), &want);
+    want.nbx = (int32_t)((gf->grid.nx + GF_NULL_BLOCK - 1) / GF_NULL_BLOCK);
+    want.nby = (int32_t)((gf->grid.ny + GF_NULL_BLOCK - 1) / GF_NULL_BLOCK);
+    n = (size_t)want.nbx * want.nby;
+
+    if (fread(&got, sizeof(got), 1, fp) == 1 && memcmp(&got, &want, sizeof(got)) == 0 &&
+            (flags = (unsigned char *)malloc(n > 0 ? n : 1)) != NULL) {
+        if (fread(flags, 1, n, fp) == n) {
+            gf->null_blocks = flags;
+            gf->nbx = want.nbx;
+            gf->nby = want.nby;
+        } else {
+            free(flags);
+        }
+    }
+    fclose(fp);
 }
 
 int gf_open(const char *hdr_file, const char *flt_file, gf_struct *gf) {
+    gf->lazy = NULL;
+    gf->null_blocks = NULL;
+    gf->nbx = gf->nby = 0;
+
     if (gf_parse_hdr(hdr_file, gf) != 0) {
         return -1;
     }
@@ -167,68 +312,246 @@ int gf_open(const char *hdr_file, const char *flt_file, gf_struct *gf) {
         return -2;
     }
 
+    gf_load_nulls(gf, flt_file);
     return 0;
 }
 
-int gf_get_line(long ii, long jj_start, long jj_end, const gf_struct *gf, gf_float *line) {
-    fseek(gf->flt, sizeof(gf_float) * (ii * gf->grid.nx + jj_start), SEEK_SET);
-    fread((void *)line, sizeof(gf_float), jj_end - jj_start, gf->flt);
-    return 0;
+/* Descriptor of the .flt, opening a lazy one on first use. Threads
+   racing to open it keep whichever FILE was published first. */
+static
+int gf_flt_fd(const gf_struct *gf) {
+    gf_lazy_flt *lazy = gf->lazy;
+    FILE *fp, *expected = NULL;
+
+    if (gf->flt != NULL)
+        return fileno(gf->flt);
+    if (lazy == NULL)
+        return -1;
+
+    if ((fp = __atomic_load_n(&lazy->fp, __ATOMIC_ACQUIRE)) == NULL) {
+        if ((fp = fopen(lazy->path, "r")) == NULL) {
+            fprintf(stderr, "Grid gf_float file does not exist: '%s'\n", lazy->path);
+            return -1;
+        }
+        if (!__atomic_compare_exchange_n(&lazy->fp, &expected, fp, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            fclose(fp);
+            fp = expected;
+        }
+    }
+    return fileno(fp);
 }
 
+/* Reads with pread(2) on the underlying descriptor, so the FILE
+   position is never touched and concurrent readers are safe. */
+static
+int gf_pread_nodes(long ii, long jj_start, long jj_end, const gf_struct *gf, gf_float *line) {
+    size_t len = (jj_end - jj_start) * sizeof(gf_float), got = 0;
+    off_t off = sizeof(gf_float) * (ii * (off_t)gf->grid.nx + jj_start);
+    ssize_t n;
+    int fd = gf_flt_fd(gf);
 
-void gf_print(const gf_grid *grid, gf_float *data, int xy) {
-    long ni, nj, i, j, k;
-    int c, nc = 1;
-
-    ni = grid->ny;
-    nj = grid->nx;
-    if (xy) {
-        ni = grid->nx;
-        nj = grid->ny;
+    if (fd < 0)
+        return -1;
+    while (got < len) {
+        n = pread(fd, (char *)line + got, len - got, off + got);
+        if (n <= 0)
+            return -1;
+        got += n;
     }
+    return 0;
+}
 
-    //fprintf(stdout, "[");
-    for (i = 0, k = 0; i < ni; ++i) {
-        fprintf(stdout, "[");
-        for (j = 0; j < nj; ++j) {
-            if (nc > 1) {
-                fprintf(stdout, "[");
-            }
-                
-            for (c = 0; c < nc; ++c) {
-                if (xy) {
-                    //fprintf(stdout, "%.12e", data[k++]);
-                    /* i is ix and j is iy */
-                    k = c + nc * (i + ni * (nj - 1 - j));
-                } else {
-                    /* j is ix and i is iy */
-                    k = c + nc * (j + nj * i);
-                }
-                fprintf(stdout, "%.12e", data[k]);
-                    
-                if (c < nc - 1) {
-                    fprintf(stdout, ", ");
-                }
+int gf_get_line(long ii, long jj_start, long jj_end, const gf_struct *gf, gf_float *line) {
+    long jj, run, block_end;
+    const unsigned char *flags;
+    int err = 0;
+    gf_float null_value = gf->null_value;
+
+    if (gf->null_blocks == NULL || ii < 0 || ii >= gf->grid.ny) {
+        err = gf_pread_nodes(ii, jj_start, jj_end, gf, line);
+    } else {
+        /* Read runs of blocks that hold data; fill all-null blocks. */
+        flags = gf->null_blocks + (ii / GF_NULL_BLOCK) * gf->nbx;
+        for (jj = jj_start; jj < jj_end; jj = block_end) {
+            block_end = (jj / GF_NULL_BLOCK + 1) * GF_NULL_BLOCK;
+            if (block_end > jj_end)
+                block_end = jj_end;
+
+            if (jj >= 0 && jj < gf->grid.nx &&
+                (flags[jj / GF_NULL_BLOCK] & GF_BLOCK_ALL_NULL)) {
+                for (run = jj; run < block_end; run++)
+                    line[run - jj_start] = GF_NULL_VAL;
+                continue;
             }
 
-            if (nc > 1) {
-                fprintf(stdout, "]");
+            /* Extend over following blocks that need reading. */
+            while (block_end < jj_end && block_end < gf->grid.nx &&
+                !(flags[block_end / GF_NULL_BLOCK] & GF_BLOCK_ALL_NULL)) {
+                block_end += GF_NULL_BLOCK;
+                if (block_end > jj_end)
+                    block_end = jj_end;
             }
+            if (gf_pread_nodes(ii, jj, block_end, gf, line + (jj - jj_start)) != 0)
+                err = -1;
+        }
+    }
 
-            if (j < nj - 1) {
+    if (null_value != (gf_float)GF_NULL_VAL) {
+        for (jj = 0; jj < jj_end - jj_start; jj++)
+            if (line[jj] == null_value)
+                line[jj] = GF_NULL_VAL;
+    }
+    return err;
+}
+
+void gf_prefetch_line(long ii, long jj_start, long jj_end, const gf_struct *gf) {
+#ifdef POSIX_FADV_WILLNEED
+    int fd;
+
+    if (ii < 0 || ii >= gf->grid.ny || (fd = gf_flt_fd(gf)) < 0)
+        return;
+    posix_fadvise(fd,
+        sizeof(gf_float) * (ii * (off_t)gf->grid.nx + jj_start),
+        sizeof(gf_float) * (jj_end - jj_start), POSIX_FADV_WILLNEED);
+#endif
+}
+
+
+int gf_scan_nulls(gf_struct *gf) {
+    long ii, jj, nx = gf->grid.nx, ny = gf->grid.ny;
+    unsigned char *flags, *f;
+    gf_float *line;
+    int bj;
+
+    gf->nbx = (int)((nx + GF_NULL_BLOCK - 1) / GF_NULL_BLOCK);
+    gf->nby = (int)((ny + GF_NULL_BLOCK - 1) / GF_NULL_BLOCK);
+
+    /* Start every block as all-null with no nulls seen, then clear or
+    set bits as rows stream past. */
+    flags = (unsigned char *)malloc(gf->nbx * gf->nby);
+    memset(flags, GF_BLOCK_ALL_NULL, gf->nbx * gf->nby);
+    line = (gf_float *)malloc(nx * sizeof(gf_float));
+
+    free(gf->null_blocks);
+    gf->null_blocks = NULL;
+
+    for (ii = 0; ii < ny; ii++) {
+        if (gf_pread_nodes(ii, 0, nx, gf, line) != 0) {
+            free(line);
+            free(flags);
+            return -1;
+        }
+
+        f = flags + (ii / GF_NULL_BLOCK) * gf->nbx;
+        for (jj = 0; jj < nx; jj++) {
+            bj = (int)(jj / GF_NULL_BLOCK);
+            if (line[jj] == gf->null_value)
+                f[bj] |= GF_BLOCK_ANY_NULL;
+            else
+                f[bj] &= ~GF_BLOCK_ALL_NULL;
+        }
+    }
+
+    free(line);
+    gf->null_blocks = flags;
+    return 0;
+}
+
+int gf_save_nulls(const gf_struct *gf, const char *flt_file) {
+    char path[4096];
+    gf_nulls_header h;
+    size_t n = (size_t)gf->nbx * gf->nby;
+    FILE *fp;
+    int fd, err = 0;
+
+    if (gf->null_blocks == NULL || (fd = gf_flt_fd(gf)) < 0 ||
+            gf_nulls_path(flt_file, path, sizeof(path)) != 0)
+        return -1;
+    gf_stamp_nulls(fd, &h);
+    h.nbx = gf->nbx;
+    h.nby = gf->nby;
+
+    if ((fp = fopen(path, "wb")) == NULL)
+        return -1;
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 || fwrite(gf->null_blocks, 1, n, fp) != n)
+        err = -1;
+    if (fclose(fp) != 0)
+        err = -1;
+    if (err != 0)
+        unlink(path);
+    return err;
+}
+
+int gf_block_flags(const gf_struct *gf, long ii, long jj) {
+    if (gf->null_blocks == NULL || ii < 0 || jj < 0 ||
+        ii >= gf->grid.ny || jj >= gf->grid.nx)
+        return 0;
+    return gf->null_blocks[(ii / GF_NULL_BLOCK) * gf->nbx + jj / GF_NULL_BLOCK];
+}
+
+int gf_fill_nulls_3x3(gf_float nine[][3]) {
+    int r, c;
+    gf_float center = nine[1][1], opp;
+
+    if (center == (gf_float)GF_NULL_VAL)
+        return 0;
+
+    for (r = 0; r < 3; r++) {
+        for (c = 0; c < 3; c++) {
+            if (nine[r][c] != (gf_float)GF_NULL_VAL)
+                continue;
+            /* Two null opposites both end up at the center. */
+            opp = nine[2 - r][2 - c];
+            nine[r][c] = opp == (gf_float)GF_NULL_VAL ? center : 2 * center - opp;
+        }
+    }
+    return 1;
+}
+
+
+/* Columns transposed at a time by gf_print -T. */
+#define PRINT_BAND 64
+
+/* Print a row-major nrows x ncols array, one bracketed row per line. */
+static
+void gf_print_array(const gf_float *data, long nrows, long ncols) {
+    long i, j;
+
+    for (i = 0; i < nrows; ++i, data += ncols) {
+        fprintf(stdout, "[");
+        for (j = 0; j < ncols; ++j) {
+            fprintf(stdout, "%.12e", data[j]);
+            if (j < ncols - 1) {
                 fprintf(stdout, ", ");
             }
         }
         fprintf(stdout, "]\n");
-/*
-        fprintf(stdout, "]");
-        if (i < ny - 1) {
-            fprintf(stdout, ", ");
-        }
-*/
     }
-    //fprintf(stdout, "]");
+}
+
+void gf_print(const gf_grid *grid, gf_float *data, int xy) {
+    gf_float *band;
+    long j0, nb;
+
+    if (!xy) {
+        gf_print_array(data, grid->ny, grid->nx);
+        return;
+    }
+
+    /* Row ix is column ix, bottom first: transpose a band of columns
+    at a time rather than striding a full row per element. */
+    band = (gf_float *)malloc(PRINT_BAND * (long)grid->ny * sizeof(gf_float));
+    for (j0 = 0; j0 < grid->nx; j0 += PRINT_BAND) {
+        nb = grid->nx - j0 < PRINT_BAND ? grid->nx - j0 : PRINT_BAND;
+        gf_transpose_flip(data + j0, grid->nx, grid->ny, (int)nb, band, grid->ny);
+        gf_print_array(band, nb, grid->ny);
+    }
+    free(band);
+}
+
+void gf_print_xy(const gf_grid *grid, gf_float *data) {
+    gf_print_array(data, grid->nx, grid->ny);
 }
 
 int gf_write_hdr(gf_grid *grid, const char *filename) {
@@ -8,6 +8,20 @@
 
 #define GF_NULL_VAL -9999.0
 
+/* Tolerance (in source cells) within which two grids are considered
+   to share nodes. See gf_grid_aligned. */
+#define GF_ALIGN_TOL 1e-6
+
+/* Side (in nodes) of the square blocks summarized by gf_scan_nulls. */
+#define GF_NULL_BLOCK 64
+
+/* Saved null summaries sit beside the .flt with this extension. */
+#define GF_NULLS_EXT ".nul"
+
+/* Per-block NODATA summary flags. */
+#define GF_BLOCK_ANY_NULL 1
+#define GF_BLOCK_ALL_NULL 2
+
 #define ERR_RET(op, err, msg) if (((err) = (op)) != 0) { \
     fprintf(stderr, "%s: %s\n", __func__, msg); return err; }
 
@@ -17,17 +31,27 @@ typedef struct gf_data {
     double *gradx;
     double *grady;
     unsigned char *shade;
+    unsigned char *rgba;    /* 4 bytes per point */
 } gf_data;
 
 typedef enum {
     ELEVATION = 001,
     GRADX = 002,
     GRADY = 004,
-    SHADE = 010
+    SHADE = 010,
+    TINT = 020      /* Shaded ramp color (RGBA) */
 } gf_data_t;
 
 void gf_init_data(int types, size_t sz, gf_data *data);
 
+void gf_free_data(gf_data *data);
+
+/**
+ * Lambertian shade (0-255) of a surface with the given gradient
+ * (dz/dx, dz/dy in meters per meter) lit from unit direction n_sun.
+ */
+unsigned char gf_shade(double gradx, double grady, const double *n_sun);
+
 
 typedef float gf_float;
 
@@ -70,6 +94,17 @@ typedef struct gf_grid {
     double top;
 } gf_grid;
 
+/**
+ * A .flt opened on first read rather than up front, shared by every
+ * copy of the gf_structs pointing at it. Databases opened from a
+ * catalog (see catalog.h) hold one per tile, so tiles never read cost
+ * no file descriptor.
+ */
+typedef struct gf_lazy_flt {
+    const char *path;
+    FILE *fp;
+} gf_lazy_flt;
+
 /**
  * The master struct. Represents a gridfloat data/header
  * pair. Holds (most importantly) a grid and a pointer
@@ -82,6 +117,11 @@ typedef struct gf_struct {
     gf_float null_value;
     char byte_order[64];
     FILE *flt;         /* Descriptor for .flt file */
+    gf_lazy_flt *lazy; /* Read through this instead when flt is NULL */
+    unsigned char *null_blocks; /* GF_BLOCK_* flags per block, row-major,
+                                   or NULL (see gf_scan_nulls) */
+    int nbx;           /* Blocks across */
+    int nby;           /* Blocks down */
 } gf_struct;
 
 /**
@@ -93,20 +133,84 @@ void gf_init_grid_point(gf_grid *grid, double lat, double lng, double width, dou
 
 void gf_init_grid_bounds(gf_grid *grid, double left, double right, double bottom, double top, int nlat, int nlng);
 
-void gf_lengths(double lat, double lng, double dlat, double dlng, double ecc, double *dy, double *dx);
+void gf_lengths(double lat, double lng, double dlat, double dlng, double ecc, double *dx, double *dy);
 
 void gf_cellsize_meters(gf_grid *grid, double *dxm, double *dym);
 
+/**
+ * Check whether every node of to_grid lands on a node of from_grid
+ * (to within GF_ALIGN_TOL of a source cell). This is the case for
+ * pure crops (same cellsize) and integer decimations.
+ *
+ * @param ii0 (out) Source row under the top row of to_grid.
+ * @param jj0 (out) Source column under the left column of to_grid.
+ * @param si (out) Source rows per to_grid row (>= 1).
+ * @param sj (out) Source columns per to_grid column (>= 1).
+ *
+ * Returns 1 if aligned, 0 otherwise.
+ */
+int gf_grid_aligned(const gf_grid *from_grid, const gf_grid *to_grid,
+    long *ii0, long *jj0, int *si, int *sj);
+
 int gf_parse_hdr(const char *hdr_file, gf_struct *gf);
 
 int gf_open(const char *hdr_file, const char *flt_file, gf_struct *gf);
 
 void gf_close(gf_struct *gf);
 
+/**
+ * Read source row ii, columns [jj_start, jj_end), into line. NODATA
+ * values come back as GF_NULL_VAL whatever the header's NODATA_value,
+ * so kernels only ever test for GF_NULL_VAL. Blocks that the null
+ * summary (if any) marks as all-null are filled without any I/O.
+ */
 int gf_get_line(long ii, long jj_start, long jj_end, const gf_struct *gf, gf_float *line);
 
+/* Hint that a gf_get_line of the same arguments is coming soon. */
+void gf_prefetch_line(long ii, long jj_start, long jj_end, const gf_struct *gf);
+
+/**
+ * Build the per-block NODATA summary with one sequential pass over the
+ * .flt. Afterwards gf_get_line fills blocks that hold nothing but
+ * NODATA without reading them, and gf_stencil_run skips the kernel for
+ * windows inside such blocks. The scan costs a full read; save the
+ * result with gf_save_nulls so later opens get it for free.
+ */
+int gf_scan_nulls(gf_struct *gf);
+
+/**
+ * Write the summary (see gf_scan_nulls) beside flt_file, with
+ * GF_NULLS_EXT for its .flt, stamped with the .flt's size and mtime.
+ * gf_open loads it back, with one small read, for as long as the .flt
+ * is unchanged. Returns 0, or -1 if there is no summary or it could not
+ * be written.
+ */
+int gf_save_nulls(const gf_struct *gf, const char *flt_file);
+
+/* Summary flags for the block containing node (ii, jj), or 0 if
+   there is no summary. */
+int gf_block_flags(const gf_struct *gf, long ii, long jj);
+
+/**
+ * NODATA handling for a 3x3 stencil. Returns 0 if the center is null.
+ * Otherwise replaces each null neighbor by reflecting its opposite
+ * through the center (or by the center if the opposite is null too),
+ * which keeps one-sided slopes at coastlines, and returns 1.
+ */
+int gf_fill_nulls_3x3(gf_float nine[][3]);
+
+/**
+ * Print data (top row first) as one bracketed row per line, or with
+ * xy nonzero, one row per column of the grid (bottom first).
+ */
 void gf_print(const gf_grid *grid, gf_float *data, int xy);
 
+/**
+ * Print data already in the xy layout of gf_print (see
+ * gf_bilinear_interpolate_xy).
+ */
+void gf_print_xy(const gf_grid *grid, gf_float *data);
+
 int gf_write_hdr(gf_grid *grid, const char *filename);
 
 void gf_save(gf_grid *grid, gf_float *data, const char *prefix);
@@ -0,0 +1,1076 @@
+#include "hydro.h"
+#include "pool.h"
+#include "radix.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define HY_NONE 255     /* No direction (flood seeds) */
+#define HY_SKIP -2      /* Label of halo and NODATA cells */
+#define HY_UNSET -1     /* Label of cells not reached yet */
+
+/* D8 neighbor k has code 1 << k, starting east and turning clockwise. */
+static const int hy_di[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+static const int hy_dj[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+#define HY_OPPOSITE(k) (((k) + 4) & 7)
+
+
+/* How the grid is cut into tiles: tile (tx, ty) spans rows
+   [row0[ty], row0[ty + 1]) and columns [col0[tx], col0[tx + 1]). */
+typedef struct hy_layout {
+    const gf_grid *grid;
+    int ntx;
+    int nty;
+    long *row0;
+    long *col0;
+} hy_layout;
+
+
+/* One tile in memory, with a one-node halo (NODATA off the grid). */
+typedef struct hy_work {
+    long ii0;
+    long jj0;
+    int nx;
+    int ny;
+    int w;              /* Row stride, nx + 2 */
+    int off[8];         /* Index offsets of the D8 neighbors */
+    float *elev;
+    float *fill;
+    int *label;
+    unsigned char *dir; /* Toward the flood parent */
+    int *fifo;
+    gf_radix_heap heap;
+} hy_work;
+
+
+/* Adjacent cells of two watersheds; dir goes from ca to cb. */
+typedef struct hy_contact {
+    int a;
+    int b;
+    float w;
+    int ca;
+    int cb;
+    unsigned char dir;
+} hy_contact;
+
+
+/* What the merge keeps of a tile: its perimeter and spill edges. */
+typedef struct hy_tile {
+    long base;          /* Node of label L is base + L (L > 0) */
+    int nperim;
+    float *perim_elev;
+    unsigned char *perim_ocean;
+    hy_contact *contacts;
+    int ncontacts;
+} hy_tile;
+
+
+/* Spillover graph edge, as seen from the node whose list holds it. */
+typedef struct hy_adj {
+    long node;
+    float w;
+    int cell;           /* Cell of the other node, in its tile */
+    unsigned char dir;  /* From that cell toward this node's cell */
+} hy_adj;
+
+
+typedef struct hy_graph {
+    long nnodes;
+    long *start;        /* CSR offsets, nnodes + 1 */
+    long *pos;
+    hy_adj *adj;        /* NULL while counting degrees */
+} hy_graph;
+
+
+typedef struct hy_job {
+    const gf_struct *gf;
+    const gf_struct *filled;
+    hy_layout layout;
+    hy_tile *tiles;
+    const float *level;
+    const int *exit_cell;
+    const unsigned char *exit_dir;
+    int fill_fd;
+    int dir_fd;
+    int failed;
+} hy_job;
+
+
+void gf_init_hydro_opts(gf_hydro_opts *opts) {
+    opts->tile_size = 1024;
+    opts->nthreads = 0;
+}
+
+
+static
+void hy_init_layout(hy_layout *l, const gf_grid *grid, int size) {
+    int k;
+
+    l->grid = grid;
+    l->nty = (grid->ny + size - 1) / size;
+    l->ntx = (grid->nx + size - 1) / size;
+    l->row0 = (long *)malloc((l->nty + 1) * sizeof(long));
+    l->col0 = (long *)malloc((l->ntx + 1) * sizeof(long));
+    for (k = 0; k <= l->nty; k++)
+        l->row0[k] = (long)grid->ny * k / l->nty;
+    for (k = 0; k <= l->ntx; k++)
+        l->col0[k] = (long)grid->nx * k / l->ntx;
+}
+
+
+static
+void hy_free_layout(hy_layout *l) {
+    free(l->row0);
+    free(l->col0);
+}
+
+
+/* Index of the tile span holding x. */
+static
+int hy_span(const long *start, int n, long total, long x) {
+    int k = (int)(x * n / total);
+
+    while (start[k] > x)
+        k--;
+    while (start[k + 1] <= x)
+        k++;
+    return k;
+}
+
+
+static
+void hy_tile_extent(const hy_layout *l, int t, long *ii0, long *jj0, int *ny, int *nx) {
+    int tx = t % l->ntx, ty = t / l->ntx;
+
+    *ii0 = l->row0[ty];
+    *jj0 = l->col0[tx];
+    *ny = (int)(l->row0[ty + 1] - *ii0);
+    *nx = (int)(l->col0[tx + 1] - *jj0);
+}
+
+
+/* Perimeter cells are numbered along the top row, the bottom row,
+   then down the left and right columns. */
+static
+int hy_perim_count(int nx, int ny) {
+    if (ny == 1)
+        return nx;
+    if (nx == 1)
+        return ny;
+    return 2 * nx + 2 * (ny - 2);
+}
+
+
+static
+int hy_perim_index(int nx, int ny, int i, int j) {
+    if (i == 0)
+        return j;
+    if (i == ny - 1)
+        return nx + j;
+    if (j == 0)
+        return 2 * nx + i - 1;
+    if (j == nx - 1)
+        return 2 * nx + ny - 2 + i - 1;
+    return -1;
+}
+
+
+static
+void hy_perim_cell(int nx, int ny, int k, int *i, int *j) {
+    if (ny == 1 || k < nx) {
+        *i = 0;
+        *j = k;
+    } else if (k < 2 * nx) {
+        *i = ny - 1;
+        *j = k - nx;
+    } else if (k < 2 * nx + ny - 2) {
+        *i = k - 2 * nx + 1;
+        *j = 0;
+    } else {
+        *i = k - 2 * nx - (ny - 2) + 1;
+        *j = nx - 1;
+    }
+}
+
+
+static
+void hy_init_work(hy_work *wk, const hy_layout *l, int t) {
+    long n;
+    int k;
+
+    hy_tile_extent(l, t, &wk->ii0, &wk->jj0, &wk->ny, &wk->nx);
+    wk->w = wk->nx + 2;
+    for (k = 0; k < 8; k++)
+        wk->off[k] = hy_di[k] * wk->w + hy_dj[k];
+    n = (long)wk->w * (wk->ny + 2);
+    wk->elev = (float *)malloc(n * sizeof(float));
+    wk->fill = (float *)malloc(n * sizeof(float));
+    wk->label = (int *)malloc(n * sizeof(int));
+    wk->dir = (unsigned char *)malloc(n);
+    wk->fifo = (int *)malloc(n * sizeof(int));
+    gf_init_radix_heap(&wk->heap);
+}
+
+
+static
+void hy_free_work(hy_work *wk) {
+    free(wk->elev);
+    free(wk->fill);
+    free(wk->label);
+    free(wk->dir);
+    free(wk->fifo);
+    gf_free_radix_heap(&wk->heap);
+}
+
+
+/* Read the tile and its halo into buf, NODATA off the grid. */
+static
+int hy_load(const gf_struct *gf, const hy_work *wk, float *buf) {
+    long i, j, ii, jj_lo, jj_hi, nx = gf->grid.nx;
+    float *row;
+    int err = 0;
+
+    for (i = 0; i < wk->ny + 2; i++) {
+        row = buf + i * wk->w;
+        ii = wk->ii0 + i - 1;
+        jj_lo = wk->jj0 > 0 ? wk->jj0 - 1 : 0;
+        jj_hi = wk->jj0 + wk->nx + 1 < nx ? wk->jj0 + wk->nx + 1 : nx;
+        for (j = 0; j < wk->w; j++)
+            row[j] = GF_NULL_VAL;
+        if (ii >= 0 && ii < gf->grid.ny &&
+                gf_get_line(ii, jj_lo, jj_hi, gf, row + (jj_lo - wk->jj0 + 1)) != 0)
+            err = -1;
+    }
+    return err;
+}
+
+
+/* Write the tile's interior rows (stride w, offset by the halo). */
+static
+int hy_store(int fd, long grid_nx, const hy_work *wk, const float *buf) {
+    size_t len = wk->nx * sizeof(float);
+    off_t off;
+    long i;
+
+    for (i = 0; i < wk->ny; i++) {
+        off = ((off_t)(wk->ii0 + i) * grid_nx + wk->jj0) * sizeof(float);
+        if (pwrite(fd, buf + (i + 1) * wk->w + 1, len, off) != (ssize_t)len)
+            return -1;
+    }
+    return 0;
+}
+
+
+/* Read back what hy_store wrote, leaving the halo alone. */
+static
+int hy_fetch(int fd, long grid_nx, const hy_work *wk, float *buf) {
+    size_t len = wk->nx * sizeof(float);
+    off_t off;
+    long i;
+
+    for (i = 0; i < wk->ny; i++) {
+        off = ((off_t)(wk->ii0 + i) * grid_nx + wk->jj0) * sizeof(float);
+        if (pread(fd, buf + (i + 1) * wk->w + 1, len, off) != (ssize_t)len)
+            return -1;
+    }
+    return 0;
+}
+
+
+static
+int hy_create(const gf_grid *grid, const char *prefix) {
+    char filename[2048];
+    gf_grid g = *grid;
+    int fd;
+
+    snprintf(filename, sizeof(filename), "%s.hdr", prefix);
+    if (gf_write_hdr(&g, filename) != 0)
+        return -1;
+    snprintf(filename, sizeof(filename), "%s.flt", prefix);
+    fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && ftruncate(fd, (off_t)grid->nx * grid->ny * sizeof(float)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static
+void hy_push(hy_work *wk, int p) {
+    gf_radix_push(&wk->heap, gf_radix_key_float(wk->elev[p]), p);
+}
+
+
+static
+void hy_add_contact(hy_contact **c, int *n, int *cap, int a, int b, float w,
+    int ca, int cb, int dir)
+{
+    if (*n == *cap) {
+        *cap = *cap ? 2 * *cap : 256;
+        *c = (hy_contact *)realloc(*c, *cap * sizeof(hy_contact));
+    }
+    (*c)[*n].a = a;
+    (*c)[*n].b = b;
+    (*c)[*n].w = w;
+    (*c)[*n].ca = ca;
+    (*c)[*n].cb = cb;
+    (*c)[*n].dir = (unsigned char)dir;
+    (*n)++;
+}
+
+
+/**
+ * Priority-flood the tile from its perimeter. Cells next to NODATA
+ * (or the edge of the grid) drain there and are labeled 0, the
+ * outside; every other perimeter cell labels its own watershed. Each
+ * cell gets the label and fill level of the cell that reached it and
+ * a direction back toward it. If contacts is not NULL, every pair of
+ * adjacent cells from different watersheds is recorded with the level
+ * water must reach to cross between them.
+ */
+static
+void hy_flood(hy_work *wk, hy_contact **contacts, int *ncontacts) {
+    long n = (long)wk->w * (wk->ny + 2);
+    int head = 0, tail = 0, cap = 0, p, q, k, i, j, lp, perim;
+    uint64_t key;
+    long val;
+
+    for (p = 0; p < n; p++) {
+        wk->fill[p] = wk->elev[p];
+        wk->dir[p] = HY_NONE;
+        wk->label[p] = HY_SKIP;
+    }
+    for (i = 1; i <= wk->ny; i++)
+        for (j = 1; j <= wk->nx; j++)
+            if (wk->elev[i * wk->w + j] != GF_NULL_VAL)
+                wk->label[i * wk->w + j] = HY_UNSET;
+
+    for (i = 1; i <= wk->ny; i++) {
+        for (j = 1; j <= wk->nx; j++) {
+            p = i * wk->w + j;
+            if (wk->label[p] != HY_UNSET)
+                continue;
+            for (k = 0; k < 8 && wk->elev[p + wk->off[k]] != GF_NULL_VAL; k++)
+                ;
+            perim = hy_perim_index(wk->nx, wk->ny, i - 1, j - 1);
+            if (k < 8) {
+                wk->label[p] = 0;
+                wk->dir[p] = (unsigned char)k;
+                hy_push(wk, p);
+            } else if (perim >= 0) {
+                wk->label[p] = 1 + perim;
+                hy_push(wk, p);
+            }
+        }
+    }
+
+    if (contacts != NULL)
+        *ncontacts = 0;
+    for (;;) {
+        if (head < tail)
+            p = wk->fifo[head++];
+        else if (gf_radix_pop(&wk->heap, &key, &val))
+            p = (int)val;
+        else
+            break;
+
+        lp = wk->label[p];
+        for (k = 0; k < 8; k++) {
+            q = p + wk->off[k];
+            if (wk->label[q] == HY_UNSET) {
+                wk->label[q] = lp;
+                wk->dir[q] = HY_OPPOSITE(k);
+                if (wk->elev[q] <= wk->fill[p]) {
+                    wk->fill[q] = wk->fill[p];
+                    wk->fifo[tail++] = q;
+                } else {
+                    hy_push(wk, q);
+                }
+            } else if (contacts != NULL && wk->label[q] > lp) {
+                hy_add_contact(contacts, ncontacts, &cap, lp, wk->label[q],
+                    wk->fill[p] > wk->fill[q] ? wk->fill[p] : wk->fill[q], p, q, k);
+            }
+        }
+    }
+}
+
+
+static
+int hy_cmp_contact(const void *a, const void *b) {
+    const hy_contact *x = (const hy_contact *)a, *y = (const hy_contact *)b;
+
+    if (x->a != y->a)
+        return x->a < y->a ? -1 : 1;
+    if (x->b != y->b)
+        return x->b < y->b ? -1 : 1;
+    return (x->w > y->w) - (x->w < y->w);
+}
+
+
+/* Pass 1: flood one tile and keep its perimeter and lowest spills. */
+static
+void hy_watershed_task(int t, void *arg) {
+    hy_job *job = (hy_job *)arg;
+    hy_tile *tile = job->tiles + t;
+    hy_work wk;
+    int k, i, j, n;
+
+    hy_init_work(&wk, &job->layout, t);
+    if (hy_load(job->gf, &wk, wk.elev) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    hy_flood(&wk, &tile->contacts, &tile->ncontacts);
+
+    if (tile->ncontacts > 0) {
+        qsort(tile->contacts, tile->ncontacts, sizeof(hy_contact), &hy_cmp_contact);
+        for (k = 1, n = 1; k < tile->ncontacts; k++)
+            if (tile->contacts[k].a != tile->contacts[n - 1].a ||
+                    tile->contacts[k].b != tile->contacts[n - 1].b)
+                tile->contacts[n++] = tile->contacts[k];
+        tile->ncontacts = n;
+        tile->contacts = (hy_contact *)realloc(tile->contacts, n * sizeof(hy_contact));
+    }
+
+    tile->nperim = hy_perim_count(wk.nx, wk.ny);
+    tile->perim_elev = (float *)malloc(tile->nperim * sizeof(float));
+    tile->perim_ocean = (unsigned char *)malloc(tile->nperim);
+    for (k = 0; k < tile->nperim; k++) {
+        hy_perim_cell(wk.nx, wk.ny, k, &i, &j);
+        tile->perim_elev[k] = wk.elev[(i + 1) * wk.w + j + 1];
+        tile->perim_ocean[k] = wk.label[(i + 1) * wk.w + j + 1] == 0;
+    }
+    hy_free_work(&wk);
+}
+
+
+static
+long hy_node(const hy_tile *tile, int label) {
+    return label == 0 ? 0 : tile->base + label;
+}
+
+
+/* Count (adj NULL) or store an edge between cell cu of u and cv of v. */
+static
+void hy_add_edge(hy_graph *g, long u, long v, float w, int cu, int cv, int dir) {
+    hy_adj *e;
+
+    if (g->adj == NULL) {
+        g->start[u + 1]++;
+        g->start[v + 1]++;
+        return;
+    }
+    e = g->adj + g->pos[u]++;
+    e->node = v;
+    e->w = w;
+    e->cell = cv;
+    e->dir = HY_OPPOSITE(dir);
+    e = g->adj + g->pos[v]++;
+    e->node = u;
+    e->w = w;
+    e->cell = cu;
+    e->dir = (unsigned char)dir;
+}
+
+
+/**
+ * Spill edges within tiles, plus one edge per pair of adjacent
+ * perimeter cells in different tiles, weighted by the higher of the
+ * two (each is its own watershed's seed, so it sits at its own
+ * elevation).
+ */
+static
+void hy_edges(const hy_job *job, hy_graph *g) {
+    const hy_layout *l = &job->layout;
+    const hy_tile *tile, *other;
+    const hy_contact *c;
+    long ii0, jj0, ii1, jj1, ii, jj;
+    int t, u, k, d, i, j, nx, ny, i1, j1, nx1, ny1, k1;
+    float e0, e1;
+
+    for (t = 0; t < l->ntx * l->nty; t++) {
+        tile = job->tiles + t;
+        hy_tile_extent(l, t, &ii0, &jj0, &ny, &nx);
+
+        for (k = 0; k < tile->ncontacts; k++) {
+            c = tile->contacts + k;
+            hy_add_edge(g, hy_node(tile, c->a), hy_node(tile, c->b), c->w,
+                c->ca, c->cb, c->dir);
+        }
+
+        for (k = 0; k < tile->nperim; k++) {
+            if ((e0 = tile->perim_elev[k]) == GF_NULL_VAL)
+                continue;
+            hy_perim_cell(nx, ny, k, &i, &j);
+            for (d = 0; d < 8; d++) {
+                ii = ii0 + i + hy_di[d];
+                jj = jj0 + j + hy_dj[d];
+                if (ii < 0 || ii >= l->grid->ny || jj < 0 || jj >= l->grid->nx ||
+                        (ii >= ii0 && ii < ii0 + ny && jj >= jj0 && jj < jj0 + nx))
+                    continue;
+                u = hy_span(l->row0, l->nty, l->grid->ny, ii) * l->ntx +
+                    hy_span(l->col0, l->ntx, l->grid->nx, jj);
+                if (u < t)
+                    continue;
+                other = job->tiles + u;
+                hy_tile_extent(l, u, &ii1, &jj1, &ny1, &nx1);
+                i1 = (int)(ii - ii1);
+                j1 = (int)(jj - jj1);
+                k1 = hy_perim_index(nx1, ny1, i1, j1);
+                if ((e1 = other->perim_elev[k1]) == GF_NULL_VAL)
+                    continue;
+                if (tile->perim_ocean[k] && other->perim_ocean[k1])
+                    continue;
+                hy_add_edge(g, hy_node(tile, tile->perim_ocean[k] ? 0 : 1 + k),
+                    hy_node(other, other->perim_ocean[k1] ? 0 : 1 + k1),
+                    e0 > e1 ? e0 : e1,
+                    (i + 1) * (nx + 2) + j + 1, (i1 + 1) * (nx1 + 2) + j1 + 1, d);
+            }
+        }
+    }
+}
+
+
+/**
+ * Flood the spillover graph from the outside (node 0). Each node's
+ * level is the lowest water level that lets it drain out; its exit is
+ * the cell (in its own tile) and direction of the edge it drains by.
+ */
+static
+void hy_solve(const hy_graph *g, float *level, int *exit_cell, unsigned char *exit_dir) {
+    gf_radix_heap heap;
+    unsigned char *done;
+    const hy_adj *e;
+    uint64_t key;
+    long u, k;
+    float nl;
+
+    done = (unsigned char *)calloc(g->nnodes, 1);
+    for (u = 0; u < g->nnodes; u++) {
+        level[u] = INFINITY;
+        exit_cell[u] = -1;
+        exit_dir[u] = HY_NONE;
+    }
+    level[0] = -INFINITY;
+
+    gf_init_radix_heap(&heap);
+    gf_radix_push(&heap, gf_radix_key_float(level[0]), 0);
+    while (gf_radix_pop(&heap, &key, &u)) {
+        if (done[u])
+            continue;
+        done[u] = 1;
+        for (k = g->start[u]; k < g->start[u + 1]; k++) {
+            e = g->adj + k;
+            if (done[e->node])
+                continue;
+            nl = level[u] > e->w ? level[u] : e->w;
+            if (nl < level[e->node]) {
+                level[e->node] = nl;
+                exit_cell[e->node] = e->cell;
+                exit_dir[e->node] = e->dir;
+                gf_radix_push(&heap, gf_radix_key_float(nl), e->node);
+            }
+        }
+    }
+    gf_free_radix_heap(&heap);
+    free(done);
+}
+
+
+/**
+ * Pass 2: flood the tile again, raise each watershed to its level and
+ * turn its flood tree around so it drains through its exit rather
+ * than back to its seed.
+ */
+static
+void hy_fill_task(int t, void *arg) {
+    hy_job *job = (hy_job *)arg;
+    const hy_tile *tile = job->tiles + t;
+    hy_work wk;
+    long g;
+    int p, q, label, d, od, i, j;
+    float lv;
+
+    hy_init_work(&wk, &job->layout, t);
+    if (hy_load(job->gf, &wk, wk.elev) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    hy_flood(&wk, NULL, NULL);
+
+    for (label = 1; label <= tile->nperim; label++) {
+        g = hy_node(tile, label);
+        p = job->exit_cell[g];
+        if (p < 0 || wk.label[p] != label)
+            continue;
+        d = job->exit_dir[g];
+        for (;;) {
+            od = wk.dir[p];
+            wk.dir[p] = (unsigned char)d;
+            if (od == HY_NONE)
+                break;
+            q = p + wk.off[od];
+            d = HY_OPPOSITE(od);
+            p = q;
+        }
+    }
+
+    for (i = 1; i <= wk.ny; i++) {
+        for (j = 1; j <= wk.nx; j++) {
+            p = i * wk.w + j;
+            if (wk.label[p] < 0) {
+                wk.fill[p] = wk.elev[p] = GF_NULL_VAL;
+                continue;
+            }
+            if (wk.label[p] > 0) {
+                lv = job->level[hy_node(tile, wk.label[p])];
+                if (lv > wk.fill[p] && lv < INFINITY)
+                    wk.fill[p] = lv;
+            }
+            wk.elev[p] = wk.dir[p] == HY_NONE ? 0.0f : (float)(1 << wk.dir[p]);
+        }
+    }
+
+    if (hy_store(job->fill_fd, job->gf->grid.nx, &wk, wk.fill) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    if (job->dir_fd >= 0 && hy_store(job->dir_fd, job->gf->grid.nx, &wk, wk.elev) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    hy_free_work(&wk);
+}
+
+
+static
+int hy_code_dir(float code) {
+    int k;
+
+    for (k = 0; k < 8; k++)
+        if (code == (float)(1 << k))
+            return k;
+    return -1;
+}
+
+
+/**
+ * Pass 3: where the filled surface has a lower neighbor, point down
+ * the steepest drop instead. Every such step goes strictly down, so
+ * together with the flood trees (which never go up) no cycle forms.
+ */
+static
+void hy_steepest_task(int t, void *arg) {
+    hy_job *job = (hy_job *)arg;
+    const gf_grid *grid = &job->gf->grid;
+    hy_work wk;
+    double dx_m, dy_m, dist[8], drop, best;
+    float *codes;
+    int p, k, kbest, i, j;
+
+    hy_init_work(&wk, &job->layout, t);
+    codes = wk.fill;
+    if (hy_load(job->filled, &wk, wk.elev) != 0 || hy_fetch(job->dir_fd, grid->nx, &wk, codes) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+
+    gf_lengths(grid->top - (wk.ii0 + 0.5 * wk.ny) * grid->dy, grid->left,
+        grid->dy, grid->dx, 0.0, &dx_m, &dy_m);
+    for (k = 0; k < 8; k++)
+        dist[k] = sqrt(hy_di[k] * hy_di[k] * dy_m * dy_m + hy_dj[k] * hy_dj[k] * dx_m * dx_m);
+
+    for (i = 1; i <= wk.ny; i++) {
+        for (j = 1; j <= wk.nx; j++) {
+            p = i * wk.w + j;
+            if (wk.elev[p] == GF_NULL_VAL)
+                continue;
+            best = 0.0;
+            kbest = -1;
+            for (k = 0; k < 8; k++) {
+                if (wk.elev[p + wk.off[k]] == GF_NULL_VAL)
+                    continue;
+                drop = (wk.elev[p] - wk.elev[p + wk.off[k]]) / dist[k];
+                if (drop > best) {
+                    best = drop;
+                    kbest = k;
+                }
+            }
+            if (kbest >= 0)
+                codes[p] = (float)(1 << kbest);
+        }
+    }
+
+    if (hy_store(job->dir_fd, grid->nx, &wk, codes) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    hy_free_work(&wk);
+}
+
+
+int gf_fill_depressions(const gf_struct *gf, const gf_hydro_opts *opts,
+    const char *fill_name, const char *dir_name)
+{
+    hy_job job;
+    hy_graph g;
+    gf_struct filled;
+    float *level;
+    int *exit_cell;
+    unsigned char *exit_dir;
+    char hdr[2048], flt[2048];
+    int t, ntiles;
+    long u, base;
+
+    if (opts->tile_size < 2 || gf->grid.nx < 1 || gf->grid.ny < 1)
+        return -1;
+
+    memset(&job, 0, sizeof(hy_job));
+    job.gf = gf;
+    job.fill_fd = job.dir_fd = -1;
+    hy_init_layout(&job.layout, &gf->grid, opts->tile_size);
+    ntiles = job.layout.ntx * job.layout.nty;
+    job.tiles = (hy_tile *)calloc(ntiles, sizeof(hy_tile));
+
+    gf_parallel_for(ntiles, opts->nthreads, &hy_watershed_task, (void *)&job);
+
+    for (t = 0, base = 0; t < ntiles; t++) {
+        job.tiles[t].base = base;
+        base += job.tiles[t].nperim;
+    }
+
+    /* Spillover graph in CSR form: count degrees, then fill. */
+    g.nnodes = base + 1;
+    g.start = (long *)calloc(g.nnodes + 1, sizeof(long));
+    g.adj = NULL;
+    hy_edges(&job, &g);
+    for (u = 0; u < g.nnodes; u++)
+        g.start[u + 1] += g.start[u];
+    g.pos = (long *)malloc(g.nnodes * sizeof(long));
+    memcpy(g.pos, g.start, g.nnodes * sizeof(long));
+    g.adj = (hy_adj *)malloc((g.start[g.nnodes] + 1) * sizeof(hy_adj));
+    hy_edges(&job, &g);
+
+    level = (float *)malloc(g.nnodes * sizeof(float));
+    exit_cell = (int *)malloc(g.nnodes * sizeof(int));
+    exit_dir = (unsigned char *)malloc(g.nnodes);
+    hy_solve(&g, level, exit_cell, exit_dir);
+    free(g.start);
+    free(g.pos);
+    free(g.adj);
+
+    job.level = level;
+    job.exit_cell = exit_cell;
+    job.exit_dir = exit_dir;
+    if ((job.fill_fd = hy_create(&gf->grid, fill_name)) < 0 ||
+            (dir_name != NULL && (job.dir_fd = hy_create(&gf->grid, dir_name)) < 0))
+        job.failed = 1;
+    else
+        gf_parallel_for(ntiles, opts->nthreads, &hy_fill_task, (void *)&job);
+
+    if (job.dir_fd >= 0 && job.failed == 0) {
+        snprintf(hdr, sizeof(hdr), "%s.hdr", fill_name);
+        snprintf(flt, sizeof(flt), "%s.flt", fill_name);
+        if (gf_open(hdr, flt, &filled) != 0) {
+            job.failed = 1;
+        } else {
+            job.filled = &filled;
+            gf_parallel_for(ntiles, opts->nthreads, &hy_steepest_task, (void *)&job);
+            gf_close(&filled);
+        }
+    }
+
+    if (job.fill_fd >= 0)
+        close(job.fill_fd);
+    if (job.dir_fd >= 0)
+        close(job.dir_fd);
+    for (t = 0; t < ntiles; t++) {
+        free(job.tiles[t].perim_elev);
+        free(job.tiles[t].perim_ocean);
+        free(job.tiles[t].contacts);
+    }
+    free(job.tiles);
+    free(level);
+    free(exit_cell);
+    free(exit_dir);
+    hy_free_layout(&job.layout);
+    return job.failed ? -1 : 0;
+}
+
+
+/* Perimeter of one tile, as the accumulation merge sees it. */
+typedef struct hy_acc_tile {
+    long base;          /* Node of perimeter cell 0 */
+    int nperim;
+    double *local;      /* In-tile accumulation; negative for NODATA */
+    int *link;          /* Next perimeter cell downstream in the tile */
+    long *out;          /* Node the flow leaves the tile to */
+    double *ext;        /* Inflow from other tiles, from the merge */
+} hy_acc_tile;
+
+
+typedef struct hy_acc_job {
+    const gf_struct *dirs;
+    hy_layout layout;
+    hy_acc_tile *tiles;
+    int fd;
+    int failed;
+} hy_acc_job;
+
+
+/* Downstream neighbor of p inside the tile, -1 for a sink or -2 if
+   the flow leaves the tile. */
+static
+int hy_target(const hy_work *wk, int p) {
+    int q, i, j;
+
+    if (wk->dir[p] == HY_NONE)
+        return -1;
+    q = p + wk->off[wk->dir[p]];
+    i = q / wk->w;
+    j = q % wk->w;
+    if (i < 1 || i > wk->ny || j < 1 || j > wk->nx)
+        return -2;
+    return wk->elev[q] == GF_NULL_VAL ? -1 : q;
+}
+
+
+/**
+ * Accumulate the tile in topological order (Kahn): every cell counts
+ * itself, perimeter cells also their inflow from other tiles (if ext
+ * is given), and each passes its total downstream. On return
+ * wk->fifo[0, *norder) holds the cells in that order; cells on
+ * direction cycles are left out.
+ */
+static
+void hy_accumulate(hy_work *wk, double *acc, const double *ext, int *norder) {
+    int head = 0, tail = 0, p, q, i, j, k;
+
+    for (i = 1; i <= wk->ny; i++) {
+        for (j = 1; j <= wk->nx; j++) {
+            p = i * wk->w + j;
+            wk->label[p] = 0;
+            k = wk->elev[p] == GF_NULL_VAL ? -1 : hy_code_dir(wk->elev[p]);
+            wk->dir[p] = k < 0 ? HY_NONE : (unsigned char)k;
+        }
+    }
+    for (i = 1; i <= wk->ny; i++)
+        for (j = 1; j <= wk->nx; j++)
+            if ((q = hy_target(wk, i * wk->w + j)) >= 0)
+                wk->label[q]++;
+
+    for (i = 1; i <= wk->ny; i++) {
+        for (j = 1; j <= wk->nx; j++) {
+            p = i * wk->w + j;
+            if (wk->elev[p] == GF_NULL_VAL)
+                continue;
+            acc[p] = 1.0;
+            if (ext != NULL && (k = hy_perim_index(wk->nx, wk->ny, i - 1, j - 1)) >= 0)
+                acc[p] += ext[k];
+            if (wk->label[p] == 0)
+                wk->fifo[tail++] = p;
+        }
+    }
+
+    while (head < tail) {
+        p = wk->fifo[head++];
+        if ((q = hy_target(wk, p)) >= 0) {
+            acc[q] += acc[p];
+            if (--wk->label[q] == 0)
+                wk->fifo[tail++] = q;
+        }
+    }
+    *norder = tail;
+}
+
+
+/* Pass 1: accumulate one tile alone and summarize its perimeter. */
+static
+void hy_acc_local_task(int t, void *arg) {
+    hy_acc_job *job = (hy_acc_job *)arg;
+    hy_acc_tile *tile = job->tiles + t;
+    const hy_layout *l = &job->layout;
+    hy_work wk;
+    double *acc;
+    int *next, norder, k, p, q, i, j, d, u, i1, j1, nx1, ny1;
+    long ii, jj, ii1, jj1;
+
+    hy_init_work(&wk, l, t);
+    acc = (double *)malloc((long)wk.w * (wk.ny + 2) * sizeof(double));
+    if (hy_load(job->dirs, &wk, wk.elev) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    hy_accumulate(&wk, acc, NULL, &norder);
+
+    /* Downstream first, find the next perimeter cell each cell's flow
+    reaches without leaving the tile. */
+    next = wk.label;
+    for (i = 1; i <= wk.ny; i++)
+        for (j = 1; j <= wk.nx; j++)
+            next[i * wk.w + j] = -1;
+    for (k = norder - 1; k >= 0; k--) {
+        p = wk.fifo[k];
+        if ((q = hy_target(&wk, p)) >= 0) {
+            i = q / wk.w - 1;
+            j = q % wk.w - 1;
+            next[p] = hy_perim_index(wk.nx, wk.ny, i, j);
+            if (next[p] < 0)
+                next[p] = next[q];
+        }
+    }
+
+    for (k = 0; k < tile->nperim; k++) {
+        hy_perim_cell(wk.nx, wk.ny, k, &i, &j);
+        p = (i + 1) * wk.w + j + 1;
+        tile->link[k] = -1;
+        tile->out[k] = -1;
+        if (wk.elev[p] == GF_NULL_VAL) {
+            tile->local[k] = -1.0;
+            continue;
+        }
+        tile->local[k] = acc[p];
+        tile->link[k] = next[p];
+        if (hy_target(&wk, p) != -2)
+            continue;
+        d = wk.dir[p];
+        ii = wk.ii0 + i + hy_di[d];
+        jj = wk.jj0 + j + hy_dj[d];
+        if (ii < 0 || ii >= l->grid->ny || jj < 0 || jj >= l->grid->nx)
+            continue;
+        u = hy_span(l->row0, l->nty, l->grid->ny, ii) * l->ntx +
+            hy_span(l->col0, l->ntx, l->grid->nx, jj);
+        hy_tile_extent(l, u, &ii1, &jj1, &ny1, &nx1);
+        i1 = (int)(ii - ii1);
+        j1 = (int)(jj - jj1);
+        tile->out[k] = job->tiles[u].base + hy_perim_index(nx1, ny1, i1, j1);
+    }
+
+    free(acc);
+    hy_free_work(&wk);
+}
+
+
+/* Pass 2: accumulate again with the inflow from other tiles. */
+static
+void hy_acc_final_task(int t, void *arg) {
+    hy_acc_job *job = (hy_acc_job *)arg;
+    hy_work wk;
+    double *acc;
+    int norder, i, j, p;
+
+    hy_init_work(&wk, &job->layout, t);
+    acc = (double *)malloc((long)wk.w * (wk.ny + 2) * sizeof(double));
+    if (hy_load(job->dirs, &wk, wk.elev) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    hy_accumulate(&wk, acc, job->tiles[t].ext, &norder);
+
+    for (i = 1; i <= wk.ny; i++) {
+        for (j = 1; j <= wk.nx; j++) {
+            p = i * wk.w + j;
+            wk.fill[p] = wk.elev[p] == GF_NULL_VAL ? GF_NULL_VAL : (float)acc[p];
+        }
+    }
+    if (hy_store(job->fd, job->dirs->grid.nx, &wk, wk.fill) != 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    free(acc);
+    hy_free_work(&wk);
+}
+
+
+int gf_flow_accumulation(const gf_struct *dirs, const gf_hydro_opts *opts,
+    const char *acc_name)
+{
+    hy_acc_job job;
+    hy_acc_tile *tile;
+    double *local, *up, *ext, total;
+    long *down, *queue, n, nn, head, tail, base, d;
+    int *indeg, t, k, ntiles;
+    unsigned char *cross;
+    long ii0, jj0;
+    int nx, ny;
+
+    if (opts->tile_size < 2 || dirs->grid.nx < 1 || dirs->grid.ny < 1)
+        return -1;
+
+    memset(&job, 0, sizeof(hy_acc_job));
+    job.dirs = dirs;
+    hy_init_layout(&job.layout, &dirs->grid, opts->tile_size);
+    ntiles = job.layout.ntx * job.layout.nty;
+    job.tiles = (hy_acc_tile *)calloc(ntiles, sizeof(hy_acc_tile));
+
+    for (t = 0, base = 0; t < ntiles; t++) {
+        hy_tile_extent(&job.layout, t, &ii0, &jj0, &ny, &nx);
+        job.tiles[t].base = base;
+        job.tiles[t].nperim = hy_perim_count(nx, ny);
+        base += job.tiles[t].nperim;
+    }
+    nn = base;
+    local = (double *)malloc(nn * sizeof(double));
+    ext = (double *)calloc(nn, sizeof(double));
+    up = (double *)calloc(nn, sizeof(double));
+    down = (long *)malloc(nn * sizeof(long));
+    queue = (long *)malloc(nn * sizeof(long));
+    indeg = (int *)calloc(nn, sizeof(int));
+    cross = (unsigned char *)malloc(nn);
+    for (t = 0; t < ntiles; t++) {
+        tile = job.tiles + t;
+        tile->local = local + tile->base;
+        tile->ext = ext + tile->base;
+        tile->link = (int *)malloc(tile->nperim * sizeof(int));
+        tile->out = (long *)malloc(tile->nperim * sizeof(long));
+    }
+
+    gf_parallel_for(ntiles, opts->nthreads, &hy_acc_local_task, (void *)&job);
+
+    /* Each perimeter cell passes flow to at most one other: the next
+    one downstream in its tile, or the one it drains to across a tile
+    edge. Carry the inflow down that forest in topological order. */
+    for (t = 0; t < ntiles; t++) {
+        tile = job.tiles + t;
+        for (k = 0; k < tile->nperim; k++) {
+            n = tile->base + k;
+            down[n] = -1;
+            if (local[n] < 0.0)
+                continue;
+            cross[n] = tile->link[k] < 0;
+            if (tile->link[k] >= 0)
+                down[n] = tile->base + tile->link[k];
+            else if (tile->out[k] >= 0 && local[tile->out[k]] >= 0.0)
+                down[n] = tile->out[k];
+            if (down[n] >= 0)
+                indeg[down[n]]++;
+        }
+    }
+    for (n = 0, tail = 0; n < nn; n++)
+        if (local[n] >= 0.0 && indeg[n] == 0)
+            queue[tail++] = n;
+    for (head = 0; head < tail; head++) {
+        n = queue[head];
+        if ((d = down[n]) < 0)
+            continue;
+        if (!cross[n]) {
+            up[d] += up[n];
+        } else {
+            total = local[n] + up[n];
+            up[d] += total;
+            ext[d] += total;
+        }
+        if (--indeg[d] == 0)
+            queue[tail++] = d;
+    }
+
+    if ((job.fd = hy_create(&dirs->grid, acc_name)) < 0)
+        job.failed = 1;
+    else
+        gf_parallel_for(ntiles, opts->nthreads, &hy_acc_final_task, (void *)&job);
+
+    if (job.fd >= 0)
+        close(job.fd);
+    for (t = 0; t < ntiles; t++) {
+        free(job.tiles[t].link);
+        free(job.tiles[t].out);
+    }
+    free(job.tiles);
+    free(local);
+    free(ext);
+    free(up);
+    free(down);
+    free(queue);
+    free(indeg);
+    free(cross);
+    hy_free_layout(&job.layout);
+    return job.failed ? -1 : 0;
+}
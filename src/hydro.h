@@ -0,0 +1,75 @@
+#ifndef GF_HYDRO_H
+#define GF_HYDRO_H
+
+#include "gridfloat.h"
+
+/**
+ * D8 flow direction codes (the common ESRI convention), stored as
+ * floats in direction GridFloats. Cells that drain into NODATA or off
+ * the edge of the grid point that way; NODATA cells stay NODATA.
+ */
+#define GF_D8_E 1
+#define GF_D8_SE 2
+#define GF_D8_S 4
+#define GF_D8_SW 8
+#define GF_D8_W 16
+#define GF_D8_NW 32
+#define GF_D8_N 64
+#define GF_D8_NE 128
+
+/**
+ * Tiling for the hydrology passes.
+ *
+ * @tile_size - Side (in nodes) of the square tiles the grid is cut
+ *      into. Each worker holds one tile (a few dozen bytes per node)
+ *      at a time, so this bounds memory; the merge steps hold only
+ *      tile perimeters.
+ * @nthreads - Tiles processed at once; 0 for gf_num_threads().
+ */
+typedef struct gf_hydro_opts {
+    int tile_size;
+    int nthreads;
+} gf_hydro_opts;
+
+void gf_init_hydro_opts(gf_hydro_opts *opts);
+
+/**
+ * Fill depressions so that every cell drains to NODATA or the edge of
+ * the grid, and optionally derive D8 flow directions, in the manner of
+ * Barnes' parallel priority-flood:
+ *
+ *   1. Each tile is flooded inward from its perimeter, with each
+ *      perimeter cell labeling the watershed it floods; where two
+ *      watersheds meet, the lowest spill elevation between them is
+ *      kept.
+ *   2. The spillover graph of all tiles (plus links between adjacent
+ *      perimeter cells of neighboring tiles) is flooded from the
+ *      outside, giving each watershed its water level.
+ *   3. Each tile is flooded again and raised to its watersheds'
+ *      levels.
+ *
+ * The floods use a radix heap for cells above the water and a plain
+ * FIFO for cells in pits, where order does not matter.
+ *
+ * Directions point down the steepest drop of the filled surface; on
+ * the flats that filling leaves, they follow the flood back toward
+ * each watershed's outlet, so every cell reaches the edge or NODATA.
+ *
+ * Writes GridFloat fill_name.{hdr,flt} and, if dir_name is not NULL,
+ * dir_name.{hdr,flt}. Neither output is ever held in memory whole.
+ */
+int gf_fill_depressions(const gf_struct *gf, const gf_hydro_opts *opts,
+    const char *fill_name, const char *dir_name);
+
+/**
+ * Flow accumulation (number of cells draining through each cell,
+ * itself included) from a D8 direction GridFloat, written to
+ * acc_name.{hdr,flt}. Tiles are accumulated independently in
+ * topological order, flows crossing tile edges are then carried over
+ * a graph of perimeter cells, and a second pass per tile adds them
+ * in. Counts beyond 2^24 are rounded by the float output.
+ */
+int gf_flow_accumulation(const gf_struct *dirs, const gf_hydro_opts *opts,
+    const char *acc_name);
+
+#endif
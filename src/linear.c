@@ -5,29 +5,66 @@
 #include <limits.h>
 
 
+/**
+ * Source row ii, columns [jj_left, jj_right), for the bilinear sweep.
+ * The sweep reads a node beyond the one it lands on, so a target edge
+ * on the source's last row or column asks for nodes past the end of
+ * the .flt (with zero weight). Those repeat the edge instead of being
+ * read. Returns 0, or -1 if the read fails.
+ */
+static
+int gf_bilinear_line(long ii, long jj_left, long jj_right, const gf_struct *gf, gf_float *line) {
+    long jj_start = jj_left < 0 ? 0 : jj_left;
+    long jj_end = jj_right > gf->grid.nx ? gf->grid.nx : jj_right;
+    long jj;
+
+    if (ii > gf->grid.ny - 1)
+        ii = gf->grid.ny - 1;
+    if (jj_end <= jj_start) {
+        for (jj = jj_left; jj < jj_right; jj++)
+            line[jj - jj_left] = GF_NULL_VAL;
+        return 0;
+    }
+    if (gf_get_line(ii, jj_start, jj_end, gf, line + (jj_start - jj_left)) != 0)
+        return -1;
+    for (jj = jj_left; jj < jj_start; jj++)
+        line[jj - jj_left] = line[jj_start - jj_left];
+    for (jj = jj_end; jj < jj_right; jj++)
+        line[jj - jj_left] = line[jj_end - 1 - jj_left];
+    return 0;
+}
+
+
 int gf_bilinear(
     const gf_struct *gf,
     const gf_grid *to_grid,
     void *set_data_xtras,
     gf_bilinear_kernel *set_data,
-//    int (*set_data)(
-//        gf_float *quad,
-//        const gf_grid *from_grid,
-//        double *weights,
-//        double *latlng,
-//        void *xtras,
-//        void **data_ptr    /* Pointer to the current position in the buffer.
-//                              Position needs to be incremented by the callback. */
-//    ),
     void *data,
     size_t elem_size
+) {
+    return gf_bilinear_strided(gf, to_grid, set_data_xtras, set_data, data, elem_size,
+        0, to_grid->nx, 1);
+}
+
+
+int gf_bilinear_strided(
+    const gf_struct *gf,
+    const gf_grid *to_grid,
+    void *set_data_xtras,
+    gf_bilinear_kernel *set_data,
+    void *data,
+    size_t elem_size,
+    long origin,
+    long row_step,
+    long col_step
 ) {
     int i, j;             /* Indices for subgrid */
     double lat, lng, latlng[2]; /* For passing to op */
     int to_nx = to_grid->nx, to_ny = to_grid->ny;
     double to_dx = to_grid->dx, to_dy = to_grid->dy;
 
-    unsigned char *d = data;
+    unsigned char *d;
 
     int ii, ii_new, jj; /* Indices for gf_tile */
 
@@ -36,6 +73,7 @@ int gf_bilinear(
     /* x-indices for bounds of line buffers */
     int jj_left, jj_right;
     int jjj; /* Index within line buffer */
+    int err = 0;
 
     /* Data surrounding requested latlng point. */
     gf_float quad[4];
@@ -44,24 +82,22 @@ int gf_bilinear(
 
     /* Aliases */
     const gf_grid *from_grid = &gf->grid;
-    FILE *flt = gf->flt;
 
     /* Find indices of dataset that bound the requested box in x. */
     jj_left = (int)((to_grid->left - from_grid->left) / from_grid->dx);
-    jj_right = ((int)((to_grid->right - from_grid->left) / from_grid->dx)) + 2; /* exclusive */
+    /* Exclusive. The accumulated lng can overshoot a right edge that
+       is on a node. */
+    jj_right = ((int)((to_grid->right - from_grid->left) / from_grid->dx + GF_ALIGN_TOL)) + 2;
 
     line1 = (gf_float *)malloc((jj_right - jj_left) * sizeof(gf_float));
     line2 = (gf_float *)malloc((jj_right - jj_left) * sizeof(gf_float));
 
-    rewind(flt);
-
     //fprintf(stdout, "req x bounds: %f, %f\n", bounds->left, bounds->right);
     
     latlng[0] = lat = to_grid->top;
     for (i = 0, ii = INT_MIN; i < to_ny; ++i) {
-        if (lat > from_grid->top || lat < from_grid->bottom) {
-            d += to_nx * elem_size;
-        } else {
+        d = (unsigned char *)data + (origin + i * row_step) * (long)elem_size;
+        if (!(lat > from_grid->top || lat < from_grid->bottom)) {
 
             // Read in data two lines at a time; the two lines
             // should bracket (in y) the current latitude.
@@ -75,11 +111,14 @@ int gf_bilinear(
                 line1 = line2;
                 line2 = line_swp;
                 line_swp = NULL;
-                gf_get_line(ii_new + 1, jj_left, jj_right, gf, line2);
+                err = gf_bilinear_line(ii_new + 1, jj_left, jj_right, gf, line2);
             } else if (ii_new > ii + 1) {
-                gf_get_line(ii_new, jj_left, jj_right, gf, line1);
-                gf_get_line(ii_new + 1, jj_left, jj_right, gf, line2);
+                err = gf_bilinear_line(ii_new, jj_left, jj_right, gf, line1);
+                if (err == 0)
+                    err = gf_bilinear_line(ii_new + 1, jj_left, jj_right, gf, line2);
             }
+            if (err != 0)
+                break;
             ii = ii_new;
 
             /* y-weight. Normalized (to dy) distance from top line to
@@ -106,7 +145,7 @@ int gf_bilinear(
                     (*set_data)(quad, from_grid, w, latlng, set_data_xtras, (void *)d);
                 }
 
-                d += elem_size;
+                d += col_step * (long)elem_size;
                 lng += to_dx;
                 latlng[1] = lng;
             }
@@ -118,13 +157,55 @@ int gf_bilinear(
     free(line1);
     free(line2);
 
-    return 0;
+    return err;
+}
+
+
+/**
+ * Replace null corners of a quad by the weighted mean of the valid
+ * ones. Returns the total weight of the valid corners (zero if the
+ * point carries no valid data, in which case the quad is untouched).
+ */
+static
+double gf_fill_nulls_quad(gf_float *quad, double *w) {
+    double qw[4], sum = 0.0, wsum = 0.0, mean;
+    int k, nulls = 0;
+
+    qw[0] = (1.0 - w[0]) * (1.0 - w[1]);
+    qw[1] = (1.0 - w[0]) *        w[1];
+    qw[2] =        w[0]  * (1.0 - w[1]);
+    qw[3] =        w[0]  *        w[1];
+
+    for (k = 0; k < 4; k++) {
+        if (quad[k] == (gf_float)GF_NULL_VAL) {
+            nulls++;
+        } else {
+            sum += qw[k] * quad[k];
+            wsum += qw[k];
+        }
+    }
+
+    if (nulls == 0 || wsum <= 0.0)
+        return nulls == 0 ? 1.0 : 0.0;
+
+    mean = sum / wsum;
+    for (k = 0; k < 4; k++)
+        if (quad[k] == (gf_float)GF_NULL_VAL)
+            quad[k] = (gf_float)mean;
+    return wsum;
 }
 
 
 int gf_bilinear_interpolate_kernel(gf_float *quad, const gf_grid *from_grid, double *w, double *latlng, void *xtras, void *data_ptr) {
     gf_float *dptr = (gf_float *)data_ptr;
 
+    /* Null corners get the mean of the valid ones, which is the same
+    as renormalizing the weights over the valid corners. */
+    if (gf_fill_nulls_quad(quad, w) == 0.0) {
+        dptr[0] = GF_NULL_VAL;
+        return 0;
+    }
+
     //fprintf(stdout, "%f, %f, %f, %f\n", quad[0], quad[1], quad[2], quad[3]);
     dptr[0] = (1.0 - w[0]) * (1.0 - w[1]) * quad[0] +
               (1.0 - w[0]) *        w[1]  * quad[1] +
@@ -134,25 +215,104 @@ int gf_bilinear_interpolate_kernel(gf_float *quad, const gf_grid *from_grid, dou
 }
 
 
+/* Above this many source columns between samples, a span read wastes
+   more bandwidth than one pread per sample costs in syscalls. */
+#define GATHER_SPAN_MAX 1024
+
+/**
+ * Fast path for gf_bilinear_interpolate when every node of to_grid is
+ * a node of the source (see gf_grid_aligned). Interpolation weights are
+ * all zero, so values are copied straight from the file: one pread per
+ * row directly into the output for unit column stride, or a span read
+ * plus strided gather otherwise. Like gf_bilinear, points outside the
+ * source are left untouched.
+ *
+ * Returns 0, or -1 at the first row that fails to read.
+ */
+static
+int gf_aligned_extract(const gf_struct *gf, const gf_grid *to_grid,
+    long ii0, long jj0, int si, int sj, gf_float *data)
+{
+    int i, j, j_start, j_end, len, err = 0;
+    long ii, jj;
+    gf_float *span = NULL, *row;
+    const gf_grid *from_grid = &gf->grid;
+
+    /* Output columns that fall on source columns [0, nx). */
+    j_start = jj0 >= 0 ? 0 : (int)((-jj0 + sj - 1) / sj);
+    j_end = to_grid->nx;
+    if (jj0 + (long)(j_end - 1) * sj > from_grid->nx - 1)
+        j_end = (int)((from_grid->nx - 1 - jj0) / sj) + 1;
+    if (j_start >= j_end)
+        return 0;
+
+    len = (j_end - j_start - 1) * sj + 1;
+    if (sj > 1 && sj <= GATHER_SPAN_MAX)
+        span = (gf_float *)malloc(len * sizeof(gf_float));
+
+    for (i = 0; i < to_grid->ny && err == 0; ++i) {
+        ii = ii0 + (long)i * si;
+        if (ii < 0 || ii >= from_grid->ny)
+            continue;
+
+        row = data + (long)i * to_grid->nx;
+        jj = jj0 + (long)j_start * sj;
+
+        if (sj == 1) {
+            err = gf_get_line(ii, jj, jj + len, gf, row + j_start);
+        } else if (span != NULL) {
+            err = gf_get_line(ii, jj, jj + len, gf, span);
+            for (j = j_start; j < j_end; ++j)
+                row[j] = span[(j - j_start) * sj];
+        } else {
+            for (j = j_start; j < j_end && err == 0; ++j, jj += sj)
+                err = gf_get_line(ii, jj, jj + 1, gf, row + j);
+        }
+    }
+
+    free(span);
+    return err ? -1 : 0;
+}
+
+
 int gf_bilinear_interpolate(const gf_struct *gf, const gf_grid *grid, gf_float *data) {
+    long ii0, jj0;
+    int si, sj;
+
+    if (gf_grid_aligned(&gf->grid, grid, &ii0, &jj0, &si, &sj))
+        return gf_aligned_extract(gf, grid, ii0, jj0, si, sj, data);
+
     return gf_bilinear(gf, grid, NULL,
         &gf_bilinear_interpolate_kernel,
         (void *)data, sizeof(float));
 }
 
 
+int gf_bilinear_interpolate_xy(const gf_struct *gf, const gf_grid *grid, gf_float *data) {
+    /* Point (i, j) goes to row j, column ny - 1 - i. */
+    return gf_bilinear_strided(gf, grid, NULL,
+        &gf_bilinear_interpolate_kernel,
+        (void *)data, sizeof(float), grid->ny - 1, -1, grid->ny);
+}
+
+
 int gf_bilinear_gradient_kernel(gf_float *quad, const gf_grid *from_grid, double *w, double *latlng, void *xtras, void *data_ptr) {
     double *grad_ptr = (double *)data_ptr;
     double dx_m = -1, dy_m = -1; 
 
-    gf_lengths(latlng[0], latlng[1], from_grid->dy, from_grid->dx, 0.0, &dy_m, &dx_m);
+    if (gf_fill_nulls_quad(quad, w) == 0.0) {
+        grad_ptr[0] = grad_ptr[1] = GF_NULL_VAL;
+        return 0;
+    }
+
+    gf_lengths(latlng[0], latlng[1], from_grid->dy, from_grid->dx, 0.0, &dx_m, &dy_m);
 
     /* Avg in y, diff in x */
     grad_ptr[0] = (((1.0 - w[0]) * quad[1] + w[0] * quad[3]) - 
                    ((1.0 - w[0]) * quad[0] + w[0] * quad[2])) / dx_m;
     /* Avg in x, diff in y */
-    grad_ptr[1] = (((1.0 - w[1]) * quad[0] + w[1] * quad[2]) - 
-                   ((1.0 - w[1]) * quad[1] + w[1] * quad[3])) / dy_m;
+    grad_ptr[1] = (((1.0 - w[1]) * quad[0] + w[1] * quad[1]) - 
+                   ((1.0 - w[1]) * quad[2] + w[1] * quad[3])) / dy_m;
     return 0;
 }
 
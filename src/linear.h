@@ -15,29 +15,46 @@ typedef int (gf_bilinear_kernel)(gf_float *quad,
  * The workhorse. Iterates over each point on a subgrid,
  * finds the 4 nearest points from the GridFloat dataset,
  * and calls a callback to do something with those 4 values.
+ * Output elements are elem_size bytes, in row-major order.
  */
 int gf_bilinear(
     const gf_struct *gf,
     const gf_grid *grid,
     void *set_data_xtras,
     gf_bilinear_kernel *set_data,
-//    int (*set_data)(
-//        gf_float *quad,
-//        const gf_grid *from_grid,
-//        double *weights,
-//        double *latlng,
-//        void *xtras,
-//        void **data_ptr    /* Pointer to the current position in the buffer.
-//                              Position needs to be incremented by the callback. */
-//    ),
     void *data,
     size_t elem_size
 );
 
+/**
+ * gf_bilinear with any output layout: point (i, j) of grid (row i from
+ * the top, column j) is handed element origin + i * row_step +
+ * j * col_step of data (steps may be negative), so kernels can write
+ * transposed or flipped arrays directly. Returns 0, or -1 if a source
+ * row could not be read.
+ */
+int gf_bilinear_strided(
+    const gf_struct *gf,
+    const gf_grid *grid,
+    void *set_data_xtras,
+    gf_bilinear_kernel *set_data,
+    void *data,
+    size_t elem_size,
+    long origin,
+    long row_step,
+    long col_step
+);
+
 int gf_bilinear_interpolate_kernel(gf_float *quad, const gf_grid *from_grid, double *w, double *latlng, void *xtras, void *data_ptr);
 
 int gf_bilinear_interpolate(const gf_struct *gf, const gf_grid *to_grid, gf_float *data);
 
+/**
+ * gf_bilinear_interpolate into the xy layout of gf_print: grid->nx
+ * rows of grid->ny values, each a column of the grid, bottom first.
+ */
+int gf_bilinear_interpolate_xy(const gf_struct *gf, const gf_grid *to_grid, gf_float *data);
+
 int gf_bilinear_gradient_kernel(gf_float *quad, const gf_grid *from_grid, double *w, double *latlng, void *xtras, void *data_ptr);
 
 int gf_bilinear_gradient(const gf_struct *gf, const gf_grid *to_grid, double *gradient);
@@ -0,0 +1,376 @@
+#include "los.h"
+#include "linear.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* Queries per pool task. */
+#define LOS_BATCH 256
+
+/**
+ * A sight line in the pyramid's node coordinates (x along columns,
+ * y down rows), parameterized by t in [0, 1]. Its height is
+ * z0 + t dz - c t (1 - t), the last term being the earth's bulge.
+ */
+typedef struct gf_los_ray {
+    double x0, y0, dx, dy;
+    double z0, dz;
+    double c;
+} gf_los_ray;
+
+typedef struct gf_los_job {
+    const gf_pyramid *pyr;
+    const gf_los_opts *opts;
+    const gf_los_query *queries;
+    signed char *visible;
+    int n;
+} gf_los_job;
+
+
+void gf_init_los_opts(gf_los_opts *opts) {
+    opts->curvature = 1;
+    opts->refraction = GF_REFRACTION_STD;
+}
+
+
+/* Max-reduce the node elevations into the pyramid levels. */
+static
+int gf_build_levels(gf_pyramid *pyr) {
+    int l, i, j, nx, ny, pnx, pny, di, dj;
+    float m, v, *cell, *prev;
+    const float *e = pyr->elev;
+    long gnx = pyr->grid.nx;
+
+    if (pyr->grid.nx < 2 || pyr->grid.ny < 2)
+        return -1;
+
+    nx = pyr->grid.nx - 1;
+    ny = pyr->grid.ny - 1;
+    for (pyr->nlevels = 1; nx > 1 || ny > 1; pyr->nlevels++) {
+        nx = (nx + 1) / 2;
+        ny = (ny + 1) / 2;
+    }
+
+    pyr->nx = (int *)malloc(pyr->nlevels * sizeof(int));
+    pyr->ny = (int *)malloc(pyr->nlevels * sizeof(int));
+    pyr->levels = (float **)malloc(pyr->nlevels * sizeof(float *));
+
+    nx = pyr->grid.nx - 1;
+    ny = pyr->grid.ny - 1;
+    cell = (float *)malloc((size_t)nx * ny * sizeof(float));
+    for (i = 0; i < ny; i++) {
+        for (j = 0; j < nx; j++) {
+            m = e[i * gnx + j];
+            if (e[i * gnx + j + 1] > m) m = e[i * gnx + j + 1];
+            if (e[(i + 1) * gnx + j] > m) m = e[(i + 1) * gnx + j];
+            if (e[(i + 1) * gnx + j + 1] > m) m = e[(i + 1) * gnx + j + 1];
+            cell[i * nx + j] = m;
+        }
+    }
+    pyr->nx[0] = nx;
+    pyr->ny[0] = ny;
+    pyr->levels[0] = cell;
+
+    for (l = 1; l < pyr->nlevels; l++) {
+        pnx = nx;
+        pny = ny;
+        prev = cell;
+        nx = (pnx + 1) / 2;
+        ny = (pny + 1) / 2;
+        cell = (float *)malloc((size_t)nx * ny * sizeof(float));
+        for (i = 0; i < ny; i++) {
+            for (j = 0; j < nx; j++) {
+                m = GF_NULL_VAL;
+                for (di = 0; di < 2 && 2 * i + di < pny; di++) {
+                    for (dj = 0; dj < 2 && 2 * j + dj < pnx; dj++) {
+                        v = prev[(2 * i + di) * pnx + 2 * j + dj];
+                        if (v > m)
+                            m = v;
+                    }
+                }
+                cell[i * nx + j] = m;
+            }
+        }
+        pyr->nx[l] = nx;
+        pyr->ny[l] = ny;
+        pyr->levels[l] = cell;
+    }
+
+    return 0;
+}
+
+
+static
+float *gf_alloc_elev(const gf_grid *grid) {
+    long k, n = (long)grid->nx * grid->ny;
+    float *elev = (float *)malloc(n * sizeof(float));
+
+    if (elev != NULL)
+        for (k = 0; k < n; k++)
+            elev[k] = GF_NULL_VAL;
+    return elev;
+}
+
+
+int gf_build_pyramid(const gf_struct *gf, const gf_grid *grid, gf_pyramid *pyr) {
+    pyr->grid = grid != NULL ? *grid : gf->grid;
+    pyr->nlevels = 0;
+    pyr->levels = NULL;
+    pyr->nx = pyr->ny = NULL;
+
+    if ((pyr->elev = gf_alloc_elev(&pyr->grid)) == NULL)
+        return -1;
+    gf_bilinear_interpolate(gf, &pyr->grid, pyr->elev);
+    return gf_build_levels(pyr);
+}
+
+
+int gf_db_build_pyramid(gf_db *db, const gf_grid *grid, gf_pyramid *pyr) {
+    pyr->grid = *grid;
+    pyr->nlevels = 0;
+    pyr->levels = NULL;
+    pyr->nx = pyr->ny = NULL;
+
+    if ((pyr->elev = gf_alloc_elev(&pyr->grid)) == NULL)
+        return -1;
+    if (gf_db_get_data(&pyr->grid, db, pyr->elev) != 0)
+        return -1;
+    return gf_build_levels(pyr);
+}
+
+
+void gf_free_pyramid(gf_pyramid *pyr) {
+    int l;
+
+    for (l = 0; l < pyr->nlevels; l++)
+        free(pyr->levels[l]);
+    free(pyr->levels);
+    free(pyr->nx);
+    free(pyr->ny);
+    free(pyr->elev);
+    pyr->levels = NULL;
+    pyr->elev = NULL;
+    pyr->nlevels = 0;
+}
+
+
+/* Bilinear ground height at node coordinates (x, y). */
+static
+double gf_los_ground(const gf_pyramid *pyr, double x, double y, int *has_null) {
+    long nx = pyr->grid.nx, i, j;
+    const float *e;
+    double wx, wy;
+
+    i = (long)y;
+    j = (long)x;
+    if (i > pyr->grid.ny - 2)
+        i = pyr->grid.ny - 2;
+    if (j > nx - 2)
+        j = nx - 2;
+    wy = y - i;
+    wx = x - j;
+    e = pyr->elev + i * nx + j;
+
+    if (has_null != NULL)
+        *has_null = e[0] == GF_NULL_VAL || e[1] == GF_NULL_VAL ||
+            e[nx] == GF_NULL_VAL || e[nx + 1] == GF_NULL_VAL;
+
+    return (1.0 - wy) * ((1.0 - wx) * e[0] + wx * e[1]) +
+                  wy  * ((1.0 - wx) * e[nx] + wx * e[nx + 1]);
+}
+
+
+static
+double gf_los_height(const gf_los_ray *ray, double t) {
+    return ray->z0 + t * ray->dz - ray->c * t * (1.0 - t);
+}
+
+
+/* Lower bound on the ray's height over [ta, tb]. */
+static
+double gf_los_lowest(const gf_los_ray *ray, double ta, double tb) {
+    double lin, q;
+
+    lin = ray->z0 + (ray->dz < 0.0 ? tb : ta) * ray->dz;
+    if (ray->c == 0.0)
+        return lin;
+
+    /* t (1 - t) peaks at t = 1/2. */
+    if (tb < 0.5)
+        q = tb * (1.0 - tb);
+    else if (ta > 0.5)
+        q = ta * (1.0 - ta);
+    else
+        q = 0.25;
+    return lin - ray->c * q;
+}
+
+
+/* Clip [ta, tb] to where the ray is inside a box. Returns 0 if empty. */
+static
+int gf_los_clip(const gf_los_ray *ray, double x0, double x1, double y0, double y1,
+    double *ta, double *tb)
+{
+    double a = *ta, b = *tb, t0, t1, s;
+
+    if (ray->dx != 0.0) {
+        t0 = (x0 - ray->x0) / ray->dx;
+        t1 = (x1 - ray->x0) / ray->dx;
+        if (t0 > t1) { s = t0; t0 = t1; t1 = s; }
+        if (t0 > a) a = t0;
+        if (t1 < b) b = t1;
+    } else if (ray->x0 < x0 || ray->x0 > x1) {
+        return 0;
+    }
+
+    if (ray->dy != 0.0) {
+        t0 = (y0 - ray->y0) / ray->dy;
+        t1 = (y1 - ray->y0) / ray->dy;
+        if (t0 > t1) { s = t0; t0 = t1; t1 = s; }
+        if (t0 > a) a = t0;
+        if (t1 < b) b = t1;
+    } else if (ray->y0 < y0 || ray->y0 > y1) {
+        return 0;
+    }
+
+    if (a > b)
+        return 0;
+    *ta = a;
+    *tb = b;
+    return 1;
+}
+
+
+/*
+ * Terrain against the ray across a quad. Ground is bilinear in the
+ * quad, so along the ray it is quadratic in t, as is the ray's height:
+ * their difference peaks at an end or at its vertex, which the ends and
+ * the midpoint locate exactly.
+ */
+static
+int gf_los_quad_blocked(const gf_pyramid *pyr, const gf_los_ray *ray, double ta, double tb) {
+    double t[3], f[3], h, curv, u;
+    int k;
+
+    t[0] = ta;
+    t[1] = 0.5 * (ta + tb);
+    t[2] = tb;
+    for (k = 0; k < 3; k++) {
+        f[k] = gf_los_ground(pyr, ray->x0 + t[k] * ray->dx, ray->y0 + t[k] * ray->dy, NULL) -
+            gf_los_height(ray, t[k]);
+        if (f[k] > 0.0)
+            return 1;
+    }
+
+    /* f(t[1] + u) = f[1] + (f[2] - f[0]) u / 2h + curv u^2 / 2h^2. */
+    h = 0.5 * (tb - ta);
+    curv = f[0] + f[2] - 2.0 * f[1];
+    if (curv >= 0.0 || h <= 0.0)
+        return 0;
+    u = (f[0] - f[2]) * h / (2.0 * curv);
+    if (u <= -h || u >= h)
+        return 0;
+    u += t[1];
+    return gf_los_ground(pyr, ray->x0 + u * ray->dx, ray->y0 + u * ray->dy, NULL) >
+        gf_los_height(ray, u);
+}
+
+
+static
+int gf_los_blocked(const gf_pyramid *pyr, const gf_los_ray *ray, int level,
+    int ci, int cj, double ta, double tb)
+{
+    int di, dj, i, j, size;
+    double ca, cb;
+
+    if (pyr->levels[level][ci * pyr->nx[level] + cj] < gf_los_lowest(ray, ta, tb))
+        return 0;
+
+    if (level == 0)
+        return gf_los_quad_blocked(pyr, ray, ta, tb);
+
+    size = 1 << (level - 1);
+    for (di = 0; di < 2; di++) {
+        i = 2 * ci + di;
+        if (i >= pyr->ny[level - 1])
+            break;
+        for (dj = 0; dj < 2; dj++) {
+            j = 2 * cj + dj;
+            if (j >= pyr->nx[level - 1])
+                break;
+            ca = ta;
+            cb = tb;
+            if (!gf_los_clip(ray, j * size, (j + 1) * size, i * size, (i + 1) * size, &ca, &cb))
+                continue;
+            if (gf_los_blocked(pyr, ray, level - 1, i, j, ca, cb))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+
+int gf_line_of_sight(const gf_pyramid *pyr, const gf_los_opts *opts,
+    const gf_los_query *query)
+{
+    const gf_grid *g = &pyr->grid;
+    gf_los_ray ray;
+    double x1, y1, z1, dx_m, dy_m, d2;
+    int null0, null1;
+
+    ray.x0 = (query->from[1] - g->left) / g->dx;
+    ray.y0 = (g->top - query->from[0]) / g->dy;
+    x1 = (query->to[1] - g->left) / g->dx;
+    y1 = (g->top - query->to[0]) / g->dy;
+    if (ray.x0 < 0.0 || ray.y0 < 0.0 || x1 < 0.0 || y1 < 0.0 ||
+        ray.x0 > g->nx - 1 || x1 > g->nx - 1 || ray.y0 > g->ny - 1 || y1 > g->ny - 1)
+        return -1;
+
+    ray.z0 = gf_los_ground(pyr, ray.x0, ray.y0, &null0) + query->from_height;
+    z1 = gf_los_ground(pyr, x1, y1, &null1) + query->to_height;
+    if (null0 || null1)
+        return -1;
+
+    ray.dx = x1 - ray.x0;
+    ray.dy = y1 - ray.y0;
+    ray.dz = z1 - ray.z0;
+    ray.c = 0.0;
+
+    if (opts->curvature) {
+        gf_lengths(0.5 * (query->from[0] + query->to[0]),
+            0.5 * (query->from[1] + query->to[1]),
+            query->to[0] - query->from[0], query->to[1] - query->from[1],
+            0.0, &dx_m, &dy_m);
+        d2 = dx_m * dx_m + dy_m * dy_m;
+        ray.c = d2 * (1.0 - opts->refraction) / (2.0 * EQ_RADIUS);
+    }
+
+    return !gf_los_blocked(pyr, &ray, pyr->nlevels - 1, 0, 0, 0.0, 1.0);
+}
+
+
+static
+void gf_los_task(int index, void *arg) {
+    gf_los_job *job = (gf_los_job *)arg;
+    int k, end = (index + 1) * LOS_BATCH;
+
+    if (end > job->n)
+        end = job->n;
+    for (k = index * LOS_BATCH; k < end; k++)
+        job->visible[k] = (signed char)gf_line_of_sight(job->pyr, job->opts, &job->queries[k]);
+}
+
+
+int gf_line_of_sight_batch(const gf_pyramid *pyr, const gf_los_opts *opts,
+    int n, const gf_los_query *queries, signed char *visible)
+{
+    gf_los_job job;
+
+    job.pyr = pyr;
+    job.opts = opts;
+    job.queries = queries;
+    job.visible = visible;
+    job.n = n;
+    return gf_parallel_for((n + LOS_BATCH - 1) / LOS_BATCH, 0, &gf_los_task, (void *)&job);
+}
@@ -0,0 +1,88 @@
+#ifndef GF_LOS_H
+#define GF_LOS_H
+
+#include "gridfloat.h"
+#include "db.h"
+
+/* Standard atmosphere refraction coefficient for radio paths. */
+#define GF_REFRACTION_STD 0.13
+
+/**
+ * Max-elevation pyramid over a grid.
+ *
+ * Cell (i, j) of level 0 is the quad between nodes (i, j) and
+ * (i + 1, j + 1) and holds the largest of its four nodes; each cell of
+ * level L holds the largest of the (up to) four level L - 1 cells it
+ * covers. The last level is a single cell. Null nodes count as
+ * GF_NULL_VAL, so they never block a ray.
+ *
+ * @grid - Nodes of the underlying elevation.
+ * @elev - grid.nx * grid.ny node elevations.
+ * @nx, @ny - Cells across and down each level.
+ * @levels - nlevels arrays of cells.
+ */
+typedef struct gf_pyramid {
+    gf_grid grid;
+    float *elev;
+    int nlevels;
+    int *nx;
+    int *ny;
+    float **levels;
+} gf_pyramid;
+
+/**
+ * Build the pyramid for a region of one source. With grid NULL the
+ * region is the whole source at its own resolution; otherwise the
+ * source is interpolated onto grid (straight copies when aligned).
+ */
+int gf_build_pyramid(const gf_struct *gf, const gf_grid *grid, gf_pyramid *pyr);
+
+/* As gf_build_pyramid over the tiles of a database. */
+int gf_db_build_pyramid(gf_db *db, const gf_grid *grid, gf_pyramid *pyr);
+
+void gf_free_pyramid(gf_pyramid *pyr);
+
+/**
+ * Line-of-sight options.
+ *
+ * @curvature - Nonzero to account for the earth's curvature: terrain
+ *      midway along a path of length D rises by D^2 t (1 - t) / 2R
+ *      relative to the straight chord.
+ * @refraction - Refraction coefficient k; the effective earth
+ *      radius is R / (1 - k). Only used with curvature.
+ */
+typedef struct gf_los_opts {
+    int curvature;
+    double refraction;
+} gf_los_opts;
+
+void gf_init_los_opts(gf_los_opts *opts);
+
+/**
+ * A sight line between two points, each raised some height (m)
+ * above the ground.
+ */
+typedef struct gf_los_query {
+    double from[2];     /* lat, lng */
+    double to[2];
+    double from_height;
+    double to_height;
+} gf_los_query;
+
+/**
+ * Returns 1 if the two ends of the query see each other, 0 if
+ * terrain strictly above the sight line blocks it, and -1 if an end
+ * lies outside the pyramid or on null ground.
+ *
+ * The ray walks the pyramid from the top, skipping every cell whose
+ * maximum is below the lowest point of the ray across it, and stops
+ * at the first blocking quad.
+ */
+int gf_line_of_sight(const gf_pyramid *pyr, const gf_los_opts *opts,
+    const gf_los_query *query);
+
+/* gf_line_of_sight for n queries on all threads. */
+int gf_line_of_sight_batch(const gf_pyramid *pyr, const gf_los_opts *opts,
+    int n, const gf_los_query *queries, signed char *visible);
+
+#endif
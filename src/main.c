@@ -8,6 +8,16 @@
 #include "linear.h"
 #include "gfpng.h"
 #include "gfstl.h"
+#include "zonal.h"
+#include "points.h"
+#include "profile.h"
+#include "viewshed.h"
+#include "contour.h"
+#include "hydro.h"
+#include "route.h"
+#include "voids.h"
+#include "ramp.h"
+#include "proj.h"
 
 
 void print_usage(void) {
@@ -30,6 +40,10 @@ void print_usage(void) {
         "Options:\n"
         "  -h:  Print this help message.\n"
         "  -i:  Print helpful info derived from GridFloat header file.\n"
+        "  -N:  Scan the source for blocks of nothing but NODATA and\n"
+        "       save the summary beside it as NAME.nul. Later runs load\n"
+        "       it on open and skip those blocks (ocean, say) without\n"
+        "       reading them, until the .flt changes.\n"
         "  -R:  Resolution of extraction. If a single integer is\n"
         "       supplied, then the resolution is the same in both\n"
         "       directions. Otherwise, the format is (by example):\n"
@@ -64,6 +78,59 @@ void print_usage(void) {
         "       file. In this case, it will write the appropriate data\n"
         "       and header files, appending .flt and .hdr, respectively,\n"
         "       to the argument of -o.\n"
+        "  -Z:  Zonal statistics. Read polygons from the given file (one\n"
+        "       per line: 'ID LNG LAT LNG LAT ...') and print a table of\n"
+        "       elevation count, min, max, mean and cut/fill volumes (m^3)\n"
+        "       for the source nodes inside each. Extraction bounds and\n"
+        "       resolution are ignored.\n"
+        "  -E:  Base elevation for -Z cut/fill volumes. Default: 0.\n"
+        "  -H:  Histogram for -Z, as BINS,MIN,MAX. E.g. '-H 10,0,3000'.\n"
+        "  -q:  Sample points. Read 'LAT LNG' pairs from the given file\n"
+        "       ('-' for stdin), one per line, and print the bilinear\n"
+        "       elevation at each, in input order. Points off the grid\n"
+        "       print as -9999.\n"
+        "  -L:  Elevation profile. Read the 'LAT LNG' vertices of a path\n"
+        "       from the given file ('-' for stdin), one per line, and\n"
+        "       print distance, position, elevation and cumulative ascent\n"
+        "       and descent at samples spaced along it.\n"
+        "  -D:  Sample spacing (m) for -L. Default: the grid's cell height.\n"
+        "  -V:  Viewshed from an observer at LAT,LNG[,OBS_H[,TGT_H]], with\n"
+        "       eye and target heights (m) above the ground (default 2\n"
+        "       and 0). Covers the source nodes within -M of the observer.\n"
+        "       With -o, a .png is white where visible, gray where hidden\n"
+        "       and black elsewhere; other names get a GridFloat of 1, 0\n"
+        "       and -9999. Without -o the raster is printed.\n"
+        "  -M:  Viewshed radius (m). Default: the whole grid.\n"
+        "  -I:  Contour lines every INTERVAL[,BASE] meters over the\n"
+        "       extraction grid (biquadratic surface), e.g. '-I 20' or\n"
+        "       '-I 20,5'. With -o, a .geojson or .json name gets GeoJSON\n"
+        "       and any other name but .png a compact binary file (see\n"
+        "       contour.h). Without -o, GeoJSON is printed.\n"
+        "  -W:  Hydrology. Fill depressions, then write GridFloats\n"
+        "       PREFIX_fill, PREFIX_dir (D8 flow directions: 1 E, 2 SE,\n"
+        "       4 S, ... 128 NE) and PREFIX_acc (flow accumulation in\n"
+        "       cells) for the whole source, tile by tile. Extraction\n"
+        "       bounds and resolution are ignored.\n"
+        "  -G:  Least-cost paths. Read 'LAT LNG LAT LNG' queries (from,\n"
+        "       to) from the given file ('-' for stdin), one per line,\n"
+        "       and print each route's cost, length and vertices (source\n"
+        "       nodes), in input order. Routes that do not exist print\n"
+        "       with n 0.\n"
+        "  -Y:  Cost model for -G, as MODEL[,WEIGHT[,MAXGRADE]]. MODEL is\n"
+        "       'slope' (meters times 1 + WEIGHT * |grade|, default\n"
+        "       WEIGHT 10) or 'tobler' (walking seconds). Moves steeper\n"
+        "       than MAXGRADE (rise over run) are not allowed. Default:\n"
+        "       'slope,10'.\n"
+        "  -F:  Fill NODATA voids of at most this many nodes (0 for any\n"
+        "       size) in the extracted grid before it is printed or\n"
+        "       saved (GridFloat or STL), with the smoothest surface\n"
+        "       meeting the valid nodes around each.\n"
+        "  -j:  Projected output: 'webmerc' (EPSG:3857) or UTM as 'utm'\n"
+        "       (zone of the center of the bounds), 'utm:10' or\n"
+        "       'utm:10s' (south). Bounds are still given in degrees; the\n"
+        "       -R grid covers their projection, with its header (and a\n"
+        "       .prj file when saved) in meters. Applies to printing,\n"
+        "       GridFloat and PNG output (no -S or -K).\n"
         "\n"
         "PNG output options:\n"
         "  When png output is specified, gridfloat automatically renders\n"
@@ -76,6 +143,25 @@ void print_usage(void) {
         "  -P:  Polar angle (in degrees) of view toward sun (for\n"
         "       relief shading). 0 means sun is on horizon, 90 when\n"
         "       directly overhead. Default: 30.\n"
+        "       -A and -P also take comma-separated lists, e.g.\n"
+        "       '-A 90,120,150,180'. Each list is one value per frame,\n"
+        "       and a single value applies to every frame. The frames\n"
+        "       are shaded from one gradient pass and written as\n"
+        "       NAME_000.png, NAME_001.png, ...\n"
+        "  -S:  Cast shadows: darken slopes hidden from the sun by\n"
+        "       terrain toward it.\n"
+        "  -C:  Hypsometric tint: color by elevation from the given ramp\n"
+        "       file, shaded, as an RGB PNG (RGBA if the ramp has any\n"
+        "       transparency). One stop per line, 'ELEVATION R G B [A]'\n"
+        "       (0-255), and optionally 'nv R G B [A]' for NODATA\n"
+        "       (default transparent); '#' starts a comment.\n"
+        "  -z:  PNG compression as LEVEL[,FILTER]: zlib LEVEL 0-9 and a\n"
+        "       row FILTER, one of none, sub, up, average, paeth or\n"
+        "       adaptive. Strips of rows compress on separate threads.\n"
+        "       Default: '6,adaptive'.\n"
+        "  -K:  Sky-view factor: darken hollows and valley floors by the\n"
+        "       share of sky hidden by terrain, sampled over the given\n"
+        "       number of azimuths (e.g. '-K 16').\n"
         "\n"
         "Examples:\n"
         "  All of the following are equivalent and simply print data\n"
@@ -91,6 +177,19 @@ void print_usage(void) {
 
 const float BAD_LATLNG = -1000.0;
 
+/* Most sun angles (frames) in one -A or -P list. */
+#define MAX_SUNS 1024
+
+/* Parse a comma-separated list of up to MAX_SUNS numbers. */
+static
+int parse_angles(char *arg, double *angles) {
+    int count = 0;
+
+    while (arg != NULL && count < MAX_SUNS)
+        angles[count++] = atof(strsep(&arg, ","));
+    return arg == NULL ? count : -1;
+}
+
 int main(int argc, char *argv[]) {
 
     int count, opt, len;
@@ -106,13 +205,60 @@ int main(int argc, char *argv[]) {
     int *res_view[2] = {&to_grid.nx, &to_grid.ny};
     double latlng[2] = {BAD_LATLNG, BAD_LATLNG};
     double wh[2] = {0, 0}; /* Width-Height */
-    int info = 0, from_point = 0, xy = 0, save = 0;
-    double n_sun[3];
-    double polar = 30.0, azimuth = 45.0;
+    int info = 0, scan_nulls = 0, from_point = 0, xy = 0, save = 0;
+    char zonal[2048] = "", points[2048] = "", path[2048] = "";
+    gf_profile prof;
+    double spacing = 0.0, dx_m;
+    int view = 0, shadows = 0, sky_dirs = 0;
+    gf_relief_opts ropts;
+    double observer[2];
+    gf_viewshed_opts vopts;
+    gf_grid view_grid;
+    int contours = 0;
+    gf_contour_opts copts;
+    gf_contours lines;
+    char hydro[2048] = "", fill_name[2100], dir_name[2100], acc_name[2100];
+    char dir_hdr[2104], dir_flt[2104];
+    gf_hydro_opts hopts;
+    gf_struct dirs;
+    char routes_file[2048] = "", model[16];
+    gf_route_opts qopts;
+    gf_route_query *queries;
+    gf_route *routes;
+    int nqueries;
+    int fill_voids = 0;
+    gf_void_opts fopts;
+    gf_color_ramp *ramp = NULL;
+    gf_png_opts popts;
+    char filter[16];
+    char proj_spec[32] = "";
+    gf_proj proj;
+    gf_proj_grid pgrid;
+    gf_bounds pbounds;
+    static const char *filters[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+    unsigned char *vis;
+    png_byte **vis_rows;
+    FILE *points_fp;
+    double *pts;
+    gf_float *elev;
+    int npts;
+    gf_zonal_opts zopts;
+    gf_polygon *polys;
+    gf_zonal_stats *zstats;
+    int npolys;
+    double phi, theta;
+    double polar[MAX_SUNS] = {30.0}, azimuth[MAX_SUNS] = {45.0};
+    int npolar = 1, nazimuth = 1, nframes;
+    double *n_suns;
 
     to_grid.nx = to_grid.ny = 128;
+    gf_init_zonal_opts(&zopts);
+    gf_init_viewshed_opts(&vopts);
+    gf_init_route_opts(&qopts);
+    gf_init_void_opts(&fopts);
+    gf_init_png_opts(&popts);
 
-    while ((opt = getopt(argc, argv, "hiTR:l:r:b:t:B:p:n:w:s:o:P:A:")) != -1) {
+    while ((opt = getopt(argc, argv, "hiNTR:l:r:b:t:B:p:n:w:s:o:P:A:Z:E:H:q:L:D:V:M:SK:I:W:G:Y:F:C:z:j:")) != -1) {
         switch (opt) {
         case 'h':
             print_usage();
@@ -198,6 +344,9 @@ int main(int argc, char *argv[]) {
         case 'i':
             info = 1;
             break;
+        case 'N':
+            scan_nulls = 1;
+            break;
         case 'T':
             xy = 1;
             break;
@@ -206,10 +355,122 @@ int main(int argc, char *argv[]) {
             strcpy(savename, optarg);
             break;
         case 'P':
-            polar = atof(optarg);
+            if ((npolar = parse_angles(optarg, polar)) < 1) {
+                fprintf(stderr, "Bad -P option. At most %d angles.\n", MAX_SUNS);
+                exit(EXIT_FAILURE);
+            }
             break;
         case 'A':
-            azimuth = atof(optarg);
+            if ((nazimuth = parse_angles(optarg, azimuth)) < 1) {
+                fprintf(stderr, "Bad -A option. At most %d angles.\n", MAX_SUNS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'Z':
+            strcpy(zonal, optarg);
+            break;
+        case 'E':
+            zopts.base = atof(optarg);
+            break;
+        case 'H':
+            if (sscanf(optarg, "%d,%lf,%lf", &zopts.nbins, &zopts.hist_min,
+                    &zopts.hist_max) != 3 || zopts.nbins < 1 ||
+                    zopts.hist_max <= zopts.hist_min) {
+                fprintf(stderr, "Bad -H option.\n  Example: '10,0,3000'\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            strcpy(points, optarg);
+            break;
+        case 'L':
+            strcpy(path, optarg);
+            break;
+        case 'D':
+            spacing = atof(optarg);
+            break;
+        case 'V':
+            view = 1;
+            count = sscanf(optarg, "%lf,%lf,%lf,%lf", &observer[0], &observer[1],
+                &vopts.observer_height, &vopts.target_height);
+            if (count < 2) {
+                fprintf(stderr, "Bad -V option. Need lat and lng.\n  Example: "
+                    "'42.5,-122.1,10,2'\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            vopts.radius = atof(optarg);
+            break;
+        case 'S':
+            shadows = 1;
+            break;
+        case 'K':
+            sky_dirs = atoi(optarg);
+            break;
+        case 'I':
+            contours = 1;
+            gf_init_contour_opts(&copts, 0.0);
+            if (sscanf(optarg, "%lf,%lf", &copts.interval, &copts.base) < 1 ||
+                    copts.interval <= 0.0) {
+                fprintf(stderr, "Bad -I option.\n  Example: '20' or '20,5'\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'W':
+            /* Room for the _fill, _dir and _acc names and their .hdr. */
+            if (snprintf(hydro, sizeof(hydro) - 8, "%s", optarg) >= (int)sizeof(hydro) - 8) {
+                fprintf(stderr, "Hydrology prefix longer than %d characters\n",
+                    (int)sizeof(hydro) - 9);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'G':
+            strcpy(routes_file, optarg);
+            break;
+        case 'Y':
+            count = sscanf(optarg, "%15[a-z],%lf,%lf", model, &qopts.slope_weight,
+                &qopts.max_grade);
+            if (count >= 1 && strcmp(model, "slope") == 0)
+                qopts.cost = GF_ROUTE_SLOPE;
+            else if (count >= 1 && strcmp(model, "tobler") == 0)
+                qopts.cost = GF_ROUTE_TOBLER;
+            else {
+                fprintf(stderr, "Bad -Y option.\n  Example: 'slope,10' or "
+                    "'tobler,0,0.5'\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'F':
+            fill_voids = 1;
+            fopts.max_cells = atol(optarg);
+            break;
+        case 'C':
+            if ((points_fp = fopen(optarg, "r")) == NULL) {
+                fprintf(stderr, "No such color ramp: '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            ramp = (gf_color_ramp *)malloc(sizeof(gf_color_ramp));
+            if (gf_read_color_ramp(points_fp, ramp) != 0)
+                exit(EXIT_FAILURE);
+            fclose(points_fp);
+            break;
+        case 'z':
+            count = sscanf(optarg, "%d,%15[a-z]", &popts.level, filter);
+            for (len = 0; count == 2 && len <= GF_PNG_FILTER_ADAPTIVE; len++)
+                if (strcmp(filter, filters[len]) == 0)
+                    break;
+            if (count < 1 || popts.level < 0 || popts.level > 9 ||
+                (count == 2 && len > GF_PNG_FILTER_ADAPTIVE))
+            {
+                fprintf(stderr, "Bad -z option.\n  Example: '9,paeth' or '1'\n");
+                exit(EXIT_FAILURE);
+            }
+            if (count == 2)
+                popts.filter = (gf_png_filter)len;
+            break;
+        case 'j':
+            snprintf(proj_spec, sizeof(proj_spec), "%s", optarg);
             break;
         default:
             print_usage();
@@ -225,6 +486,19 @@ int main(int argc, char *argv[]) {
         gf_init_grid_bounds(&to_grid, to_grid.left, to_grid.right, to_grid.bottom, to_grid.top, to_grid.ny, to_grid.nx);
     }
 
+    if (proj_spec[0] != '\0') {
+        if (gf_parse_proj(proj_spec, 0.5 * (to_grid.bottom + to_grid.top),
+                0.5 * (to_grid.left + to_grid.right), &proj) != 0) {
+            fprintf(stderr, "Bad -j option.\n  Example: 'webmerc', 'utm' or 'utm:10'\n");
+            exit(EXIT_FAILURE);
+        }
+        pbounds.left = to_grid.left;
+        pbounds.right = to_grid.right;
+        pbounds.bottom = to_grid.bottom;
+        pbounds.top = to_grid.top;
+        gf_init_proj_grid(&pgrid, &proj, &pbounds, to_grid.ny, to_grid.nx);
+    }
+
 
     /* Final unhandled args are gridfloat and header filename pair
        or the shared prefix (no extension) of both gridfloat and
@@ -260,35 +534,239 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    if (info) {
+    if (scan_nulls) {
+        if (gf_scan_nulls(&gf) != 0 || gf_save_nulls(&gf, flt) != 0) {
+            fprintf(stderr, "Failed to scan %s or save its null summary.\n", flt);
+            exit(EXIT_FAILURE);
+        }
+    } else if (info) {
         fprintf(stdout, "data file: %s\nheader file: %s\n", flt, hdr);
         gf_print_grid_info(from_grid);
+    } else if (zonal[0] != '\0') {
+        if (gf_read_polygons(zonal, &polys, &npolys) != 0)
+            exit(EXIT_FAILURE);
+        zstats = (gf_zonal_stats *)malloc(npolys * sizeof(gf_zonal_stats));
+        gf_zonal(&gf, polys, npolys, &zopts, zstats);
+        gf_print_zonal_stats(stdout, polys, npolys, &zopts, zstats);
+        gf_free_zonal_stats(zstats, npolys);
+        free(zstats);
+        gf_free_polygons(polys, npolys);
+    } else if (points[0] != '\0' || path[0] != '\0') {
+        if (path[0] != '\0')
+            strcpy(points, path);
+        if (strcmp(points, "-") == 0)
+            points_fp = stdin;
+        else if ((points_fp = fopen(points, "r")) == NULL) {
+            fprintf(stderr, "No such points file: '%s'\n", points);
+            exit(EXIT_FAILURE);
+        }
+        gf_read_points(points_fp, &pts, &npts);
+        if (points_fp != stdin)
+            fclose(points_fp);
+
+        if (path[0] != '\0') {
+            if (spacing <= 0.0)
+                gf_cellsize_meters(from_grid, &dx_m, &spacing);
+            if ((count = gf_profile_path(&gf, npts, pts, spacing, &prof)) != 0) {
+                if (count == -1)
+                    fprintf(stderr, "Empty path in '%s'\n", path);
+                else
+                    fprintf(stderr, "Failed to read %s\n", flt);
+                exit(EXIT_FAILURE);
+            }
+            gf_print_profile(stdout, &prof);
+            gf_free_profile(&prof);
+        } else {
+            elev = (gf_float *)malloc(npts * sizeof(gf_float));
+            if (gf_sample_points(&gf, npts, pts, elev) != 0) {
+                fprintf(stderr, "Failed to read %s\n", flt);
+                exit(EXIT_FAILURE);
+            }
+            for (count = 0; count < npts; count++)
+                fprintf(stdout, "%f\n", elev[count]);
+            free(elev);
+        }
+        free(pts);
+    } else if (view) {
+        count = gf_viewshed(&gf, observer[0], observer[1], &vopts, &view_grid, &vis);
+        if (count == -1) {
+            fprintf(stderr, "Observer is off the grid or on null ground.\n");
+            exit(EXIT_FAILURE);
+        } else if (count != 0) {
+            fprintf(stderr, "Failed to read %s\n", flt);
+            exit(EXIT_FAILURE);
+        }
+        len = save ? strlen(savename) : 0;
+        count = view_grid.nx * view_grid.ny;
+        if (len > 4 && !strcmp(savename + len - 4, ".png")) {
+            vis_rows = (png_byte **)malloc(view_grid.ny * sizeof(png_byte *));
+            for (opt = 0; opt < count; opt++)
+                vis[opt] = vis[opt] == GF_VISIBLE ? 255 : vis[opt] == GF_HIDDEN ? 96 : 0;
+            for (opt = 0; opt < view_grid.ny; opt++)
+                vis_rows[opt] = vis + opt * view_grid.nx;
+            if (gf_save_png_opts(view_grid.nx, view_grid.ny, vis_rows, 1, PNG_COLOR_TYPE_GRAY,
+                    &popts, savename) != 0) {
+                fprintf(stderr, "Failed to write %s\n", savename);
+                exit(EXIT_FAILURE);
+            }
+            free(vis_rows);
+        } else {
+            data = (gf_float *)malloc(count * sizeof(gf_float));
+            for (opt = 0; opt < count; opt++)
+                data[opt] = vis[opt] == GF_VIEW_NONE ? GF_NULL_VAL : vis[opt];
+            if (save)
+                gf_save(&view_grid, data, savename);
+            else
+                gf_print(&view_grid, data, xy);
+            free(data);
+        }
+        free(vis);
+    } else if (hydro[0] != '\0') {
+        gf_init_hydro_opts(&hopts);
+        snprintf(fill_name, sizeof(fill_name), "%s_fill", hydro);
+        snprintf(dir_name, sizeof(dir_name), "%s_dir", hydro);
+        snprintf(acc_name, sizeof(acc_name), "%s_acc", hydro);
+        if (gf_fill_depressions(&gf, &hopts, fill_name, dir_name) != 0) {
+            fprintf(stderr, "Failed to write %s or %s\n", fill_name, dir_name);
+            exit(EXIT_FAILURE);
+        }
+        snprintf(dir_hdr, sizeof(dir_hdr), "%s.hdr", dir_name);
+        snprintf(dir_flt, sizeof(dir_flt), "%s.flt", dir_name);
+        if (gf_open(dir_hdr, dir_flt, &dirs) != 0 ||
+                gf_flow_accumulation(&dirs, &hopts, acc_name) != 0) {
+            fprintf(stderr, "Failed to write %s\n", acc_name);
+            exit(EXIT_FAILURE);
+        }
+        gf_close(&dirs);
+    } else if (routes_file[0] != '\0') {
+        if (strcmp(routes_file, "-") == 0)
+            points_fp = stdin;
+        else if ((points_fp = fopen(routes_file, "r")) == NULL) {
+            fprintf(stderr, "No such queries file: '%s'\n", routes_file);
+            exit(EXIT_FAILURE);
+        }
+        gf_read_route_queries(points_fp, &queries, &nqueries);
+        if (points_fp != stdin)
+            fclose(points_fp);
+        routes = (gf_route *)malloc((nqueries > 0 ? nqueries : 1) * sizeof(gf_route));
+        gf_route_batch(&gf, &qopts, nqueries, queries, routes);
+        gf_print_routes(stdout, nqueries, routes);
+        for (count = 0; count < nqueries; count++)
+            gf_free_route(&routes[count]);
+        free(routes);
+        free(queries);
+    } else if (contours) {
+        len = strlen(savename);
+        if (save && len > 4 && !strcmp(savename + len - 4, ".png")) {
+            fprintf(stderr, "-I writes GeoJSON or binary contours, not PNG.\n");
+            exit(EXIT_FAILURE);
+        }
+        switch (gf_contour_lines(&gf, &to_grid, &copts, &lines)) {
+        case 0:
+            break;
+        case -2:
+            fprintf(stderr, "Extraction grid is too small for contours (%dx%d).\n",
+                to_grid.nx, to_grid.ny);
+            exit(EXIT_FAILURE);
+        default:
+            fprintf(stderr, "Failed to contour %s\n", flt);
+            exit(EXIT_FAILURE);
+        }
+        if (save && gf_save_contours(&lines, savename) != 0) {
+            fprintf(stderr, "Failed to write %s\n", savename);
+            exit(EXIT_FAILURE);
+        } else if (!save) {
+            gf_write_contours_geojson(stdout, &lines);
+        }
+        gf_free_contours(&lines);
     } else if (save) {
         len = strlen(savename);
         if (len > 4 && !strcmp(savename + len - 4, ".png")) {
-            polar *= PI / 180.0;
-            azimuth *= PI / 180.0;
+            if (npolar > 1 && nazimuth > 1 && npolar != nazimuth) {
+                fprintf(stderr, "-A and -P lists differ in length.\n");
+                exit(EXIT_FAILURE);
+            }
+            nframes = npolar > nazimuth ? npolar : nazimuth;
+            n_suns = (double *)malloc(3 * nframes * sizeof(double));
+            for (count = 0; count < nframes; count++) {
+                phi = polar[npolar > 1 ? count : 0] * PI / 180.0;
+                theta = azimuth[nazimuth > 1 ? count : 0] * PI / 180.0;
+                n_suns[3 * count] = cos(phi) * cos(theta);
+                n_suns[3 * count + 1] = cos(phi) * sin(theta);
+                n_suns[3 * count + 2] = sin(phi);
+            }
 
-            n_sun[0] = cos(polar) * cos(azimuth);
-            n_sun[1] = cos(polar) * sin(azimuth);
-            n_sun[2] = sin(polar);
-            gf_relief_shade(&gf, &to_grid, n_sun, savename);
+            gf_init_relief_opts(&ropts, n_suns);
+            ropts.shadows = shadows;
+            ropts.sky_dirs = sky_dirs;
+            ropts.ramp = ramp;
+            ropts.png = &popts;
+            if (proj_spec[0] != '\0') {
+                if (nframes > 1 || shadows || sky_dirs > 0) {
+                    fprintf(stderr, "-j does not support -S, -K or frames.\n");
+                    exit(EXIT_FAILURE);
+                }
+                if (gf_relief_shade_proj(&gf, &pgrid, &ropts, savename) != 0) {
+                    fprintf(stderr, "Failed to write %s\n", savename);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (nframes == 1) {
+                if (gf_relief_shade_opts(&gf, &to_grid, &ropts, savename) != 0) {
+                    fprintf(stderr, "Failed to write %s\n", savename);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (gf_relief_shade_frames(&gf, &to_grid, nframes, n_suns, &ropts, savename) != 0) {
+                fprintf(stderr, "Failed to write %s\n", savename);
+                exit(EXIT_FAILURE);
+            }
+            free(n_suns);
+            free(ramp);
+        } else if (proj_spec[0] != '\0') {
+            if (len > 4 && !strcmp(savename + len - 4, ".stl")) {
+                fprintf(stderr, "-j does not support STL output.\n");
+                exit(EXIT_FAILURE);
+            }
+            data = (gf_float *)malloc(pgrid.grid.nx * pgrid.grid.ny * sizeof(gf_float));
+            gf_proj_interpolate(&gf, &pgrid, data);
+            if (fill_voids)
+                gf_fill_voids(&pgrid.grid, &fopts, data);
+            gf_proj_save(&pgrid, data, savename);
+            free(data);
         } else if (len > 4 && !strcmp(savename + len - 4, ".stl")) {
             data = (gf_float *)malloc(to_grid.nx * to_grid.ny * sizeof(gf_float));
             gf_bilinear_interpolate(&gf, &to_grid, data);
+            if (fill_voids)
+                gf_fill_voids(&to_grid, &fopts, data);
             gf_save_stl(&to_grid, data, savename);
             free(data);
         } else {
             data = (gf_float *)malloc(to_grid.nx * to_grid.ny * sizeof(gf_float));
             gf_bilinear_interpolate(&gf, &to_grid, data);
+            if (fill_voids)
+                gf_fill_voids(&to_grid, &fopts, data);
             gf_save(&to_grid, data, savename);
             free(data);
         }
 
         exit(EXIT_SUCCESS);
+    } else if (proj_spec[0] != '\0') {
+        data = (gf_float *)malloc(pgrid.grid.nx * pgrid.grid.ny * sizeof(gf_float));
+        gf_proj_interpolate(&gf, &pgrid, data);
+        if (fill_voids)
+            gf_fill_voids(&pgrid.grid, &fopts, data);
+        gf_print(&pgrid.grid, data, xy);
+        free(data);
+    } else if (xy && !fill_voids) {
+        /* Interpolate straight into the -T layout. */
+        data = (gf_float *)malloc(to_grid.nx * to_grid.ny * sizeof(gf_float));
+        gf_bilinear_interpolate_xy(&gf, &to_grid, data);
+        gf_print_xy(&to_grid, data);
+        free(data);
     } else {
         data = (gf_float *)malloc(to_grid.nx * to_grid.ny * sizeof(gf_float));
         gf_bilinear_interpolate(&gf, &to_grid, data);
+        if (fill_voids)
+            gf_fill_voids(&to_grid, &fopts, data);
         gf_print(&to_grid, data, xy);
         free(data);
     }
@@ -0,0 +1,264 @@
+#include "points.h"
+#include "cache.h"
+#include "pool.h"
+#include "sort.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Below this many points a batch is not worth splitting. */
+#define POINTS_MIN_RUN 4096
+
+/* Cache blocks per thread (GF_CACHE_BLOCK^2 floats each). */
+#define POINTS_CACHE_BLOCKS 64
+
+typedef struct gf_point_key {
+    int64_t d;
+    int index;
+} gf_point_key;
+
+typedef struct gf_points_job {
+    const gf_struct *gf;
+    const double *latlng;
+    const gf_point_key *keys;
+    int n;
+    int nruns;
+    gf_bilinear_kernel *kernel;
+    void *xtras;
+    unsigned char *data;
+    size_t elem_size;
+    int failed;     /* Runs that could not read the source */
+} gf_points_job;
+
+
+static
+int gf_point_key_cmp(const void *a, const void *b) {
+    int64_t d1 = ((const gf_point_key *)a)->d, d2 = ((const gf_point_key *)b)->d;
+    if (d1 < d2) return -1;
+    else if (d1 == d2) return 0;
+    else return 1;
+}
+
+
+/**
+ * Upper-left node of the quad around (lat, lng) and the y/x
+ * weights, as in gf_bilinear. Points on the right or bottom edge use
+ * the last full quad with a weight of one. Returns nonzero outside
+ * the source.
+ */
+static
+int gf_point_quad(const gf_grid *g, double lat, double lng, long *ii, long *jj, double *w) {
+    double y, x;
+
+    if (lat > g->top || lat < g->bottom || lng < g->left || lng > g->right)
+        return -1;
+
+    y = (g->top - lat) / g->dy;
+    x = (lng - g->left) / g->dx;
+    *ii = (long)y;
+    *jj = (long)x;
+    if (*ii > g->ny - 2)
+        *ii = g->ny - 2;
+    if (*jj > g->nx - 2)
+        *jj = g->nx - 2;
+    w[0] = y - *ii;
+    w[1] = x - *jj;
+    return 0;
+}
+
+
+static
+void gf_points_task(int run, void *arg) {
+    gf_points_job *job = (gf_points_job *)arg;
+    const gf_grid *g = &job->gf->grid;
+    gf_block_cache cache;
+    gf_float quad[4];
+    double w[2], latlng[2];
+    long ii, jj;
+    int k, k0, k1, p;
+
+    k0 = (int)((long)job->n * run / job->nruns);
+    k1 = (int)((long)job->n * (run + 1) / job->nruns);
+
+    if (gf_init_block_cache(&cache, job->gf, POINTS_CACHE_BLOCKS) != 0) {
+        __sync_fetch_and_add(&job->failed, 1);
+        return;
+    }
+
+    for (k = k0; k < k1; k++) {
+        p = job->keys[k].index;
+        latlng[0] = job->latlng[2 * p];
+        latlng[1] = job->latlng[2 * p + 1];
+        if (gf_point_quad(g, latlng[0], latlng[1], &ii, &jj, w) != 0)
+            continue;
+
+        gf_cache_quad(&cache, ii, jj, quad);
+        (*job->kernel)(quad, g, w, latlng, job->xtras,
+            (void *)(job->data + (size_t)p * job->elem_size));
+    }
+
+    if (cache.failed > 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    gf_free_block_cache(&cache);
+}
+
+
+int gf_sample_points_kernel(const gf_struct *gf, int n, const double *latlng,
+    gf_bilinear_kernel *kernel, void *xtras, void *data, size_t elem_size)
+{
+    const gf_grid *g = &gf->grid;
+    gf_points_job job;
+    gf_point_key *keys;
+    int64_t side = 1;
+    long ii, jj;
+    double w[2];
+    int k;
+
+    if (n <= 0)
+        return 0;
+    if (g->nx < 2 || g->ny < 2)
+        return -1;
+
+    if ((keys = (gf_point_key *)malloc(n * sizeof(gf_point_key))) == NULL)
+        return -1;
+
+    while (side < g->nx || side < g->ny)
+        side *= 2;
+
+    /* Points outside the source sort to the front; they are skipped. */
+    for (k = 0; k < n; k++) {
+        keys[k].index = k;
+        if (gf_point_quad(g, latlng[2 * k], latlng[2 * k + 1], &ii, &jj, w) != 0)
+            keys[k].d = -1;
+        else
+            keys[k].d = gf_hilbert_index(side, jj, ii);
+    }
+    qsort(keys, n, sizeof(gf_point_key), &gf_point_key_cmp);
+
+    job.gf = gf;
+    job.latlng = latlng;
+    job.keys = keys;
+    job.n = n;
+    job.kernel = kernel;
+    job.xtras = xtras;
+    job.data = (unsigned char *)data;
+    job.elem_size = elem_size;
+    job.nruns = gf_num_threads();
+    if (job.nruns > n / POINTS_MIN_RUN)
+        job.nruns = n / POINTS_MIN_RUN;
+    if (job.nruns < 1)
+        job.nruns = 1;
+    job.failed = 0;
+
+    gf_parallel_for(job.nruns, job.nruns, &gf_points_task, (void *)&job);
+
+    free(keys);
+    return job.failed ? -1 : 0;
+}
+
+
+int gf_sample_points(const gf_struct *gf, int n, const double *latlng, gf_float *out) {
+    int k;
+
+    for (k = 0; k < n; k++)
+        out[k] = GF_NULL_VAL;
+
+    return gf_sample_points_kernel(gf, n, latlng,
+        &gf_bilinear_interpolate_kernel, NULL, (void *)out, sizeof(gf_float));
+}
+
+
+int gf_db_sample_points(gf_db *db, int n, const double *latlng, gf_float *out) {
+    gf_rtree_node **found_nodes;
+    gf_bounds b;
+    int *tile_of, *start, *order;
+    double *sub_latlng;
+    gf_float *sub_out;
+    int k, t, found, m, err = 0;
+
+    for (k = 0; k < n; k++)
+        out[k] = GF_NULL_VAL;
+    if (n <= 0 || db->count == 0 || db->tree == NULL)
+        return 0;
+
+    found_nodes = (gf_rtree_node **)malloc(db->count * sizeof(gf_rtree_node *));
+    tile_of = (int *)malloc(n * sizeof(int));
+    start = (int *)calloc(db->count + 1, sizeof(int));
+    order = (int *)malloc(n * sizeof(int));
+
+    /* Tile of each point, then a counting sort of points by tile. */
+    for (k = 0; k < n; k++) {
+        b.left = b.right = latlng[2 * k + 1];
+        b.bottom = b.top = latlng[2 * k];
+        gf_search_rtree(&b, db->tree, found_nodes, &found);
+        tile_of[k] = found > 0 ? (int)(found_nodes[0]->gf - db->tiles) : -1;
+        if (tile_of[k] >= 0)
+            start[tile_of[k] + 1]++;
+    }
+    for (t = 0; t < db->count; t++)
+        start[t + 1] += start[t];
+    for (k = 0; k < n; k++)
+        if (tile_of[k] >= 0)
+            order[start[tile_of[k]]++] = k;
+    /* start[t] is now the end of tile t's run; shift back. */
+    for (t = db->count; t > 0; t--)
+        start[t] = start[t - 1];
+    start[0] = 0;
+
+    sub_latlng = (double *)malloc(2 * n * sizeof(double));
+    sub_out = (gf_float *)malloc(n * sizeof(gf_float));
+
+    for (t = 0; t < db->count && err == 0; t++) {
+        if ((m = start[t + 1] - start[t]) == 0)
+            continue;
+
+        for (k = 0; k < m; k++) {
+            sub_latlng[2 * k] = latlng[2 * order[start[t] + k]];
+            sub_latlng[2 * k + 1] = latlng[2 * order[start[t] + k] + 1];
+        }
+        err = gf_sample_points(&db->tiles[t], m, sub_latlng, sub_out);
+        for (k = 0; k < m; k++)
+            out[order[start[t] + k]] = sub_out[k];
+    }
+
+    free(sub_latlng);
+    free(sub_out);
+    free(found_nodes);
+    free(tile_of);
+    free(start);
+    free(order);
+    return err;
+}
+
+
+int gf_read_points(FILE *fp, double **latlng, int *n) {
+    char *line = NULL, *tok, *saveptr;
+    size_t line_cap = 0;
+    int cap = 0;
+    double lat;
+
+    *latlng = NULL;
+    *n = 0;
+
+    while (getline(&line, &line_cap, fp) != -1) {
+        tok = strtok_r(line, " ,\t\r\n", &saveptr);
+        if (tok == NULL || tok[0] == '#')
+            continue;
+        lat = atof(tok);
+        if ((tok = strtok_r(NULL, " ,\t\r\n", &saveptr)) == NULL) {
+            fprintf(stderr, "Skipping point without a longitude\n");
+            continue;
+        }
+
+        if (*n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            *latlng = (double *)realloc(*latlng, 2 * cap * sizeof(double));
+        }
+        (*latlng)[2 * *n] = lat;
+        (*latlng)[2 * *n + 1] = atof(tok);
+        (*n)++;
+    }
+
+    free(line);
+    return 0;
+}
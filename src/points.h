@@ -0,0 +1,46 @@
+#ifndef GF_POINTS_H
+#define GF_POINTS_H
+
+#include "gridfloat.h"
+#include "linear.h"
+#include "db.h"
+
+/**
+ * Batched sampling at scattered points.
+ *
+ * Points are given as n interleaved (lat, lng) pairs. They are
+ * visited in Hilbert order over the source grid, so consecutive
+ * lookups land in the same few blocks of a gf_block_cache, and the
+ * sorted batch is split into contiguous runs that are sampled in
+ * parallel. Results are written back in input order.
+ */
+
+/**
+ * Call kernel on the bilinear quad around each point, exactly as
+ * gf_bilinear does for the nodes of a grid. The kernel writes
+ * elem_size bytes at data + k * elem_size for point k. Points outside
+ * the source are left untouched. Returns -1 if the source is smaller
+ * than 2x2 or a block of it cannot be read (points in it are then
+ * sampled as NODATA).
+ */
+int gf_sample_points_kernel(const gf_struct *gf, int n, const double *latlng,
+    gf_bilinear_kernel *kernel, void *xtras, void *data, size_t elem_size);
+
+/* Bilinear elevation at each point; GF_NULL_VAL outside the source. */
+int gf_sample_points(const gf_struct *gf, int n, const double *latlng, gf_float *out);
+
+/**
+ * As gf_sample_points, across all tiles of a database. Each point is
+ * sampled from the first tile found to contain it.
+ */
+int gf_db_sample_points(gf_db *db, int n, const double *latlng, gf_float *out);
+
+/**
+ * Read points for gf_sample_points from a text stream, one "lat lng"
+ * pair per line (commas also separate). Blank lines and lines
+ * starting with '#' are skipped. On success *latlng is malloc'd and
+ * *n holds the number of points.
+ */
+int gf_read_points(FILE *fp, double **latlng, int *n);
+
+#endif
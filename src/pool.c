@@ -0,0 +1,93 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define MAX_THREADS 256
+
+typedef struct gf_pool_job {
+    int next;
+    int n;
+    gf_task *task;
+    void *arg;
+    pthread_mutex_t lock;
+} gf_pool_job;
+
+/* Set while this thread runs tasks of a multithreaded gf_parallel_for. */
+static __thread int gf_pool_inside;
+
+
+int gf_num_threads(void) {
+    char *env;
+    long n;
+
+    if ((env = getenv("GF_THREADS")) != NULL && (n = atol(env)) > 0)
+        return n < MAX_THREADS ? (int)n : MAX_THREADS;
+
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        return 1;
+    return n < MAX_THREADS ? (int)n : MAX_THREADS;
+}
+
+
+static
+void *gf_pool_worker(void *arg) {
+    gf_pool_job *job = (gf_pool_job *)arg;
+    int i, inside = gf_pool_inside;
+
+    gf_pool_inside = 1;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (i >= job->n)
+            break;
+        job->task(i, job->arg);
+    }
+    gf_pool_inside = inside;
+    return NULL;
+}
+
+
+int gf_parallel_for(int n, int nthreads, gf_task *task, void *arg) {
+    pthread_t threads[MAX_THREADS];
+    gf_pool_job job;
+    int i, started;
+
+    /* Inside a task the other threads are busy already: a default
+    nested loop runs inline instead of multiplying them. */
+    if (nthreads <= 0)
+        nthreads = gf_pool_inside ? 1 : gf_num_threads();
+    if (nthreads > n)
+        nthreads = n;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    if (nthreads <= 1) {
+        for (i = 0; i < n; i++)
+            task(i, arg);
+        return 0;
+    }
+
+    job.next = 0;
+    job.n = n;
+    job.task = task;
+    job.arg = arg;
+    pthread_mutex_init(&job.lock, NULL);
+
+    /* The calling thread works too, so spawn one fewer. */
+    for (started = 0; started < nthreads - 1; started++)
+        if (pthread_create(&threads[started], NULL, gf_pool_worker, &job) != 0)
+            break;
+
+    gf_pool_worker(&job);
+
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&job.lock);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef GF_POOL_H
+#define GF_POOL_H
+
+/**
+ * Minimal fork/join parallelism for the gridfloat engines.
+ *
+ * Work is expressed as n independent tasks, indexed 0..n-1. Worker
+ * threads pull the next unclaimed index until none remain, so tasks
+ * of uneven cost balance themselves.
+ */
+
+typedef void (gf_task)(int index, void *arg);
+
+/**
+ * Number of threads engines use by default. Taken from the
+ * GF_THREADS environment variable if set, otherwise the number of
+ * online processors.
+ */
+int gf_num_threads(void);
+
+/**
+ * Run task(i, arg) for i in [0, n) on up to nthreads threads
+ * (nthreads <= 0 means gf_num_threads(), or just the calling thread
+ * when that is already running a task of a multithreaded
+ * gf_parallel_for). Blocks until every task has returned. With one
+ * thread (or one task) everything runs inline on the calling thread.
+ */
+int gf_parallel_for(int n, int nthreads, gf_task *task, void *arg);
+
+#endif
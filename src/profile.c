@@ -0,0 +1,108 @@
+#include "profile.h"
+#include "points.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+
+/* Length in meters of the segment between two (lat, lng) vertices. */
+static
+double gf_segment_length(const double *a, const double *b) {
+    double dx_m, dy_m;
+
+    gf_lengths(0.5 * (a[0] + b[0]), 0.5 * (a[1] + b[1]),
+        b[0] - a[0], b[1] - a[1], 0.0, &dx_m, &dy_m);
+    return sqrt(dx_m * dx_m + dy_m * dy_m);
+}
+
+
+int gf_profile_path(const gf_struct *gf, int nv, const double *latlng,
+    double spacing, gf_profile *prof)
+{
+    double *seg, total = 0.0, d, t, last;
+    int v, k, n, cap;
+
+    prof->n = 0;
+    prof->latlng = prof->dist = prof->ascent = prof->descent = NULL;
+    prof->elev = NULL;
+
+    if (nv < 1 || spacing <= 0.0)
+        return -1;
+
+    seg = (double *)malloc(nv * sizeof(double));
+    for (v = 0; v + 1 < nv; v++) {
+        seg[v] = gf_segment_length(latlng + 2 * v, latlng + 2 * (v + 1));
+        total += seg[v];
+    }
+
+    cap = (int)(total / spacing) + 2;
+    prof->latlng = (double *)malloc(2 * cap * sizeof(double));
+    prof->dist = (double *)malloc(cap * sizeof(double));
+    prof->elev = (gf_float *)malloc(cap * sizeof(gf_float));
+    prof->ascent = (double *)malloc(cap * sizeof(double));
+    prof->descent = (double *)malloc(cap * sizeof(double));
+
+    /* Samples at multiples of spacing; d is the start of segment v. */
+    n = 0;
+    d = 0.0;
+    for (v = 0; v + 1 < nv; v++) {
+        for (k = (int)ceil(d / spacing); k * spacing < d + seg[v] && n < cap - 1; k++) {
+            t = seg[v] > 0.0 ? (k * spacing - d) / seg[v] : 0.0;
+            prof->latlng[2 * n] = latlng[2 * v] + t * (latlng[2 * v + 2] - latlng[2 * v]);
+            prof->latlng[2 * n + 1] = latlng[2 * v + 1] + t * (latlng[2 * v + 3] - latlng[2 * v + 1]);
+            prof->dist[n++] = k * spacing;
+        }
+        d += seg[v];
+    }
+    prof->latlng[2 * n] = latlng[2 * (nv - 1)];
+    prof->latlng[2 * n + 1] = latlng[2 * (nv - 1) + 1];
+    prof->dist[n++] = total;
+    prof->n = n;
+    free(seg);
+
+    if (gf_sample_points(gf, n, prof->latlng, prof->elev) != 0)
+        return -2;
+
+    last = GF_NULL_VAL;
+    for (k = 0; k < n; k++) {
+        prof->ascent[k] = k > 0 ? prof->ascent[k - 1] : 0.0;
+        prof->descent[k] = k > 0 ? prof->descent[k - 1] : 0.0;
+        if (prof->elev[k] == GF_NULL_VAL)
+            continue;
+        if (last != GF_NULL_VAL) {
+            if (prof->elev[k] > last)
+                prof->ascent[k] += prof->elev[k] - last;
+            else
+                prof->descent[k] += last - prof->elev[k];
+        }
+        last = prof->elev[k];
+    }
+
+    return 0;
+}
+
+
+void gf_free_profile(gf_profile *prof) {
+    free(prof->latlng);
+    free(prof->dist);
+    free(prof->elev);
+    free(prof->ascent);
+    free(prof->descent);
+    prof->n = 0;
+}
+
+
+void gf_print_profile(FILE *fp, const gf_profile *prof) {
+    int k;
+
+    fprintf(fp, "dist\tlat\tlng\telev\tascent\tdescent\n");
+    for (k = 0; k < prof->n; k++) {
+        fprintf(fp, "%f\t%f\t%f\t", prof->dist[k],
+            prof->latlng[2 * k], prof->latlng[2 * k + 1]);
+        if (prof->elev[k] == GF_NULL_VAL)
+            fprintf(fp, "\t");
+        else
+            fprintf(fp, "%f\t", prof->elev[k]);
+        fprintf(fp, "%f\t%f\n", prof->ascent[k], prof->descent[k]);
+    }
+}
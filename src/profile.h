@@ -0,0 +1,45 @@
+#ifndef GF_PROFILE_H
+#define GF_PROFILE_H
+
+#include "gridfloat.h"
+
+/**
+ * Elevation profile along a polyline.
+ *
+ * @n - Number of samples.
+ * @latlng - 2 * n doubles: lat0, lng0, lat1, lng1, ...
+ * @dist - Distance (m) from the start of the path to each sample.
+ * @elev - Bilinear elevation; GF_NULL_VAL off the grid or in voids.
+ * @ascent - Cumulative climb (m) up to each sample.
+ * @descent - Cumulative drop (m) up to each sample, positive.
+ */
+typedef struct gf_profile {
+    int n;
+    double *latlng;
+    double *dist;
+    gf_float *elev;
+    double *ascent;
+    double *descent;
+} gf_profile;
+
+/**
+ * Sample a polyline of nv (lat, lng) vertices every spacing meters,
+ * plus its last vertex. Segment lengths use gf_lengths at each
+ * segment's midpoint. Samples are read with gf_sample_points, so only
+ * the blocks of the source the path crosses are touched.
+ *
+ * Null samples do not count toward ascent or descent; the climb is
+ * taken between the valid samples on either side.
+ *
+ * Returns 0, -1 for an empty path or nonpositive spacing, or -2 if
+ * the source could not be sampled. prof is to be freed either way.
+ */
+int gf_profile_path(const gf_struct *gf, int nv, const double *latlng,
+    double spacing, gf_profile *prof);
+
+void gf_free_profile(gf_profile *prof);
+
+/* Tab-separated table: dist, lat, lng, elev, ascent, descent. */
+void gf_print_profile(FILE *fp, const gf_profile *prof);
+
+#endif
@@ -0,0 +1,527 @@
+#include "proj.h"
+#include "cache.h"
+#include "pool.h"
+#include "stencil.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PJ_PI 3.14159265358979323846
+#define PJ_DEG (PJ_PI / 180.0)
+
+/* WGS84, and the sphere of Web Mercator. */
+#define PJ_A 6378137.0
+#define PJ_F (1.0 / 298.257223563)
+
+/* UTM scale on the central meridian and false origin. */
+#define PJ_K0 0.9996
+#define PJ_FE 500000.0
+#define PJ_FN_SOUTH 10000000.0
+
+/* Web Mercator stops here (the map is square). */
+#define PJ_MERC_LAT 85.05112877980659
+
+/* Points followed along each edge of the box in gf_init_proj_grid. */
+#define PJ_EDGE_SAMPLES 64
+
+
+int gf_parse_proj(const char *spec, double lat, double lng, gf_proj *proj) {
+    char hemi = '\0';
+    int count;
+
+    memset((void *)proj, 0, sizeof(gf_proj));
+
+    if (strcmp(spec, "webmerc") == 0 || strcmp(spec, "3857") == 0) {
+        proj->type = GF_PROJ_WEBMERC;
+        return 0;
+    }
+    if (strncmp(spec, "utm", 3) != 0)
+        return -1;
+
+    proj->type = GF_PROJ_UTM;
+    if (spec[3] == '\0') {
+        proj->zone = (int)floor((lng + 180.0) / 6.0) + 1;
+        if (proj->zone > 60)
+            proj->zone = 60;
+        if (proj->zone < 1)
+            proj->zone = 1;
+        proj->south = lat < 0.0;
+        return 0;
+    }
+
+    count = sscanf(spec + 3, ":%d%c", &proj->zone, &hemi);
+    if (count < 1 || proj->zone < 1 || proj->zone > 60)
+        return -1;
+    if (count == 2 && hemi != 'n' && hemi != 's' && hemi != 'N' && hemi != 'S')
+        return -1;
+    proj->south = hemi == 's' || hemi == 'S';
+    return 0;
+}
+
+
+/**
+ * Krüger's series for the transverse Mercator, to third order in the
+ * third flattening n (sub-millimeter within a zone): the rectifying
+ * radius A and the forward (alpha), inverse (beta) and conformal to
+ * geodetic latitude (delta) coefficients.
+ */
+static
+void pj_kruger(double *A, double *alpha, double *beta, double *delta) {
+    double n = PJ_F / (2.0 - PJ_F), n2 = n * n, n3 = n2 * n;
+
+    *A = PJ_A / (1.0 + n) * (1.0 + n2 / 4.0 + n2 * n2 / 64.0);
+
+    alpha[0] = n / 2.0 - 2.0 / 3.0 * n2 + 5.0 / 16.0 * n3;
+    alpha[1] = 13.0 / 48.0 * n2 - 3.0 / 5.0 * n3;
+    alpha[2] = 61.0 / 240.0 * n3;
+
+    beta[0] = n / 2.0 - 2.0 / 3.0 * n2 + 37.0 / 96.0 * n3;
+    beta[1] = 1.0 / 48.0 * n2 + 1.0 / 15.0 * n3;
+    beta[2] = 17.0 / 480.0 * n3;
+
+    delta[0] = 2.0 * n - 2.0 / 3.0 * n2 - 2.0 * n3;
+    delta[1] = 7.0 / 3.0 * n2 - 8.0 / 5.0 * n3;
+    delta[2] = 56.0 / 15.0 * n3;
+}
+
+
+static
+double pj_utm_meridian(int zone) {
+    return 6.0 * zone - 183.0;
+}
+
+
+void gf_proj_forward(const gf_proj *proj, double lat, double lng, double *x, double *y) {
+    double A, alpha[3], beta[3], delta[3];
+    double n, c, t, xi, eta, e, s, phi, lam;
+    int j;
+
+    if (proj->type == GF_PROJ_WEBMERC) {
+        if (lat > PJ_MERC_LAT)
+            lat = PJ_MERC_LAT;
+        else if (lat < -PJ_MERC_LAT)
+            lat = -PJ_MERC_LAT;
+        *x = PJ_A * lng * PJ_DEG;
+        *y = PJ_A * log(tan(0.25 * PJ_PI + 0.5 * lat * PJ_DEG));
+        return;
+    }
+
+    pj_kruger(&A, alpha, beta, delta);
+    n = PJ_F / (2.0 - PJ_F);
+    c = 2.0 * sqrt(n) / (1.0 + n);
+
+    phi = lat * PJ_DEG;
+    lam = (lng - pj_utm_meridian(proj->zone)) * PJ_DEG;
+
+    /* Conformal latitude, then Gauss-Schreiber coordinates. */
+    s = sin(phi);
+    t = sinh(atanh(s) - c * atanh(c * s));
+    xi = atan2(t, cos(lam));
+    eta = atanh(sin(lam) / sqrt(1.0 + t * t));
+
+    e = eta;
+    s = xi;
+    for (j = 1; j <= 3; j++) {
+        e += alpha[j - 1] * cos(2 * j * xi) * sinh(2 * j * eta);
+        s += alpha[j - 1] * sin(2 * j * xi) * cosh(2 * j * eta);
+    }
+
+    *x = PJ_FE + PJ_K0 * A * e;
+    *y = (proj->south ? PJ_FN_SOUTH : 0.0) + PJ_K0 * A * s;
+}
+
+
+void gf_proj_inverse(const gf_proj *proj, double x, double y, double *lat, double *lng) {
+    double A, alpha[3], beta[3], delta[3];
+    double xi, eta, xi1, eta1, chi;
+    int j;
+
+    if (proj->type == GF_PROJ_WEBMERC) {
+        *lat = (2.0 * atan(exp(y / PJ_A)) - 0.5 * PJ_PI) / PJ_DEG;
+        *lng = x / PJ_A / PJ_DEG;
+        return;
+    }
+
+    pj_kruger(&A, alpha, beta, delta);
+
+    xi = (y - (proj->south ? PJ_FN_SOUTH : 0.0)) / (PJ_K0 * A);
+    eta = (x - PJ_FE) / (PJ_K0 * A);
+
+    xi1 = xi;
+    eta1 = eta;
+    for (j = 1; j <= 3; j++) {
+        xi1 -= beta[j - 1] * sin(2 * j * xi) * cosh(2 * j * eta);
+        eta1 -= beta[j - 1] * cos(2 * j * xi) * sinh(2 * j * eta);
+    }
+
+    chi = asin(sin(xi1) / cosh(eta1));
+    *lat = chi;
+    for (j = 1; j <= 3; j++)
+        *lat += delta[j - 1] * sin(2 * j * chi);
+    *lat /= PJ_DEG;
+    *lng = pj_utm_meridian(proj->zone) + atan2(sinh(eta1), cos(xi1)) / PJ_DEG;
+}
+
+
+void gf_init_proj_grid(gf_proj_grid *pg, const gf_proj *proj, const gf_bounds *b,
+    int ny, int nx)
+{
+    double x, y, lat, lng, f, l = INFINITY, r = -INFINITY, bot = INFINITY, top = -INFINITY;
+    int k, e;
+
+    pg->proj = *proj;
+
+    /* Edges in turn: bottom, top, left, right. */
+    for (e = 0; e < 4; e++) {
+        for (k = 0; k <= PJ_EDGE_SAMPLES; k++) {
+            f = (double)k / PJ_EDGE_SAMPLES;
+            if (e < 2) {
+                lat = e == 0 ? b->bottom : b->top;
+                lng = b->left + f * (b->right - b->left);
+            } else {
+                lat = b->bottom + f * (b->top - b->bottom);
+                lng = e == 2 ? b->left : b->right;
+            }
+            gf_proj_forward(proj, lat, lng, &x, &y);
+            l = x < l ? x : l;
+            r = x > r ? x : r;
+            bot = y < bot ? y : bot;
+            top = y > top ? y : top;
+        }
+    }
+
+    gf_init_grid_bounds(&pg->grid, l, r, bot, top, ny, nx);
+}
+
+
+/**
+ * Where each node of a projected grid falls in lat/lng. Web Mercator
+ * keeps a latitude per row and a longitude per column; UTM keeps the
+ * exact transform of every GF_PROJ_STEP-th node (and the last row and
+ * column) and interpolates the rest.
+ */
+typedef struct pj_table {
+    const gf_proj_grid *pg;
+    double *row_lat;    /* Web Mercator */
+    double *col_lng;
+    int cy, cx;         /* UTM control nodes down and across */
+    double *clat;       /* cy x cx */
+    double *clng;
+} pj_table;
+
+
+/* Node index of control node c of n nodes. */
+static inline
+int pj_control(int c, int n) {
+    return c * GF_PROJ_STEP < n - 1 ? c * GF_PROJ_STEP : n - 1;
+}
+
+
+static
+int pj_init_table(pj_table *tab, const gf_proj_grid *pg) {
+    const gf_grid *g = &pg->grid;
+    double unused;
+    int i, j, r, c;
+
+    memset((void *)tab, 0, sizeof(pj_table));
+    tab->pg = pg;
+
+    if (pg->proj.type == GF_PROJ_WEBMERC) {
+        tab->row_lat = (double *)malloc(g->ny * sizeof(double));
+        tab->col_lng = (double *)malloc(g->nx * sizeof(double));
+        if (tab->row_lat == NULL || tab->col_lng == NULL)
+            return -1;
+        for (i = 0; i < g->ny; i++)
+            gf_proj_inverse(&pg->proj, g->left, g->top - i * g->dy, &tab->row_lat[i], &unused);
+        for (j = 0; j < g->nx; j++)
+            gf_proj_inverse(&pg->proj, g->left + j * g->dx, 0.0, &unused, &tab->col_lng[j]);
+        return 0;
+    }
+
+    tab->cy = (g->ny - 2) / GF_PROJ_STEP + 2;
+    tab->cx = (g->nx - 2) / GF_PROJ_STEP + 2;
+    tab->clat = (double *)malloc((long)tab->cy * tab->cx * sizeof(double));
+    tab->clng = (double *)malloc((long)tab->cy * tab->cx * sizeof(double));
+    if (tab->clat == NULL || tab->clng == NULL)
+        return -1;
+    for (r = 0; r < tab->cy; r++) {
+        i = pj_control(r, g->ny);
+        for (c = 0; c < tab->cx; c++) {
+            j = pj_control(c, g->nx);
+            gf_proj_inverse(&pg->proj, g->left + j * g->dx, g->top - i * g->dy,
+                &tab->clat[r * tab->cx + c], &tab->clng[r * tab->cx + c]);
+        }
+    }
+    return 0;
+}
+
+
+static
+void pj_free_table(pj_table *tab) {
+    free(tab->row_lat);
+    free(tab->col_lng);
+    free(tab->clat);
+    free(tab->clng);
+}
+
+
+/* Lat/lng of the nodes of row i. */
+static
+void pj_row(const pj_table *tab, int i, double *lat, double *lng) {
+    const gf_grid *g = &tab->pg->grid;
+    const double *la0, *la1, *ln0, *ln1;
+    double v, u, a0, a1, b0, b1;
+    int j, j0, j1, r, c;
+
+    if (tab->row_lat != NULL) {
+        for (j = 0; j < g->nx; j++) {
+            lat[j] = tab->row_lat[i];
+            lng[j] = tab->col_lng[j];
+        }
+        return;
+    }
+
+    /* Between control rows r and r + 1, then control columns. */
+    r = i / GF_PROJ_STEP < tab->cy - 1 ? i / GF_PROJ_STEP : tab->cy - 2;
+    j0 = pj_control(r, g->ny);
+    v = (double)(i - j0) / (pj_control(r + 1, g->ny) - j0);
+    la0 = tab->clat + r * tab->cx;
+    la1 = la0 + tab->cx;
+    ln0 = tab->clng + r * tab->cx;
+    ln1 = ln0 + tab->cx;
+
+    for (c = 0; c < tab->cx - 1; c++) {
+        j0 = pj_control(c, g->nx);
+        j1 = pj_control(c + 1, g->nx);
+        a0 = la0[c] + v * (la1[c] - la0[c]);
+        a1 = la0[c + 1] + v * (la1[c + 1] - la0[c + 1]);
+        b0 = ln0[c] + v * (ln1[c] - ln0[c]);
+        b1 = ln0[c + 1] + v * (ln1[c + 1] - ln0[c + 1]);
+        for (j = j0; j < j1 || (j == j1 && c == tab->cx - 2); j++) {
+            u = (double)(j - j0) / (j1 - j0);
+            lat[j] = a0 + u * (a1 - a0);
+            lng[j] = b0 + u * (b1 - b0);
+        }
+    }
+}
+
+
+/* As gf_point_quad in points.c: the quad holding (lat, lng). */
+static inline
+int pj_quad(const gf_grid *g, double lat, double lng, long *ii, long *jj, double *w) {
+    double y, x;
+
+    if (lat > g->top || lat < g->bottom || lng < g->left || lng > g->right)
+        return -1;
+
+    y = (g->top - lat) / g->dy;
+    x = (lng - g->left) / g->dx;
+    *ii = (long)y;
+    *jj = (long)x;
+    if (*ii > g->ny - 2)
+        *ii = g->ny - 2;
+    if (*jj > g->nx - 2)
+        *jj = g->nx - 2;
+    w[0] = y - *ii;
+    w[1] = x - *jj;
+    return 0;
+}
+
+
+/* Cache blocks for a band: a few rows of blocks across the source,
+since an output row may cut diagonally through them. */
+static
+int pj_cache_blocks(const gf_struct *gf) {
+    return 3 * (gf->grid.nx / GF_CACHE_BLOCK + 2);
+}
+
+
+typedef struct pj_job {
+    const gf_struct *gf;
+    const pj_table *tab;
+    void *xtras;
+    gf_bilinear_kernel *kernel;
+    char *data;
+    size_t elem_size;
+    int nbands;
+    int failed;
+} pj_job;
+
+
+static
+void pj_bilinear_task(int b, void *arg) {
+    pj_job *job = (pj_job *)arg;
+    const gf_grid *from = &job->gf->grid, *to = &job->tab->pg->grid;
+    gf_block_cache cache;
+    gf_float quad[4];
+    double *lat, *lng, w[2], latlng[2];
+    long ii, jj;
+    int i, j, i0, i1;
+
+    gf_stencil_band(to, b, job->nbands, &i0, &i1);
+
+    lat = (double *)malloc(2 * to->nx * sizeof(double));
+    if (lat == NULL || gf_init_block_cache(&cache, job->gf, pj_cache_blocks(job->gf)) != 0) {
+        free(lat);
+        __sync_fetch_and_add(&job->failed, 1);
+        return;
+    }
+    lng = lat + to->nx;
+
+    for (i = i0; i < i1; i++) {
+        pj_row(job->tab, i, lat, lng);
+        for (j = 0; j < to->nx; j++) {
+            if (pj_quad(from, lat[j], lng[j], &ii, &jj, w) != 0)
+                continue;
+            gf_cache_quad(&cache, ii, jj, quad);
+            latlng[0] = lat[j];
+            latlng[1] = lng[j];
+            (*job->kernel)(quad, from, w, latlng, job->xtras,
+                (void *)(job->data + ((size_t)i * to->nx + j) * job->elem_size));
+        }
+    }
+
+    if (cache.failed > 0)
+        __sync_fetch_and_add(&job->failed, 1);
+    gf_free_block_cache(&cache);
+    free(lat);
+}
+
+
+int gf_proj_bilinear(const gf_struct *gf, const gf_proj_grid *pg, void *xtras,
+    gf_bilinear_kernel *kernel, void *data, size_t elem_size)
+{
+    pj_table tab;
+    pj_job job;
+    int nthreads = gf_num_threads();
+
+    if (pg->grid.nx < 2 || pg->grid.ny < 2 || gf->grid.nx < 2 || gf->grid.ny < 2)
+        return -1;
+    if (pj_init_table(&tab, pg) != 0) {
+        pj_free_table(&tab);
+        return -1;
+    }
+
+    job.gf = gf;
+    job.tab = &tab;
+    job.xtras = xtras;
+    job.kernel = kernel;
+    job.data = (char *)data;
+    job.elem_size = elem_size;
+    job.nbands = nthreads < pg->grid.ny ? nthreads : pg->grid.ny;
+    job.failed = 0;
+    gf_parallel_for(job.nbands, nthreads, &pj_bilinear_task, (void *)&job);
+
+    pj_free_table(&tab);
+    return job.failed ? -1 : 0;
+}
+
+
+int gf_proj_interpolate(const gf_struct *gf, const gf_proj_grid *pg, gf_float *data) {
+    long k, n = (long)pg->grid.nx * pg->grid.ny;
+
+    for (k = 0; k < n; k++)
+        data[k] = GF_NULL_VAL;
+
+    return gf_proj_bilinear(gf, pg, NULL, &gf_bilinear_interpolate_kernel,
+        (void *)data, sizeof(gf_float));
+}
+
+
+int gf_proj_biquadratic(const gf_struct *gf, const gf_proj_grid *pg, void *xtras,
+    int (*set_data)(gf_float nine[][3], const gf_grid *from_grid, double *w,
+        double *latlng, void *xtras, void **data_ptr),
+    int (*set_null)(void **), void *data)
+{
+    const gf_grid *from = &gf->grid, *to = &pg->grid;
+    gf_block_cache cache;
+    pj_table tab;
+    gf_float nine[3][3];
+    double *lat, *lng, w[2], latlng[2], y, x;
+    long ii, jj, failed;
+    int i, j, r, c;
+
+    if (to->nx < 2 || to->ny < 2 || from->nx < 3 || from->ny < 3)
+        return -1;
+
+    if (pj_init_table(&tab, pg) != 0) {
+        pj_free_table(&tab);
+        return -1;
+    }
+    lat = (double *)malloc(2 * to->nx * sizeof(double));
+    if (lat == NULL || gf_init_block_cache(&cache, gf, pj_cache_blocks(gf)) != 0) {
+        free(lat);
+        pj_free_table(&tab);
+        return -1;
+    }
+    lng = lat + to->nx;
+
+    for (i = 0; i < to->ny; i++) {
+        pj_row(&tab, i, lat, lng);
+        for (j = 0; j < to->nx; j++) {
+            /* Nearest node, whose 3x3 must sit inside the source. */
+            y = (from->top - lat[j]) / from->dy;
+            x = (lng[j] - from->left) / from->dx;
+            ii = (long)floor(y + 0.5);
+            jj = (long)floor(x + 0.5);
+            if (ii < 1 || ii > from->ny - 2 || jj < 1 || jj > from->nx - 2) {
+                (*set_null)(&data);
+                continue;
+            }
+
+            for (r = 0; r < 3; r++)
+                for (c = 0; c < 3; c++)
+                    nine[r][c] = gf_cache_value(&cache, ii - 1 + r, jj - 1 + c);
+            w[0] = y - ii;
+            w[1] = x - jj;
+            latlng[0] = lat[j];
+            latlng[1] = lng[j];
+            (*set_data)(nine, from, w, latlng, xtras, &data);
+        }
+    }
+
+    failed = cache.failed;
+    gf_free_block_cache(&cache);
+    pj_free_table(&tab);
+    free(lat);
+    return failed > 0 ? -1 : 0;
+}
+
+
+#define PJ_GEOGCS "GEOGCS[\"GCS_WGS_1984\",DATUM[\"D_WGS_1984\"," \
+    "SPHEROID[\"WGS_1984\",6378137.0,298.257223563]],PRIMEM[\"Greenwich\",0.0]," \
+    "UNIT[\"Degree\",0.0174532925199433]]"
+
+int gf_proj_save(const gf_proj_grid *pg, gf_float *data, const char *prefix) {
+    gf_grid grid = pg->grid;
+    char filename[2048];
+    FILE *prj;
+
+    gf_save(&grid, data, prefix);
+
+    snprintf(filename, sizeof(filename), "%s.prj", prefix);
+    if ((prj = fopen(filename, "w")) == NULL) {
+        fprintf(stderr, "Could not open %s for writing.\n", filename);
+        return -1;
+    }
+
+    if (pg->proj.type == GF_PROJ_WEBMERC) {
+        fprintf(prj, "PROJCS[\"WGS_1984_Web_Mercator_Auxiliary_Sphere\"," PJ_GEOGCS ","
+            "PROJECTION[\"Mercator_Auxiliary_Sphere\"],PARAMETER[\"False_Easting\",0.0],"
+            "PARAMETER[\"False_Northing\",0.0],PARAMETER[\"Central_Meridian\",0.0],"
+            "PARAMETER[\"Standard_Parallel_1\",0.0],PARAMETER[\"Auxiliary_Sphere_Type\",0.0],"
+            "UNIT[\"Meter\",1.0]]\n");
+    } else {
+        fprintf(prj, "PROJCS[\"WGS_1984_UTM_Zone_%d%c\"," PJ_GEOGCS ","
+            "PROJECTION[\"Transverse_Mercator\"],PARAMETER[\"False_Easting\",%.1f],"
+            "PARAMETER[\"False_Northing\",%.1f],PARAMETER[\"Central_Meridian\",%.1f],"
+            "PARAMETER[\"Scale_Factor\",%.4f],PARAMETER[\"Latitude_Of_Origin\",0.0],"
+            "UNIT[\"Meter\",1.0]]\n",
+            pg->proj.zone, pg->proj.south ? 'S' : 'N', PJ_FE,
+            pg->proj.south ? PJ_FN_SOUTH : 0.0, pj_utm_meridian(pg->proj.zone), PJ_K0);
+    }
+
+    fclose(prj);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#ifndef GF_PROJ_H
+#define GF_PROJ_H
+
+#include "gridfloat.h"
+#include "linear.h"
+#include "quadratic.h"
+
+/**
+ * Projected output grids.
+ *
+ * A gf_proj_grid is an ordinary gf_grid whose bounds and cell sizes
+ * are in projected meters (x east, y north) rather than degrees. Its
+ * nodes are mapped back to lat/lng and sampled from a geographic
+ * source with the usual bilinear and biquadratic kernels, which see
+ * the same (quad or 3x3, weights, latlng) they get from gf_bilinear
+ * and gf_biquadratic.
+ *
+ * No node is transformed on its own. Web Mercator is separable, so
+ * longitude depends only on the column and latitude only on the row:
+ * one table of each. UTM nodes are transformed exactly on a control
+ * grid every GF_PROJ_STEP nodes and bilinearly interpolated in between
+ * (the approximate transformer of GDAL and PROJ); at that spacing the
+ * error is far below a node for any sensible cell size.
+ *
+ * Slopes (and so shading) stay relative to true north, which differs
+ * from UTM grid north by the meridian convergence (a degree or two).
+ */
+
+/* Control grid spacing (in nodes) for UTM. */
+#define GF_PROJ_STEP 16
+
+typedef enum {
+    GF_PROJ_WEBMERC,    /* EPSG:3857, on the WGS84 sphere */
+    GF_PROJ_UTM         /* WGS84 transverse Mercator, zones 1-60 */
+} gf_proj_type;
+
+/**
+ * @zone, @south - UTM zone and hemisphere (false northing 10000 km
+ *      when south).
+ */
+typedef struct gf_proj {
+    gf_proj_type type;
+    int zone;
+    int south;
+} gf_proj;
+
+/**
+ * Parse 'webmerc' (or '3857'), 'utm', 'utm:10' or 'utm:10s'. A UTM zone
+ * left out is taken from lat and lng (the center of the area of
+ * interest). Returns 0, or -1 if spec is not understood.
+ */
+int gf_parse_proj(const char *spec, double lat, double lng, gf_proj *proj);
+
+/* Exact transforms: degrees to meters and back. */
+void gf_proj_forward(const gf_proj *proj, double lat, double lng, double *x, double *y);
+
+void gf_proj_inverse(const gf_proj *proj, double x, double y, double *lat, double *lng);
+
+/**
+ * @grid - Bounds, cell sizes and resolution in projected meters.
+ */
+typedef struct gf_proj_grid {
+    gf_proj proj;
+    gf_grid grid;
+} gf_proj_grid;
+
+/**
+ * The ny x nx grid covering the projection of the lat/lng box b (its
+ * edges are followed, since UTM bends them).
+ */
+void gf_init_proj_grid(gf_proj_grid *pg, const gf_proj *proj, const gf_bounds *b,
+    int ny, int nx);
+
+/**
+ * gf_bilinear over a projected grid: kernel gets the quad around each
+ * node's lat/lng and writes elem_size bytes at data + k * elem_size for
+ * node k (row-major). Nodes off the source are left untouched. Bands
+ * of rows run in parallel, each reading through its own block cache.
+ */
+int gf_proj_bilinear(const gf_struct *gf, const gf_proj_grid *pg, void *xtras,
+    gf_bilinear_kernel *kernel, void *data, size_t elem_size);
+
+/* Bilinear elevations; GF_NULL_VAL off the source. */
+int gf_proj_interpolate(const gf_struct *gf, const gf_proj_grid *pg, gf_float *data);
+
+/**
+ * gf_biquadratic over a projected grid, with the same cursor-style
+ * callbacks, called in row-major order. Nodes whose 3x3 stencil leaves
+ * the source get set_null.
+ */
+int gf_proj_biquadratic(const gf_struct *gf, const gf_proj_grid *pg, void *xtras,
+    int (*set_data)(gf_float nine[][3], const gf_grid *from_grid, double *w,
+        double *latlng, void *xtras, void **data_ptr),
+    int (*set_null)(void **), void *data);
+
+/* gf_biquadratic_data_opts over a projected grid. */
+int gf_proj_biquadratic_data(const gf_struct *gf, const gf_proj_grid *pg,
+    const gf_data_xtras *xtras, gf_data *data);
+
+/**
+ * GridFloat prefix.{hdr,flt} of data on pg, plus prefix.prj (ESRI WKT)
+ * so GIS tools know the projection.
+ */
+int gf_proj_save(const gf_proj_grid *pg, gf_float *data, const char *prefix);
+
+#endif
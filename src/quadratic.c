@@ -1,8 +1,42 @@
 #include "quadratic.h"
+#include "stencil.h"
+#include "proj.h"
 
 #include <math.h>
 #include <stdlib.h>
-#include <limits.h>
+#include <string.h>
+
+
+/* Adapts the classic 3x3 callbacks to the stencil engine. The engine
+runs single-banded here, so points arrive in row-major order and the
+callbacks can keep advancing their own cursor. */
+typedef struct gf_biquadratic_xtras {
+    int (*set_data)(gf_float nine[][3], const gf_grid *, double *, double *, void *, void **);
+    int (*set_null)(void **);
+    void *xtras;
+    void *cursor;
+} gf_biquadratic_xtras;
+
+
+static
+int gf_biquadratic_stencil_kernel(const gf_window *win, const gf_grid *from_grid, double *w, double *latlng, void *xtras, void *data_ptr) {
+    gf_biquadratic_xtras *x = (gf_biquadratic_xtras *)xtras;
+    gf_float nine[3][3];
+    int r, c;
+
+    for (r = 0; r < 3; ++r)
+        for (c = 0; c < 3; ++c)
+            nine[r][c] = GF_WIN(win, r - 1, c - 1);
+
+    return x->set_data(nine, from_grid, w, latlng, x->xtras, &x->cursor);
+}
+
+
+static
+int gf_biquadratic_stencil_null(void *xtras, void *data_ptr) {
+    gf_biquadratic_xtras *x = (gf_biquadratic_xtras *)xtras;
+    return x->set_null(&x->cursor);
+}
 
 
 int gf_biquadratic(
@@ -21,132 +55,19 @@ int gf_biquadratic(
     int (*set_null)(void **),
     void *data
 ) {
-    int i, j;             /* Indices for subgrid */
-    double lat, lng, latlng[2]; /* For passing to op */
-    int to_nx = to_grid->nx, to_ny = to_grid->ny;
-    double to_dx = to_grid->dx, to_dy = to_grid->dy;
-    double in_r, in_l, in_b, in_t;
-
-    /* Pointer that will be moved by set_data callback. */
-    void *d = data;
+    gf_stencil st;
+    gf_biquadratic_xtras x;
 
-    int ii, ii_new, jj; /* Indices for gf_tile */
-
-    /* Buffers for lines of gf_tile data */
-    gf_float *line1, *line2, *line3, *line_swp;
-    /* x-indices for bounds of line buffers */
-    int jj_left, jj_right;
-    int jjj; /* Index within line buffer */
-
-    /* Data surrounding requested latlng point. */
-    gf_float nine[3][3];
-    /* Interpolation weights (y-weight, x-weight). */
-    double w[2];
-
-    /* Aliases */
-    const gf_grid *from_grid = &gf->grid;
-    FILE *flt = gf->flt;
-
-    /* For cubic operations, the bounds within which we can interpolate
-    are more restrictive (b/c of the larger stencil). */
-    in_l = from_grid->left + 0.5 * from_grid->dx;
-    in_r = from_grid->right - 0.5 * from_grid->dx;
-    in_b = from_grid->bottom + 0.5 * from_grid->dy;
-    in_t = from_grid->top - 0.5 * from_grid->dy;
-
-    /* Find indices of dataset that bound the requested box in x. */
-    jj_left = ((int)((to_grid->left - from_grid->left) / from_grid->dx + 0.5)) - 1;
-    jj_left = jj_left >= 0 ? jj_left : 0;
-
-    jj_right = ((int)((to_grid->right - from_grid->left) / from_grid->dx + 0.5)) + 2; /* exclusive */
-    jj_right = jj_right < from_grid->nx ? jj_right : from_grid->nx - 1;
-
-    line1 = (gf_float *)malloc((jj_right - jj_left) * sizeof(gf_float));
-    line2 = (gf_float *)malloc((jj_right - jj_left) * sizeof(gf_float));
-    line3 = (gf_float *)malloc((jj_right - jj_left) * sizeof(gf_float));
-
-    rewind(flt);
-
-    //fprintf(stdout, "req x bounds: %f, %f\n", bounds->left, bounds->right);
-    
-    latlng[0] = lat = to_grid->top;
-    for (i = 0, ii = INT_MIN; i < to_ny; ++i) {
-        if (lat > in_t || lat < in_b) {
-            for (j = 0; j < to_nx; ++j) {
-                (*set_null)(&d);
-            }
-        } else {
-
-            // Read in data three lines at a time: the nearest line
-            // (in y), the line above, and the line below.
-
-            // ii_new is nearest line:
-            ii_new = (int)((from_grid->top - lat) / from_grid->dy + 0.5);
-
-            if (ii_new == ii + 1) {
-                // Advance by one line. line2 -> line1, line3 -> line2.
-                line_swp = line1;
-                line1 = line2;
-                line2 = line3;
-                line3 = line_swp;
-                gf_get_line(ii_new + 1, jj_left, jj_right, gf, line3);
-            } else if (ii_new == ii + 2) {
-                // Advance by two lines. line3 -> line1.
-                line_swp = line1;
-                line1 = line3;
-                line3 = line_swp;
-                gf_get_line(ii_new, jj_left, jj_right, gf, line2);
-                gf_get_line(ii_new + 1, jj_left, jj_right, gf, line3);
-            } else if (ii_new > ii + 2) {
-                gf_get_line(ii_new - 1, jj_left, jj_right, gf, line1);
-                gf_get_line(ii_new, jj_left, jj_right, gf, line2);
-                gf_get_line(ii_new + 1, jj_left, jj_right, gf, line3);
-            }
-            ii = ii_new;
-
-            /* y-weight. [-1, 1] */
-            w[0] = (from_grid->top - ii * from_grid->dy - lat) / from_grid->dy;
-
-            latlng[1] = lng = to_grid->left;
-
-            for (j = 0; j < to_nx; ++j) {
-                if (lng > in_r || lng < in_l) {
-                    (*set_null)(&d);
-                } else {
-                    // Nearest node.
-                    jj = (int)((lng - from_grid->left) / from_grid->dx + 0.5);
-                    jjj = jj - jj_left;
-                    //fprintf(stdout, "lng: %f, jj: %d, jjj: %d, linelen: %d\n", lng, jj, jjj, jj_right - jj_left);
-
-                    nine[0][0] = line1[jjj - 1];
-                    nine[0][1] = line1[jjj];
-                    nine[0][2] = line1[jjj + 1];
-                    nine[1][0] = line2[jjj - 1];
-                    nine[1][1] = line2[jjj];
-                    nine[1][2] = line2[jjj + 1];
-                    nine[2][0] = line3[jjj - 1];
-                    nine[2][1] = line3[jjj];
-                    nine[2][2] = line3[jjj + 1];
-
-                    /* x-weight. [-1, 1] */
-                    w[1] = (lng - (from_grid->left + jj * from_grid->dx)) / from_grid->dx;
-
-                    (*set_data)(nine, from_grid, w, latlng, set_data_xtras, &d);
-                }
-
-                lng += to_dx;
-                latlng[1] = lng;
-            }
-        }
-        lat -= to_dy;
-        latlng[0] = lat;
-    }
+    x.set_data = set_data;
+    x.set_null = set_null;
+    x.xtras = set_data_xtras;
+    x.cursor = data;
 
-    free(line1);
-    free(line2);
-    free(line3);
+    /* Output goes through the cursor, not the engine's buffer. */
+    gf_init_stencil(&st, 3, 3, &gf_biquadratic_stencil_kernel, (void *)&x, 0);
+    st.set_null = &gf_biquadratic_stencil_null;
 
-    return 0;
+    return gf_stencil_run(gf, to_grid, &st, NULL);
 }
 
 
@@ -156,8 +77,21 @@ int gf_biquadratic_gradient_kernel(gf_float nine[][3], const gf_grid *from_grid,
     int i, k;
     double avg_w;
     double v[3];
+    gf_float filled[3][3];
+
+    /* Work on a copy so callers' stencils keep their nulls. */
+    for (i = 0; i < 3; ++i)
+        for (k = 0; k < 3; ++k)
+            filled[i][k] = nine[i][k];
+    if (!gf_fill_nulls_3x3(filled)) {
+        (*dptr)[0] = GF_NULL_VAL;
+        (*dptr)[1] = GF_NULL_VAL;
+        dptr[0] += 2;
+        return 0;
+    }
+    nine = filled;
 
-    gf_lengths(latlng[0], latlng[1], from_grid->dy, from_grid->dx, 0.0, &dy_m, &dx_m);
+    gf_lengths(latlng[0], latlng[1], from_grid->dy, from_grid->dx, 0.0, &dx_m, &dy_m);
     
     /* Derivative in x. */
     /* Average in y */
@@ -214,3 +148,210 @@ int gf_biquadratic_gradient(const gf_struct *gf, const gf_grid *grid, double *gr
     return gf_biquadratic(gf, grid, NULL,
         &gf_biquadratic_gradient_kernel, &gf_set_null_gradient, (void *)gradient);
 }
+
+
+static
+int gf_set_null_data(void **data_ptr);
+
+
+/* Quadratic through (-1, v[0]), (0, v[1]), (1, v[2]) evaluated at t. */
+static
+double quad_interp1(const double v[3], double t) {
+    return v[1] + 0.5 * (v[2] - v[0]) * t + 0.5 * (v[0] + v[2] - 2.0 * v[1]) * t * t;
+}
+
+
+double gf_biquadratic_value(gf_float nine[][3], const double *w) {
+    double v[3], row[3];
+    int i, k;
+
+    for (i = 0; i < 3; ++i) {
+        for (k = 0; k < 3; ++k)
+            row[k] = nine[i][k];
+        v[i] = quad_interp1(row, w[1]);
+    }
+    return quad_interp1(v, w[0]);
+}
+
+
+int gf_biquadratic_data_kernel(gf_float nine[][3], const gf_grid *from_grid, double *w, double *latlng, void *xtras, void **data_ptr) {
+    gf_data *d = (gf_data *)*data_ptr;
+    gf_data_xtras *x = (gf_data_xtras *)xtras;
+    double grad[2], *grad_view = grad;
+    gf_float filled[3][3];
+    float elev = 0.0f;
+    unsigned char shade = 0;
+    int i, k;
+
+    for (i = 0; i < 3; ++i)
+        for (k = 0; k < 3; ++k)
+            filled[i][k] = nine[i][k];
+    if (!gf_fill_nulls_3x3(filled)) {
+        if (x->types & TINT) {
+            memcpy(d->rgba, x->ramp->nodata, 4);
+            d->rgba += 4;
+        }
+        return gf_set_null_data(data_ptr);
+    }
+    nine = filled;
+
+    if (x->types & (ELEVATION | TINT))
+        elev = (float)gf_biquadratic_value(nine, w);
+    if (x->types & ELEVATION)
+        *d->elev++ = elev;
+
+    if (x->types & (GRADX | GRADY | SHADE | TINT)) {
+        gf_biquadratic_gradient_kernel(nine, from_grid, w, latlng, NULL, (void **)&grad_view);
+
+        if (x->types & GRADX)
+            *d->gradx++ = grad[0];
+        if (x->types & GRADY)
+            *d->grady++ = grad[1];
+        if (x->types & (SHADE | TINT))
+            shade = gf_shade(grad[0], grad[1], x->n_sun);
+        if (x->types & SHADE)
+            *d->shade++ = shade;
+    }
+
+    if (x->types & TINT) {
+        gf_tint(x->ramp, elev, shade, x->tint_shade, d->rgba);
+        d->rgba += 4;
+    }
+
+    return 0;
+}
+
+
+static
+int gf_set_null_data(void **data_ptr) {
+    gf_data *d = (gf_data *)*data_ptr;
+
+    if (d->elev != NULL)
+        *d->elev++ = GF_NULL_VAL;
+    if (d->gradx != NULL)
+        *d->gradx++ = GF_NULL_VAL;
+    if (d->grady != NULL)
+        *d->grady++ = GF_NULL_VAL;
+    if (d->shade != NULL)
+        *d->shade++ = 0;
+    return 0;
+}
+
+
+/* Cursor for TINT, whose null points are the ramp's nodata color. */
+typedef struct gf_tint_cursor {
+    gf_data d;
+    const gf_color_ramp *ramp;
+} gf_tint_cursor;
+
+
+static
+int gf_set_null_tint(void **data_ptr) {
+    gf_tint_cursor *c = (gf_tint_cursor *)*data_ptr;
+
+    memcpy(c->d.rgba, c->ramp->nodata, 4);
+    c->d.rgba += 4;
+    return gf_set_null_data(data_ptr);
+}
+
+
+int gf_biquadratic_data(const gf_struct *gf, const gf_grid *grid, int types, const double *n_sun, gf_data *data) {
+    gf_data_xtras xtras;
+
+    memset((void *)&xtras, 0, sizeof(gf_data_xtras));
+    xtras.types = types & ~TINT;
+    xtras.n_sun = n_sun;
+    return gf_biquadratic_data_opts(gf, grid, &xtras, data);
+}
+
+
+static
+void gf_init_tint_cursor(const gf_data_xtras *xtras, gf_data *data, gf_tint_cursor *cursor) {
+    int types = xtras->types;
+
+    /* Only advance the arrays that were asked for. */
+    memset((void *)cursor, 0, sizeof(gf_tint_cursor));
+    if (types & ELEVATION)
+        cursor->d.elev = data->elev;
+    if (types & GRADX)
+        cursor->d.gradx = data->gradx;
+    if (types & GRADY)
+        cursor->d.grady = data->grady;
+    if (types & SHADE)
+        cursor->d.shade = data->shade;
+    if (types & TINT) {
+        cursor->d.rgba = data->rgba;
+        cursor->ramp = xtras->ramp;
+    }
+}
+
+
+int gf_biquadratic_data_opts(const gf_struct *gf, const gf_grid *grid, const gf_data_xtras *xtras, gf_data *data) {
+    gf_tint_cursor cursor;
+
+    gf_init_tint_cursor(xtras, data, &cursor);
+    return gf_biquadratic(gf, grid, (void *)xtras, &gf_biquadratic_data_kernel,
+        xtras->types & TINT ? &gf_set_null_tint : &gf_set_null_data, (void *)&cursor);
+}
+
+
+/* Cursor for gf_biquadratic_interpolate_xy: points arrive in row-major
+order, k counting them, and land transposed. */
+typedef struct gf_xy_cursor {
+    gf_float *data;
+    long k;
+    long nx;
+    long ny;
+} gf_xy_cursor;
+
+
+static
+gf_float *gf_xy_next(void **data_ptr) {
+    gf_xy_cursor *c = (gf_xy_cursor *)*data_ptr;
+    long i = c->k / c->nx, j = c->k % c->nx;
+
+    c->k++;
+    return c->data + j * c->ny + c->ny - 1 - i;
+}
+
+
+static
+int gf_biquadratic_xy_kernel(gf_float nine[][3], const gf_grid *from_grid, double *w, double *latlng, void *xtras, void **data_ptr) {
+    gf_float filled[3][3];
+    int i, k;
+
+    for (i = 0; i < 3; ++i)
+        for (k = 0; k < 3; ++k)
+            filled[i][k] = nine[i][k];
+    *gf_xy_next(data_ptr) = gf_fill_nulls_3x3(filled) ?
+        (gf_float)gf_biquadratic_value(filled, w) : GF_NULL_VAL;
+    return 0;
+}
+
+
+static
+int gf_set_null_xy(void **data_ptr) {
+    *gf_xy_next(data_ptr) = GF_NULL_VAL;
+    return 0;
+}
+
+
+int gf_biquadratic_interpolate_xy(const gf_struct *gf, const gf_grid *grid, gf_float *data) {
+    gf_xy_cursor cursor;
+
+    cursor.data = data;
+    cursor.k = 0;
+    cursor.nx = grid->nx;
+    cursor.ny = grid->ny;
+    return gf_biquadratic(gf, grid, NULL, &gf_biquadratic_xy_kernel, &gf_set_null_xy,
+        (void *)&cursor);
+}
+
+
+int gf_proj_biquadratic_data(const gf_struct *gf, const gf_proj_grid *pg, const gf_data_xtras *xtras, gf_data *data) {
+    gf_tint_cursor cursor;
+
+    gf_init_tint_cursor(xtras, data, &cursor);
+    return gf_proj_biquadratic(gf, pg, (void *)xtras, &gf_biquadratic_data_kernel,
+        xtras->types & TINT ? &gf_set_null_tint : &gf_set_null_data, (void *)&cursor);
+}
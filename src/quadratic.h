@@ -2,6 +2,7 @@
 #define QUADRATIC_H
 
 #include "gridfloat.h"
+#include "ramp.h"
 
 
 int gf_biquadratic(
@@ -25,4 +26,55 @@ int gf_biquadratic_gradient_kernel(gf_float nine[][3], const gf_grid *from_grid,
 
 int gf_biquadratic_gradient(const gf_struct *gf, const gf_grid *to_grid, double *gradient);
 
+/**
+ * Biquadratic elevation at offset w (in source cells, y then x) from
+ * the center of a null-free 3x3 stencil.
+ */
+double gf_biquadratic_value(gf_float nine[][3], const double *w);
+
+/**
+ * Extras for gf_biquadratic_data_kernel.
+ *
+ * @types - Bitmask of gf_data_t products to compute.
+ * @n_sun - Unit vector toward the sun. Needed for SHADE and TINT.
+ * @ramp - Colors for TINT.
+ * @tint_shade - Weight of relief shade in TINT (see gf_tint).
+ */
+typedef struct gf_data_xtras {
+    int types;
+    const double *n_sun;
+    const gf_color_ramp *ramp;
+    float tint_shade;
+} gf_data_xtras;
+
+/**
+ * Fills every product requested in the gf_data_xtras mask from one
+ * stencil. The data pointer is a gf_data cursor whose non-NULL arrays
+ * are each advanced by one element.
+ */
+int gf_biquadratic_data_kernel(gf_float nine[][3], const gf_grid *from_grid, double *w, double *latlng, void *xtras, void **data_ptr);
+
+/**
+ * Fused pass: one read of each source row fills elevation, gradients
+ * and/or shade (whichever are in the types mask) for every point on
+ * to_grid. The arrays in data must be allocated for the requested
+ * types (see gf_init_data) with to_grid->nx * to_grid->ny elements.
+ */
+int gf_biquadratic_data(const gf_struct *gf, const gf_grid *to_grid, int types, const double *n_sun, gf_data *data);
+
+/**
+ * gf_biquadratic_data with every gf_data_xtras field, for TINT: ramp
+ * colors shaded in the same pass, so an elevation is read, colored and
+ * lit once.
+ */
+int gf_biquadratic_data_opts(const gf_struct *gf, const gf_grid *to_grid, const gf_data_xtras *xtras, gf_data *data);
+
+/**
+ * gf_biquadratic_data's ELEVATION into the xy layout of gf_print, as
+ * gf_bilinear_interpolate_xy. Kernels here place their own output
+ * through a cursor, so the layout lives in the cursor rather than in
+ * strides handed to the engine.
+ */
+int gf_biquadratic_interpolate_xy(const gf_struct *gf, const gf_grid *to_grid, gf_float *data);
+
 #endif
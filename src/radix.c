@@ -0,0 +1,94 @@
+#include "radix.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+void gf_init_radix_heap(gf_radix_heap *h) {
+    memset(h, 0, sizeof(gf_radix_heap));
+}
+
+
+void gf_free_radix_heap(gf_radix_heap *h) {
+    int b;
+
+    for (b = 0; b < 65; b++)
+        free(h->buckets[b]);
+    memset(h, 0, sizeof(gf_radix_heap));
+}
+
+
+static
+int gf_radix_bucket(uint64_t key, uint64_t last) {
+    return key == last ? 0 : 64 - __builtin_clzll(key ^ last);
+}
+
+
+static
+void gf_radix_append(gf_radix_heap *h, int b, uint64_t key, long val) {
+    if (h->len[b] == h->cap[b]) {
+        h->cap[b] = h->cap[b] ? 2 * h->cap[b] : 64;
+        h->buckets[b] = (gf_radix_item *)realloc(h->buckets[b],
+            h->cap[b] * sizeof(gf_radix_item));
+    }
+    h->buckets[b][h->len[b]].key = key;
+    h->buckets[b][h->len[b]].val = val;
+    h->len[b]++;
+}
+
+
+void gf_radix_push(gf_radix_heap *h, uint64_t key, long val) {
+    if (key < h->last)
+        key = h->last;
+    gf_radix_append(h, gf_radix_bucket(key, h->last), key, val);
+    h->size++;
+}
+
+
+int gf_radix_pop(gf_radix_heap *h, uint64_t *key, long *val) {
+    gf_radix_item *items;
+    size_t k, n;
+    int b;
+
+    if (h->size == 0)
+        return 0;
+
+    if (h->len[0] == 0) {
+        /* Refill bucket 0 from the first non-empty bucket: its minimum
+        becomes the new last key, and everything in it moves down. */
+        for (b = 1; h->len[b] == 0; b++)
+            ;
+        items = h->buckets[b];
+        n = h->len[b];
+        h->last = items[0].key;
+        for (k = 1; k < n; k++)
+            if (items[k].key < h->last)
+                h->last = items[k].key;
+        h->len[b] = 0;
+        for (k = 0; k < n; k++)
+            gf_radix_append(h, gf_radix_bucket(items[k].key, h->last),
+                items[k].key, items[k].val);
+    }
+
+    n = --h->len[0];
+    *key = h->buckets[0][n].key;
+    *val = h->buckets[0][n].val;
+    h->size--;
+    return 1;
+}
+
+
+uint64_t gf_radix_key_float(float f) {
+    uint32_t u;
+
+    memcpy(&u, &f, sizeof(u));
+    return (u & 0x80000000u) ? ~u & 0xffffffffu : u | 0x80000000u;
+}
+
+
+uint64_t gf_radix_key_double(double d) {
+    uint64_t u;
+
+    memcpy(&u, &d, sizeof(u));
+    return (u & 0x8000000000000000ULL) ? ~u : u | 0x8000000000000000ULL;
+}
@@ -0,0 +1,45 @@
+#ifndef GF_RADIX_H
+#define GF_RADIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Radix heap: a bucketed priority queue for monotone workloads, where
+ * no key pushed is below the last key popped (priority-flood, Dijkstra
+ * and A* with consistent heuristics). Bucket b > 0 holds keys whose
+ * highest bit differing from the last popped key is bit b - 1, so
+ * push is O(1) and each item is redistributed at most 64 times over
+ * its life, with no comparisons between items in the same bucket.
+ *
+ * Float and double priorities go through gf_radix_key_float/double,
+ * which map them to unsigned keys of the same order.
+ */
+typedef struct gf_radix_item {
+    uint64_t key;
+    long val;
+} gf_radix_item;
+
+typedef struct gf_radix_heap {
+    gf_radix_item *buckets[65];
+    size_t len[65];
+    size_t cap[65];
+    uint64_t last;
+    size_t size;
+} gf_radix_heap;
+
+void gf_init_radix_heap(gf_radix_heap *h);
+
+void gf_free_radix_heap(gf_radix_heap *h);
+
+/* Keys below the last popped key are clamped up to it. */
+void gf_radix_push(gf_radix_heap *h, uint64_t key, long val);
+
+/* Pops a smallest item. Returns 0 if the heap is empty, 1 otherwise. */
+int gf_radix_pop(gf_radix_heap *h, uint64_t *key, long *val);
+
+uint64_t gf_radix_key_float(float f);
+
+uint64_t gf_radix_key_double(double d);
+
+#endif
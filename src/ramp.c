@@ -0,0 +1,110 @@
+#include "ramp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct rp_stop {
+    double elev;
+    unsigned char rgba[4];
+} rp_stop;
+
+
+/* Color at elev between sorted stops. */
+static
+void rp_interp(const rp_stop *stops, int n, double elev, unsigned char *rgba) {
+    int s, c;
+    double t;
+
+    for (s = 1; s < n - 1 && stops[s].elev < elev; s++)
+        ;
+    if (n == 1 || elev <= stops[0].elev) {
+        memcpy(rgba, stops[0].rgba, 4);
+        return;
+    }
+    if (elev >= stops[n - 1].elev) {
+        memcpy(rgba, stops[n - 1].rgba, 4);
+        return;
+    }
+    t = stops[s].elev > stops[s - 1].elev ?
+        (elev - stops[s - 1].elev) / (stops[s].elev - stops[s - 1].elev) : 1.0;
+    for (c = 0; c < 4; c++)
+        rgba[c] = (unsigned char)(stops[s - 1].rgba[c] +
+            t * (stops[s].rgba[c] - stops[s - 1].rgba[c]) + 0.5);
+}
+
+
+int gf_read_color_ramp(FILE *fp, gf_color_ramp *ramp) {
+    char *line = NULL, *tok, *saveptr, *hash;
+    size_t line_cap = 0;
+    rp_stop *stops = NULL, stop;
+    double v[5];
+    int cap = 0, n = 0, lineno = 0, nodata, k, s, err = 0;
+
+    memset((void *)ramp, 0, sizeof(gf_color_ramp));
+
+    while (getline(&line, &line_cap, fp) != -1) {
+        lineno++;
+        if ((hash = strchr(line, '#')) != NULL)
+            *hash = '\0';
+        tok = strtok_r(line, " ,\t\r\n", &saveptr);
+        if (tok == NULL)
+            continue;
+        nodata = !strcmp(tok, "nv");
+        v[3] = 255.0;
+        v[4] = 255.0;
+        for (k = 0; k < 5 && tok != NULL; k++) {
+            v[k] = atof(tok);
+            tok = strtok_r(NULL, " ,\t\r\n", &saveptr);
+        }
+        if (k < 4 || tok != NULL) {
+            fprintf(stderr, "Bad color ramp line %d: want 'ELEVATION R G B [A]'\n", lineno);
+            err = -1;
+            break;
+        }
+
+        stop.elev = v[0];
+        for (k = 0; k < 4; k++)
+            stop.rgba[k] = (unsigned char)(v[k + 1] < 0.0 ? 0 : v[k + 1] > 255.0 ? 255 : v[k + 1]);
+        if (nodata) {
+            memcpy(ramp->nodata, stop.rgba, 4);
+            continue;
+        }
+
+        /* Insert in order of elevation, after equal ones, so that two
+        stops at one elevation make a sharp step. */
+        if (n == cap) {
+            cap = cap ? 2 * cap : 16;
+            stops = (rp_stop *)realloc(stops, cap * sizeof(rp_stop));
+        }
+        for (s = n; s > 0 && stops[s - 1].elev > stop.elev; s--)
+            stops[s] = stops[s - 1];
+        stops[s] = stop;
+        n++;
+    }
+    free(line);
+
+    if (err == 0 && n == 0) {
+        fprintf(stderr, "Color ramp has no stops\n");
+        err = -1;
+    }
+    if (err != 0) {
+        free(stops);
+        return err;
+    }
+
+    ramp->lo = stops[0].elev;
+    ramp->scale = stops[n - 1].elev > ramp->lo ?
+        (GF_RAMP_LUT - 1) / (stops[n - 1].elev - ramp->lo) : 0.0;
+    for (k = 0; k < GF_RAMP_LUT; k++)
+        rp_interp(stops, n, ramp->scale > 0.0 ? ramp->lo + k / ramp->scale : ramp->lo,
+            ramp->lut[k]);
+
+    ramp->alpha = ramp->nodata[3] < 255;
+    for (s = 0; s < n; s++)
+        if (stops[s].rgba[3] < 255)
+            ramp->alpha = 1;
+
+    free(stops);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef GF_RAMP_H
+#define GF_RAMP_H
+
+#include <stdio.h>
+
+/* Colors in a ramp's lookup table. */
+#define GF_RAMP_LUT 4096
+
+/**
+ * Hypsometric color ramp, precomputed as a table of RGBA colors evenly
+ * spaced in elevation between the first and last stops. Elevations
+ * past either end take the end color. Stops closer together than a
+ * table step (span / 4095) blur into each other.
+ *
+ * @lo, @scale - Table index of elevation e is (e - lo) * scale.
+ * @nodata - Color of null points.
+ * @alpha - Nonzero if any color (nodata included) is not opaque, in
+ *      which case images are written as RGBA rather than RGB.
+ */
+typedef struct gf_color_ramp {
+    double lo;
+    double scale;
+    unsigned char lut[GF_RAMP_LUT][4];
+    unsigned char nodata[4];
+    int alpha;
+} gf_color_ramp;
+
+/**
+ * Read a ramp from a text file of stops, one per line:
+ *
+ *   ELEVATION R G B [A]
+ *
+ * with channels 0-255 (A defaults to 255), separated by spaces, tabs
+ * or commas, in any order of elevation. A line 'nv R G B [A]' sets the
+ * nodata color (default: transparent). Blank lines and anything after
+ * '#' are ignored. This is the format of gdaldem color-relief, less
+ * percentages and color names.
+ *
+ * Returns 0, or -1 after printing the offending line to stderr.
+ */
+int gf_read_color_ramp(FILE *fp, gf_color_ramp *ramp);
+
+/**
+ * Ramp color at elev, darkened by relief shade (0-255) with weight
+ * w: color * (1 - w + w * shade / 255). Alpha is not shaded.
+ */
+static inline
+void gf_tint(const gf_color_ramp *ramp, float elev, unsigned char shade, float w,
+    unsigned char *rgba)
+{
+    double t = (elev - ramp->lo) * ramp->scale;
+    const unsigned char *c = ramp->lut[t <= 0.0 ? 0 :
+        t >= GF_RAMP_LUT - 1 ? GF_RAMP_LUT - 1 : (int)(t + 0.5)];
+    float f = 1.0f - w + w * shade * (1.0f / 255.0f);
+
+    rgba[0] = (unsigned char)(c[0] * f);
+    rgba[1] = (unsigned char)(c[1] * f);
+    rgba[2] = (unsigned char)(c[2] * f);
+    rgba[3] = c[3];
+}
+
+#endif
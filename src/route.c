@@ -0,0 +1,529 @@
+#include "route.h"
+#include "cache.h"
+#include "pool.h"
+#include "radix.h"
+#include "sort.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Side (in nodes) of a block of search state. */
+#define ROUTE_BLOCK 64
+#define ROUTE_BLOCK_NODES (ROUTE_BLOCK * ROUTE_BLOCK)
+
+/* Node flags; the low three bits hold the direction to the parent. */
+#define ROUTE_SEEN 0x10
+#define ROUTE_CLOSED 0x20
+#define ROUTE_START 0x40
+
+/* Fastest walking pace allowed by Tobler's function (s/m). */
+#define ROUTE_TOBLER_MIN_PACE 0.6
+
+static const int rt_di[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+static const int rt_dj[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+
+typedef struct rt_block {
+    float g[ROUTE_BLOCK_NODES];
+    unsigned char st[ROUTE_BLOCK_NODES];
+} rt_block;
+
+
+/**
+ * Search state by block, looked up through an open-addressing table
+ * of block ids. Blocks are pooled and cleared between searches.
+ */
+typedef struct rt_nodes {
+    long nbx;
+    long *ids;
+    int *slots;
+    size_t cap;
+    int used;
+    int nblocks;
+    rt_block **blocks;
+    long last_id;
+    rt_block *last;
+} rt_nodes;
+
+
+/* What the searches of one thread share. */
+typedef struct rt_search {
+    const gf_struct *gf;
+    const gf_route_opts *opts;
+    const double *dx_m;     /* Per row */
+    const double *dy_m;
+    double hx;              /* Heuristic cost per column, row and diagonal */
+    double hy;
+    double hd;
+    gf_block_cache cache;
+    rt_nodes nodes;
+    gf_radix_heap heap;
+} rt_search;
+
+
+typedef struct rt_key {
+    int64_t d;
+    int index;
+} rt_key;
+
+
+typedef struct rt_job {
+    const gf_struct *gf;
+    const gf_route_opts *opts;
+    const gf_route_query *q;
+    gf_route *routes;
+    const rt_key *keys;
+    const double *dx_m;
+    const double *dy_m;
+    int n;
+    int nruns;
+    int failed;
+} rt_job;
+
+
+void gf_init_route_opts(gf_route_opts *opts) {
+    opts->cost = GF_ROUTE_SLOPE;
+    opts->slope_weight = 10.0;
+    opts->max_grade = 0.0;
+    opts->max_expand = 0;
+    opts->cache_blocks = 256;
+}
+
+
+static
+void rt_init_nodes(rt_nodes *s, const gf_grid *grid) {
+    memset(s, 0, sizeof(rt_nodes));
+    s->nbx = (grid->nx + ROUTE_BLOCK - 1) / ROUTE_BLOCK;
+    s->cap = 64;
+    s->ids = (long *)malloc(s->cap * sizeof(long));
+    s->slots = (int *)malloc(s->cap * sizeof(int));
+    memset(s->ids, 0xff, s->cap * sizeof(long));
+    s->last_id = -1;
+}
+
+
+static
+void rt_free_nodes(rt_nodes *s) {
+    int b;
+
+    for (b = 0; b < s->nblocks; b++)
+        free(s->blocks[b]);
+    free(s->blocks);
+    free(s->ids);
+    free(s->slots);
+}
+
+
+/* Forget the last search, keeping the blocks for the next. */
+static
+void rt_clear_nodes(rt_nodes *s) {
+    int b;
+
+    for (b = 0; b < s->used; b++)
+        memset(s->blocks[b]->st, 0, ROUTE_BLOCK_NODES);
+    memset(s->ids, 0xff, s->cap * sizeof(long));
+    s->used = 0;
+    s->last_id = -1;
+}
+
+
+static
+size_t rt_slot(const rt_nodes *s, long id) {
+    size_t h = (size_t)(((uint64_t)id * 0x9E3779B97F4A7C15ULL) >> 32) & (s->cap - 1);
+
+    while (s->ids[h] != -1 && s->ids[h] != id)
+        h = (h + 1) & (s->cap - 1);
+    return h;
+}
+
+
+static
+void rt_grow_nodes(rt_nodes *s) {
+    long *ids = s->ids;
+    int *slots = s->slots;
+    size_t k, h, cap = s->cap;
+
+    s->cap *= 2;
+    s->ids = (long *)malloc(s->cap * sizeof(long));
+    s->slots = (int *)malloc(s->cap * sizeof(int));
+    memset(s->ids, 0xff, s->cap * sizeof(long));
+    for (k = 0; k < cap; k++) {
+        if (ids[k] == -1)
+            continue;
+        h = rt_slot(s, ids[k]);
+        s->ids[h] = ids[k];
+        s->slots[h] = slots[k];
+    }
+    free(ids);
+    free(slots);
+}
+
+
+/* Block holding node (ii, jj), allocated (cleared) on first touch. */
+static
+rt_block *rt_node_block(rt_nodes *s, long ii, long jj) {
+    long id = (ii / ROUTE_BLOCK) * s->nbx + jj / ROUTE_BLOCK;
+    size_t h;
+
+    if (id == s->last_id)
+        return s->last;
+
+    h = rt_slot(s, id);
+    if (s->ids[h] == -1) {
+        if (2 * (size_t)(s->used + 1) > s->cap) {
+            rt_grow_nodes(s);
+            h = rt_slot(s, id);
+        }
+        if (s->used == s->nblocks) {
+            s->blocks = (rt_block **)realloc(s->blocks, (s->nblocks + 1) * sizeof(rt_block *));
+            s->blocks[s->nblocks] = (rt_block *)calloc(1, sizeof(rt_block));
+            s->nblocks++;
+        }
+        s->ids[h] = id;
+        s->slots[h] = s->used++;
+    }
+    s->last_id = id;
+    s->last = s->blocks[s->slots[h]];
+    return s->last;
+}
+
+
+/* Empty the heap, keeping its buckets. */
+static
+void rt_clear_heap(gf_radix_heap *h) {
+    memset(h->len, 0, sizeof(h->len));
+    h->last = 0;
+    h->size = 0;
+}
+
+
+#define RT_INDEX(ii, jj) (((ii) % ROUTE_BLOCK) * ROUTE_BLOCK + (jj) % ROUTE_BLOCK)
+
+
+/* Cost of a move of horizontal length len (m) and rise dz (m), or a
+   negative value if the move is not allowed. */
+static
+double rt_move_cost(const gf_route_opts *opts, double len, double dz) {
+    double grade = dz / len;
+
+    if (opts->max_grade > 0.0 && fabs(grade) > opts->max_grade)
+        return -1.0;
+    if (opts->cost == GF_ROUTE_TOBLER)
+        return len / (6000.0 / 3600.0 * exp(-3.5 * fabs(grade + 0.05)));
+    return len * (1.0 + opts->slope_weight * fabs(grade));
+}
+
+
+/* Admissible, consistent estimate of the cost from (ii, jj) to the goal. */
+static
+double rt_heuristic(const rt_search *s, long ii, long jj, long gi, long gj) {
+    long di = labs(gi - ii), dj = labs(gj - jj), m = di < dj ? di : dj;
+
+    return m * s->hd + (di - m) * s->hy + (dj - m) * s->hx;
+}
+
+
+static
+int rt_nearest_node(const gf_grid *g, const double *latlng, long *ii, long *jj) {
+    *ii = lround((g->top - latlng[0]) / g->dy);
+    *jj = lround((latlng[1] - g->left) / g->dx);
+    return *ii >= 0 && *ii < g->ny && *jj >= 0 && *jj < g->nx ? 0 : -1;
+}
+
+
+static
+int rt_search_one(rt_search *s, const gf_route_query *q, gf_route *route) {
+    const gf_grid *g = &s->gf->grid;
+    const gf_route_opts *opts = s->opts;
+    long si, sj, gi, gj, ii, jj, ni, nj, val, goal, expanded = 0, failed0;
+    double len[8], c, ng;
+    float z, zn;
+    uint64_t key;
+    rt_block *b, *nb;
+    int k, at, nat, n;
+
+    route->n = 0;
+    route->latlng = NULL;
+    route->cost = route->length = 0.0;
+    failed0 = s->cache.failed;
+
+    if (rt_nearest_node(g, q->from, &si, &sj) != 0 || rt_nearest_node(g, q->to, &gi, &gj) != 0 ||
+            gf_cache_value(&s->cache, si, sj) == GF_NULL_VAL ||
+            gf_cache_value(&s->cache, gi, gj) == GF_NULL_VAL)
+        return -1;
+
+    rt_clear_nodes(&s->nodes);
+    rt_clear_heap(&s->heap);
+
+    b = rt_node_block(&s->nodes, si, sj);
+    at = RT_INDEX(si, sj);
+    b->g[at] = 0.0f;
+    b->st[at] = ROUTE_SEEN | ROUTE_START;
+    goal = gi * g->nx + gj;
+    gf_radix_push(&s->heap, gf_radix_key_double(rt_heuristic(s, si, sj, gi, gj)), si * g->nx + sj);
+
+    while (gf_radix_pop(&s->heap, &key, &val)) {
+        ii = val / g->nx;
+        jj = val % g->nx;
+        b = rt_node_block(&s->nodes, ii, jj);
+        at = RT_INDEX(ii, jj);
+        if (b->st[at] & ROUTE_CLOSED)
+            continue;
+        b->st[at] |= ROUTE_CLOSED;
+        if (val == goal)
+            break;
+        if (opts->max_expand > 0 && ++expanded > opts->max_expand)
+            return -1;
+
+        z = gf_cache_value(&s->cache, ii, jj);
+        len[0] = len[4] = s->dx_m[ii];
+        len[2] = len[6] = s->dy_m[ii];
+        len[1] = len[3] = len[5] = len[7] = hypot(s->dx_m[ii], s->dy_m[ii]);
+        for (k = 0; k < 8; k++) {
+            ni = ii + rt_di[k];
+            nj = jj + rt_dj[k];
+            if (ni < 0 || ni >= g->ny || nj < 0 || nj >= g->nx)
+                continue;
+            if ((zn = gf_cache_value(&s->cache, ni, nj)) == GF_NULL_VAL)
+                continue;
+            if ((c = rt_move_cost(opts, len[k], zn - z)) < 0.0)
+                continue;
+
+            /* The block lookup may move b's fast path; g[at] stays put. */
+            ng = rt_node_block(&s->nodes, ii, jj)->g[at] + c;
+            nb = rt_node_block(&s->nodes, ni, nj);
+            nat = RT_INDEX(ni, nj);
+            if ((nb->st[nat] & ROUTE_SEEN) && ((nb->st[nat] & ROUTE_CLOSED) || ng >= nb->g[nat]))
+                continue;
+            nb->g[nat] = (float)ng;
+            nb->st[nat] = ROUTE_SEEN | ((k + 4) & 7);
+            gf_radix_push(&s->heap, gf_radix_key_double(ng + rt_heuristic(s, ni, nj, gi, gj)),
+                ni * g->nx + nj);
+        }
+    }
+
+    b = rt_node_block(&s->nodes, gi, gj);
+    at = RT_INDEX(gi, gj);
+    if (!(b->st[at] & ROUTE_CLOSED) || s->cache.failed > failed0)
+        return -1;
+    route->cost = b->g[at];
+
+    /* Walk back to the start, then reverse. */
+    for (n = 1, ii = gi, jj = gj; !(b->st[at] & ROUTE_START); n++) {
+        k = b->st[at] & 7;
+        ii += rt_di[k];
+        jj += rt_dj[k];
+        b = rt_node_block(&s->nodes, ii, jj);
+        at = RT_INDEX(ii, jj);
+    }
+    route->n = n;
+    route->latlng = (double *)malloc(2 * n * sizeof(double));
+    for (n = route->n - 1, ii = gi, jj = gj; n >= 0; n--) {
+        route->latlng[2 * n] = g->top - ii * g->dy;
+        route->latlng[2 * n + 1] = g->left + jj * g->dx;
+        b = rt_node_block(&s->nodes, ii, jj);
+        at = RT_INDEX(ii, jj);
+        if (n > 0) {
+            k = b->st[at] & 7;
+            route->length += (rt_di[k] && rt_dj[k]) ? hypot(s->dx_m[ii], s->dy_m[ii]) :
+                rt_di[k] ? s->dy_m[ii] : s->dx_m[ii];
+            ii += rt_di[k];
+            jj += rt_dj[k];
+        }
+    }
+    return 0;
+}
+
+
+static
+void rt_row_lengths(const gf_grid *g, double *dx_m, double *dy_m) {
+    long ii;
+
+    for (ii = 0; ii < g->ny; ii++)
+        gf_lengths(g->top - ii * g->dy, g->left, g->dy, g->dx, 0.0, &dx_m[ii], &dy_m[ii]);
+}
+
+
+static
+int rt_init_search(rt_search *s, const gf_struct *gf, const gf_route_opts *opts,
+    const double *dx_m, const double *dy_m)
+{
+    double dx_min = dx_m[0], dy_min = dy_m[0], pace;
+    long ii;
+
+    s->gf = gf;
+    s->opts = opts;
+    s->dx_m = dx_m;
+    s->dy_m = dy_m;
+    for (ii = 1; ii < gf->grid.ny; ii++) {
+        if (dx_m[ii] < dx_min)
+            dx_min = dx_m[ii];
+        if (dy_m[ii] < dy_min)
+            dy_min = dy_m[ii];
+    }
+    pace = opts->cost == GF_ROUTE_TOBLER ? ROUTE_TOBLER_MIN_PACE : 1.0;
+    s->hx = pace * dx_min;
+    s->hy = pace * dy_min;
+    s->hd = pace * hypot(dx_min, dy_min);
+
+    if (gf_init_block_cache(&s->cache, gf, opts->cache_blocks) != 0)
+        return -1;
+    rt_init_nodes(&s->nodes, &gf->grid);
+    gf_init_radix_heap(&s->heap);
+    return 0;
+}
+
+
+static
+void rt_free_search(rt_search *s) {
+    gf_free_block_cache(&s->cache);
+    rt_free_nodes(&s->nodes);
+    gf_free_radix_heap(&s->heap);
+}
+
+
+int gf_find_route(const gf_struct *gf, const gf_route_opts *opts,
+    const gf_route_query *q, gf_route *route)
+{
+    return gf_route_batch(gf, opts, 1, q, route) == 0 ? 0 : -1;
+}
+
+
+static
+void rt_route_task(int run, void *arg) {
+    rt_job *job = (rt_job *)arg;
+    rt_search s;
+    int k, k0, k1, p, failed = 0;
+
+    k0 = (int)((long)job->n * run / job->nruns);
+    k1 = (int)((long)job->n * (run + 1) / job->nruns);
+    if (rt_init_search(&s, job->gf, job->opts, job->dx_m, job->dy_m) != 0) {
+        __sync_fetch_and_add(&job->failed, k1 - k0);
+        return;
+    }
+    for (k = k0; k < k1; k++) {
+        p = job->keys[k].index;
+        if (rt_search_one(&s, job->q + p, job->routes + p) != 0)
+            failed++;
+    }
+    rt_free_search(&s);
+    __sync_fetch_and_add(&job->failed, failed);
+}
+
+
+static
+int rt_key_cmp(const void *a, const void *b) {
+    int64_t d1 = ((const rt_key *)a)->d, d2 = ((const rt_key *)b)->d;
+    return (d1 > d2) - (d1 < d2);
+}
+
+
+int gf_route_batch(const gf_struct *gf, const gf_route_opts *opts,
+    int n, const gf_route_query *q, gf_route *routes)
+{
+    const gf_grid *g = &gf->grid;
+    rt_job job;
+    rt_key *keys;
+    double *dx_m, *dy_m;
+    int64_t side = 1;
+    long ii, jj;
+    int k;
+
+    if (n <= 0)
+        return 0;
+    for (k = 0; k < n; k++) {
+        routes[k].n = 0;
+        routes[k].latlng = NULL;
+    }
+
+    while (side < g->nx || side < g->ny)
+        side *= 2;
+    keys = (rt_key *)malloc(n * sizeof(rt_key));
+    for (k = 0; k < n; k++) {
+        keys[k].index = k;
+        keys[k].d = rt_nearest_node(g, q[k].from, &ii, &jj) == 0 ?
+            gf_hilbert_index(side, jj, ii) : -1;
+    }
+    qsort(keys, n, sizeof(rt_key), &rt_key_cmp);
+
+    dx_m = (double *)malloc(g->ny * sizeof(double));
+    dy_m = (double *)malloc(g->ny * sizeof(double));
+    rt_row_lengths(g, dx_m, dy_m);
+
+    job.gf = gf;
+    job.opts = opts;
+    job.q = q;
+    job.routes = routes;
+    job.keys = keys;
+    job.dx_m = dx_m;
+    job.dy_m = dy_m;
+    job.n = n;
+    job.nruns = gf_num_threads();
+    if (job.nruns > n)
+        job.nruns = n;
+    job.failed = 0;
+    gf_parallel_for(job.nruns, job.nruns, &rt_route_task, (void *)&job);
+
+    free(keys);
+    free(dx_m);
+    free(dy_m);
+    return job.failed;
+}
+
+
+void gf_free_route(gf_route *route) {
+    free(route->latlng);
+    route->latlng = NULL;
+    route->n = 0;
+}
+
+
+int gf_read_route_queries(FILE *fp, gf_route_query **q, int *n) {
+    char *line = NULL, *tok, *saveptr;
+    size_t line_cap = 0;
+    double v[4];
+    int cap = 0, k;
+
+    *q = NULL;
+    *n = 0;
+
+    while (getline(&line, &line_cap, fp) != -1) {
+        tok = strtok_r(line, " ,\t\r\n", &saveptr);
+        if (tok == NULL || tok[0] == '#')
+            continue;
+        for (k = 0; k < 4 && tok != NULL; k++) {
+            v[k] = atof(tok);
+            tok = strtok_r(NULL, " ,\t\r\n", &saveptr);
+        }
+        if (k < 4) {
+            fprintf(stderr, "Skipping query without both ends\n");
+            continue;
+        }
+
+        if (*n == cap) {
+            cap = cap ? 2 * cap : 64;
+            *q = (gf_route_query *)realloc(*q, cap * sizeof(gf_route_query));
+        }
+        (*q)[*n].from[0] = v[0];
+        (*q)[*n].from[1] = v[1];
+        (*q)[*n].to[0] = v[2];
+        (*q)[*n].to[1] = v[3];
+        (*n)++;
+    }
+
+    free(line);
+    return 0;
+}
+
+
+void gf_print_routes(FILE *fp, int n, const gf_route *routes) {
+    int k, v;
+
+    for (k = 0; k < n; k++) {
+        fprintf(fp, "# route %d cost %f length %f n %d\n", k,
+            routes[k].cost, routes[k].length, routes[k].n);
+        for (v = 0; v < routes[k].n; v++)
+            fprintf(fp, "%f %f\n", routes[k].latlng[2 * v], routes[k].latlng[2 * v + 1]);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef GF_ROUTE_H
+#define GF_ROUTE_H
+
+#include "gridfloat.h"
+
+/* Cost models for gf_route_opts. */
+#define GF_ROUTE_SLOPE 0    /* Meters, times 1 + slope_weight * |grade| */
+#define GF_ROUTE_TOBLER 1   /* Walking seconds, by Tobler's hiking function */
+
+/**
+ * Least-cost path options.
+ *
+ * @cost - GF_ROUTE_SLOPE or GF_ROUTE_TOBLER.
+ * @slope_weight - Penalty per unit of grade for GF_ROUTE_SLOPE.
+ * @max_grade - Steeper moves (|rise / run|) are impassable; 0 for no
+ *      limit.
+ * @max_expand - Give up after settling this many nodes; 0 for no
+ *      limit.
+ * @cache_blocks - Elevation blocks each search thread keeps (see
+ *      gf_block_cache).
+ */
+typedef struct gf_route_opts {
+    int cost;
+    double slope_weight;
+    double max_grade;
+    long max_expand;
+    int cache_blocks;
+} gf_route_opts;
+
+void gf_init_route_opts(gf_route_opts *opts);
+
+typedef struct gf_route_query {
+    double from[2];     /* lat, lng */
+    double to[2];
+} gf_route_query;
+
+/**
+ * A route through source nodes.
+ *
+ * @n - Number of vertices; 0 if there is no route.
+ * @latlng - 2 * n doubles: lat0, lng0, lat1, lng1, ...
+ * @cost - Total cost, in the units of the cost model.
+ * @length - Horizontal length (m).
+ */
+typedef struct gf_route {
+    int n;
+    double *latlng;
+    double cost;
+    double length;
+} gf_route;
+
+/**
+ * Least-cost 8-connected path between the source nodes nearest the
+ * query's ends, by A* with an octile-distance heuristic scaled to the
+ * cheapest cost per meter the model allows (so it stays admissible).
+ * Moves into NODATA or steeper than max_grade are not allowed.
+ *
+ * Nothing is read up front: elevations come through a block cache
+ * and per-node search state (a float cost and one byte of flags and
+ * back-pointer) lives in 64x64 blocks allocated as the search first
+ * touches them, so a search costs memory for the area it explores
+ * only. The open set is a radix heap.
+ *
+ * Returns 0 on success, -1 if an end is off the source or on NODATA,
+ * if no route exists within max_expand, or if elevations along the
+ * search could not be read.
+ */
+int gf_find_route(const gf_struct *gf, const gf_route_opts *opts,
+    const gf_route_query *q, gf_route *route);
+
+/**
+ * Many routes at once. Queries are ordered along a Hilbert curve and
+ * split into runs, one per thread, so neighboring queries share a
+ * thread's elevation cache and node-state blocks. Returns the number
+ * of queries without a route (their n is 0).
+ */
+int gf_route_batch(const gf_struct *gf, const gf_route_opts *opts,
+    int n, const gf_route_query *q, gf_route *routes);
+
+void gf_free_route(gf_route *route);
+
+/* Read 'LAT LNG LAT LNG' queries, one per line. */
+int gf_read_route_queries(FILE *fp, gf_route_query **q, int *n);
+
+/* '# route K cost C length L n N' then N 'LAT LNG' lines. */
+void gf_print_routes(FILE *fp, int n, const gf_route *routes);
+
+#endif
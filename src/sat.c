@@ -0,0 +1,373 @@
+#include "sat.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAT_MAGIC "GFSAT002"
+#define SAT_STRIPE 256
+
+/* Table index of entry (i, j). */
+#define SAT_AT(sat, i, j) ((size_t)(i) * ((sat)->grid.nx + 1) + (j))
+
+
+typedef struct gf_sat_job {
+    const gf_struct *gf;
+    gf_sat *sat;
+    long ii0;       /* Source row of region row 0 */
+    long jj0;       /* Source column of region column 0 */
+    int nbands;
+    int failed;
+} gf_sat_job;
+
+
+/* Row pass: table row i + 1 gets running sums along region row i. */
+static
+void gf_sat_rows_task(int b, void *arg) {
+    gf_sat_job *job = (gf_sat_job *)arg;
+    gf_sat *sat = job->sat;
+    int i, j, i_start, i_end, nx = sat->grid.nx;
+    gf_float *line;
+    double s, s2, v;
+    unsigned int c;
+    size_t k;
+
+    i_start = (int)(((long)sat->grid.ny * b) / job->nbands);
+    i_end = (int)(((long)sat->grid.ny * (b + 1)) / job->nbands);
+
+    line = (gf_float *)malloc(nx * sizeof(gf_float));
+
+    for (i = i_start; i < i_end; i++) {
+        if (gf_get_line(job->ii0 + i, job->jj0, job->jj0 + nx, job->gf, line) != 0)
+            __sync_fetch_and_add(&job->failed, 1);
+
+        k = SAT_AT(sat, i + 1, 0);
+        sat->sum[k] = sat->sum2[k] = 0.0;
+        sat->count[k] = 0;
+        s = s2 = 0.0;
+        c = 0;
+        for (j = 0; j < nx; j++) {
+            if (line[j] != GF_NULL_VAL) {
+                v = line[j] - sat->shift;
+                s += v;
+                s2 += v * v;
+                c++;
+            }
+            sat->sum[k + j + 1] = s;
+            sat->sum2[k + j + 1] = s2;
+            sat->count[k + j + 1] = c;
+        }
+    }
+
+    free(line);
+}
+
+
+/* Column pass over one stripe of table columns. */
+static
+void gf_sat_cols_task(int stripe, void *arg) {
+    gf_sat_job *job = (gf_sat_job *)arg;
+    gf_sat *sat = job->sat;
+    int i, j, j_start, j_end;
+    size_t k, up;
+
+    j_start = stripe * SAT_STRIPE;
+    j_end = j_start + SAT_STRIPE;
+    if (j_end > sat->grid.nx + 1)
+        j_end = sat->grid.nx + 1;
+
+    for (i = 2; i <= sat->grid.ny; i++) {
+        k = SAT_AT(sat, i, 0);
+        up = SAT_AT(sat, i - 1, 0);
+        for (j = j_start; j < j_end; j++) {
+            sat->sum[k + j] += sat->sum[up + j];
+            sat->sum2[k + j] += sat->sum2[up + j];
+            sat->count[k + j] += sat->count[up + j];
+        }
+    }
+}
+
+
+/* Shift by the mean of the region's first row (or by nothing if it is
+all null): close enough to the region's mean to keep sum2 small. */
+static
+int gf_sat_shift(const gf_struct *gf, long ii0, long jj0, gf_sat *sat) {
+    gf_float *line;
+    double s = 0.0;
+    long c = 0;
+    int j, err;
+
+    line = (gf_float *)malloc(sat->grid.nx * sizeof(gf_float));
+    if ((err = gf_get_line(ii0, jj0, jj0 + sat->grid.nx, gf, line)) == 0) {
+        for (j = 0; j < sat->grid.nx; j++) {
+            if (line[j] != GF_NULL_VAL) {
+                s += line[j];
+                c++;
+            }
+        }
+    }
+    free(line);
+
+    sat->shift = c > 0 ? s / c : 0.0;
+    return err;
+}
+
+
+static
+int gf_sat_alloc(gf_sat *sat) {
+    size_t n = (size_t)(sat->grid.nx + 1) * (sat->grid.ny + 1);
+
+    sat->sum = (double *)malloc(n * sizeof(double));
+    sat->sum2 = (double *)malloc(n * sizeof(double));
+    sat->count = (unsigned int *)malloc(n * sizeof(unsigned int));
+
+    if (sat->sum == NULL || sat->sum2 == NULL || sat->count == NULL) {
+        gf_free_sat(sat);
+        return -1;
+    }
+
+    /* Row zero is all zeros. */
+    memset(sat->sum, 0, (sat->grid.nx + 1) * sizeof(double));
+    memset(sat->sum2, 0, (sat->grid.nx + 1) * sizeof(double));
+    memset(sat->count, 0, (sat->grid.nx + 1) * sizeof(unsigned int));
+    return 0;
+}
+
+
+int gf_build_sat(const gf_struct *gf, const gf_bounds *bounds, gf_sat *sat) {
+    const gf_grid *g = &gf->grid;
+    gf_sat_job job;
+    long ii1, jj1;
+
+    memset((void *)sat, 0, sizeof(gf_sat));
+
+    if (bounds == NULL) {
+        job.jj0 = job.ii0 = 0;
+        jj1 = g->nx - 1;
+        ii1 = g->ny - 1;
+    } else {
+        /* Nodes inside the bounds. */
+        job.jj0 = (long)ceil((bounds->left - g->left) / g->dx - GF_ALIGN_TOL);
+        jj1 = (long)floor((bounds->right - g->left) / g->dx + GF_ALIGN_TOL);
+        job.ii0 = (long)ceil((g->top - bounds->top) / g->dy - GF_ALIGN_TOL);
+        ii1 = (long)floor((g->top - bounds->bottom) / g->dy + GF_ALIGN_TOL);
+
+        if (job.jj0 < 0) job.jj0 = 0;
+        if (job.ii0 < 0) job.ii0 = 0;
+        if (jj1 > g->nx - 1) jj1 = g->nx - 1;
+        if (ii1 > g->ny - 1) ii1 = g->ny - 1;
+    }
+
+    if (jj1 < job.jj0 || ii1 < job.ii0)
+        return -1;
+
+    sat->grid.nx = (int)(jj1 - job.jj0 + 1);
+    sat->grid.ny = (int)(ii1 - job.ii0 + 1);
+    sat->grid.dx = g->dx;
+    sat->grid.dy = g->dy;
+    sat->grid.left = g->left + job.jj0 * g->dx;
+    sat->grid.right = g->left + jj1 * g->dx;
+    sat->grid.top = g->top - job.ii0 * g->dy;
+    sat->grid.bottom = g->top - ii1 * g->dy;
+
+    if (gf_sat_alloc(sat) != 0)
+        return -1;
+    if (gf_sat_shift(gf, job.ii0, job.jj0, sat) != 0) {
+        gf_free_sat(sat);
+        return -1;
+    }
+
+    job.gf = gf;
+    job.sat = sat;
+    job.failed = 0;
+    job.nbands = gf_num_threads();
+    if (job.nbands > sat->grid.ny)
+        job.nbands = sat->grid.ny;
+
+    gf_parallel_for(job.nbands, job.nbands, &gf_sat_rows_task, (void *)&job);
+    gf_parallel_for((sat->grid.nx + SAT_STRIPE) / SAT_STRIPE, 0,
+        &gf_sat_cols_task, (void *)&job);
+
+    return job.failed ? -1 : 0;
+}
+
+
+void gf_free_sat(gf_sat *sat) {
+    free(sat->sum);
+    free(sat->sum2);
+    free(sat->count);
+    sat->sum = sat->sum2 = NULL;
+    sat->count = NULL;
+}
+
+
+int gf_save_sat(const gf_sat *sat, const char *filename) {
+    FILE *fp;
+    size_t n = (size_t)(sat->grid.nx + 1) * (sat->grid.ny + 1);
+    int ok;
+
+    if ((fp = fopen(filename, "wb")) == NULL)
+        return -1;
+
+    ok = fwrite(SAT_MAGIC, 1, 8, fp) == 8 &&
+        fwrite((void *)&sat->grid, sizeof(gf_grid), 1, fp) == 1 &&
+        fwrite((void *)&sat->shift, sizeof(double), 1, fp) == 1 &&
+        fwrite((void *)sat->sum, sizeof(double), n, fp) == n &&
+        fwrite((void *)sat->sum2, sizeof(double), n, fp) == n &&
+        fwrite((void *)sat->count, sizeof(unsigned int), n, fp) == n;
+
+    fclose(fp);
+    return ok ? 0 : -2;
+}
+
+
+int gf_load_sat(const char *filename, gf_sat *sat) {
+    FILE *fp;
+    char magic[8];
+    size_t n;
+    int ok;
+
+    memset((void *)sat, 0, sizeof(gf_sat));
+
+    if ((fp = fopen(filename, "rb")) == NULL)
+        return -1;
+
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, SAT_MAGIC, 8) != 0 ||
+        fread((void *)&sat->grid, sizeof(gf_grid), 1, fp) != 1 ||
+        fread((void *)&sat->shift, sizeof(double), 1, fp) != 1 ||
+        sat->grid.nx < 1 || sat->grid.ny < 1 ||
+        gf_sat_alloc(sat) != 0) {
+        fclose(fp);
+        return -2;
+    }
+
+    n = (size_t)(sat->grid.nx + 1) * (sat->grid.ny + 1);
+    ok = fread((void *)sat->sum, sizeof(double), n, fp) == n &&
+        fread((void *)sat->sum2, sizeof(double), n, fp) == n &&
+        fread((void *)sat->count, sizeof(unsigned int), n, fp) == n;
+
+    fclose(fp);
+    if (!ok) {
+        gf_free_sat(sat);
+        return -3;
+    }
+    return 0;
+}
+
+
+/* Clip a window to the region. Returns 0 if nothing is left. */
+static
+int gf_sat_clip(const gf_sat *sat, int *i0, int *j0, int *i1, int *j1) {
+    if (*i0 < 0) *i0 = 0;
+    if (*j0 < 0) *j0 = 0;
+    if (*i1 > sat->grid.ny) *i1 = sat->grid.ny;
+    if (*j1 > sat->grid.nx) *j1 = sat->grid.nx;
+    return *i0 < *i1 && *j0 < *j1;
+}
+
+
+#define SAT_RECT(table, sat, i0, j0, i1, j1) \
+    ((table)[SAT_AT(sat, i1, j1)] - (table)[SAT_AT(sat, i0, j1)] - \
+     (table)[SAT_AT(sat, i1, j0)] + (table)[SAT_AT(sat, i0, j0)])
+
+
+double gf_sat_sum(const gf_sat *sat, int i0, int j0, int i1, int j1) {
+    if (!gf_sat_clip(sat, &i0, &j0, &i1, &j1))
+        return 0.0;
+    return SAT_RECT(sat->sum, sat, i0, j0, i1, j1) +
+        sat->shift * SAT_RECT(sat->count, sat, i0, j0, i1, j1);
+}
+
+
+long gf_sat_count(const gf_sat *sat, int i0, int j0, int i1, int j1) {
+    if (!gf_sat_clip(sat, &i0, &j0, &i1, &j1))
+        return 0;
+    return (long)SAT_RECT(sat->count, sat, i0, j0, i1, j1);
+}
+
+
+double gf_sat_mean(const gf_sat *sat, int i0, int j0, int i1, int j1) {
+    long n;
+
+    if (!gf_sat_clip(sat, &i0, &j0, &i1, &j1) ||
+        (n = (long)SAT_RECT(sat->count, sat, i0, j0, i1, j1)) == 0)
+        return GF_NULL_VAL;
+    return SAT_RECT(sat->sum, sat, i0, j0, i1, j1) / n + sat->shift;
+}
+
+
+double gf_sat_stddev(const gf_sat *sat, int i0, int j0, int i1, int j1) {
+    long n;
+    double mean, var;
+
+    if (!gf_sat_clip(sat, &i0, &j0, &i1, &j1) ||
+        (n = (long)SAT_RECT(sat->count, sat, i0, j0, i1, j1)) == 0)
+        return GF_NULL_VAL;
+
+    /* Both shifted; the variance is the same. */
+    mean = SAT_RECT(sat->sum, sat, i0, j0, i1, j1) / n;
+    var = SAT_RECT(sat->sum2, sat, i0, j0, i1, j1) / n - mean * mean;
+    return var > 0.0 ? sqrt(var) : 0.0;
+}
+
+
+typedef struct gf_tpi_job {
+    const gf_sat *sat;
+    int nradii;
+    const int *radii;
+    float **tpi;
+    float **roughness;
+} gf_tpi_job;
+
+
+static
+void gf_sat_tpi_task(int i, void *arg) {
+    gf_tpi_job *job = (gf_tpi_job *)arg;
+    const gf_sat *sat = job->sat;
+    int j, k, r, nx = sat->grid.nx;
+    long n;
+    double z, s;    /* Shifted; the shift cancels out of TPI. */
+    size_t out = (size_t)i * nx;
+
+    for (j = 0; j < nx; j++, out++) {
+        /* A lone node's "window" gives its own value back. */
+        if (SAT_RECT(sat->count, sat, i, j, i + 1, j + 1) == 0) {
+            for (k = 0; k < job->nradii; k++) {
+                if (job->tpi != NULL)
+                    job->tpi[k][out] = GF_NULL_VAL;
+                if (job->roughness != NULL)
+                    job->roughness[k][out] = GF_NULL_VAL;
+            }
+            continue;
+        }
+        z = SAT_RECT(sat->sum, sat, i, j, i + 1, j + 1);
+
+        for (k = 0; k < job->nradii; k++) {
+            r = job->radii[k];
+            if (job->tpi != NULL) {
+                n = gf_sat_count(sat, i - r, j - r, i + r + 1, j + r + 1);
+                s = gf_sat_sum(sat, i - r, j - r, i + r + 1, j + r + 1) - sat->shift * n;
+                job->tpi[k][out] = n > 1 ? (float)(z - (s - z) / (n - 1)) : 0.0f;
+            }
+            if (job->roughness != NULL)
+                job->roughness[k][out] = (float)gf_sat_stddev(sat,
+                    i - r, j - r, i + r + 1, j + r + 1);
+        }
+    }
+}
+
+
+int gf_sat_tpi(const gf_sat *sat, int nradii, const int *radii,
+    float **tpi, float **roughness)
+{
+    gf_tpi_job job;
+
+    job.sat = sat;
+    job.nradii = nradii;
+    job.radii = radii;
+    job.tpi = tpi;
+    job.roughness = roughness;
+
+    return gf_parallel_for(sat->grid.ny, 0, &gf_sat_tpi_task, (void *)&job);
+}
@@ -0,0 +1,75 @@
+#ifndef GF_SAT_H
+#define GF_SAT_H
+
+#include "gridfloat.h"
+
+/**
+ * Summed-area tables over a rectangle of source nodes.
+ *
+ * Each table has (ny + 1) x (nx + 1) entries; entry (i, j) holds the
+ * total over nodes [0, i) x [0, j) of the region, so any rectangle's
+ * sum is four lookups. NODATA nodes are left out of every table, and
+ * the count table says how many valid nodes a rectangle holds.
+ *
+ * Elevations are summed less a shift near the region's mean, so that
+ * variances of high, flat terrain do not cancel away in sum2.
+ *
+ * @grid - The source nodes covered (native resolution).
+ * @shift - Subtracted from every elevation before summing.
+ * @sum - Sums of shifted elevations.
+ * @sum2 - Sums of squared shifted elevations.
+ * @count - Numbers of valid nodes.
+ */
+typedef struct gf_sat {
+    gf_grid grid;
+    double shift;
+    double *sum;
+    double *sum2;
+    unsigned int *count;
+} gf_sat;
+
+/**
+ * Build tables over the source nodes inside bounds (the whole source if
+ * bounds is NULL). Rows are read and summed in parallel bands, then
+ * columns are accumulated in parallel stripes.
+ */
+int gf_build_sat(const gf_struct *gf, const gf_bounds *bounds, gf_sat *sat);
+
+void gf_free_sat(gf_sat *sat);
+
+/**
+ * Persist tables, conventionally beside the .flt as PREFIX.sat, and
+ * read them back.
+ */
+int gf_save_sat(const gf_sat *sat, const char *filename);
+
+int gf_load_sat(const char *filename, gf_sat *sat);
+
+/*
+ * Window queries over rows [i0, i1) and columns [j0, j1) of the region,
+ * clipped to it. Statistics cover valid nodes only; mean and stddev
+ * are GF_NULL_VAL for windows without any.
+ */
+double gf_sat_sum(const gf_sat *sat, int i0, int j0, int i1, int j1);
+
+long gf_sat_count(const gf_sat *sat, int i0, int j0, int i1, int j1);
+
+double gf_sat_mean(const gf_sat *sat, int i0, int j0, int i1, int j1);
+
+double gf_sat_stddev(const gf_sat *sat, int i0, int j0, int i1, int j1);
+
+/**
+ * Multi-scale topographic position index and roughness. For each
+ * radius r, TPI is a node's elevation minus the mean of the other
+ * valid nodes in the (2r + 1)^2 window around it, and roughness is the
+ * standard deviation over the window. Every node costs the same
+ * whatever the radius.
+ *
+ * @tpi, @roughness - Arrays of nradii rasters of grid.nx * grid.ny
+ *      floats each (row-major, top row first). Either may be NULL.
+ *      Null nodes get GF_NULL_VAL.
+ */
+int gf_sat_tpi(const gf_sat *sat, int nradii, const int *radii,
+    float **tpi, float **roughness);
+
+#endif
@@ -37,13 +37,10 @@ void gf_sift_down(gf_struct **gfs, int start, int end,
 int gf_sort(gf_struct **gfs, int len, int (*cmp)(gf_struct *gf1, gf_struct *gf2)) {
     int start, end;
     gf_struct *gf_swap;
-    printf("starting sort\n");
 
     for (start = (len - 2) / 2; start >= 0; start--)
         gf_sift_down(gfs, start, len, cmp);
 
-    printf("built heap\n");
-
     for (end = len - 1; end > 0; end--) {
         gf_swap = gfs[end];
         gfs[end] = gfs[0];
@@ -77,12 +74,11 @@ void rot(int64_t n, int64_t *x, int64_t *y, int rx, int ry) {
     }
 }
 
-//convert (x,y) to d
-static
-int64_t xy2d(int64_t x, int64_t y) {
+//convert (x,y) to d on an n x n curve (n a power of two)
+int64_t gf_hilbert_index(int64_t n, int64_t x, int64_t y) {
     int rx, ry;
     int64_t s, d=0;
-    for (s=hn/2; s>0; s/=2) {
+    for (s=n/2; s>0; s/=2) {
         rx = (x & s) > 0;
         ry = (y & s) > 0;
         d += s * s * ((3 * rx) ^ ry);
@@ -90,6 +86,11 @@ int64_t xy2d(int64_t x, int64_t y) {
     }
     return d;
 }
+
+static
+int64_t xy2d(int64_t x, int64_t y) {
+    return gf_hilbert_index(hn, x, y);
+}
  
 //convert d to (x,y)
 static
@@ -1,9 +1,18 @@
 #ifndef GF_SORT_H
 #define GF_SORT_H
 
+#include <stdint.h>
+
 int gf_sort(gf_struct **gfs, int len,
         int (*cmp)(gf_struct *gf1, gf_struct *gf2));
 
 int hilbert_cmp(gf_struct *gf1, gf_struct *gf2);
 
+/**
+ * Distance of (x, y) along the Hilbert curve filling an n x n grid,
+ * n a power of two and 0 <= x, y < n. Sorting by this index keeps
+ * nearby points close together.
+ */
+int64_t gf_hilbert_index(int64_t n, int64_t x, int64_t y);
+
 #endif
@@ -0,0 +1,267 @@
+#include "stencil.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+
+typedef struct gf_stencil_job {
+    const gf_struct *gf;
+    const gf_grid *to_grid;
+    const gf_stencil *st;
+    unsigned char *data;
+    int nbands;
+
+    /* Window offsets: rows [lo_r, hi_r], columns [lo_c, hi_c]. */
+    int lo_r, hi_r, lo_c, hi_c;
+
+    /* Per-column anchors (-1 where the window does not fit) and
+    x-offsets. Identical for every row, so computed once. */
+    long *jj;
+    double *wx;
+
+    /* Source columns held in each ring buffer, [jj_left, jj_right). */
+    long jj_left;
+    long jj_right;
+
+    int failed;     /* Bands that could not read a source row */
+} gf_stencil_job;
+
+
+void gf_init_stencil(gf_stencil *st, int height, int width,
+    gf_stencil_kernel *kernel, void *xtras, size_t elem_size)
+{
+    memset((void *)st, 0, sizeof(gf_stencil));
+    st->height = height;
+    st->width = width;
+    st->kernel = kernel;
+    st->xtras = xtras;
+    st->elem_size = elem_size;
+}
+
+
+void gf_stencil_band(const gf_grid *to_grid, int b, int n, int *i_start, int *i_end) {
+    *i_start = (int)(((long)to_grid->ny * b) / n);
+    *i_end = (int)(((long)to_grid->ny * (b + 1)) / n);
+}
+
+
+/**
+ * Anchor node for fractional node coordinate x and a window of the
+ * given size over n nodes. Returns LONG_MIN if the window does not
+ * fit. Even windows that would hang one node off the far edge, for a
+ * point sitting exactly on the last node, are shifted back by one.
+ */
+static
+long gf_stencil_anchor(double x, int size, long n, double *w) {
+    double a;
+    int lo = -(size - 1) / 2, hi = size / 2;
+
+    a = (size % 2) ? floor(x + 0.5) : floor(x);
+    *w = x - a;
+
+    if ((long)a + hi == n && size % 2 == 0 && *w < GF_ALIGN_TOL) {
+        a -= 1.0;
+        *w += 1.0;
+    }
+
+    if (a + lo < 0.0 || a + hi > (double)(n - 1))
+        return LONG_MIN;
+    return (long)a;
+}
+
+
+static
+void gf_stencil_null_row(const gf_stencil_job *job, unsigned char *row) {
+    int j;
+    const gf_stencil *st = job->st;
+
+    if (st->set_null == NULL)
+        return;
+    for (j = 0; j < job->to_grid->nx; ++j)
+        st->set_null(st->xtras, (void *)(row + j * st->elem_size));
+}
+
+
+/*
+ * Whether the null summary marks every node of the window anchored at
+ * (ii, jj) as NODATA. Windows no bigger than a block touch at most
+ * 2x2 blocks, whose corners they contain.
+ */
+static
+int gf_stencil_all_null(const gf_stencil_job *job, long ii, long jj) {
+    const gf_struct *gf = job->gf;
+    long r0 = ii + job->lo_r, r1 = ii + job->hi_r;
+    long c0 = jj + job->lo_c, c1 = jj + job->hi_c;
+
+    return (gf_block_flags(gf, r0, c0) & GF_BLOCK_ALL_NULL) &&
+        (gf_block_flags(gf, r0, c1) & GF_BLOCK_ALL_NULL) &&
+        (gf_block_flags(gf, r1, c0) & GF_BLOCK_ALL_NULL) &&
+        (gf_block_flags(gf, r1, c1) & GF_BLOCK_ALL_NULL);
+}
+
+
+static
+void gf_stencil_band_task(int b, void *arg) {
+    gf_stencil_job *job = (gf_stencil_job *)arg;
+    const gf_stencil *st = job->st;
+    const gf_grid *to_grid = job->to_grid, *from_grid = &job->gf->grid;
+    int i, j, k, i_start, i_end, h = st->height, skip_nulls, err = 0;
+    long ii, ii_next, r, span = job->jj_right - job->jj_left;
+    long *ring_ii;
+    gf_float **ring, **rowptrs;
+    unsigned char *scratch = NULL, *row;
+    double lat, w[2], latlng[2], wy_next;
+    gf_window win;
+
+    gf_stencil_band(to_grid, b, job->nbands, &i_start, &i_end);
+    if (i_start >= i_end)
+        return;
+
+    ring = (gf_float **)malloc(h * sizeof(gf_float *));
+    ring_ii = (long *)malloc(h * sizeof(long));
+    rowptrs = (gf_float **)malloc(h * sizeof(gf_float *));
+    for (k = 0; k < h; k++) {
+        ring[k] = span > 0 ? (gf_float *)malloc(span * sizeof(gf_float)) : NULL;
+        ring_ii[k] = LONG_MIN;
+    }
+
+    if (job->data == NULL && st->elem_size > 0)
+        scratch = (unsigned char *)malloc(to_grid->nx * st->elem_size);
+
+    skip_nulls = job->gf->null_blocks != NULL &&
+        st->height <= GF_NULL_BLOCK && st->width <= GF_NULL_BLOCK;
+
+    win.rows = rowptrs - job->lo_r;
+    win.height = h;
+    win.width = st->width;
+
+    for (i = i_start; i < i_end; ++i) {
+        lat = to_grid->top - i * to_grid->dy;
+        latlng[0] = lat;
+
+        if (job->data != NULL)
+            row = job->data + (size_t)i * to_grid->nx * st->elem_size;
+        else
+            row = scratch;
+
+        ii = span > 0 ? gf_stencil_anchor((from_grid->top - lat) / from_grid->dy,
+            h, from_grid->ny, &w[0]) : LONG_MIN;
+
+        if (ii == LONG_MIN) {
+            gf_stencil_null_row(job, row);
+        } else {
+            /* Row r lives in slot r % h; only missing rows are read.
+               A failed read ends the band before any kernel sees it. */
+            for (k = 0; k < h; k++) {
+                r = ii + job->lo_r + k;
+                if (ring_ii[r % h] != r) {
+                    ring_ii[r % h] = LONG_MIN;
+                    if ((err = gf_get_line(r, job->jj_left, job->jj_right, job->gf,
+                            ring[r % h])) != 0)
+                        break;
+                    ring_ii[r % h] = r;
+                }
+                rowptrs[k] = ring[r % h];
+            }
+            if (err != 0) {
+                __sync_fetch_and_add(&job->failed, 1);
+                break;
+            }
+
+            /* Ask for the rows the next target row will bring in. */
+            if (i + 1 < i_end) {
+                ii_next = gf_stencil_anchor(
+                    (from_grid->top - lat + to_grid->dy) / from_grid->dy,
+                    h, from_grid->ny, &wy_next);
+                if (ii_next != LONG_MIN) {
+                    for (r = ii_next + job->lo_r; r <= ii_next + job->hi_r; r++)
+                        if (r > ii + job->hi_r)
+                            gf_prefetch_line(r, job->jj_left, job->jj_right, job->gf);
+                }
+            }
+
+            for (j = 0; j < to_grid->nx; ++j) {
+                if (job->jj[j] < 0 || (skip_nulls && gf_stencil_all_null(job, ii, job->jj[j]))) {
+                    if (st->set_null != NULL)
+                        st->set_null(st->xtras, (void *)(row + j * st->elem_size));
+                    continue;
+                }
+                win.col = (int)(job->jj[j] - job->jj_left);
+                w[1] = job->wx[j];
+                latlng[1] = to_grid->left + j * to_grid->dx;
+                st->kernel(&win, from_grid, w, latlng, st->xtras,
+                    (void *)(row + j * st->elem_size));
+            }
+        }
+
+        if (st->row_done != NULL)
+            st->row_done(b, i, (void *)row, st->xtras);
+    }
+
+    for (k = 0; k < h; k++)
+        free(ring[k]);
+    free(ring);
+    free(ring_ii);
+    free(rowptrs);
+    free(scratch);
+}
+
+
+int gf_stencil_run(const gf_struct *gf, const gf_grid *to_grid,
+    const gf_stencil *st, void *data)
+{
+    gf_stencil_job job;
+    const gf_grid *from_grid = &gf->grid;
+    long a;
+    int j;
+
+    if (st->height < 1 || st->width < 1 || st->kernel == NULL)
+        return -1;
+    if (data == NULL && st->elem_size > 0 && st->row_done == NULL)
+        return -1;
+
+    job.gf = gf;
+    job.to_grid = to_grid;
+    job.st = st;
+    job.data = (unsigned char *)data;
+    job.nbands = st->nbands > 1 ? st->nbands : 1;
+    if (job.nbands > to_grid->ny)
+        job.nbands = to_grid->ny > 0 ? to_grid->ny : 1;
+
+    job.lo_r = -(st->height - 1) / 2;
+    job.hi_r = st->height / 2;
+    job.lo_c = -(st->width - 1) / 2;
+    job.hi_c = st->width / 2;
+
+    job.jj = (long *)malloc(to_grid->nx * sizeof(long));
+    job.wx = (double *)malloc(to_grid->nx * sizeof(double));
+    job.jj_left = LONG_MAX;
+    job.jj_right = LONG_MIN;
+    job.failed = 0;
+
+    for (j = 0; j < to_grid->nx; ++j) {
+        a = gf_stencil_anchor(
+            (to_grid->left + j * to_grid->dx - from_grid->left) / from_grid->dx,
+            st->width, from_grid->nx, &job.wx[j]);
+        if (a == LONG_MIN) {
+            job.jj[j] = -1;
+            continue;
+        }
+        job.jj[j] = a;
+        if (a + job.lo_c < job.jj_left)
+            job.jj_left = a + job.lo_c;
+        if (a + job.hi_c + 1 > job.jj_right)
+            job.jj_right = a + job.hi_c + 1;
+    }
+    if (job.jj_left > job.jj_right)
+        job.jj_left = job.jj_right = 0;
+
+    gf_parallel_for(job.nbands, job.nbands, &gf_stencil_band_task, (void *)&job);
+
+    free(job.jj);
+    free(job.wx);
+    return job.failed ? -2 : 0;
+}
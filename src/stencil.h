@@ -0,0 +1,108 @@
+#ifndef GF_STENCIL_H
+#define GF_STENCIL_H
+
+#include "gridfloat.h"
+
+/**
+ * Sliding-window stencil engine.
+ *
+ * For every point on a target grid, the engine finds the anchoring
+ * source node and hands a kernel a height x width window of source
+ * values around it. Source rows live in a ring of `height` line
+ * buffers; row ii always occupies slot ii % height, so advancing the
+ * window never copies data and rows shared by consecutive target rows
+ * are read once.
+ *
+ * Anchoring: for odd sizes the anchor is the nearest node and the
+ * window spans offsets [-size/2, size/2]. For even sizes the anchor is
+ * the node below/left of the point and the window spans
+ * [-(size/2 - 1), size/2] (so a 2x2 window is the bilinear quad).
+ * Points whose window would leave the source are "null", as are
+ * points whose window the source's null summary (see gf_scan_nulls)
+ * shows to hold nothing but NODATA: the kernel is not called for them.
+ */
+
+/**
+ * Window handed to a kernel. Use GF_WIN(win, r, c) to get the value
+ * at row offset r and column offset c from the anchor.
+ */
+typedef struct gf_window {
+    gf_float **rows;    /* Indexed by row offset (may be negative). */
+    int col;            /* Anchor position within each row. */
+    int height;
+    int width;
+} gf_window;
+
+#define GF_WIN(win, r, c) ((win)->rows[(r)][(win)->col + (c)])
+
+/**
+ * @w - Offset of the target point from the anchor node, in source
+ *      cells: (y-offset, x-offset). y increases southward.
+ * @latlng - Target point.
+ * @data_ptr - Output element for this point (elem_size bytes).
+ */
+typedef int (gf_stencil_kernel)(const gf_window *win,
+    const gf_grid *from_grid,
+    double *w,
+    double *latlng,
+    void *xtras,
+    void *data_ptr
+);
+
+/* Called for points whose window does not fit in the source or is all
+NODATA by the null summary. */
+typedef int (gf_stencil_null)(void *xtras, void *data_ptr);
+
+/**
+ * Called once each target row is complete. @band identifies the
+ * calling band (see nbands), so per-band state can live in xtras.
+ */
+typedef int (gf_stencil_row)(int band, int i, void *row, void *xtras);
+
+/**
+ * Stencil description.
+ *
+ * @height, @width - Window size in source nodes.
+ * @kernel - Required.
+ * @set_null - Optional. Null points are left untouched without it.
+ * @row_done - Optional, except when streaming (see gf_stencil_run).
+ * @xtras - Passed through to the callbacks.
+ * @elem_size - Bytes per output point.
+ * @nbands - Number of horizontal bands processed in parallel, each
+ *      with its own ring. Zero or one runs on the calling thread, in
+ *      row order.
+ */
+typedef struct gf_stencil {
+    int height;
+    int width;
+    gf_stencil_kernel *kernel;
+    gf_stencil_null *set_null;
+    gf_stencil_row *row_done;
+    void *xtras;
+    size_t elem_size;
+    int nbands;
+} gf_stencil;
+
+void gf_init_stencil(gf_stencil *st, int height, int width,
+    gf_stencil_kernel *kernel, void *xtras, size_t elem_size);
+
+/**
+ * Run the stencil over to_grid.
+ *
+ * If data is non-NULL it holds to_grid->nx * to_grid->ny elements in
+ * row-major order (top row first). If data is NULL, each band writes
+ * into a one-row scratch buffer that is passed to row_done, so memory
+ * stays O(row width); with elem_size zero no output is kept at all and
+ * kernels are expected to work through xtras.
+ *
+ * Returns 0, -1 for a bad stencil, or -2 if a source row could not be
+ * read (a band stops at its first failed read, so its later rows are
+ * left unwritten).
+ */
+int gf_stencil_run(const gf_struct *gf, const gf_grid *to_grid,
+    const gf_stencil *st, void *data);
+
+/* Band of to_grid rows [*i_start, *i_end) handled by band b of n. */
+void gf_stencil_band(const gf_grid *to_grid, int b, int n, int *i_start, int *i_end);
+
+#endif
@@ -0,0 +1,239 @@
+#include "sweep.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* Lines per pool task. */
+#define SWEEP_CHUNK 64
+
+typedef struct gf_sweep_job {
+    const gf_sweep *sw;
+    gf_sweep_task *task;
+    void *arg;
+} gf_sweep_job;
+
+typedef struct gf_sky_job {
+    const float *elev;
+    float *svf;
+    float weight;           /* 1 / ndirs */
+} gf_sky_job;
+
+typedef struct gf_shadow_job {
+    const float *elev;
+    double tan_sun;
+    unsigned char *shadow;
+} gf_shadow_job;
+
+
+void gf_init_sweep(gf_sweep *sw, int nx, int ny, double dx_m, double dy_m, double azimuth) {
+    double ux, uy;
+    int nmajor, nminor, r;
+
+    /* Pixels per meter toward azimuth; rows run south. */
+    ux = cos(azimuth) / dx_m;
+    uy = -sin(azimuth) / dy_m;
+
+    sw->nx = nx;
+    sw->ny = ny;
+    sw->x_major = fabs(ux) >= fabs(uy);
+    if (sw->x_major) {
+        sw->sign = ux >= 0.0 ? 1 : -1;
+        sw->slope = uy / fabs(ux);
+        sw->step = sqrt(dx_m * dx_m + sw->slope * dy_m * sw->slope * dy_m);
+        nmajor = nx;
+        nminor = ny;
+    } else {
+        sw->sign = uy >= 0.0 ? 1 : -1;
+        sw->slope = ux / fabs(uy);
+        sw->step = sqrt(dy_m * dy_m + sw->slope * dx_m * sw->slope * dx_m);
+        nmajor = ny;
+        nminor = nx;
+    }
+
+    /* Minor drift across the whole raster. */
+    r = (int)floor((nmajor - 1) * sw->slope + 0.5);
+    sw->off = r > 0 ? r : 0;
+    sw->nlines = nminor + abs(r);
+}
+
+
+int gf_sweep_line(const gf_sweep *sw, int l, long *idx) {
+    int k, a, b, n = 0, nmajor, nminor;
+
+    nmajor = sw->x_major ? sw->nx : sw->ny;
+    nminor = sw->x_major ? sw->ny : sw->nx;
+
+    for (k = 0; k < nmajor; k++) {
+        b = l - sw->off + (int)floor(k * sw->slope + 0.5);
+        if (b < 0 || b >= nminor) {
+            if (n > 0)
+                break;      /* Left the raster for good. */
+            continue;
+        }
+        a = sw->sign > 0 ? k : nmajor - 1 - k;
+        idx[n++] = sw->x_major ? (long)b * sw->nx + a : (long)a * sw->nx + b;
+    }
+    return n;
+}
+
+
+static
+void gf_sweep_chunk_task(int chunk, void *arg) {
+    gf_sweep_job *job = (gf_sweep_job *)arg;
+    const gf_sweep *sw = job->sw;
+    long *idx;
+    int l, l1, n;
+
+    idx = (long *)malloc((sw->nx > sw->ny ? sw->nx : sw->ny) * sizeof(long));
+    l1 = (chunk + 1) * SWEEP_CHUNK;
+    if (l1 > sw->nlines)
+        l1 = sw->nlines;
+    for (l = chunk * SWEEP_CHUNK; l < l1; l++) {
+        if ((n = gf_sweep_line(sw, l, idx)) > 0)
+            (*job->task)(sw, idx, n, job->arg);
+    }
+    free(idx);
+}
+
+
+int gf_sweep_run(const gf_sweep *sw, gf_sweep_task *task, void *arg) {
+    gf_sweep_job job;
+
+    job.sw = sw;
+    job.task = task;
+    job.arg = arg;
+    return gf_parallel_for((sw->nlines + SWEEP_CHUNK - 1) / SWEEP_CHUNK, 0,
+        &gf_sweep_chunk_task, (void *)&job);
+}
+
+
+/**
+ * Walking away from the sun, a pixel at distance s is shadowed when
+ * some earlier pixel q has z_q + s_q tan > z + s tan, so the running
+ * maximum of z + s tan is the whole horizon.
+ */
+static
+void gf_shadow_line(const gf_sweep *sw, const long *idx, int n, void *arg) {
+    gf_shadow_job *job = (gf_shadow_job *)arg;
+    double horizon = -HUGE_VAL, h, rise = job->tan_sun * sw->step;
+    float z;
+    int m;
+
+    for (m = 0; m < n; m++) {
+        z = job->elev[idx[m]];
+        if (z == (float)GF_NULL_VAL) {
+            job->shadow[idx[m]] = 0;
+            continue;
+        }
+        h = z + m * rise;
+        job->shadow[idx[m]] = h < horizon;
+        if (h > horizon)
+            horizon = h;
+    }
+}
+
+
+int gf_cast_shadows(const gf_grid *grid, const float *elev, const double *n_sun,
+    unsigned char *shadow)
+{
+    gf_shadow_job job;
+    gf_sweep sw;
+    double dx_m, dy_m, horiz;
+    long k, n = (long)grid->nx * grid->ny;
+
+    horiz = sqrt(n_sun[0] * n_sun[0] + n_sun[1] * n_sun[1]);
+
+    /* Sun overhead or below the horizon: Lambert shading says it all. */
+    if (horiz < 1e-9 || n_sun[2] <= 0.0) {
+        for (k = 0; k < n; k++)
+            shadow[k] = 0;
+        return 0;
+    }
+
+    gf_cellsize_meters((gf_grid *)grid, &dx_m, &dy_m);
+
+    job.elev = elev;
+    job.tan_sun = n_sun[2] / horiz;
+    job.shadow = shadow;
+
+    /* Walk away from the sun. */
+    gf_init_sweep(&sw, grid->nx, grid->ny, dx_m, dy_m, atan2(-n_sun[1], -n_sun[0]));
+    return gf_sweep_run(&sw, &gf_shadow_line, (void *)&job);
+}
+
+
+/**
+ * Walking a line, the highest horizon from the current point is
+ * tangent to the upper hull of the points already passed. Hull points
+ * below the tangent from this point are below it from every later
+ * point too, so they are popped for good.
+ */
+static
+void gf_sky_line(const gf_sweep *sw, const long *idx, int n, void *arg) {
+    gf_sky_job *job = (gf_sky_job *)arg;
+    double *hs, *hz, s, z, t, t2;
+    int m, top = 0;
+
+    hs = (double *)malloc(n * sizeof(double));
+    hz = (double *)malloc(n * sizeof(double));
+
+    for (m = 0; m < n; m++) {
+        z = job->elev[idx[m]];
+        if (z == GF_NULL_VAL)
+            continue;
+        s = m * sw->step;
+
+        /* Pop hull points hidden behind the next one in. */
+        while (top >= 2 &&
+               (hz[top - 1] - z) * (s - hs[top - 2]) <= (hz[top - 2] - z) * (s - hs[top - 1]))
+            top--;
+
+        if (top > 0) {
+            t = (hz[top - 1] - z) / (s - hs[top - 1]);
+            if (t > 0.0) {
+                t2 = t * t;
+                job->svf[idx[m]] -= job->weight * (float)(t / sqrt(1.0 + t2));
+            }
+        }
+
+        hs[top] = s;
+        hz[top] = z;
+        top++;
+    }
+
+    free(hs);
+    free(hz);
+}
+
+
+int gf_sky_view(const gf_grid *grid, const float *elev, int ndirs, float *svf) {
+    gf_sky_job job;
+    gf_sweep sw;
+    double dx_m, dy_m;
+    long k, n = (long)grid->nx * grid->ny;
+    int d;
+
+    if (ndirs < 1)
+        return -1;
+
+    for (k = 0; k < n; k++)
+        svf[k] = 1.0f;
+
+    gf_cellsize_meters((gf_grid *)grid, &dx_m, &dy_m);
+    job.elev = elev;
+    job.svf = svf;
+    job.weight = 1.0f / ndirs;
+
+    /* Each sweep's lines touch disjoint pixels, so they can all add
+    into svf at once; the directions go one after another. */
+    for (d = 0; d < ndirs; d++) {
+        gf_init_sweep(&sw, grid->nx, grid->ny, dx_m, dy_m, 2.0 * PI * d / ndirs);
+        gf_sweep_run(&sw, &gf_sky_line, (void *)&job);
+    }
+
+    for (k = 0; k < n; k++)
+        if (elev[k] == (float)GF_NULL_VAL)
+            svf[k] = GF_NULL_VAL;
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef GF_SWEEP_H
+#define GF_SWEEP_H
+
+#include "gridfloat.h"
+
+/**
+ * Parallel line sweeps over an nx x ny raster.
+ *
+ * A sweep covers the raster with parallel digital lines running in
+ * one compass direction, so that every pixel lies on exactly one
+ * line. Walking each line in order lets a running quantity (a
+ * horizon, say) be carried from pixel to pixel at O(1) cost per
+ * pixel. Lines are independent and run in parallel.
+ *
+ * Lines step one pixel along the major axis (whichever of x and y
+ * the direction is closer to) and slope pixels along the other, with
+ * the minor offset rounded. Line l is shifted l - off pixels across
+ * the major axis from the first.
+ */
+typedef struct gf_sweep {
+    int nx, ny;
+    int x_major;
+    int sign;           /* Step along the major axis, +1 or -1 */
+    double slope;       /* Minor pixels per major step, signed */
+    int nlines;
+    int off;            /* Lines starting off the raster */
+    double step;        /* Meters per step along a line */
+} gf_sweep;
+
+/**
+ * Set up a sweep running toward azimuth (radians, 0 east, pi/2
+ * north) over a raster whose rows run south and whose cells measure
+ * dx_m by dy_m meters.
+ */
+void gf_init_sweep(gf_sweep *sw, int nx, int ny, double dx_m, double dy_m, double azimuth);
+
+/**
+ * Pixel indices (row * nx + column) of line l in walking order; pixel
+ * m is m steps from the first. idx must hold max(nx, ny) entries.
+ * Returns the count.
+ */
+int gf_sweep_line(const gf_sweep *sw, int l, long *idx);
+
+/* Called for each line with its pixels as from gf_sweep_line. */
+typedef void (gf_sweep_task)(const gf_sweep *sw, const long *idx, int n, void *arg);
+
+/* Run task over every line of the sweep on all threads. */
+int gf_sweep_run(const gf_sweep *sw, gf_sweep_task *task, void *arg);
+
+/**
+ * Cast shadows on a grid of elevations from a sun in unit direction
+ * n_sun (east, north, up), by one sweep away from the sun keeping the
+ * running horizon. shadow is set to 1 where terrain toward the sun
+ * rises above the sun's elevation angle, 0 elsewhere (including null
+ * elevations, which cast no shadow).
+ */
+int gf_cast_shadows(const gf_grid *grid, const float *elev, const double *n_sun,
+    unsigned char *shadow);
+
+/**
+ * Sky-view factor of every point of a grid of elevations: the share
+ * of the sky hemisphere not hidden by terrain, 1 on open flats,
+ * approximated over ndirs evenly spaced azimuths as the mean of
+ * 1 - sin(horizon angle). Each azimuth is one sweep whose lines keep
+ * the upper convex hull of the terrain behind them, so the horizon
+ * costs amortized O(1) per pixel however far away it lies. Null
+ * elevations get GF_NULL_VAL and do not block the sky.
+ */
+int gf_sky_view(const gf_grid *grid, const float *elev, int ndirs, float *svf);
+
+#endif
@@ -0,0 +1,145 @@
+#include "terrain.h"
+#include "stencil.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+
+static
+int gf_set_null_float(void *xtras, void *data_ptr) {
+    *(float *)data_ptr = GF_NULL_VAL;
+    return 0;
+}
+
+
+static
+int gf_run_float(const gf_struct *gf, const gf_grid *to_grid, int size,
+    gf_stencil_kernel *kernel, void *xtras, float *out)
+{
+    gf_stencil st;
+
+    gf_init_stencil(&st, size, size, kernel, xtras, sizeof(float));
+    st.set_null = &gf_set_null_float;
+    st.nbands = gf_num_threads();
+
+    return gf_stencil_run(gf, to_grid, &st, (void *)out);
+}
+
+
+/* Copy the 3x3 around the anchor with NODATA filled in. Returns 0 if
+   the anchor itself is null. */
+static
+int gf_window_3x3(const gf_window *win, gf_float nine[][3]) {
+    int r, c;
+
+    for (r = 0; r < 3; r++)
+        for (c = 0; c < 3; c++)
+            nine[r][c] = GF_WIN(win, r - 1, c - 1);
+    return gf_fill_nulls_3x3(nine);
+}
+
+
+static
+int gf_slope_kernel(const gf_window *win, const gf_grid *from_grid, double *w, double *latlng, void *xtras, void *data_ptr) {
+    double dx_m, dy_m, gx, gy;
+    gf_float z[3][3];
+
+    if (!gf_window_3x3(win, z))
+        return gf_set_null_float(xtras, data_ptr);
+
+    gf_lengths(latlng[0], latlng[1], from_grid->dy, from_grid->dx, 0.0, &dx_m, &dy_m);
+
+    gx = ((z[0][2] + 2.0 * z[1][2] + z[2][2]) -
+          (z[0][0] + 2.0 * z[1][0] + z[2][0])) / (8.0 * dx_m);
+    /* Rows run southward. */
+    gy = ((z[0][0] + 2.0 * z[0][1] + z[0][2]) -
+          (z[2][0] + 2.0 * z[2][1] + z[2][2])) / (8.0 * dy_m);
+
+    *(float *)data_ptr = (float)(atan(sqrt(gx * gx + gy * gy)) * 180.0 / PI);
+    return 0;
+}
+
+
+int gf_slope(const gf_struct *gf, const gf_grid *to_grid, float *out) {
+    return gf_run_float(gf, to_grid, 3, &gf_slope_kernel, NULL, out);
+}
+
+
+static
+int gf_curvature_kernel(const gf_window *win, const gf_grid *from_grid, double *w, double *latlng, void *xtras, void *data_ptr) {
+    double dx_m, dy_m;
+    gf_float z[3][3];
+
+    if (!gf_window_3x3(win, z))
+        return gf_set_null_float(xtras, data_ptr);
+
+    gf_lengths(latlng[0], latlng[1], from_grid->dy, from_grid->dx, 0.0, &dx_m, &dy_m);
+
+    *(float *)data_ptr = (float)(
+        (z[1][0] + z[1][2] - 2.0 * z[1][1]) / (dx_m * dx_m) +
+        (z[0][1] + z[2][1] - 2.0 * z[1][1]) / (dy_m * dy_m));
+    return 0;
+}
+
+
+int gf_curvature(const gf_struct *gf, const gf_grid *to_grid, float *out) {
+    return gf_run_float(gf, to_grid, 3, &gf_curvature_kernel, NULL, out);
+}
+
+
+typedef struct gf_gaussian_xtras {
+    int half;
+    double *weights;    /* 1D, indexed [-half, half], sums to 1. */
+} gf_gaussian_xtras;
+
+
+static
+int gf_gaussian_kernel(const gf_window *win, const gf_grid *from_grid, double *w, double *latlng, void *xtras, void *data_ptr) {
+    gf_gaussian_xtras *x = (gf_gaussian_xtras *)xtras;
+    double sum = 0.0, wsum = 0.0, row, rw, v;
+    int r, c;
+
+    if (GF_WIN(win, 0, 0) == (gf_float)GF_NULL_VAL)
+        return gf_set_null_float(xtras, data_ptr);
+
+    /* Weights are renormalized over the valid nodes. */
+    for (r = -x->half; r <= x->half; r++) {
+        row = rw = 0.0;
+        for (c = -x->half; c <= x->half; c++) {
+            if ((v = GF_WIN(win, r, c)) == (gf_float)GF_NULL_VAL)
+                continue;
+            row += x->weights[c] * v;
+            rw += x->weights[c];
+        }
+        sum += x->weights[r] * row;
+        wsum += x->weights[r] * rw;
+    }
+
+    *(float *)data_ptr = (float)(sum / wsum);
+    return 0;
+}
+
+
+int gf_gaussian(const gf_struct *gf, const gf_grid *to_grid, double sigma, float *out) {
+    gf_gaussian_xtras x;
+    double *weights, norm = 0.0;
+    int k, err;
+
+    if (sigma <= 0.0)
+        return -1;
+
+    x.half = (int)ceil(3.0 * sigma);
+    weights = (double *)malloc((2 * x.half + 1) * sizeof(double));
+    x.weights = weights + x.half;
+
+    for (k = -x.half; k <= x.half; k++)
+        norm += (x.weights[k] = exp(-0.5 * k * k / (sigma * sigma)));
+    for (k = -x.half; k <= x.half; k++)
+        x.weights[k] /= norm;
+
+    err = gf_run_float(gf, to_grid, 2 * x.half + 1, &gf_gaussian_kernel, (void *)&x, out);
+
+    free(weights);
+    return err;
+}
@@ -0,0 +1,23 @@
+#ifndef GF_TERRAIN_H
+#define GF_TERRAIN_H
+
+#include "gridfloat.h"
+
+/**
+ * Terrain operators built on the stencil engine. Each samples the
+ * window around the nearest source node of every to_grid point, runs
+ * in parallel bands, and writes GF_NULL_VAL where the window does not
+ * fit in the source.
+ */
+
+/* Slope in degrees (Horn's method, 3x3). */
+int gf_slope(const gf_struct *gf, const gf_grid *to_grid, float *out);
+
+/* Laplacian curvature, d2z/dx2 + d2z/dy2, in 1/m (3x3). */
+int gf_curvature(const gf_struct *gf, const gf_grid *to_grid, float *out);
+
+/* Gaussian smoothing with standard deviation sigma (in source cells).
+   The window is 2 * ceil(3 * sigma) + 1 nodes wide. */
+int gf_gaussian(const gf_struct *gf, const gf_grid *to_grid, double sigma, float *out);
+
+#endif
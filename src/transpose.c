@@ -0,0 +1,87 @@
+#include "transpose.h"
+
+#include <string.h>
+
+/* Tile edge (in elements): an input and an output tile of floats fill
+half of a 32K L1. */
+#define TP_TILE 64
+
+
+#if defined(__GNUC__) && !defined(__clang__)
+
+typedef float tp_vec __attribute__((vector_size(4 * sizeof(float))));
+typedef int tp_idx __attribute__((vector_size(4 * sizeof(int))));
+
+/* 4x4 transpose of a, b, c, d (rows) into r[0..3]. */
+static inline
+void tp_4x4(tp_vec a, tp_vec b, tp_vec c, tp_vec d, tp_vec *r) {
+    const tp_idx lo = {0, 4, 1, 5}, hi = {2, 6, 3, 7};
+    const tp_idx lo2 = {0, 1, 4, 5}, hi2 = {2, 3, 6, 7};
+    tp_vec t0 = __builtin_shuffle(a, b, lo), t1 = __builtin_shuffle(a, b, hi);
+    tp_vec t2 = __builtin_shuffle(c, d, lo), t3 = __builtin_shuffle(c, d, hi);
+
+    r[0] = __builtin_shuffle(t0, t2, lo2);
+    r[1] = __builtin_shuffle(t0, t2, hi2);
+    r[2] = __builtin_shuffle(t1, t3, lo2);
+    r[3] = __builtin_shuffle(t1, t3, hi2);
+}
+
+
+/* One 8x8 square: rows i..i+7 of in to columns (flipped) of out. The
+rows are loaded bottom first, which makes the flip free. */
+static inline
+void tp_8x8(const gf_float *in, long in_stride, gf_float *out, long out_stride) {
+    tp_vec a[8][2], r[4];
+    int k, h, q;
+
+    for (k = 0; k < 8; k++) {
+        memcpy(&a[k][0], in + (7 - k) * in_stride, sizeof(tp_vec));
+        memcpy(&a[k][1], in + (7 - k) * in_stride + 4, sizeof(tp_vec));
+    }
+    /* Quadrant (h, q): input columns 4h.. of rows 4q.. */
+    for (h = 0; h < 2; h++) {
+        for (q = 0; q < 2; q++) {
+            tp_4x4(a[4 * q][h], a[4 * q + 1][h], a[4 * q + 2][h], a[4 * q + 3][h], r);
+            for (k = 0; k < 4; k++)
+                memcpy(out + (4 * h + k) * out_stride + 4 * q, &r[k], sizeof(tp_vec));
+        }
+    }
+}
+
+#else
+
+static inline
+void tp_8x8(const gf_float *in, long in_stride, gf_float *out, long out_stride) {
+    int i, j;
+
+    for (i = 0; i < 8; i++)
+        for (j = 0; j < 8; j++)
+            out[j * out_stride + 7 - i] = in[i * in_stride + j];
+}
+
+#endif
+
+
+void gf_transpose_flip(const gf_float *in, long in_stride, int rows, int cols,
+    gf_float *out, long out_stride)
+{
+    int i0, j0, i1, j1, i, j;
+
+    for (i0 = 0; i0 < rows; i0 += TP_TILE) {
+        i1 = i0 + TP_TILE < rows ? i0 + TP_TILE : rows;
+        for (j0 = 0; j0 < cols; j0 += TP_TILE) {
+            j1 = j0 + TP_TILE < cols ? j0 + TP_TILE : cols;
+
+            for (i = i0; i + 8 <= i1; i += 8)
+                for (j = j0; j + 8 <= j1; j += 8)
+                    tp_8x8(in + i * in_stride + j, in_stride,
+                        out + j * out_stride + rows - 8 - i, out_stride);
+
+            /* Ragged right and bottom edges of the tile. */
+            for (i = i0; i < i1; i++) {
+                for (j = i < i0 + ((i1 - i0) & ~7) ? j0 + ((j1 - j0) & ~7) : j0; j < j1; j++)
+                    out[j * out_stride + rows - 1 - i] = in[i * in_stride + j];
+            }
+        }
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef GF_TRANSPOSE_H
+#define GF_TRANSPOSE_H
+
+#include "gridfloat.h"
+
+/**
+ * Transpose and flip a rows x cols block: out[j][rows - 1 - i] =
+ * in[i][j], with in's rows in_stride elements apart and out's
+ * out_stride apart. For a grid stored top row first this gives the
+ * x-major layout of gridfloat -T (each output row a column of the
+ * grid, bottom first).
+ *
+ * The block is walked in tiles that fit in L1, and each tile in 8x8
+ * squares transposed in vector registers, so every cache line read or
+ * written is used whole instead of once per element as with a plain
+ * strided loop.
+ */
+void gf_transpose_flip(const gf_float *in, long in_stride, int rows, int cols,
+    gf_float *out, long out_stride);
+
+#endif
@@ -0,0 +1,244 @@
+#include "viewshed.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* Sight-line height of a null node with nothing in front of it. */
+#define VIEW_FLOOR -1.0e30f
+
+typedef struct gf_viewshed_job {
+    const gf_struct *gf;
+    const gf_grid *grid;
+    long i0, j0;            /* Region origin in the source */
+    int oi, oj;             /* Observer in the region */
+    double z_obs;
+    double target_height;
+    double dx_m, dy_m;
+    double bulge;           /* Curvature drop per m^2 of distance */
+    double radius2;
+    float *z;               /* Elevation, then sight-line height */
+    unsigned char *vis;
+    int nbands;
+    int failed;
+} gf_viewshed_job;
+
+/* One of eight octants: offset a along the major axis, b <= a along
+   the minor one. */
+typedef struct gf_octant {
+    int major_x;
+    int sx, sy;
+    int amax, bmax;         /* Region extent along each axis */
+} gf_octant;
+
+
+void gf_init_viewshed_opts(gf_viewshed_opts *opts) {
+    opts->observer_height = 2.0;
+    opts->target_height = 0.0;
+    opts->radius = 0.0;
+    gf_init_los_opts(&opts->los);
+}
+
+
+/* Read a band of region rows and drop them by the earth's curvature. */
+static
+void gf_viewshed_load_task(int band, void *arg) {
+    gf_viewshed_job *job = (gf_viewshed_job *)arg;
+    int nx = job->grid->nx, ny = job->grid->ny, i, j, i0, i1;
+    double di, dj;
+    float *row;
+
+    i0 = (int)((long)ny * band / job->nbands);
+    i1 = (int)((long)ny * (band + 1) / job->nbands);
+    for (i = i0; i < i1; i++) {
+        row = job->z + (size_t)i * nx;
+        if (gf_get_line(job->i0 + i, job->j0, job->j0 + nx, job->gf, row) != 0) {
+            __sync_fetch_and_add(&job->failed, 1);
+            return;
+        }
+        if (job->bulge == 0.0)
+            continue;
+        di = (i - job->oi) * job->dy_m;
+        for (j = 0; j < nx; j++) {
+            if (row[j] == (float)GF_NULL_VAL)
+                continue;
+            dj = (j - job->oj) * job->dx_m;
+            row[j] -= (float)(job->bulge * (di * di + dj * dj));
+        }
+    }
+}
+
+
+static
+void gf_init_octant(gf_octant *oct, int o, const gf_viewshed_job *job) {
+    int nx = job->grid->nx, ny = job->grid->ny;
+    int xmax, ymax;
+
+    oct->major_x = o < 4;
+    oct->sx = (o & 1) ? -1 : 1;
+    oct->sy = (o & 2) ? -1 : 1;
+    xmax = oct->sx > 0 ? nx - 1 - job->oj : job->oj;
+    ymax = oct->sy > 0 ? ny - 1 - job->oi : job->oi;
+    oct->amax = oct->major_x ? xmax : ymax;
+    oct->bmax = oct->major_x ? ymax : xmax;
+}
+
+
+static
+size_t gf_octant_index(const gf_octant *oct, const gf_viewshed_job *job, int a, int b) {
+    int i, j;
+
+    if (oct->major_x) {
+        i = job->oi + oct->sy * b;
+        j = job->oj + oct->sx * a;
+    } else {
+        i = job->oi + oct->sy * a;
+        j = job->oj + oct->sx * b;
+    }
+    return (size_t)i * job->grid->nx + j;
+}
+
+
+static
+void gf_viewshed_cell(const gf_octant *oct, gf_viewshed_job *job, int k, int m) {
+    size_t p = gf_octant_index(oct, job, k, m);
+    double t, f, za, zb, zp, e, di, dj;
+    int b;
+
+    if (k == 1) {
+        zp = VIEW_FLOOR;
+    } else {
+        /* The ray to (k, m) crosses ring k - 1 at minor offset t. */
+        t = (double)m * (k - 1) / k;
+        b = (int)t;
+        f = t - b;
+        za = job->z[gf_octant_index(oct, job, k - 1, b)];
+        zb = f > 0.0 ? job->z[gf_octant_index(oct, job, k - 1, b + 1)] : za;
+        zp = job->z_obs + (za + f * (zb - za) - job->z_obs) * k / (k - 1);
+    }
+
+    e = job->z[p];
+    if (e == (float)GF_NULL_VAL) {
+        job->vis[p] = GF_VIEW_NONE;
+        job->z[p] = (float)zp;
+        return;
+    }
+
+    job->vis[p] = e + job->target_height >= zp ? GF_VISIBLE : GF_HIDDEN;
+    if (e > zp)
+        zp = e;
+    job->z[p] = (float)zp;
+
+    if (job->radius2 > 0.0) {
+        di = ((long)(p / job->grid->nx) - job->oi) * job->dy_m;
+        dj = ((long)(p % job->grid->nx) - job->oj) * job->dx_m;
+        if (di * di + dj * dj > job->radius2)
+            job->vis[p] = GF_VIEW_NONE;
+    }
+}
+
+
+/* Interior nodes (strictly between axis and diagonal) of an octant. */
+static
+void gf_viewshed_octant_task(int o, void *arg) {
+    gf_viewshed_job *job = (gf_viewshed_job *)arg;
+    gf_octant oct;
+    int k, m, mmax;
+
+    gf_init_octant(&oct, o, job);
+    for (k = 2; k <= oct.amax; k++) {
+        mmax = k - 1 < oct.bmax ? k - 1 : oct.bmax;
+        for (m = 1; m <= mmax; m++)
+            gf_viewshed_cell(&oct, job, k, m);
+    }
+}
+
+
+int gf_viewshed(const gf_struct *gf, double lat, double lng,
+    const gf_viewshed_opts *opts, gf_grid *grid, unsigned char **vis)
+{
+    const gf_grid *g = &gf->grid;
+    gf_viewshed_job job;
+    gf_octant oct;
+    gf_float ground;
+    long oi, oj, ri, rj, i1, j1;
+    int o, k;
+
+    *vis = NULL;
+    if (lat > g->top || lat < g->bottom || lng < g->left || lng > g->right)
+        return -1;
+
+    oi = lround((g->top - lat) / g->dy);
+    oj = lround((lng - g->left) / g->dx);
+    if (gf_get_line(oi, oj, oj + 1, gf, &ground) != 0)
+        return -2;
+    if (ground == (gf_float)GF_NULL_VAL)
+        return -1;
+
+    job.gf = gf;
+    job.grid = grid;
+    job.target_height = opts->target_height;
+    gf_lengths(lat, lng, g->dy, g->dx, 0.0, &job.dx_m, &job.dy_m);
+    job.bulge = opts->los.curvature ?
+        (1.0 - opts->los.refraction) / (2.0 * EQ_RADIUS) : 0.0;
+    job.radius2 = opts->radius * opts->radius;
+    job.z_obs = ground + opts->observer_height;
+
+    /* Source nodes within the radius's bounding box. */
+    ri = opts->radius > 0.0 ? (long)ceil(opts->radius / job.dy_m) : g->ny;
+    rj = opts->radius > 0.0 ? (long)ceil(opts->radius / job.dx_m) : g->nx;
+    job.i0 = oi - ri < 0 ? 0 : oi - ri;
+    job.j0 = oj - rj < 0 ? 0 : oj - rj;
+    i1 = oi + ri > g->ny - 1 ? g->ny - 1 : oi + ri;
+    j1 = oj + rj > g->nx - 1 ? g->nx - 1 : oj + rj;
+    job.oi = (int)(oi - job.i0);
+    job.oj = (int)(oj - job.j0);
+
+    grid->nx = (int)(j1 - job.j0 + 1);
+    grid->ny = (int)(i1 - job.i0 + 1);
+    grid->dx = g->dx;
+    grid->dy = g->dy;
+    grid->left = g->left + job.j0 * g->dx;
+    grid->right = g->left + j1 * g->dx;
+    grid->top = g->top - job.i0 * g->dy;
+    grid->bottom = g->top - i1 * g->dy;
+
+    job.z = (float *)malloc((size_t)grid->nx * grid->ny * sizeof(float));
+    job.vis = (unsigned char *)malloc((size_t)grid->nx * grid->ny);
+    if (job.z == NULL || job.vis == NULL) {
+        free(job.z);
+        free(job.vis);
+        return -1;
+    }
+
+    job.nbands = gf_num_threads();
+    job.failed = 0;
+    gf_parallel_for(job.nbands, job.nbands, &gf_viewshed_load_task, (void *)&job);
+    if (job.failed) {
+        free(job.z);
+        free(job.vis);
+        return -2;
+    }
+
+    job.vis[(size_t)job.oi * grid->nx + job.oj] = GF_VISIBLE;
+
+    /* Axes and diagonals first; every octant reads them. Each is
+    shared by two octants but must be swept once, since a sweep
+    replaces elevations by sight-line heights. Octants 0, 1, 4 and 6
+    hold the four axes and 0 to 3 the four diagonals. */
+    for (o = 0; o < 8; o++) {
+        gf_init_octant(&oct, o, &job);
+        for (k = 1; k <= oct.amax; k++) {
+            if (o == 0 || o == 1 || o == 4 || o == 6)
+                gf_viewshed_cell(&oct, &job, k, 0);
+            if (o < 4 && k <= oct.bmax)
+                gf_viewshed_cell(&oct, &job, k, k);
+        }
+    }
+
+    gf_parallel_for(8, 8, &gf_viewshed_octant_task, (void *)&job);
+
+    free(job.z);
+    *vis = job.vis;
+    return 0;
+}
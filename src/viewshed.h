@@ -0,0 +1,47 @@
+#ifndef GF_VIEWSHED_H
+#define GF_VIEWSHED_H
+
+#include "gridfloat.h"
+#include "los.h"
+
+/* Values of a viewshed raster. */
+#define GF_HIDDEN 0
+#define GF_VISIBLE 1
+#define GF_VIEW_NONE 255    /* Null ground or beyond the radius */
+
+/**
+ * Viewshed options.
+ *
+ * @observer_height - Eye height (m) above the ground.
+ * @target_height - Height (m) above the ground a target must reach
+ *      to count as seen.
+ * @radius - Largest distance (m) from the observer; 0 for the whole
+ *      source.
+ * @los - Earth curvature and refraction, as for line of sight.
+ */
+typedef struct gf_viewshed_opts {
+    double observer_height;
+    double target_height;
+    double radius;
+    gf_los_opts los;
+} gf_viewshed_opts;
+
+void gf_init_viewshed_opts(gf_viewshed_opts *opts);
+
+/**
+ * Visibility of every source node within the radius of an observer
+ * at (lat, lng), computed in one O(n) pass in the manner of XDraw:
+ * rings of nodes are swept outward from the observer, and the
+ * sight-line height at each node is projected from the two nodes its
+ * ray crosses on the previous ring. The eight octants run in parallel
+ * once the axes and diagonals they share are done.
+ *
+ * On success grid is set to the (source-aligned) region covered and
+ * *vis to a malloc'd grid->nx * grid->ny raster of GF_HIDDEN,
+ * GF_VISIBLE and GF_VIEW_NONE. Returns -1 if the observer is off the
+ * source or on null ground, or -2 if the source could not be read.
+ */
+int gf_viewshed(const gf_struct *gf, double lat, double lng,
+    const gf_viewshed_opts *opts, gf_grid *grid, unsigned char **vis);
+
+#endif
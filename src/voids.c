@@ -0,0 +1,597 @@
+#include "voids.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Window cell classes, before unknowns are numbered. */
+#define VD_OUT -1       /* Null, not in this void: no-flux */
+#define VD_KNOWN -2     /* Valid data */
+
+/* Smoothing sweeps before and after each coarse correction. */
+#define VD_SWEEPS 1
+
+/* Stretch of coarse corrections (see vd_cycle). */
+#define VD_OVER 1.8f
+
+/* Sweeps on the coarsest (at most 2x2) level. */
+#define VD_COARSEST 16
+
+
+/* A run of null nodes [j0, j1) on row i. */
+typedef struct vd_run {
+    int i;
+    int j0;
+    int j1;
+    int parent;
+} vd_run;
+
+typedef struct vd_region {
+    long count;
+    int i0, i1, j0, j1;     /* Bounding box, inclusive */
+    int run0, nruns;        /* Its runs, in row order */
+    float *values;          /* Solution, in run order */
+} vd_region;
+
+
+/**
+ * One multigrid level over a window: for each unknown p,
+ *
+ *     diag[p] x[p] - sum_q w(p, q) x[q] = b[p]
+ *
+ * where q ranges over the 4 neighbors and w(p, east) = we[p],
+ * w(p, south) = ws[p]. Cells with diag 0 are not unknowns.
+ */
+typedef struct vd_level {
+    int nx, ny;
+    float *diag;
+    float *we;
+    float *ws;
+    float *x;
+    float *b;
+    float *r;
+} vd_level;
+
+
+typedef struct vd_job {
+    const gf_grid *grid;
+    const gf_void_opts *opts;
+    const gf_float *data;
+    const vd_run *runs;
+    vd_region *regions;
+    int *order;
+    int filled;
+} vd_job;
+
+
+void gf_init_void_opts(gf_void_opts *opts) {
+    opts->max_cells = 0;
+    opts->tol = 1e-3;
+    opts->max_cycles = 100;
+    opts->nthreads = 0;
+}
+
+
+static
+int vd_find(vd_run *runs, int r) {
+    int root = r, next;
+
+    while (runs[root].parent != root)
+        root = runs[root].parent;
+    while (runs[r].parent != root) {
+        next = runs[r].parent;
+        runs[r].parent = root;
+        r = next;
+    }
+    return root;
+}
+
+
+static
+void vd_union(vd_run *runs, int a, int b) {
+    a = vd_find(runs, a);
+    b = vd_find(runs, b);
+    /* The earlier run stays root, so each void's root is its first. */
+    if (a < b)
+        runs[b].parent = a;
+    else if (b < a)
+        runs[a].parent = b;
+}
+
+
+/* Null runs, row by row, joined where they overlap the row above. */
+static
+vd_run *vd_label(const gf_grid *grid, const gf_float *data, int *nruns) {
+    vd_run *runs = NULL;
+    int cap = 0, n = 0, prev0 = 0, prev1 = 0, cur0, p, i, j, j0;
+    const gf_float *row;
+
+    for (i = 0; i < grid->ny; i++) {
+        row = data + (long)i * grid->nx;
+        cur0 = n;
+        for (j = 0; j < grid->nx; ) {
+            if (row[j] != (gf_float)GF_NULL_VAL) {
+                j++;
+                continue;
+            }
+            for (j0 = j; j < grid->nx && row[j] == (gf_float)GF_NULL_VAL; j++)
+                ;
+            if (n == cap) {
+                cap = cap ? 2 * cap : 1024;
+                runs = (vd_run *)realloc(runs, cap * sizeof(vd_run));
+            }
+            runs[n].i = i;
+            runs[n].j0 = j0;
+            runs[n].j1 = j;
+            runs[n].parent = n;
+
+            /* Runs above are sorted by column: skip those that end
+            before this one starts. */
+            while (prev0 < prev1 && runs[prev0].j1 <= j0)
+                prev0++;
+            for (p = prev0; p < prev1 && runs[p].j0 < j; p++)
+                vd_union(runs, p, n);
+            n++;
+        }
+        prev0 = cur0;
+        prev1 = n;
+    }
+    *nruns = n;
+    return runs;
+}
+
+
+static
+void vd_alloc_level(vd_level *l, int nx, int ny) {
+    size_t n = (size_t)nx * ny;
+
+    l->nx = nx;
+    l->ny = ny;
+    l->diag = (float *)calloc(n, sizeof(float));
+    l->we = (float *)calloc(n, sizeof(float));
+    l->ws = (float *)calloc(n, sizeof(float));
+    l->x = (float *)calloc(n, sizeof(float));
+    l->b = (float *)calloc(n, sizeof(float));
+    l->r = (float *)calloc(n, sizeof(float));
+}
+
+
+static
+void vd_free_level(vd_level *l) {
+    free(l->diag);
+    free(l->we);
+    free(l->ws);
+    free(l->x);
+    free(l->b);
+    free(l->r);
+}
+
+
+/* Sum of w(p, q) x[q] over p's neighbors. */
+static inline
+float vd_neighbors(const vd_level *l, const float *x, int i, int j) {
+    long p = (long)i * l->nx + j;
+    float s = 0.0f;
+
+    if (j + 1 < l->nx)
+        s += l->we[p] * x[p + 1];
+    if (j > 0)
+        s += l->we[p - 1] * x[p - 1];
+    if (i + 1 < l->ny)
+        s += l->ws[p] * x[p + l->nx];
+    if (i > 0)
+        s += l->ws[p - l->nx] * x[p - l->nx];
+    return s;
+}
+
+
+/* Red-black Gauss-Seidel; black first when backward, so that a forward
+sweep followed by a backward one is symmetric. */
+static
+void vd_smooth(vd_level *l, int sweeps, int backward) {
+    int s, k, color, i, j;
+    long p;
+
+    for (s = 0; s < sweeps; s++) {
+        for (k = 0; k < 2; k++) {
+            color = k ^ backward;
+            for (i = 0; i < l->ny; i++) {
+                for (j = (i + color) & 1; j < l->nx; j += 2) {
+                    p = (long)i * l->nx + j;
+                    if (l->diag[p] > 0.0f)
+                        l->x[p] = (l->b[p] + vd_neighbors(l, l->x, i, j)) / l->diag[p];
+                }
+            }
+        }
+    }
+}
+
+
+/* y = A x over the unknowns. */
+static
+void vd_apply(const vd_level *l, const float *x, float *y) {
+    int i, j;
+    long p;
+
+    for (i = 0; i < l->ny; i++) {
+        for (j = 0; j < l->nx; j++) {
+            p = (long)i * l->nx + j;
+            y[p] = l->diag[p] > 0.0f ? l->diag[p] * x[p] - vd_neighbors(l, x, i, j) : 0.0f;
+        }
+    }
+}
+
+
+/**
+ * Galerkin coarsening over 2x2 aggregates with piecewise-constant
+ * interpolation: couplings between aggregates add up, and couplings
+ * inside one cancel out of its diagonal.
+ */
+static
+void vd_coarsen(const vd_level *f, vd_level *c) {
+    int i, j;
+    long p, q, qe, qs;
+
+    vd_alloc_level(c, (f->nx + 1) / 2, (f->ny + 1) / 2);
+    for (i = 0; i < f->ny; i++) {
+        for (j = 0; j < f->nx; j++) {
+            p = (long)i * f->nx + j;
+            if (f->diag[p] <= 0.0f)
+                continue;
+            q = (long)(i / 2) * c->nx + j / 2;
+            c->diag[q] += f->diag[p];
+            if (f->we[p] > 0.0f) {
+                qe = (long)(i / 2) * c->nx + (j + 1) / 2;
+                if (qe == q)
+                    c->diag[q] -= 2.0f * f->we[p];
+                else
+                    c->we[q] += f->we[p];
+            }
+            if (f->ws[p] > 0.0f) {
+                qs = (long)((i + 1) / 2) * c->nx + j / 2;
+                if (qs == q)
+                    c->diag[q] -= 2.0f * f->ws[p];
+                else
+                    c->ws[q] += f->ws[p];
+            }
+        }
+    }
+}
+
+
+/**
+ * One V-cycle for A x = b from x = 0, as a (symmetric) preconditioner:
+ * forward sweeps on the way down, backward on the way up, and the
+ * coarse correction stretched by VD_OVER, since piecewise-constant
+ * corrections fall short of the smooth error they stand for.
+ */
+static
+void vd_cycle(vd_level *levels, int nlevels, int l) {
+    vd_level *f = &levels[l], *c;
+    int i, j;
+    long p;
+
+    if (l == nlevels - 1) {
+        memset(f->x, 0, (size_t)f->nx * f->ny * sizeof(float));
+        vd_smooth(f, VD_COARSEST, 0);
+        vd_smooth(f, VD_COARSEST, 1);
+        return;
+    }
+
+    memset(f->x, 0, (size_t)f->nx * f->ny * sizeof(float));
+    vd_smooth(f, VD_SWEEPS, 0);
+    vd_apply(f, f->x, f->r);
+    for (p = 0; p < (long)f->nx * f->ny; p++)
+        f->r[p] = f->b[p] - f->r[p];
+
+    c = &levels[l + 1];
+    memset(c->b, 0, (size_t)c->nx * c->ny * sizeof(float));
+    for (i = 0; i < f->ny; i++)
+        for (j = 0; j < f->nx; j++)
+            c->b[(long)(i / 2) * c->nx + j / 2] += f->r[(long)i * f->nx + j];
+    vd_cycle(levels, nlevels, l + 1);
+
+    for (i = 0; i < f->ny; i++) {
+        for (j = 0; j < f->nx; j++) {
+            p = (long)i * f->nx + j;
+            if (f->diag[p] > 0.0f)
+                f->x[p] += VD_OVER * c->x[(long)(i / 2) * c->nx + j / 2];
+        }
+    }
+    vd_smooth(f, VD_SWEEPS, 1);
+}
+
+
+/* y = A x over the unknowns, in double. */
+static
+void vd_apply_double(const vd_level *l, const double *x, double *y) {
+    int i, j;
+    long p;
+    double s;
+
+    for (i = 0; i < l->ny; i++) {
+        for (j = 0; j < l->nx; j++) {
+            p = (long)i * l->nx + j;
+            if (l->diag[p] <= 0.0f) {
+                y[p] = 0.0;
+                continue;
+            }
+            s = l->diag[p] * x[p];
+            if (j + 1 < l->nx)
+                s -= l->we[p] * x[p + 1];
+            if (j > 0)
+                s -= l->we[p - 1] * x[p - 1];
+            if (i + 1 < l->ny)
+                s -= l->ws[p] * x[p + l->nx];
+            if (i > 0)
+                s -= l->ws[p - l->nx] * x[p - l->nx];
+            y[p] = s;
+        }
+    }
+}
+
+
+/**
+ * Conjugate gradients on the finest level, preconditioned by
+ * V-cycles. The iteration runs in double, since residuals of a large
+ * void are small differences of large sums; the cycles only need to
+ * be roughly right and run in float. u starts at zero.
+ */
+static
+void vd_pcg(vd_level *levels, int nlevels, const gf_void_opts *opts, const double *rhs, double *u) {
+    vd_level *f = &levels[0];
+    long p, n = (long)f->nx * f->ny;
+    double *r, *d, *q, rz, rz_next, dq, alpha, step;
+    int it;
+
+    r = (double *)malloc(n * sizeof(double));
+    d = (double *)malloc(n * sizeof(double));
+    q = (double *)malloc(n * sizeof(double));
+
+    memcpy(r, rhs, n * sizeof(double));
+    for (p = 0; p < n; p++)
+        f->b[p] = (float)r[p];
+    vd_cycle(levels, nlevels, 0);
+    for (rz = 0.0, p = 0; p < n; p++) {
+        d[p] = f->x[p];
+        rz += r[p] * f->x[p];
+    }
+
+    for (it = 0; it < opts->max_cycles && rz > 0.0; it++) {
+        vd_apply_double(f, d, q);
+        for (dq = 0.0, p = 0; p < n; p++)
+            dq += d[p] * q[p];
+        if (dq <= 0.0)
+            break;
+        alpha = rz / dq;
+        for (step = 0.0, p = 0; p < n; p++) {
+            u[p] += alpha * d[p];
+            r[p] -= alpha * q[p];
+            if (fabs(alpha * d[p]) > step)
+                step = fabs(alpha * d[p]);
+        }
+        if (step <= opts->tol)
+            break;
+
+        for (p = 0; p < n; p++)
+            f->b[p] = (float)r[p];
+        vd_cycle(levels, nlevels, 0);
+        for (rz_next = 0.0, p = 0; p < n; p++)
+            rz_next += r[p] * f->x[p];
+        for (p = 0; p < n; p++)
+            d[p] = f->x[p] + rz_next / rz * d[p];
+        rz = rz_next;
+    }
+
+    free(r);
+    free(d);
+    free(q);
+}
+
+
+static
+void vd_solve_task(int k, void *arg) {
+    vd_job *job = (vd_job *)arg;
+    const gf_grid *grid = job->grid;
+    vd_region *reg = &job->regions[job->order[k]];
+    const vd_run *run;
+    vd_level *levels;
+    int wi0, wi1, wj0, wj1, nx, ny, nlevels, i, j, r, d, pass;
+    static const int di[4] = {0, 1, 0, -1};
+    static const int dj[4] = {1, 0, -1, 0};
+    int *cls;
+    long p, q, m, rim = 0;
+    double rim_sum = 0.0, mean = 0.0, rhs_p, *rhs, *u;
+    gf_float v;
+
+    if (job->opts->max_cells > 0 && reg->count > job->opts->max_cells)
+        return;
+
+    /* Window: the void's box plus a rim, inside the grid. */
+    wi0 = reg->i0 > 0 ? reg->i0 - 1 : 0;
+    wj0 = reg->j0 > 0 ? reg->j0 - 1 : 0;
+    wi1 = reg->i1 < grid->ny - 1 ? reg->i1 + 1 : reg->i1;
+    wj1 = reg->j1 < grid->nx - 1 ? reg->j1 + 1 : reg->j1;
+    nx = wj1 - wj0 + 1;
+    ny = wi1 - wi0 + 1;
+
+    cls = (int *)malloc((size_t)nx * ny * sizeof(int));
+    for (i = 0; i < ny; i++)
+        for (j = 0; j < nx; j++)
+            cls[(long)i * nx + j] = job->data[(long)(wi0 + i) * grid->nx + wj0 + j] ==
+                (gf_float)GF_NULL_VAL ? VD_OUT : VD_KNOWN;
+    for (r = 0, m = 0; r < reg->nruns; r++) {
+        run = &job->runs[reg->run0 + r];
+        for (j = run->j0; j < run->j1; j++)
+            cls[(long)(run->i - wi0) * nx + j - wj0] = (int)m++;
+    }
+
+    for (nlevels = 1, i = nx, j = ny; i > 2 || j > 2; nlevels++) {
+        i = (i + 1) / 2;
+        j = (j + 1) / 2;
+    }
+    levels = (vd_level *)malloc(nlevels * sizeof(vd_level));
+    vd_alloc_level(&levels[0], nx, ny);
+    rhs = (double *)calloc((size_t)nx * ny, sizeof(double));
+
+    /* Finest level: valid neighbors move to the right-hand side,
+    less the mean of the rim, so that floats keep their precision. */
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < ny; i++) {
+            for (j = 0; j < nx; j++) {
+                p = (long)i * nx + j;
+                if (cls[p] < 0)
+                    continue;
+                for (d = 0, rhs_p = 0.0; d < 4; d++) {
+                    if (i + di[d] < 0 || i + di[d] >= ny || j + dj[d] < 0 || j + dj[d] >= nx)
+                        continue;
+                    q = p + di[d] * nx + dj[d];
+                    if (cls[q] == VD_OUT)
+                        continue;
+                    if (cls[q] == VD_KNOWN) {
+                        v = job->data[(long)(wi0 + i + di[d]) * grid->nx + wj0 + j + dj[d]];
+                        rhs_p += v - mean;
+                        rim_sum += v;
+                        rim++;
+                    }
+                    if (pass == 0)
+                        continue;
+                    levels[0].diag[p] += 1.0f;
+                    if (cls[q] >= 0 && d < 2)
+                        (d == 0 ? levels[0].we : levels[0].ws)[p] = 1.0f;
+                }
+                if (pass == 1)
+                    rhs[p] = rhs_p;
+            }
+        }
+        if (rim == 0)
+            break;
+        mean = rim_sum / rim;
+    }
+
+    if (rim > 0) {
+        for (i = 1; i < nlevels; i++)
+            vd_coarsen(&levels[i - 1], &levels[i]);
+        u = (double *)calloc((size_t)nx * ny, sizeof(double));
+        vd_pcg(levels, nlevels, job->opts, rhs, u);
+
+        reg->values = (float *)malloc(reg->count * sizeof(float));
+        for (p = 0; p < (long)nx * ny; p++)
+            if (cls[p] >= 0)
+                reg->values[cls[p]] = (float)(u[p] + mean);
+        free(u);
+        __sync_fetch_and_add(&job->filled, 1);
+    }
+    free(rhs);
+
+    for (i = 0; i < nlevels; i++)
+        if (i == 0 || rim > 0)
+            vd_free_level(&levels[i]);
+    free(levels);
+    free(cls);
+}
+
+
+typedef struct vd_key {
+    long count;
+    int index;
+} vd_key;
+
+
+/* Largest first, so the long solves do not start last. */
+static
+int vd_cmp_size(const void *a, const void *b) {
+    const vd_key *ka = (const vd_key *)a, *kb = (const vd_key *)b;
+
+    if (ka->count != kb->count)
+        return ka->count > kb->count ? -1 : 1;
+    return ka->index - kb->index;
+}
+
+
+int gf_fill_voids(const gf_grid *grid, const gf_void_opts *opts, gf_float *data) {
+    vd_job job;
+    vd_run *runs, *sorted;
+    vd_region *reg;
+    vd_key *keys;
+    int nruns, nregions = 0, r, k, *region_of;
+    long m;
+    const vd_run *run;
+
+    runs = vd_label(grid, data, &nruns);
+    if (nruns == 0)
+        return 0;
+
+    /* Number the voids by their first run, then group runs by void,
+    keeping row order. */
+    region_of = (int *)malloc(nruns * sizeof(int));
+    for (r = 0; r < nruns; r++)
+        region_of[r] = vd_find(runs, r) == r ? nregions++ : region_of[vd_find(runs, r)];
+
+    job.regions = (vd_region *)calloc(nregions, sizeof(vd_region));
+    for (r = 0; r < nruns; r++) {
+        reg = &job.regions[region_of[r]];
+        if (reg->nruns++ == 0) {
+            reg->i0 = reg->i1 = runs[r].i;
+            reg->j0 = runs[r].j0;
+            reg->j1 = runs[r].j1 - 1;
+        }
+        reg->i1 = runs[r].i;
+        if (runs[r].j0 < reg->j0)
+            reg->j0 = runs[r].j0;
+        if (runs[r].j1 - 1 > reg->j1)
+            reg->j1 = runs[r].j1 - 1;
+        reg->count += runs[r].j1 - runs[r].j0;
+    }
+    for (k = 0, m = 0; k < nregions; k++) {
+        job.regions[k].run0 = (int)m;
+        m += job.regions[k].nruns;
+        job.regions[k].nruns = 0;
+    }
+    sorted = (vd_run *)malloc(nruns * sizeof(vd_run));
+    for (r = 0; r < nruns; r++) {
+        reg = &job.regions[region_of[r]];
+        sorted[reg->run0 + reg->nruns++] = runs[r];
+    }
+    free(runs);
+    free(region_of);
+
+    job.grid = grid;
+    job.opts = opts;
+    job.data = data;
+    job.runs = sorted;
+    job.filled = 0;
+    keys = (vd_key *)malloc(nregions * sizeof(vd_key));
+    for (k = 0; k < nregions; k++) {
+        keys[k].count = job.regions[k].count;
+        keys[k].index = k;
+    }
+    qsort(keys, nregions, sizeof(vd_key), &vd_cmp_size);
+    job.order = (int *)malloc(nregions * sizeof(int));
+    for (k = 0; k < nregions; k++)
+        job.order[k] = keys[k].index;
+    free(keys);
+
+    gf_parallel_for(nregions, opts->nthreads, &vd_solve_task, (void *)&job);
+
+    /* Patch once every void is solved, since each read its rim from
+    data. */
+    for (k = 0; k < nregions; k++) {
+        reg = &job.regions[k];
+        if (reg->values == NULL)
+            continue;
+        for (r = 0, m = 0; r < reg->nruns; r++) {
+            run = &sorted[reg->run0 + r];
+            memcpy(data + (long)run->i * grid->nx + run->j0, reg->values + m,
+                (run->j1 - run->j0) * sizeof(gf_float));
+            m += run->j1 - run->j0;
+        }
+        free(reg->values);
+    }
+
+    free(job.regions);
+    free(job.order);
+    free(sorted);
+    return job.filled;
+}
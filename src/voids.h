@@ -0,0 +1,44 @@
+#ifndef GF_VOIDS_H
+#define GF_VOIDS_H
+
+#include "gridfloat.h"
+
+/**
+ * Void filling options.
+ *
+ * @max_cells - Leave voids of more cells than this alone (open water,
+ *      areas off the survey); 0 for no limit.
+ * @tol - Stop once the next update would move no cell by more than
+ *      this (elevation units).
+ * @max_cycles - Solver iterations per void, at most (each costs one
+ *      multigrid V-cycle).
+ * @nthreads - Voids solved at once; 0 for gf_num_threads().
+ */
+typedef struct gf_void_opts {
+    long max_cells;
+    double tol;
+    int max_cycles;
+    int nthreads;
+} gf_void_opts;
+
+void gf_init_void_opts(gf_void_opts *opts);
+
+/**
+ * Fill NODATA voids in data (grid->nx * grid->ny values, top row
+ * first) with the smoothest surface that meets the valid nodes around
+ * them: the solution of Laplace's equation, with each void's rim as
+ * the boundary and no-flux where a void meets the edge of the grid.
+ *
+ * Voids are the 4-connected components of null nodes, found in one
+ * pass over the rows. Each is solved on its own bounding window (plus
+ * a one-node rim) by conjugate gradients preconditioned with multigrid
+ * V-cycles, so iterations barely grow with the void's width, as they
+ * would (quadratically) for plain relaxation. Voids are solved in
+ * parallel, largest first, and patched in once all are done. Voids
+ * without a single valid neighbor stay null.
+ *
+ * Returns the number of voids filled.
+ */
+int gf_fill_voids(const gf_grid *grid, const gf_void_opts *opts, gf_float *data);
+
+#endif
@@ -0,0 +1,462 @@
+#include "zonal.h"
+#include "pool.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Polygon edge, y in degrees latitude. x(y) = x0 + (y - y0) * dxdy. */
+typedef struct gf_zonal_edge {
+    double ymin;
+    double ymax;
+    double x0;
+    double y0;
+    double dxdy;
+} gf_zonal_edge;
+
+/* Read-only per-polygon rasterization setup, shared by all bands. */
+typedef struct gf_zonal_poly {
+    int index;
+    long ii_top;        /* Source rows [ii_top, ii_bot] */
+    long ii_bot;
+    long jj_left;       /* Source columns [jj_left, jj_right] */
+    long jj_right;
+    int nedges;
+    gf_zonal_edge *edges;   /* Sorted by ymax, descending. */
+} gf_zonal_poly;
+
+/* Band-local sweep state of an active polygon. */
+typedef struct gf_zonal_active {
+    const gf_zonal_poly *poly;
+    int next_edge;
+    int nactive;
+    int *active;        /* Indices into poly->edges */
+} gf_zonal_active;
+
+typedef struct gf_zonal_job {
+    const gf_struct *gf;
+    const gf_zonal_opts *opts;
+    int npolys;
+    gf_zonal_poly *polys;       /* Sorted by ii_top */
+    int nbands;
+    long ii_start;              /* Rows swept: [ii_start, ii_end) */
+    long ii_end;
+    gf_zonal_stats **partial;   /* Per band, npolys entries each */
+    int failed;
+} gf_zonal_job;
+
+
+void gf_init_zonal_opts(gf_zonal_opts *opts) {
+    opts->nbins = 0;
+    opts->hist_min = 0.0;
+    opts->hist_max = 0.0;
+    opts->base = 0.0;
+}
+
+
+int gf_read_polygons(const char *filename, gf_polygon **polys, int *count) {
+    FILE *fp;
+    char *line = NULL, *tok, *saveptr;
+    size_t line_cap = 0;
+    gf_polygon *p;
+    int cap = 0, nv, cap_v;
+
+    *polys = NULL;
+    *count = 0;
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "No such polygon file: '%s'\n", filename);
+        return -1;
+    }
+
+    /* Parcels can have thousands of vertices; no fixed line length. */
+    while (getline(&line, &line_cap, fp) != -1) {
+        tok = strtok_r(line, " \t\r\n", &saveptr);
+        if (tok == NULL || tok[0] == '#')
+            continue;
+
+        if (*count == cap) {
+            cap = cap ? 2 * cap : 64;
+            *polys = (gf_polygon *)realloc(*polys, cap * sizeof(gf_polygon));
+        }
+        p = &(*polys)[*count];
+        strncpy(p->id, tok, sizeof(p->id) - 1);
+        p->id[sizeof(p->id) - 1] = '\0';
+
+        nv = 0;
+        cap_v = 16;
+        p->lnglat = (double *)malloc(cap_v * sizeof(double));
+        while ((tok = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+            if (nv == cap_v) {
+                cap_v *= 2;
+                p->lnglat = (double *)realloc(p->lnglat, cap_v * sizeof(double));
+            }
+            p->lnglat[nv++] = atof(tok);
+        }
+
+        if (nv < 6 || nv % 2 != 0) {
+            fprintf(stderr, "Bad polygon '%s': need at least 3 lng/lat pairs\n", p->id);
+            free(p->lnglat);
+            continue;
+        }
+        p->n = nv / 2;
+        (*count)++;
+    }
+
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+
+void gf_free_polygons(gf_polygon *polys, int count) {
+    int i;
+    for (i = 0; i < count; i++)
+        free(polys[i].lnglat);
+    free(polys);
+}
+
+
+void gf_free_zonal_stats(gf_zonal_stats *stats, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        free(stats[i].hist);
+        stats[i].hist = NULL;
+    }
+}
+
+
+static
+int cmp_edge_ymax(const void *a, const void *b) {
+    double ya = ((const gf_zonal_edge *)a)->ymax, yb = ((const gf_zonal_edge *)b)->ymax;
+    return ya < yb ? 1 : (ya > yb ? -1 : 0);
+}
+
+
+static
+int cmp_poly_top(const void *a, const void *b) {
+    long ia = ((const gf_zonal_poly *)a)->ii_top, ib = ((const gf_zonal_poly *)b)->ii_top;
+    return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+
+/* Edges and node ranges for one polygon. Returns 0 if it covers no
+   source node. */
+static
+int gf_zonal_setup(const gf_grid *g, const gf_polygon *poly, int index, gf_zonal_poly *zp) {
+    int k, n = poly->n;
+    double x0, y0, x1, y1, xmin, xmax, ymin, ymax;
+    gf_zonal_edge *e;
+
+    zp->index = index;
+    zp->edges = (gf_zonal_edge *)malloc(n * sizeof(gf_zonal_edge));
+    zp->nedges = 0;
+
+    xmin = xmax = poly->lnglat[0];
+    ymin = ymax = poly->lnglat[1];
+
+    for (k = 0; k < n; k++) {
+        x0 = poly->lnglat[2 * k];
+        y0 = poly->lnglat[2 * k + 1];
+        x1 = poly->lnglat[2 * ((k + 1) % n)];
+        y1 = poly->lnglat[2 * ((k + 1) % n) + 1];
+
+        if (x0 < xmin) xmin = x0;
+        if (x0 > xmax) xmax = x0;
+        if (y0 < ymin) ymin = y0;
+        if (y0 > ymax) ymax = y0;
+
+        /* Horizontal edges never cross a scanline. */
+        if (y0 == y1)
+            continue;
+
+        e = &zp->edges[zp->nedges++];
+        e->ymin = y0 < y1 ? y0 : y1;
+        e->ymax = y0 < y1 ? y1 : y0;
+        e->x0 = x0;
+        e->y0 = y0;
+        e->dxdy = (x1 - x0) / (y1 - y0);
+    }
+
+    qsort(zp->edges, zp->nedges, sizeof(gf_zonal_edge), cmp_edge_ymax);
+
+    zp->ii_top = (long)ceil((g->top - ymax) / g->dy);
+    zp->ii_bot = (long)floor((g->top - ymin) / g->dy);
+    zp->jj_left = (long)ceil((xmin - g->left) / g->dx);
+    zp->jj_right = (long)floor((xmax - g->left) / g->dx);
+
+    if (zp->ii_top < 0) zp->ii_top = 0;
+    if (zp->jj_left < 0) zp->jj_left = 0;
+    if (zp->ii_bot > g->ny - 1) zp->ii_bot = g->ny - 1;
+    if (zp->jj_right > g->nx - 1) zp->jj_right = g->nx - 1;
+
+    if (zp->nedges == 0 || zp->ii_top > zp->ii_bot || zp->jj_left > zp->jj_right) {
+        free(zp->edges);
+        zp->edges = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+
+static
+void gf_zonal_init_stats(gf_zonal_stats *s, int nbins) {
+    s->count = 0;
+    s->min = s->max = s->sum = s->cut = s->fill = 0.0;
+    s->hist = nbins > 0 ? (long *)calloc(nbins, sizeof(long)) : NULL;
+}
+
+
+static
+void gf_zonal_add(gf_zonal_stats *s, const gf_zonal_opts *opts, double z, double area) {
+    int bin;
+
+    if (s->count == 0 || z < s->min) s->min = z;
+    if (s->count == 0 || z > s->max) s->max = z;
+    s->count++;
+    s->sum += z;
+    if (z > opts->base)
+        s->cut += (z - opts->base) * area;
+    else
+        s->fill += (opts->base - z) * area;
+
+    if (opts->nbins > 0) {
+        bin = (int)floor((z - opts->hist_min) / (opts->hist_max - opts->hist_min) * opts->nbins);
+        if (bin < 0) bin = 0;
+        if (bin >= opts->nbins) bin = opts->nbins - 1;
+        s->hist[bin]++;
+    }
+}
+
+
+static
+void gf_zonal_merge(gf_zonal_stats *into, const gf_zonal_stats *from, int nbins) {
+    int k;
+
+    if (from->count == 0)
+        return;
+    if (into->count == 0 || from->min < into->min) into->min = from->min;
+    if (into->count == 0 || from->max > into->max) into->max = from->max;
+    into->count += from->count;
+    into->sum += from->sum;
+    into->cut += from->cut;
+    into->fill += from->fill;
+    for (k = 0; k < nbins; k++)
+        into->hist[k] += from->hist[k];
+}
+
+
+/* Sorted crossings of the active edges with the scanline at lat y. */
+static
+int gf_zonal_crossings(gf_zonal_active *act, double y, double *xs) {
+    const gf_zonal_poly *zp = act->poly;
+    const gf_zonal_edge *e;
+    int k, m, q, n = 0;
+    double x;
+
+    /* Bring in edges reaching down to y; drop those that ended. Rows
+    move south, so both lists only advance. */
+    while (act->next_edge < zp->nedges && zp->edges[act->next_edge].ymax > y)
+        act->active[act->nactive++] = act->next_edge++;
+
+    for (k = 0, m = 0; k < act->nactive; k++) {
+        e = &zp->edges[act->active[k]];
+        if (e->ymin > y)
+            continue;
+        act->active[m++] = act->active[k];
+
+        /* Half-open [ymin, ymax) so shared vertices count once. */
+        if (y >= e->ymax)
+            continue;
+        x = e->x0 + (y - e->y0) * e->dxdy;
+
+        /* Insertion sort; there are few crossings per row. */
+        for (q = n++; q > 0 && xs[q - 1] > x; q--)
+            xs[q] = xs[q - 1];
+        xs[q] = x;
+    }
+    act->nactive = m;
+    return n;
+}
+
+
+static
+void gf_zonal_band_task(int b, void *arg) {
+    gf_zonal_job *job = (gf_zonal_job *)arg;
+    const gf_grid *g = &job->gf->grid;
+    const gf_zonal_opts *opts = job->opts;
+    gf_zonal_stats *stats = job->partial[b];
+    gf_zonal_active *act;
+    gf_zonal_poly *zp;
+    gf_float *line;
+    double *xs, y, dxm, dym, area, z;
+    long ii, ii_start, ii_end, jj, jj0, jj1, read_l, read_r;
+    int k, a, nact = 0, next = 0, max_edges = 0, ncross;
+
+    ii_start = job->ii_start + ((job->ii_end - job->ii_start) * b) / job->nbands;
+    ii_end = job->ii_start + ((job->ii_end - job->ii_start) * (b + 1)) / job->nbands;
+
+    for (k = 0; k < job->npolys; k++)
+        if (job->polys[k].nedges > max_edges)
+            max_edges = job->polys[k].nedges;
+
+    act = (gf_zonal_active *)malloc(job->npolys * sizeof(gf_zonal_active));
+    xs = (double *)malloc((max_edges + 1) * sizeof(double));
+    line = (gf_float *)malloc(g->nx * sizeof(gf_float));
+
+    for (ii = ii_start; ii < ii_end; ii++) {
+        y = g->top - ii * g->dy;
+
+        /* Activate polygons reaching this row, in top-row order. Those
+        that started above the band come in on its first row. */
+        while (next < job->npolys && job->polys[next].ii_top <= ii) {
+            zp = &job->polys[next++];
+            if (zp->ii_bot < ii)
+                continue;
+            act[nact].poly = zp;
+            act[nact].next_edge = 0;
+            act[nact].nactive = 0;
+            act[nact].active = (int *)malloc(zp->nedges * sizeof(int));
+            nact++;
+        }
+
+        /* Retire finished polygons and find the columns to read. */
+        read_l = g->nx;
+        read_r = -1;
+        for (a = 0, k = 0; a < nact; a++) {
+            if (act[a].poly->ii_bot < ii) {
+                free(act[a].active);
+                continue;
+            }
+            act[k++] = act[a];
+            if (act[a].poly->jj_left < read_l) read_l = act[a].poly->jj_left;
+            if (act[a].poly->jj_right > read_r) read_r = act[a].poly->jj_right;
+        }
+        nact = k;
+        if (nact == 0)
+            continue;
+
+        /* One read of the row serves every active polygon. */
+        if (gf_get_line(ii, read_l, read_r + 1, job->gf, line) != 0) {
+            __sync_fetch_and_add(&job->failed, 1);
+            break;
+        }
+
+        gf_lengths(y, g->left, g->dy, g->dx, 0.0, &dxm, &dym);
+        area = dxm * dym;
+
+        for (a = 0; a < nact; a++) {
+            zp = (gf_zonal_poly *)act[a].poly;
+            ncross = gf_zonal_crossings(&act[a], y, xs);
+
+            for (k = 0; k + 1 < ncross; k += 2) {
+                /* Nodes with lng in [xs[k], xs[k + 1]). */
+                jj0 = (long)ceil((xs[k] - g->left) / g->dx);
+                jj1 = (long)ceil((xs[k + 1] - g->left) / g->dx) - 1;
+                if (jj0 < zp->jj_left) jj0 = zp->jj_left;
+                if (jj1 > zp->jj_right) jj1 = zp->jj_right;
+
+                for (jj = jj0; jj <= jj1; jj++) {
+                    if ((z = line[jj - read_l]) == GF_NULL_VAL)
+                        continue;
+                    gf_zonal_add(&stats[zp->index], opts, z, area);
+                }
+            }
+        }
+    }
+
+    for (a = 0; a < nact; a++)
+        free(act[a].active);
+    free(act);
+    free(xs);
+    free(line);
+}
+
+
+int gf_zonal(const gf_struct *gf, const gf_polygon *polys, int npolys,
+    const gf_zonal_opts *opts, gf_zonal_stats *stats)
+{
+    gf_zonal_job job;
+    gf_zonal_poly zp;
+    int i, b, n = 0;
+
+    job.gf = gf;
+    job.opts = opts;
+    job.polys = (gf_zonal_poly *)malloc((npolys > 0 ? npolys : 1) * sizeof(gf_zonal_poly));
+    job.failed = 0;
+
+    for (i = 0; i < npolys; i++) {
+        gf_zonal_init_stats(&stats[i], opts->nbins);
+        if (gf_zonal_setup(&gf->grid, &polys[i], i, &zp))
+            job.polys[n++] = zp;
+    }
+    job.npolys = n;
+
+    if (n == 0) {
+        free(job.polys);
+        return 0;
+    }
+
+    qsort(job.polys, n, sizeof(gf_zonal_poly), cmp_poly_top);
+
+    job.ii_start = job.polys[0].ii_top;
+    job.ii_end = 0;
+    for (i = 0; i < n; i++)
+        if (job.polys[i].ii_bot + 1 > job.ii_end)
+            job.ii_end = job.polys[i].ii_bot + 1;
+
+    job.nbands = gf_num_threads();
+    if (job.nbands > job.ii_end - job.ii_start)
+        job.nbands = (int)(job.ii_end - job.ii_start);
+
+    job.partial = (gf_zonal_stats **)malloc(job.nbands * sizeof(gf_zonal_stats *));
+    for (b = 0; b < job.nbands; b++) {
+        job.partial[b] = (gf_zonal_stats *)malloc(npolys * sizeof(gf_zonal_stats));
+        for (i = 0; i < npolys; i++)
+            gf_zonal_init_stats(&job.partial[b][i], opts->nbins);
+    }
+
+    gf_parallel_for(job.nbands, job.nbands, &gf_zonal_band_task, (void *)&job);
+
+    /* Reduce bands in order. */
+    for (b = 0; b < job.nbands; b++) {
+        for (i = 0; i < npolys; i++)
+            gf_zonal_merge(&stats[i], &job.partial[b][i], opts->nbins);
+        gf_free_zonal_stats(job.partial[b], npolys);
+        free(job.partial[b]);
+    }
+    free(job.partial);
+
+    for (i = 0; i < n; i++)
+        free(job.polys[i].edges);
+    free(job.polys);
+
+    return job.failed ? -1 : 0;
+}
+
+
+void gf_print_zonal_stats(FILE *fp, const gf_polygon *polys, int npolys,
+    const gf_zonal_opts *opts, const gf_zonal_stats *stats)
+{
+    int i, k;
+    const gf_zonal_stats *s;
+
+    fprintf(fp, "id\tcount\tmin\tmax\tmean\tcut\tfill");
+    for (k = 0; k < opts->nbins; k++)
+        fprintf(fp, "\tbin%d", k);
+    fprintf(fp, "\n");
+
+    for (i = 0; i < npolys; i++) {
+        s = &stats[i];
+        if (s->count == 0) {
+            fprintf(fp, "%s\t0\t\t\t\t0\t0", polys[i].id);
+        } else {
+            fprintf(fp, "%s\t%ld\t%f\t%f\t%f\t%f\t%f", polys[i].id, s->count,
+                s->min, s->max, s->sum / s->count, s->cut, s->fill);
+        }
+        for (k = 0; k < opts->nbins; k++)
+            fprintf(fp, "\t%ld", s->hist[k]);
+        fprintf(fp, "\n");
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef GF_ZONAL_H
+#define GF_ZONAL_H
+
+#include "gridfloat.h"
+
+/**
+ * A simple polygon (one ring, even-odd rule) in lng/lat.
+ *
+ * @id - Identifier copied from the polygon file.
+ * @n - Number of vertices. The ring closes implicitly.
+ * @lnglat - 2 * n doubles: lng0, lat0, lng1, lat1, ...
+ */
+typedef struct gf_polygon {
+    char id[64];
+    int n;
+    double *lnglat;
+} gf_polygon;
+
+/**
+ * Zonal statistics options.
+ *
+ * @nbins - Histogram bins (0 for none) spanning [hist_min, hist_max).
+ *      Values outside land in the end bins.
+ * @base - Reference elevation for cut/fill volumes.
+ */
+typedef struct gf_zonal_opts {
+    int nbins;
+    double hist_min;
+    double hist_max;
+    double base;
+} gf_zonal_opts;
+
+/**
+ * Statistics over the valid source nodes whose centers fall inside a
+ * polygon.
+ *
+ * @cut - Volume (m^3) above base, i.e. to be cut down to it.
+ * @fill - Volume (m^3) below base, i.e. to be filled up to it.
+ * @hist - nbins counts.
+ */
+typedef struct gf_zonal_stats {
+    long count;
+    double min;
+    double max;
+    double sum;
+    double cut;
+    double fill;
+    long *hist;
+} gf_zonal_stats;
+
+void gf_init_zonal_opts(gf_zonal_opts *opts);
+
+/**
+ * Read polygons from a text file, one per line:
+ *
+ *     ID LNG LAT LNG LAT ...
+ *
+ * Blank lines and lines starting with '#' are skipped.
+ */
+int gf_read_polygons(const char *filename, gf_polygon **polys, int *count);
+
+void gf_free_polygons(gf_polygon *polys, int count);
+
+/**
+ * Rasterize every polygon against the source grid with a scanline
+ * sweep and reduce statistics per polygon. Polygons are processed in
+ * order of their top row so each source row is read once for all the
+ * polygons crossing it; row bands run in parallel and their partial
+ * statistics are merged at the end.
+ *
+ * @stats - npolys entries, filled on return. Free with
+ *      gf_free_zonal_stats.
+ *
+ * Returns 0, or -1 if a source row could not be read.
+ */
+int gf_zonal(const gf_struct *gf, const gf_polygon *polys, int npolys,
+    const gf_zonal_opts *opts, gf_zonal_stats *stats);
+
+void gf_free_zonal_stats(gf_zonal_stats *stats, int count);
+
+/* One tab-separated row per polygon, after a header row. */
+void gf_print_zonal_stats(FILE *fp, const gf_polygon *polys, int npolys,
+    const gf_zonal_opts *opts, const gf_zonal_stats *stats);
+
+#endif
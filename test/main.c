@@ -4,6 +4,27 @@
 #include "../src/db.h"
 #include "../src/sort.h"
 #include "../src/tile.h"
+#include "../src/stencil.h"
+#include "../src/sat.h"
+#include "../src/zonal.h"
+#include "../src/points.h"
+#include "../src/profile.h"
+#include "../src/los.h"
+#include "../src/viewshed.h"
+#include "../src/sweep.h"
+#include "../src/contour.h"
+#include "../src/hydro.h"
+#include "../src/route.h"
+#include "../src/calc.h"
+#include "../src/voids.h"
+#include "../src/quadratic.h"
+#include "../src/gfpng.h"
+#include "../src/pool.h"
+#include "../src/transpose.h"
+#include "../src/proj.h"
+#include "../src/catalog.h"
+#include "../src/linear.h"
+#include "../src/terrain.h"
 
 #include <getopt.h>
 #include <string.h>
@@ -11,6 +32,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <math.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 
 static int test_passed = 0;
 static int test_failed = 0;
@@ -191,6 +216,2396 @@ int test_tile() {
     return 0;
 }
 
+static
+int sum_kernel(const gf_window *win, const gf_grid *from_grid, double *w,
+    double *latlng, void *xtras, void *data_ptr)
+{
+    int r, c;
+    float sum = 0.0f;
+    for (r = -2; r <= 2; r++)
+        for (c = -2; c <= 2; c++)
+            sum += GF_WIN(win, r, c);
+    *(float *)data_ptr = sum;
+    return 0;
+}
+
+/* to_grid over source rows ii0 + i * si and columns jj0 + j * sj. */
+static
+void aligned_grid(const gf_grid *g, long ii0, long jj0, int si, int sj, int ny, int nx,
+    gf_grid *grid)
+{
+    gf_init_grid_bounds(grid, g->left + jj0 * g->dx, g->left + (jj0 + (long)(nx - 1) * sj) * g->dx,
+        g->top - (ii0 + (long)(ny - 1) * si) * g->dy, g->top - ii0 * g->dy, ny, nx);
+}
+
+/* The fast path against gf_bilinear's, outside points untouched by both. */
+static
+int aligned_matches_bilinear(const gf_struct *gf, long ii0, long jj0, int si, int sj,
+    int ny, int nx)
+{
+    gf_grid grid;
+    gf_float *fast, *slow;
+    long ki, kj;
+    int ki_s, kj_s, k;
+
+    aligned_grid(&gf->grid, ii0, jj0, si, sj, ny, nx, &grid);
+    check(gf_grid_aligned(&gf->grid, &grid, &ki, &kj, &ki_s, &kj_s));
+    check(ki == ii0 && kj == jj0 && ki_s == si && kj_s == sj);
+
+    fast = (gf_float *)malloc(nx * ny * sizeof(gf_float));
+    slow = (gf_float *)malloc(nx * ny * sizeof(gf_float));
+    for (k = 0; k < nx * ny; k++)
+        fast[k] = slow[k] = 7.0f;
+    check(gf_bilinear_interpolate(gf, &grid, fast) == 0);
+    check(gf_bilinear(gf, &grid, NULL, &gf_bilinear_interpolate_kernel,
+        (void *)slow, sizeof(gf_float)) == 0);
+    for (k = 0; k < nx * ny; k++) {
+        check((fast[k] == (gf_float)GF_NULL_VAL) == (slow[k] == (gf_float)GF_NULL_VAL));
+        check(fabs(fast[k] - slow[k]) < 1e-3);
+    }
+    free(fast);
+    free(slow);
+    return 0;
+}
+
+int test_aligned() {
+    gf_db db;
+    gf_grid grid;
+    gf_struct gf;
+    gf_float *data, out[4 * 1000];
+    const int ny = 30, nx = 2100;
+    long i, j;
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    check(aligned_matches_bilinear(&db.tiles[0], 10, 20, 1, 1, 40, 150) == 0);
+    check(aligned_matches_bilinear(&db.tiles[0], 3, 5, 2, 3, 50, 40) == 0);
+    gf_close_db(&db);
+
+    /* Wide enough for strides past a span read. */
+    data = (gf_float *)malloc(nx * ny * sizeof(gf_float));
+    for (i = 0; i < ny; i++)
+        for (j = 0; j < nx; j++)
+            data[i * nx + j] = 100.0f + (i * 31 + j * 17) % 97;
+    gf_init_grid_bounds(&grid, -110.0, -110.0 + (nx - 1) * 0.001, 35.0, 35.0 + (ny - 1) * 0.001, ny, nx);
+    gf_save(&grid, data, "/tmp/gf-aligned");
+
+    check(gf_open("/tmp/gf-aligned.hdr", "/tmp/gf-aligned.flt", &gf) == 0);
+    check(aligned_matches_bilinear(&gf, 3, 5, 1, 1, 18, 1000) == 0);
+    check(aligned_matches_bilinear(&gf, 2, 7, 2, 3, 11, 300) == 0);
+    check(aligned_matches_bilinear(&gf, 1, 10, 1, 1030, 5, 2) == 0);
+
+    /* Hanging off the top left, where gf_bilinear has no source to
+    compare with: check against the source directly. */
+    aligned_grid(&gf.grid, -3, -4, 1, 2, 12, 50, &grid);
+    for (i = 0; i < 12 * 50; i++)
+        out[i] = 7.0f;
+    check(gf_bilinear_interpolate(&gf, &grid, out) == 0);
+    for (i = 0; i < 12; i++)
+        for (j = 0; j < 50; j++)
+            check(out[i * 50 + j] == (i < 3 || j < 2 ? 7.0f : data[(i - 3) * nx + 2 * j - 4]));
+
+    /* The bottom right corner needs no node past the end of the file. */
+    gf_init_grid_bounds(&grid, gf.grid.right, gf.grid.right + 1.0, gf.grid.bottom - 1.0,
+        gf.grid.bottom, 1, 1);
+    check(gf_bilinear_interpolate(&gf, &grid, out) == 0);
+    check(out[0] == data[(ny - 1) * nx + nx - 1]);
+    gf_close(&gf);
+    free(data);
+
+    /* Rows past a truncated .flt fail to read. */
+    check(truncate("/tmp/gf-aligned.flt", 10 * nx * sizeof(gf_float)) == 0);
+    check(gf_open("/tmp/gf-aligned.hdr", "/tmp/gf-aligned.flt", &gf) == 0);
+    aligned_grid(&gf.grid, 5, 0, 1, 1, 4, 1000, &grid);
+    check(gf_bilinear_interpolate(&gf, &grid, out) == 0);
+    aligned_grid(&gf.grid, 8, 0, 1, 1, 4, 1000, &grid);
+    check(gf_bilinear_interpolate(&gf, &grid, out) == -1);
+    aligned_grid(&gf.grid, 12, 0, 2, 3, 4, 300, &grid);
+    check(gf_bilinear_interpolate(&gf, &grid, out) == -1);
+    aligned_grid(&gf.grid, 12, 0, 1, 1030, 2, 2, &grid);
+    check(gf_bilinear_interpolate(&gf, &grid, out) == -1);
+    gf_init_grid_bounds(&grid, -109.9995, -109.9, 35.0205, 35.0285, 3, 50);
+    check(gf_bilinear_interpolate(&gf, &grid, out) == 0);
+    gf_init_grid_bounds(&grid, -109.9995, -109.9, 35.0125, 35.0285, 3, 50);
+    check(gf_bilinear_interpolate(&gf, &grid, out) == -1);
+    gf_close(&gf);
+
+    unlink("/tmp/gf-aligned.hdr");
+    unlink("/tmp/gf-aligned.flt");
+    return 0;
+}
+
+/* Each product of one fused pass equals the same product alone. */
+static
+int fused_matches_single(const gf_struct *gf, const gf_grid *grid, const double *n_sun) {
+    const int types[4] = {ELEVATION, GRADX, GRADY, SHADE};
+    long k, n = (long)grid->nx * grid->ny;
+    gf_data all, one;
+    int t;
+
+    gf_init_data(ELEVATION | GRADX | GRADY | SHADE, n, &all);
+    check(gf_biquadratic_data(gf, grid, ELEVATION | GRADX | GRADY | SHADE, n_sun, &all) == 0);
+    for (t = 0; t < 4; t++) {
+        gf_init_data(types[t], n, &one);
+        check(gf_biquadratic_data(gf, grid, types[t], n_sun, &one) == 0);
+        for (k = 0; k < n; k++) {
+            if (types[t] == ELEVATION)
+                check(one.elev[k] == all.elev[k]);
+            else if (types[t] == GRADX)
+                check(one.gradx[k] == all.gradx[k]);
+            else if (types[t] == GRADY)
+                check(one.grady[k] == all.grady[k]);
+            else
+                check(one.shade[k] == all.shade[k]);
+        }
+        gf_free_data(&one);
+    }
+    gf_free_data(&all);
+    return 0;
+}
+
+int test_fused_data() {
+    gf_db db;
+    gf_grid src, grid, *g;
+    gf_struct gf;
+    gf_data data;
+    gf_float z[60 * 60];
+    double *grad, n_sun[3] = {0.5, 0.5, sqrt(0.5)};
+    const int n = 47;
+    long i, j, k;
+
+    /* Every tile, nulls and all. */
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    for (k = 0; k < db.count; k++) {
+        g = &db.tiles[k].grid;
+        gf_init_grid_bounds(&grid, g->left - 2.3 * g->dx, g->right + 1.7 * g->dx,
+            g->bottom - 0.6 * g->dy, g->top + 3.1 * g->dy, n, n);
+        check(fused_matches_single(&db.tiles[k], &grid, n_sun) == 0);
+    }
+    gf_close_db(&db);
+
+    /* Gradients against gf_biquadratic_gradient and shade against
+    gf_shade of them, on a null-free hill (the gradient pass does not
+    fill nulls). */
+    for (i = 0; i < 60; i++)
+        for (j = 0; j < 60; j++)
+            z[i * 60 + j] = 800.0f + 300.0f * (float)(sin(i / 9.0) * cos(j / 7.0));
+    gf_init_grid_bounds(&src, -105.0, -104.941, 39.0, 39.059, 60, 60);
+    gf_save(&src, z, "/tmp/gf-fused");
+    check(gf_open("/tmp/gf-fused.hdr", "/tmp/gf-fused.flt", &gf) == 0);
+    gf_init_grid_bounds(&grid, src.left + 1.37 * src.dx, src.right - 1.21 * src.dx,
+        src.bottom + 2.9 * src.dy, src.top - 1.55 * src.dy, n, n);
+
+    check(fused_matches_single(&gf, &grid, n_sun) == 0);
+    gf_init_data(GRADX | GRADY | SHADE, n * n, &data);
+    check(gf_biquadratic_data(&gf, &grid, GRADX | GRADY | SHADE, n_sun, &data) == 0);
+    grad = (double *)malloc(2 * n * n * sizeof(double));
+    check(gf_biquadratic_gradient(&gf, &grid, grad) == 0);
+    for (k = 0; k < n * n; k++) {
+        check(data.gradx[k] == grad[2 * k] && data.grady[k] == grad[2 * k + 1]);
+        check(data.gradx[k] != GF_NULL_VAL);
+        check(data.shade[k] == gf_shade(grad[2 * k], grad[2 * k + 1], n_sun));
+    }
+    free(grad);
+    gf_free_data(&data);
+    gf_close(&gf);
+
+    unlink("/tmp/gf-fused.hdr");
+    unlink("/tmp/gf-fused.flt");
+    return 0;
+}
+
+int test_stencil_bands() {
+    gf_db db;
+    gf_grid grid, *g;
+    gf_stencil st;
+    const int n = 97;
+    int i;
+    float *one, *many;
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+    gf_init_grid_bounds(&grid, g->left, g->right, g->bottom, g->top, n, n);
+
+    one = (float *)malloc(n * n * sizeof(float));
+    many = (float *)malloc(n * n * sizeof(float));
+    memset(one, 0, n * n * sizeof(float));
+    memset(many, 0, n * n * sizeof(float));
+
+    gf_init_stencil(&st, 5, 5, &sum_kernel, NULL, sizeof(float));
+    gf_stencil_run(&db.tiles[0], &grid, &st, one);
+    st.nbands = 7;
+    gf_stencil_run(&db.tiles[0], &grid, &st, many);
+
+    for (i = 0; i < n * n; i++)
+        check(one[i] == many[i]);
+
+    free(one);
+    free(many);
+    gf_close_db(&db);
+    return 0;
+}
+
+/* The biquadratic row loop before the stencil engine: lat and lng are
+accumulated, and each point reads its own 3x3 from the file. */
+static
+void old_biquadratic(const gf_struct *gf, const gf_grid *to, float *out) {
+    const gf_grid *g = &gf->grid;
+    double lat, lng, w[2];
+    double in_l = g->left + 0.5 * g->dx, in_r = g->right - 0.5 * g->dx;
+    double in_b = g->bottom + 0.5 * g->dy, in_t = g->top - 0.5 * g->dy;
+    gf_float nine[3][3];
+    long ii, jj;
+    int i, j, r;
+
+    lat = to->top;
+    for (i = 0; i < to->ny; i++, lat -= to->dy) {
+        lng = to->left;
+        for (j = 0; j < to->nx; j++, lng += to->dx) {
+            *out = GF_NULL_VAL;
+            if (lat > in_t || lat < in_b || lng > in_r || lng < in_l) {
+                out++;
+                continue;
+            }
+            ii = (long)((g->top - lat) / g->dy + 0.5);
+            jj = (long)((lng - g->left) / g->dx + 0.5);
+            for (r = 0; r < 3; r++)
+                gf_get_line(ii - 1 + r, jj - 1, jj + 2, gf, nine[r]);
+            w[0] = (g->top - ii * g->dy - lat) / g->dy;
+            w[1] = (lng - (g->left + jj * g->dx)) / g->dx;
+            if (gf_fill_nulls_3x3(nine))
+                *out = (float)gf_biquadratic_value(nine, w);
+            out++;
+        }
+    }
+}
+
+/* Both paths null at the same points and within rounding elsewhere, on
+a grid hanging off every edge of the source. */
+static
+int biquadratic_matches_old(const gf_struct *gf) {
+    const gf_grid *g = &gf->grid;
+    gf_grid grid;
+    gf_data data;
+    float *old;
+    const int n = 83;
+    int k;
+
+    gf_init_grid_bounds(&grid, g->left - 7.37 * g->dx, g->right + 5.21 * g->dx,
+        g->bottom - 3.73 * g->dy, g->top + 6.19 * g->dy, n, n);
+    old = (float *)malloc(n * n * sizeof(float));
+    old_biquadratic(gf, &grid, old);
+    gf_init_data(ELEVATION, n * n, &data);
+    check(gf_biquadratic_data(gf, &grid, ELEVATION, NULL, &data) == 0);
+    for (k = 0; k < n * n; k++) {
+        check((old[k] == (float)GF_NULL_VAL) == (data.elev[k] == (float)GF_NULL_VAL));
+        check(fabs(old[k] - data.elev[k]) < 1e-3);
+    }
+    gf_free_data(&data);
+    free(old);
+    return 0;
+}
+
+/* A 40x40 tile at 45N, written to /tmp/gf-terrain. Kind 0 is the plane
+100 + 3j - 2i, 1 the paraboloid 2j^2 + 3i^2, 2 a rough surface; nulls
+land on the nodes in holes. */
+static
+void terrain_tile(int kind, const long *holes, int nholes, gf_grid *grid) {
+    gf_float data[40 * 40];
+    long i, j;
+    int h;
+
+    gf_init_grid_bounds(grid, -100.0, -99.961, 45.0, 45.039, 40, 40);
+    for (i = 0; i < 40; i++)
+        for (j = 0; j < 40; j++)
+            data[i * 40 + j] = kind == 0 ? 100.0f + 3 * j - 2 * i :
+                kind == 1 ? 2.0f * j * j + 3.0f * i * i :
+                500.0f + (i * 37 + j * 11) % 29;
+    for (h = 0; h < nholes; h++)
+        data[holes[h]] = GF_NULL_VAL;
+    gf_save(grid, data, "/tmp/gf-terrain");
+}
+
+/* Biquadratic products and contours over a source that fails to read. */
+static
+int stencil_reads_fail(const gf_struct *gf) {
+    gf_contour_opts opts;
+    gf_contours lines;
+    gf_data data;
+
+    gf_init_data(ELEVATION, (long)gf->grid.nx * gf->grid.ny, &data);
+    check(gf_biquadratic_data(gf, &gf->grid, ELEVATION, NULL, &data) != 0);
+    gf_free_data(&data);
+    gf_init_contour_opts(&opts, 5.0);
+    check(gf_contour_lines(gf, &gf->grid, &opts, &lines) == -3);
+    gf_free_contours(&lines);
+    return 0;
+}
+
+static
+int terrain_hole(const long *holes, int nholes, long i, long j) {
+    int h;
+
+    for (h = 0; h < nholes; h++)
+        if (holes[h] == i * 40 + j)
+            return 1;
+    return 0;
+}
+
+int test_terrain() {
+    gf_db db;
+    gf_grid grid;
+    gf_struct gf;
+    float out[40 * 40];
+    double dx_m, dy_m, want, sum, wsum, wk[13];
+    const long plane_holes[] = {5 * 40 + 6, 20 * 40 + 20};
+    const long rough_holes[] = {10 * 40 + 10, 10 * 40 + 12, 15 * 40 + 20, 30 * 40 + 5};
+    long i, j, r, c;
+    float v;
+
+    /* Against the pre-stencil path, on real data and on one with nulls. */
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    check(biquadratic_matches_old(&db.tiles[0]) == 0);
+    gf_close_db(&db);
+
+    terrain_tile(2, rough_holes, 4, &grid);
+    check(gf_open("/tmp/gf-terrain.hdr", "/tmp/gf-terrain.flt", &gf) == 0);
+    check(biquadratic_matches_old(&gf) == 0);
+    gf_close(&gf);
+
+    /* Slope of a plane is exact, also where a neighbor is null (it is
+    reflected through the center); a null center and the border, where
+    the window does not fit, are null. */
+    terrain_tile(0, plane_holes, 2, &grid);
+    check(gf_open("/tmp/gf-terrain.hdr", "/tmp/gf-terrain.flt", &gf) == 0);
+    check(gf_slope(&gf, &grid, out) == 0);
+    for (i = 0; i < 40; i++) {
+        for (j = 0; j < 40; j++) {
+            v = out[i * 40 + j];
+            if (i == 0 || j == 0 || i == 39 || j == 39 || terrain_hole(plane_holes, 2, i, j)) {
+                check(v == (float)GF_NULL_VAL);
+                continue;
+            }
+            gf_lengths(grid.top - i * grid.dy, grid.left + j * grid.dx, grid.dy, grid.dx,
+                0.0, &dx_m, &dy_m);
+            want = atan(sqrt(9.0 / (dx_m * dx_m) + 4.0 / (dy_m * dy_m))) * 180.0 / PI;
+            check(fabs(v - want) < 1e-4);
+        }
+    }
+    gf_close(&gf);
+
+    /* The discrete Laplacian of a paraboloid is exact. */
+    terrain_tile(1, plane_holes, 1, &grid);
+    check(gf_open("/tmp/gf-terrain.hdr", "/tmp/gf-terrain.flt", &gf) == 0);
+    check(gf_curvature(&gf, &grid, out) == 0);
+    check(out[plane_holes[0]] == (float)GF_NULL_VAL);
+    check(out[0] == (float)GF_NULL_VAL && out[40 * 40 - 1] == (float)GF_NULL_VAL);
+    for (i = 10; i < 39; i++) {
+        for (j = 1; j < 39; j++) {
+            gf_lengths(grid.top - i * grid.dy, grid.left + j * grid.dx, grid.dy, grid.dx,
+                0.0, &dx_m, &dy_m);
+            want = 4.0 / (dx_m * dx_m) + 6.0 / (dy_m * dy_m);
+            check(fabs(out[i * 40 + j] - want) < 1e-5 * want);
+        }
+    }
+    check(gf_gaussian(&gf, &grid, 0.0, out) == -1);
+    gf_close(&gf);
+
+    /* Gaussian against the 2D sum, renormalized over valid nodes. */
+    terrain_tile(2, rough_holes, 4, &grid);
+    check(gf_open("/tmp/gf-terrain.hdr", "/tmp/gf-terrain.flt", &gf) == 0);
+    check(gf_gaussian(&gf, &grid, 1.3, out) == 0);
+    for (r = -6; r <= 6; r++)
+        wk[r + 6] = exp(-0.5 * r * r / (1.3 * 1.3));
+    for (i = 0; i < 40; i++) {
+        for (j = 0; j < 40; j++) {
+            v = out[i * 40 + j];
+            if (i < 4 || j < 4 || i > 35 || j > 35 || terrain_hole(rough_holes, 4, i, j)) {
+                check(v == (float)GF_NULL_VAL);
+                continue;
+            }
+            sum = wsum = 0.0;
+            for (r = -4; r <= 4; r++) {
+                for (c = -4; c <= 4; c++) {
+                    if (terrain_hole(rough_holes, 4, i + r, j + c))
+                        continue;
+                    sum += wk[r + 6] * wk[c + 6] * (500 + ((i + r) * 37 + (j + c) * 11) % 29);
+                    wsum += wk[r + 6] * wk[c + 6];
+                }
+            }
+            check(fabs(v - sum / wsum) < 1e-3);
+        }
+    }
+    gf_close(&gf);
+
+    /* Rows past a truncated .flt fail the run, whatever the kernel. */
+    check(truncate("/tmp/gf-terrain.flt", 20 * 40 * sizeof(gf_float)) == 0);
+    check(gf_open("/tmp/gf-terrain.hdr", "/tmp/gf-terrain.flt", &gf) == 0);
+    check(gf_slope(&gf, &grid, out) != 0);
+    check(gf_gaussian(&gf, &grid, 1.3, out) != 0);
+    check(stencil_reads_fail(&gf) == 0);
+    gf_close(&gf);
+
+    unlink("/tmp/gf-terrain.hdr");
+    unlink("/tmp/gf-terrain.flt");
+    return 0;
+}
+
+/* A 130x130 tile (3x3 null blocks) of 100 + i + 2j, with the first
+block all NODATA and one null node in the block right of it. */
+static
+void null_blocks_tile(gf_grid *grid) {
+    gf_float *data;
+    long i, j;
+
+    gf_init_grid_bounds(grid, -120.0, -119.871, 40.0, 40.129, 130, 130);
+    data = (gf_float *)malloc(130 * 130 * sizeof(gf_float));
+    for (i = 0; i < 130; i++)
+        for (j = 0; j < 130; j++)
+            data[i * 130 + j] = i < 64 && j < 64 ? GF_NULL_VAL : 100.0f + i + 2 * j;
+    data[10 * 130 + 100] = GF_NULL_VAL;
+    gf_save(grid, data, "/tmp/gf-nulls");
+    free(data);
+}
+
+/* Crop source rows [i0, i0 + n) and columns [j0, j0 + n). */
+static
+void null_blocks_crop(const gf_grid *g, long i0, long j0, int n, gf_grid *crop) {
+    gf_init_grid_bounds(crop, g->left + j0 * g->dx, g->left + (j0 + n - 1) * g->dx,
+        g->top - (i0 + n - 1) * g->dy, g->top - i0 * g->dy, n, n);
+}
+
+int test_null_blocks() {
+    gf_grid grid, crop;
+    gf_struct gf;
+    gf_float junk[64], out[16 * 16];
+    float slope[16 * 16];
+    long i, j;
+    int fd;
+
+    null_blocks_tile(&grid);
+    unlink("/tmp/gf-nulls" GF_NULLS_EXT);
+    check(gf_open("/tmp/gf-nulls.hdr", "/tmp/gf-nulls.flt", &gf) == 0);
+    check(gf.null_blocks == NULL && gf_block_flags(&gf, 0, 0) == 0);
+
+    /* All null, mixed and all valid blocks. */
+    check(gf_scan_nulls(&gf) == 0);
+    check(gf.nbx == 3 && gf.nby == 3);
+    check(gf_block_flags(&gf, 0, 0) == (GF_BLOCK_ALL_NULL | GF_BLOCK_ANY_NULL));
+    check(gf_block_flags(&gf, 63, 63) == (GF_BLOCK_ALL_NULL | GF_BLOCK_ANY_NULL));
+    check(gf_block_flags(&gf, 0, 64) == GF_BLOCK_ANY_NULL);
+    check(gf_block_flags(&gf, 64, 0) == 0 && gf_block_flags(&gf, 129, 129) == 0);
+    check(gf_save_nulls(&gf, "/tmp/gf-nulls.flt") == 0);
+    gf_close(&gf);
+
+    /* Loaded on open. */
+    check(gf_open("/tmp/gf-nulls.hdr", "/tmp/gf-nulls.flt", &gf) == 0);
+    check(gf.null_blocks != NULL && gf.nbx == 3);
+    check(gf_block_flags(&gf, 0, 64) == GF_BLOCK_ANY_NULL);
+
+    /* Overwrite the null block behind the handle's back: extraction and
+    stencils there still see NODATA, so they never read it. */
+    for (j = 0; j < 64; j++)
+        junk[j] = 123.0f;
+    check((fd = open("/tmp/gf-nulls.flt", O_WRONLY)) >= 0);
+    for (i = 0; i < 64; i++)
+        check(pwrite(fd, junk, sizeof(junk), i * 130 * sizeof(gf_float)) == sizeof(junk));
+    close(fd);
+
+    null_blocks_crop(&grid, 5, 5, 16, &crop);
+    check(gf_bilinear_interpolate(&gf, &crop, out) == 0);
+    for (i = 0; i < 16 * 16; i++)
+        check(out[i] == (gf_float)GF_NULL_VAL);
+    crop.left += 0.5 * grid.dx;
+    crop.right += 0.5 * grid.dx;
+    check(gf_bilinear_interpolate(&gf, &crop, out) == 0);
+    for (i = 0; i < 16 * 16; i++)
+        check(out[i] == (gf_float)GF_NULL_VAL);
+    check(gf_slope(&gf, &crop, slope) == 0);
+    for (i = 0; i < 16 * 16; i++)
+        check(slope[i] == (float)GF_NULL_VAL);
+
+    /* The mixed block reads as usual, its null node included. */
+    null_blocks_crop(&grid, 2, 92, 16, &crop);
+    check(gf_bilinear_interpolate(&gf, &crop, out) == 0);
+    for (i = 0; i < 16; i++)
+        for (j = 0; j < 16; j++)
+            check(out[i * 16 + j] == (i == 8 && j == 8 ? (gf_float)GF_NULL_VAL :
+                100.0f + (i + 2) + 2 * (j + 92)));
+    check(gf_slope(&gf, &crop, slope) == 0);
+    check(slope[8 * 16 + 8] == (float)GF_NULL_VAL && slope[3 * 16 + 3] > 0.0f);
+
+    /* So does the valid one. */
+    null_blocks_crop(&grid, 70, 70, 16, &crop);
+    check(gf_bilinear_interpolate(&gf, &crop, out) == 0);
+    for (i = 0; i < 16; i++)
+        for (j = 0; j < 16; j++)
+            check(out[i * 16 + j] == 100.0f + (i + 70) + 2 * (j + 70));
+    gf_close(&gf);
+
+    /* The .flt changed, so the saved summary no longer applies. */
+    check(gf_open("/tmp/gf-nulls.hdr", "/tmp/gf-nulls.flt", &gf) == 0);
+    check(gf.null_blocks == NULL);
+    gf_close(&gf);
+
+    unlink("/tmp/gf-nulls.hdr");
+    unlink("/tmp/gf-nulls.flt");
+    unlink("/tmp/gf-nulls" GF_NULLS_EXT);
+    return 0;
+}
+
+/* Brute-force TPI and roughness at node (i, j) of an n x n raster,
+over the window of radius r clipped to it. */
+static
+void sat_window(const gf_float *data, int n, int i, int j, int r, double *tpi, double *rough) {
+    double sum = 0.0, dev = 0.0, mean;
+    long c = 0;
+    int a, b;
+
+    for (a = i - r; a <= i + r; a++)
+        for (b = j - r; b <= j + r; b++)
+            if (a >= 0 && b >= 0 && a < n && b < n && data[a * n + b] != GF_NULL_VAL) {
+                sum += data[a * n + b];
+                c++;
+            }
+    mean = sum / c;
+    for (a = i - r; a <= i + r; a++)
+        for (b = j - r; b <= j + r; b++)
+            if (a >= 0 && b >= 0 && a < n && b < n && data[a * n + b] != GF_NULL_VAL)
+                dev += (data[a * n + b] - mean) * (data[a * n + b] - mean);
+    *tpi = c > 1 ? data[i * n + j] - (sum - data[i * n + j]) / (c - 1) : 0.0;
+    *rough = sqrt(dev / c);
+}
+
+int test_sat() {
+    gf_db db;
+    gf_sat sat;
+    gf_bounds b;
+    gf_grid *g, grid;
+    gf_struct gf;
+    gf_float line[64], *data;
+    float *tpi[2], *rough[2];
+    const int radii[2] = {1, 3}, n = 120;
+    double sum = 0.0, dev = 0.0, mean, stddev, want_tpi, want_rough;
+    long count = 0;
+    int i, j, k;
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+
+    /* A region away from the tile's corner. */
+    b.left = g->left + 10 * g->dx;
+    b.right = g->left + 169 * g->dx;
+    b.top = g->top - 20 * g->dy;
+    b.bottom = g->top - 119 * g->dy;
+    check(gf_build_sat(&db.tiles[0], &b, &sat) == 0);
+    check(sat.grid.nx == 160 && sat.grid.ny == 100);
+
+    /* Brute force over region rows [30, 60), columns [40, 104). */
+    for (i = 30; i < 60; i++) {
+        gf_get_line(20 + i, 10 + 40, 10 + 104, &db.tiles[0], line);
+        for (j = 0; j < 64; j++) {
+            if (line[j] == GF_NULL_VAL)
+                continue;
+            sum += line[j];
+            count++;
+        }
+    }
+    mean = sum / count;
+    for (i = 30; i < 60; i++) {
+        gf_get_line(20 + i, 10 + 40, 10 + 104, &db.tiles[0], line);
+        for (j = 0; j < 64; j++)
+            if (line[j] != GF_NULL_VAL)
+                dev += (line[j] - mean) * (line[j] - mean);
+    }
+
+    check(gf_sat_count(&sat, 30, 40, 60, 104) == count);
+    if (count > 0) {
+        stddev = sqrt(dev / count);
+        check(fabs(gf_sat_sum(&sat, 30, 40, 60, 104) - sum) < 1e-9 * fabs(sum) + 1e-6);
+        check(fabs(gf_sat_mean(&sat, 30, 40, 60, 104) - mean) < 1e-6 * fabs(mean) + 1e-6);
+        check(fabs(gf_sat_stddev(&sat, 30, 40, 60, 104) - stddev) < 1e-6 * stddev + 1e-6);
+    }
+
+    gf_free_sat(&sat);
+    gf_close_db(&db);
+
+    /* High, nearly flat terrain with a flat corner and some nulls, where
+    E[x^2] - mean^2 would cancel to noise. */
+    data = (gf_float *)malloc(n * n * sizeof(gf_float));
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++)
+            data[i * n + j] = i < 20 && j < 20 ? 8848.3f :
+                (i * 7 + j * 13) % 41 == 0 ? GF_NULL_VAL :
+                8848.3f + 0.1f * ((i * 7 + j * 3) % 5);
+    gf_init_grid_bounds(&grid, 86.0, 86.0 + (n - 1) * 0.001, 27.0, 27.0 + (n - 1) * 0.001, n, n);
+    gf_save(&grid, data, "/tmp/gf-sat");
+    check(gf_open("/tmp/gf-sat.hdr", "/tmp/gf-sat.flt", &gf) == 0);
+    check(gf_build_sat(&gf, NULL, &sat) == 0);
+    check(sat.grid.nx == n && sat.grid.ny == n);
+
+    for (k = 0; k < 2; k++) {
+        tpi[k] = (float *)malloc(n * n * sizeof(float));
+        rough[k] = (float *)malloc(n * n * sizeof(float));
+    }
+    check(gf_sat_tpi(&sat, 2, radii, tpi, rough) == 0);
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            for (k = 0; k < 2; k++) {
+                if (data[i * n + j] == GF_NULL_VAL) {
+                    check(tpi[k][i * n + j] == (float)GF_NULL_VAL);
+                    check(rough[k][i * n + j] == (float)GF_NULL_VAL);
+                    continue;
+                }
+                sat_window(data, n, i, j, radii[k], &want_tpi, &want_rough);
+                check(fabs(tpi[k][i * n + j] - want_tpi) < 1e-5);
+                check(fabs(rough[k][i * n + j] - want_rough) < 1e-5);
+            }
+        }
+    }
+    check(gf_sat_stddev(&sat, 0, 0, 20, 20) < 1e-6);
+
+    for (k = 0; k < 2; k++) {
+        free(tpi[k]);
+        free(rough[k]);
+    }
+    free(data);
+    gf_free_sat(&sat);
+    gf_close(&gf);
+    unlink("/tmp/gf-sat.hdr");
+    unlink("/tmp/gf-sat.flt");
+    return 0;
+}
+
+/* Even-odd test with the sweep's half-open [ymin, ymax) edges. */
+static
+int zonal_inside(const gf_polygon *poly, double x, double y) {
+    double x0, y0, x1, y1;
+    int k, in = 0;
+
+    for (k = 0; k < poly->n; k++) {
+        x0 = poly->lnglat[2 * k];
+        y0 = poly->lnglat[2 * k + 1];
+        x1 = poly->lnglat[2 * ((k + 1) % poly->n)];
+        y1 = poly->lnglat[2 * ((k + 1) % poly->n) + 1];
+        if ((y0 > y) != (y1 > y) && x >= x0 + (y - y0) * (x1 - x0) / (y1 - y0))
+            in = !in;
+    }
+    return in;
+}
+
+int test_zonal() {
+    static double rings[][12] = {
+        /* Concave, inside the tile */
+        {-99.8713, 30.0517, -99.6211, 30.1093, -99.7402, 30.2189,
+         -99.5437, 30.3811, -99.9123, 30.4271, -99.8002, 30.2347},
+        /* Hangs off the top left corner */
+        {-100.2031, 30.2213, -99.7317, 30.6519, -100.1109, 30.7007},
+        /* Off the tile */
+        {-98.5011, 31.0021, -98.2033, 31.0047, -98.3517, 31.3013},
+    };
+    static const int nverts[] = {6, 3, 3};
+    gf_polygon polys[3];
+    gf_zonal_opts opts;
+    gf_zonal_stats stats[3], want;
+    gf_grid grid;
+    gf_struct gf;
+    gf_float *data;
+    double x, y, z, dxm, dym, sum;
+    long i, j;
+    int p, nulls, bin;
+
+    /* 50 rows of 60 nodes, a tilted ripple with nulls sprinkled in. */
+    gf_init_grid_bounds(&grid, -100.0, -99.41, 30.0, 30.49, 50, 60);
+    data = (gf_float *)malloc(60 * 50 * sizeof(gf_float));
+    for (i = 0; i < 50; i++)
+        for (j = 0; j < 60; j++)
+            data[i * 60 + j] = (i * 7 + j * 3) % 23 == 0 ? GF_NULL_VAL :
+                (gf_float)(600.0 + 4.0 * i - 2.5 * j + 40.0 * sin(0.3 * i) * cos(0.2 * j));
+    gf_save(&grid, data, "/tmp/gf-zonal");
+    check(gf_open("/tmp/gf-zonal.hdr", "/tmp/gf-zonal.flt", &gf) == 0);
+
+    for (p = 0; p < 3; p++) {
+        snprintf(polys[p].id, sizeof(polys[p].id), "p%d", p);
+        polys[p].n = nverts[p];
+        polys[p].lnglat = rings[p];
+    }
+    gf_init_zonal_opts(&opts);
+    opts.nbins = 5;
+    opts.hist_min = 500.0;
+    opts.hist_max = 800.0;
+    opts.base = 650.0;
+    check(gf_zonal(&gf, polys, 3, &opts, stats) == 0);
+
+    want.hist = (long *)malloc(opts.nbins * sizeof(long));
+    for (p = 0; p < 3; p++) {
+        memset(want.hist, 0, opts.nbins * sizeof(long));
+        want.count = 0;
+        want.sum = want.cut = want.fill = 0.0;
+        nulls = 0;
+        for (i = 0; i < 50; i++) {
+            y = grid.top - i * grid.dy;
+            gf_lengths(y, grid.left, grid.dy, grid.dx, 0.0, &dxm, &dym);
+            for (j = 0; j < 60; j++) {
+                x = grid.left + j * grid.dx;
+                if (!zonal_inside(&polys[p], x, y))
+                    continue;
+                if ((z = data[i * 60 + j]) == GF_NULL_VAL) {
+                    nulls++;
+                    continue;
+                }
+                if (want.count == 0 || z < want.min) want.min = z;
+                if (want.count == 0 || z > want.max) want.max = z;
+                want.count++;
+                want.sum += z;
+                if (z > opts.base)
+                    want.cut += (z - opts.base) * dxm * dym;
+                else
+                    want.fill += (opts.base - z) * dxm * dym;
+                bin = (int)floor((z - opts.hist_min) / (opts.hist_max - opts.hist_min) * opts.nbins);
+                want.hist[bin < 0 ? 0 : bin >= opts.nbins ? opts.nbins - 1 : bin]++;
+            }
+        }
+
+        /* Nulls inside are skipped, not counted or averaged in. */
+        check(stats[p].count == want.count);
+        check(stats[p].count == want.count);
+        if (want.count == 0)
+            continue;
+        check(stats[p].min == want.min && stats[p].max == want.max);
+        check(fabs(stats[p].sum / stats[p].count - want.sum / want.count) < 1e-9 * want.max);
+        check(fabs(stats[p].cut - want.cut) <= 1e-9 * want.cut);
+        check(fabs(stats[p].fill - want.fill) <= 1e-9 * want.fill);
+        for (bin = 0, sum = 0.0; bin < opts.nbins; bin++) {
+            check(stats[p].hist[bin] == want.hist[bin]);
+            sum += stats[p].hist[bin];
+        }
+        check(sum == want.count);
+    }
+
+    free(want.hist);
+    gf_free_zonal_stats(stats, 3);
+
+    /* Rows past the end of a truncated file fail the pass, whichever
+    band reads them. */
+    check(truncate("/tmp/gf-zonal.flt", 20 * 60 * sizeof(gf_float)) == 0);
+    setenv("GF_THREADS", "4", 1);
+    check(gf_zonal(&gf, polys, 3, &opts, stats) == -1);
+    unsetenv("GF_THREADS");
+    gf_free_zonal_stats(stats, 3);
+
+    gf_close(&gf);
+    free(data);
+    unlink("/tmp/gf-zonal.hdr");
+    unlink("/tmp/gf-zonal.flt");
+    return 0;
+}
+
+int test_sample_points() {
+    gf_db db;
+    gf_grid grid, *g;
+    const int n = 5000;
+    double *latlng;
+    gf_float *pts, *db_pts, v;
+    int k;
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+
+    latlng = (double *)malloc(2 * n * sizeof(double));
+    pts = (gf_float *)malloc(n * sizeof(gf_float));
+    db_pts = (gf_float *)malloc(n * sizeof(gf_float));
+
+    /* Scatter over (and a little beyond) the first tile. */
+    srand(7);
+    for (k = 0; k < n; k++) {
+        latlng[2 * k] = g->bottom - 0.01 + (g->top - g->bottom + 0.02) * rand() / RAND_MAX;
+        latlng[2 * k + 1] = g->left - 0.01 + (g->right - g->left + 0.02) * rand() / RAND_MAX;
+    }
+
+    check(gf_sample_points(&db.tiles[0], n, latlng, pts) == 0);
+    check(gf_db_sample_points(&db, n, latlng, db_pts) == 0);
+
+    for (k = 0; k < n; k += 10) {
+        /* One-node grid at the point. */
+        gf_init_grid_bounds(&grid, latlng[2 * k + 1], latlng[2 * k + 1] + 1.0,
+            latlng[2 * k] - 1.0, latlng[2 * k], 1, 1);
+        v = GF_NULL_VAL;
+        gf_bilinear_interpolate(&db.tiles[0], &grid, &v);
+        check(pts[k] == v);
+        if (v != GF_NULL_VAL)
+            check(db_pts[k] != GF_NULL_VAL);
+    }
+
+    free(latlng);
+    free(pts);
+    free(db_pts);
+    gf_close_db(&db);
+    return 0;
+}
+
+static
+double pyramid_ground(const gf_pyramid *p, double x, double y) {
+    long nx = p->grid.nx, i = (long)y, j = (long)x;
+    const float *e;
+    double wy, wx;
+
+    if (i > p->grid.ny - 2) i = p->grid.ny - 2;
+    if (j > nx - 2) j = nx - 2;
+    wy = y - i;
+    wx = x - j;
+    e = p->elev + i * nx + j;
+    return (1 - wy) * ((1 - wx) * e[0] + wx * e[1]) + wy * ((1 - wx) * e[nx] + wx * e[nx + 1]);
+}
+
+/* Elevation of the test_profile plane at fractional node (fi, fj). */
+static
+double profile_plane(double fi, double fj) {
+    return 800.0 + 3.0 * fi - 2.0 * fj;
+}
+
+int test_profile() {
+    static const double path[] = {60.005, 10.004, 60.070, 10.060, 60.020, 10.075};
+    gf_grid grid;
+    gf_struct gf;
+    gf_profile prof;
+    gf_float *data;
+    double seg[2], dx_m, dy_m, total, d, t, lat, lng, fi, fj, last, up, down;
+    double grad[2 * 16];
+    gf_float at[3];
+    long i, j;
+    int k, v, corners, nulls = 0;
+
+    /* A plane (bilinear reproduces it) with a hole of nulls. */
+    gf_init_grid_bounds(&grid, 10.0, 10.079, 60.0, 60.079, 80, 80);
+    data = (gf_float *)malloc(80 * 80 * sizeof(gf_float));
+    for (i = 0; i < 80; i++)
+        for (j = 0; j < 80; j++)
+            data[i * 80 + j] = i >= 30 && i < 45 && j >= 30 && j < 45 ? GF_NULL_VAL :
+                (gf_float)profile_plane(i, j);
+    gf_save(&grid, data, "/tmp/gf-profile");
+    free(data);
+    check(gf_open("/tmp/gf-profile.hdr", "/tmp/gf-profile.flt", &gf) == 0);
+
+    check(gf_profile_path(&gf, 3, path, 25.0, &prof) == 0);
+    for (v = 0, total = 0.0; v < 2; v++) {
+        gf_lengths(0.5 * (path[2 * v] + path[2 * v + 2]), 0.5 * (path[2 * v + 1] + path[2 * v + 3]),
+            path[2 * v + 2] - path[2 * v], path[2 * v + 3] - path[2 * v + 1], 0.0, &dx_m, &dy_m);
+        seg[v] = sqrt(dx_m * dx_m + dy_m * dy_m);
+        total += seg[v];
+    }
+
+    /* Every 25 m, then the last vertex. */
+    check(prof.n == (int)ceil(total / 25.0) + 1);
+    check(prof.dist[prof.n - 1] == total);
+    check(prof.latlng[2 * (prof.n - 1)] == path[4] && prof.latlng[2 * prof.n - 1] == path[5]);
+
+    last = GF_NULL_VAL;
+    up = down = 0.0;
+    for (k = 0; k < prof.n; k++) {
+        if (k + 1 < prof.n)
+            check(fabs(prof.dist[k] - 25.0 * k) < 1e-9);
+
+        /* On the path, at that distance along it. */
+        v = prof.dist[k] < seg[0] ? 0 : 1;
+        d = v == 0 ? prof.dist[k] : prof.dist[k] - seg[0];
+        t = d / seg[v];
+        lat = path[2 * v] + t * (path[2 * v + 2] - path[2 * v]);
+        lng = path[2 * v + 1] + t * (path[2 * v + 3] - path[2 * v + 1]);
+        check(fabs(prof.latlng[2 * k] - lat) < 1e-9 && fabs(prof.latlng[2 * k + 1] - lng) < 1e-9);
+
+        /* The plane where the quad is whole, null where it is all hole. */
+        fi = (grid.top - lat) / grid.dy;
+        fj = (lng - grid.left) / grid.dx;
+        i = (long)floor(fi);
+        j = (long)floor(fj);
+        corners = (i >= 30 && i < 45) + (i + 1 >= 30 && i + 1 < 45);
+        corners *= (j >= 30 && j < 45) + (j + 1 >= 30 && j + 1 < 45);
+        if (corners == 0)
+            check(fabs(prof.elev[k] - profile_plane(fi, fj)) < 1e-3);
+        else if (corners == 4)
+            check(prof.elev[k] == (gf_float)GF_NULL_VAL);
+
+        /* Climb totals bridge the nulls. */
+        if (prof.elev[k] == (gf_float)GF_NULL_VAL) {
+            nulls++;
+        } else {
+            if (last != GF_NULL_VAL) {
+                if (prof.elev[k] > last)
+                    up += prof.elev[k] - last;
+                else
+                    down += last - prof.elev[k];
+            }
+            last = prof.elev[k];
+        }
+        check(fabs(prof.ascent[k] - up) < 1e-6 && fabs(prof.descent[k] - down) < 1e-6);
+    }
+    check(nulls > 0 && up > 0.0 && down > 0.0);
+    gf_free_profile(&prof);
+
+    /* At 60 degrees a cell is half as wide as it is tall: gradients
+    (east, north) must scale x differences by the east-west length. */
+    gf_init_grid_bounds(&grid, 10.0205, 10.0235, 60.0405, 60.0435, 4, 4);
+    gf_lengths(60.042, 10.022, gf.grid.dy, gf.grid.dx, 0.0, &dx_m, &dy_m);
+    check(dx_m < 0.6 * dy_m);
+    check(gf_bilinear_gradient(&gf, &grid, grad) == 0);
+    for (k = 0; k < 16; k++) {
+        check(fabs(grad[2 * k] + 2.0 / dx_m) < 1e-3 * 2.0 / dx_m);
+        check(fabs(grad[2 * k + 1] + 3.0 / dy_m) < 1e-3 * 3.0 / dy_m);
+    }
+    check(gf_biquadratic_gradient(&gf, &grid, grad) == 0);
+    for (k = 0; k < 16; k++) {
+        check(fabs(grad[2 * k] + 2.0 / dx_m) < 1e-3 * 2.0 / dx_m);
+        check(fabs(grad[2 * k + 1] + 3.0 / dy_m) < 1e-3 * 3.0 / dy_m);
+    }
+
+    /* Rows past the end of a truncated file fail the sampling. */
+    check(truncate("/tmp/gf-profile.flt", 20 * 80 * sizeof(gf_float)) == 0);
+    check(gf_sample_points(&gf, 3, path, at) == -1);
+    check(gf_profile_path(&gf, 3, path, 25.0, &prof) == -2);
+    gf_free_profile(&prof);
+
+    gf_close(&gf);
+    unlink("/tmp/gf-profile.hdr");
+    unlink("/tmp/gf-profile.flt");
+    return 0;
+}
+
+int test_line_of_sight() {
+    gf_db db;
+    gf_struct ridge;
+    gf_float elev[16];
+    gf_pyramid pyr;
+    gf_los_opts opts;
+    gf_los_query q[400];
+    signed char vis[400];
+    const gf_grid *g;
+    double x0, y0, x1, y1, z0, z1, t;
+    int k, s, m, blocked, mismatches = 0;
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    check(gf_build_pyramid(&db.tiles[0], NULL, &pyr) == 0);
+    g = &pyr.grid;
+
+    gf_init_los_opts(&opts);
+    opts.curvature = 0;
+
+    srand(11);
+    for (k = 0; k < 400; k++) {
+        q[k].from[0] = g->bottom + (g->top - g->bottom) * rand() / RAND_MAX;
+        q[k].from[1] = g->left + (g->right - g->left) * rand() / RAND_MAX;
+        q[k].to[0] = g->bottom + (g->top - g->bottom) * rand() / RAND_MAX;
+        q[k].to[1] = g->left + (g->right - g->left) * rand() / RAND_MAX;
+        q[k].from_height = q[k].to_height = 20.0;
+    }
+    check(gf_line_of_sight_batch(&pyr, &opts, 400, q, vis) == 0);
+
+    /* Against a fine ray march over the same bilinear terrain; the march
+    may miss grazing blocks between its samples. */
+    for (k = 0; k < 400; k++) {
+        if (vis[k] < 0)
+            continue;
+        x0 = (q[k].from[1] - g->left) / g->dx;
+        y0 = (g->top - q[k].from[0]) / g->dy;
+        x1 = (q[k].to[1] - g->left) / g->dx;
+        y1 = (g->top - q[k].to[0]) / g->dy;
+        z0 = pyramid_ground(&pyr, x0, y0) + 20.0;
+        z1 = pyramid_ground(&pyr, x1, y1) + 20.0;
+        m = (int)(4 * fmax(fabs(x1 - x0), fabs(y1 - y0))) + 2;
+        blocked = 0;
+        for (s = 0; s <= m && !blocked; s++) {
+            t = (double)s / m;
+            blocked = pyramid_ground(&pyr, x0 + t * (x1 - x0), y0 + t * (y1 - y0)) >
+                z0 + t * (z1 - z0);
+        }
+        mismatches += vis[k] != !blocked;
+    }
+    check(mismatches <= 4);
+
+    /* Out of the region. */
+    q[0].to[0] = g->top + 1.0;
+    check(gf_line_of_sight(&pyr, &opts, &q[0]) == -1);
+    gf_free_pyramid(&pyr);
+
+    /* A saddle quad whose ridge, along the ray from node (1, 1) to
+    (x, y) = (2, 1.5), peaks at 3/4 of the way: 56.25 m against a ray
+    at 53.25 m there, while the ends and midpoint clear it. */
+    gf_init_grid_bounds(&ridge.grid, -120.0, -119.997, 40.0, 40.003, 4, 4);
+    for (k = 0; k < 16; k++)
+        elev[k] = 0.0f;
+    elev[1 * 4 + 2] = elev[2 * 4 + 1] = 100.0f;
+    gf_save(&ridge.grid, elev, "/tmp/gf-los-ridge");
+    check(gf_open("/tmp/gf-los-ridge.hdr", "/tmp/gf-los-ridge.flt", &ridge) == 0);
+    check(gf_build_pyramid(&ridge, NULL, &pyr) == 0);
+    q[0].from[0] = 40.002;
+    q[0].from[1] = -119.999;
+    q[0].to[0] = 40.0015;
+    q[0].to[1] = -119.998;
+    q[0].from_height = 60.0;
+    q[0].to_height = 1.0;
+    check(gf_line_of_sight(&pyr, &opts, &q[0]) == 0);
+    q[0].from_height = 80.0;
+    q[0].to_height = 20.0;
+    check(gf_line_of_sight(&pyr, &opts, &q[0]) == 1);
+    gf_free_pyramid(&pyr);
+    gf_close(&ridge);
+    unlink("/tmp/gf-los-ridge.hdr");
+    unlink("/tmp/gf-los-ridge.flt");
+
+    gf_close_db(&db);
+    return 0;
+}
+
+int test_viewshed() {
+    gf_db db;
+    gf_pyramid pyr;
+    gf_viewshed_opts opts;
+    gf_los_query q;
+    gf_grid vg, *g;
+    gf_struct src;
+    gf_float *data;
+    unsigned char *vis;
+    long agree = 0, total = 0;
+    int i, j, l;
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+    check(gf_build_pyramid(&db.tiles[0], NULL, &pyr) == 0);
+
+    gf_init_viewshed_opts(&opts);
+    opts.observer_height = 10.0;
+    opts.target_height = 2.0;
+    q.from[0] = g->top - (g->ny / 2) * g->dy;
+    q.from[1] = g->left + (g->nx / 3) * g->dx;
+    q.from_height = opts.observer_height;
+    q.to_height = opts.target_height;
+    check(gf_viewshed(&db.tiles[0], q.from[0], q.from[1], &opts, &vg, &vis) == 0);
+    check(vg.nx == g->nx && vg.ny == g->ny);
+
+    /* XDraw interpolates sight lines, so allow a few disagreements with
+    line of sight along the exact ray. */
+    for (i = 0; i < vg.ny; i += 13) {
+        for (j = 0; j < vg.nx; j += 11) {
+            if (vis[i * vg.nx + j] == GF_VIEW_NONE)
+                continue;
+            q.to[0] = vg.top - i * vg.dy;
+            q.to[1] = vg.left + j * vg.dx;
+            if ((l = gf_line_of_sight(&pyr, &opts.los, &q)) < 0)
+                continue;
+            agree += l == vis[i * vg.nx + j];
+            total++;
+        }
+    }
+    check(total > 0 && agree >= 0.98 * total);
+    free(vis);
+    gf_free_pyramid(&pyr);
+    gf_close_db(&db);
+
+    /* Rows the source can't supply fail the viewshed rather than
+    reading as terrain. */
+    data = (gf_float *)malloc(40 * 40 * sizeof(gf_float));
+    for (i = 0; i < 40 * 40; i++)
+        data[i] = 100.0f;
+    gf_init_grid_bounds(&vg, 10.0, 10.039, 60.0, 60.039, 40, 40);
+    gf_save(&vg, data, "/tmp/gf-view");
+    free(data);
+    check(truncate("/tmp/gf-view.flt", 30 * 40 * sizeof(gf_float)) == 0);
+    check(gf_open("/tmp/gf-view.hdr", "/tmp/gf-view.flt", &src) == 0);
+    check(gf_viewshed(&src, 60.02, 10.02, &opts, &vg, &vis) == -2);
+    check(vis == NULL);
+    check(gf_viewshed(&src, 60.002, 10.02, &opts, &vg, &vis) == -2);
+    gf_close(&src);
+    unlink("/tmp/gf-view.hdr");
+    unlink("/tmp/gf-view.flt");
+    return 0;
+}
+
+int test_cast_shadows() {
+    gf_grid grid;
+    float elev[64 * 64];
+    unsigned char shadow[64 * 64];
+    double dx_m, dy_m, n_sun[3], len;
+    int i, j;
+
+    gf_init_grid_bounds(&grid, -121.01, -121.0, 45.0, 45.01, 64, 64);
+    gf_cellsize_meters(&grid, &dx_m, &dy_m);
+
+    /* Flat ground with a north-south wall at column 40. */
+    for (i = 0; i < 64 * 64; i++)
+        elev[i] = 100.0f;
+    for (i = 0; i < 64; i++)
+        elev[i * 64 + 40] = 100.0f + 10.0f * dx_m;
+
+    /* Sun due east, 45 degrees up: the wall shades 10 cells west. */
+    n_sun[0] = n_sun[2] = sqrt(0.5);
+    n_sun[1] = 0.0;
+    check(gf_cast_shadows(&grid, elev, n_sun, shadow) == 0);
+
+    for (i = 0; i < 64; i++) {
+        for (j = 0; j < 64; j++) {
+            len = 40 - j;
+            if (len > 0.5 && len < 9.5)
+                check(shadow[i * 64 + j] == 1);
+            else if (len < -0.5 || len > 10.5)
+                check(shadow[i * 64 + j] == 0);
+        }
+    }
+
+    /* Same wall, sun from the west: the east side shades. */
+    n_sun[0] = -sqrt(0.5);
+    check(gf_cast_shadows(&grid, elev, n_sun, shadow) == 0);
+    check(shadow[10 * 64 + 45] == 1 && shadow[10 * 64 + 35] == 0);
+    return 0;
+}
+
+/* Read a PNG back with libpng as 8-bit pixels of the given format. */
+static
+unsigned char *read_png(const char *filename, png_uint_32 format, int *nx, int *ny) {
+    png_image image;
+    unsigned char *pixels;
+
+    memset((void *)&image, 0, sizeof(png_image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, filename))
+        return NULL;
+    image.format = format;
+    pixels = (unsigned char *)malloc(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, NULL, pixels, 0, NULL)) {
+        free(pixels);
+        return NULL;
+    }
+    *nx = image.width;
+    *ny = image.height;
+    return pixels;
+}
+
+typedef struct sun_frames_nest {
+    pthread_t self;
+    int failed;
+} sun_frames_nest;
+
+static
+void sun_frames_inner(int i, void *arg) {
+    sun_frames_nest *nest = (sun_frames_nest *)arg;
+
+    usleep(1000);
+    if (!pthread_equal(pthread_self(), nest->self))
+        __sync_fetch_and_add(&nest->failed, 1);
+}
+
+/* Nested default loops stay on the outer task's thread. */
+static
+void sun_frames_outer(int i, void *arg) {
+    sun_frames_nest nest;
+
+    nest.self = pthread_self();
+    nest.failed = 0;
+    gf_parallel_for(16, 0, &sun_frames_inner, (void *)&nest);
+    if (nest.failed)
+        __sync_fetch_and_add((int *)arg, 1);
+}
+
+int test_sun_frames() {
+    double suns[9];
+    char name[64];
+    gf_db db;
+    gf_grid grid, *g;
+    gf_relief_opts opts;
+    gf_struct src;
+    gf_float *data;
+    unsigned char *frame, *one, *first = NULL;
+    int k, i, w, h, w1, h1, nested = 0, same;
+
+    for (k = 0; k < 3; k++) {
+        suns[3 * k] = cos(0.5) * cos(2.1 * k);
+        suns[3 * k + 1] = cos(0.5) * sin(2.1 * k);
+        suns[3 * k + 2] = sin(0.5);
+    }
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+    gf_init_grid_bounds(&grid, g->left + 0.1 * (g->right - g->left),
+        g->left + 0.6 * (g->right - g->left), g->bottom + 0.2 * (g->top - g->bottom),
+        g->bottom + 0.6 * (g->top - g->bottom), 90, 110);
+
+    /* Each frame is the single render for its sun, to float rounding
+    of the shade. */
+    gf_init_relief_opts(&opts, suns);
+    opts.shadows = 1;
+    check(gf_relief_shade_frames(&db.tiles[0], &grid, 3, suns, &opts, "/tmp/gf-frames.png") == 0);
+    for (k = 0; k < 3; k++) {
+        opts.n_sun = suns + 3 * k;
+        check(gf_relief_shade_opts(&db.tiles[0], &grid, &opts, "/tmp/gf-frame.png") == 0);
+        snprintf(name, sizeof(name), "/tmp/gf-frames_%03d.png", k);
+        check((frame = read_png(name, PNG_FORMAT_GRAY, &w, &h)) != NULL);
+        check((one = read_png("/tmp/gf-frame.png", PNG_FORMAT_GRAY, &w1, &h1)) != NULL);
+        check(w == 110 && h == 90 && w1 == w && h1 == h);
+        for (i = 0; i < w * h; i++)
+            check(abs((int)frame[i] - (int)one[i]) <= 1);
+        free(one);
+        unlink(name);
+
+        /* The suns light the terrain differently. */
+        if (first == NULL) {
+            first = frame;
+            continue;
+        }
+        for (i = 0, same = 1; i < w * h && same; i++)
+            same = frame[i] == first[i];
+        check(!same);
+        free(frame);
+    }
+    free(first);
+    unlink("/tmp/gf-frame.png");
+    gf_close_db(&db);
+
+    /* Frames shadow in parallel; each sweep inside runs on its thread
+    even when threads are plentiful. */
+    setenv("GF_THREADS", "8", 1);
+    gf_parallel_for(4, 4, &sun_frames_outer, (void *)&nested);
+    unsetenv("GF_THREADS");
+    check(nested == 0);
+
+    /* A source that can't be read fails both renders. */
+    data = (gf_float *)malloc(40 * 40 * sizeof(gf_float));
+    for (i = 0; i < 40 * 40; i++)
+        data[i] = (gf_float)(i % 40);
+    gf_init_grid_bounds(&grid, 10.0, 10.039, 60.0, 60.039, 40, 40);
+    gf_save(&grid, data, "/tmp/gf-frames-src");
+    free(data);
+    check(truncate("/tmp/gf-frames-src.flt", 10 * 40 * sizeof(gf_float)) == 0);
+    check(gf_open("/tmp/gf-frames-src.hdr", "/tmp/gf-frames-src.flt", &src) == 0);
+    gf_init_grid_bounds(&grid, 10.005, 10.035, 60.005, 60.035, 20, 20);
+    gf_init_relief_opts(&opts, suns);
+    check(gf_relief_shade_opts(&src, &grid, &opts, "/tmp/gf-frame.png") != 0);
+    check(gf_relief_shade_frames(&src, &grid, 3, suns, &opts, "/tmp/gf-frames.png") != 0);
+    gf_close(&src);
+    unlink("/tmp/gf-frames-src.hdr");
+    unlink("/tmp/gf-frames-src.flt");
+    return 0;
+}
+
+int test_sky_view() {
+    gf_grid grid;
+    float elev[65 * 65], svf[65 * 65];
+    double dx_m, dy_m, expect = 0.0, t, a = 0.5;
+    int i, j, d, ndirs = 32;
+
+    gf_init_grid_bounds(&grid, -121.01, -121.0, 45.0, 45.01, 65, 65);
+    gf_cellsize_meters(&grid, &dx_m, &dy_m);
+
+    /* Open flats see the whole sky. */
+    for (i = 0; i < 65 * 65; i++)
+        elev[i] = 100.0f;
+    check(gf_sky_view(&grid, elev, ndirs, svf) == 0);
+    for (i = 0; i < 65 * 65; i++)
+        check(fabs(svf[i] - 1.0) < 1e-5);
+
+    /* A V-shaped trench with walls of slope a: from its floor the
+    horizon toward azimuth phi rises at a |cos(phi)|. Digital lines
+    round off the crease, hence the loose tolerance. */
+    for (i = 0; i < 65; i++)
+        for (j = 0; j < 65; j++)
+            elev[i * 65 + j] = (float)(100.0 + a * abs(j - 32) * dx_m);
+    check(gf_sky_view(&grid, elev, ndirs, svf) == 0);
+
+    for (d = 0; d < ndirs; d++) {
+        t = a * fabs(cos(2.0 * PI * d / ndirs));
+        expect += (1.0 - t / sqrt(1.0 + t * t)) / ndirs;
+    }
+    check(fabs(svf[32 * 65 + 32] - expect) < 0.04);
+    check(svf[32 * 65 + 32] < svf[32 * 65 + 10]);
+    return 0;
+}
+
+static
+double contour_length(const gf_contours *c, long *nverts) {
+    double len = 0.0, *p;
+    int l, k;
+
+    *nverts = 0;
+    for (l = 0; l < c->count; l++) {
+        p = c->lines[l].lnglat;
+        *nverts += c->lines[l].n;
+        for (k = 1; k < c->lines[l].n; k++)
+            len += hypot(p[2 * k] - p[2 * k - 2], p[2 * k + 1] - p[2 * k - 1]);
+    }
+    return len;
+}
+
+int test_contours() {
+    gf_db db;
+    gf_grid grid, *g;
+    gf_contour_opts opts;
+    gf_contours one, many;
+    long n_one, n_many;
+    double len_one, len_many, x, y, *p;
+    int l, e, k;
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+    gf_init_grid_bounds(&grid, g->left, g->right, g->bottom, g->top, 301, 257);
+    gf_init_contour_opts(&opts, 25.0);
+    opts.base = 3.0;
+
+    setenv("GF_THREADS", "1", 1);
+    check(gf_contour_lines(&db.tiles[0], &grid, &opts, &one) == 0);
+    setenv("GF_THREADS", "5", 1);
+    check(gf_contour_lines(&db.tiles[0], &grid, &opts, &many) == 0);
+    unsetenv("GF_THREADS");
+
+    /* Seam merging loses and duplicates nothing. */
+    check(one.count > 0 && one.count == many.count);
+    len_one = contour_length(&one, &n_one);
+    len_many = contour_length(&many, &n_many);
+    check(n_one == n_many && fabs(len_one - len_many) < 1e-9 * len_one);
+
+    /* Rings close; open lines end only where the 3x3 window stops
+    fitting, one node in from the edge of the grid. */
+    for (l = 0; l < many.count; l++) {
+        p = many.lines[l].lnglat;
+        e = 2 * (many.lines[l].n - 1);
+        if (many.lines[l].closed) {
+            check(p[0] == p[e] && p[1] == p[e + 1]);
+            continue;
+        }
+        for (k = 0; k < 2; k++) {
+            x = (p[k * e] - grid.left) / grid.dx;
+            y = (grid.top - p[k * e + 1]) / grid.dy;
+            check(x < 1.0 + 1e-6 || x > grid.nx - 2 - 1e-6 ||
+                y < 1.0 + 1e-6 || y > grid.ny - 2 - 1e-6);
+        }
+    }
+
+    gf_free_contours(&one);
+    gf_free_contours(&many);
+
+    /* Failures say why. */
+    opts.interval = 0.0;
+    check(gf_contour_lines(&db.tiles[0], &grid, &opts, &one) == -1);
+    opts.interval = 25.0;
+    grid.nx = 1;
+    check(gf_contour_lines(&db.tiles[0], &grid, &opts, &one) == -2);
+    check(one.count == 0);
+
+    gf_close_db(&db);
+    return 0;
+}
+
+static
+float *read_flt(const char *prefix, gf_struct *gf) {
+    char hdr[256], flt[256];
+    float *data;
+    long i;
+
+    sprintf(hdr, "%s.hdr", prefix);
+    sprintf(flt, "%s.flt", prefix);
+    if (gf_open(hdr, flt, gf) != 0)
+        return NULL;
+    data = (float *)malloc((long)gf->grid.nx * gf->grid.ny * sizeof(float));
+    for (i = 0; i < gf->grid.ny; i++)
+        gf_get_line(i, 0, gf->grid.nx, gf, data + i * gf->grid.nx);
+    return data;
+}
+
+int test_hydrology() {
+    gf_db db;
+    gf_struct out, dirs;
+    gf_hydro_opts opts;
+    float *fill_one, *fill_many, *dir, *acc_one, *acc_many;
+    long n, p, q, nx, ny, i, j, steps;
+    int k, code;
+    static const int di[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    static const int dj[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    nx = db.tiles[0].grid.nx;
+    ny = db.tiles[0].grid.ny;
+    n = nx * ny;
+
+    /* One tile, then many small ones with seams everywhere. */
+    gf_init_hydro_opts(&opts);
+    opts.tile_size = nx > ny ? nx : ny;
+    check(gf_fill_depressions(&db.tiles[0], &opts, "/tmp/gf-hydro-fill", "/tmp/gf-hydro-dir") == 0);
+    check((fill_one = read_flt("/tmp/gf-hydro-fill", &out)) != NULL);
+    gf_close(&out);
+
+    opts.tile_size = 37;
+    check(gf_fill_depressions(&db.tiles[0], &opts, "/tmp/gf-hydro-fill", "/tmp/gf-hydro-dir") == 0);
+    check((fill_many = read_flt("/tmp/gf-hydro-fill", &out)) != NULL);
+    gf_close(&out);
+
+    /* Directions on flats depend on the tiling, so accumulate the same
+    directions both ways. */
+    check((dir = read_flt("/tmp/gf-hydro-dir", &dirs)) != NULL);
+    check(gf_flow_accumulation(&dirs, &opts, "/tmp/gf-hydro-acc") == 0);
+    check((acc_many = read_flt("/tmp/gf-hydro-acc", &out)) != NULL);
+    gf_close(&out);
+    opts.tile_size = nx > ny ? nx : ny;
+    check(gf_flow_accumulation(&dirs, &opts, "/tmp/gf-hydro-acc") == 0);
+    check((acc_one = read_flt("/tmp/gf-hydro-acc", &out)) != NULL);
+    gf_close(&out);
+    gf_close(&dirs);
+
+    for (p = 0; p < n; p++)
+        check(fill_one[p] == fill_many[p]);
+
+    /* Every few cells, follow the flow: it never climbs the filled
+    surface and leaves the grid (or hits NODATA) without looping. */
+    for (p = 0; p < n; p += 97) {
+        if (fill_many[p] == GF_NULL_VAL)
+            continue;
+        for (q = p, steps = 0; steps <= n; steps++) {
+            code = (int)dir[q];
+            for (k = 0; k < 8 && code != 1 << k; k++)
+                ;
+            check(k < 8);
+            i = q / nx + di[k];
+            j = q % nx + dj[k];
+            if (i < 0 || i >= ny || j < 0 || j >= nx || fill_many[i * nx + j] == GF_NULL_VAL)
+                break;
+            check(fill_many[i * nx + j] <= fill_many[q]);
+            q = i * nx + j;
+        }
+        check(steps <= n);
+    }
+
+    /* Flows that cross tile edges add up as if there were none. */
+    for (p = 0; p < n; p++)
+        check(acc_one[p] == acc_many[p]);
+
+    free(fill_one);
+    free(fill_many);
+    free(dir);
+    free(acc_one);
+    free(acc_many);
+    gf_close_db(&db);
+    return 0;
+}
+
+static
+double route_move_cost(const gf_route_opts *opts, double len, double dz) {
+    double grade = dz / len;
+
+    if (opts->cost == GF_ROUTE_TOBLER)
+        return len / (6000.0 / 3600.0 * exp(-3.5 * fabs(grade + 0.05)));
+    return len * (1.0 + opts->slope_weight * fabs(grade));
+}
+
+int test_route() {
+    gf_db db;
+    gf_struct sub;
+    gf_grid grid, *g;
+    gf_route_opts opts;
+    gf_route_query q[6];
+    gf_route one[6], many[6];
+    float *z;
+    double *dist, *dx_m, *dy_m, len, c, sum;
+    long nx = 40, ny = 40, n = nx * ny, i, j, ni, nj, p, s, t;
+    int k, m, v, changed;
+    static const int di[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    static const int dj[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+    /* A small crop, so plain Bellman-Ford can check optimality. */
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+    z = (float *)malloc(n * sizeof(float));
+    for (i = 0; i < ny; i++)
+        gf_get_line(i + 100, 100, 100 + nx, &db.tiles[0], z + i * nx);
+    grid = *g;
+    grid.nx = nx;
+    grid.ny = ny;
+    grid.top = g->top - 100 * g->dy;
+    grid.left = g->left + 100 * g->dx;
+    grid.bottom = grid.top - (ny - 1) * g->dy;
+    grid.right = grid.left + (nx - 1) * g->dx;
+    gf_save(&grid, z, "/tmp/gf-route");
+    free(z);
+    check((z = read_flt("/tmp/gf-route", &sub)) != NULL);
+
+    dx_m = (double *)malloc(ny * sizeof(double));
+    dy_m = (double *)malloc(ny * sizeof(double));
+    for (i = 0; i < ny; i++)
+        gf_lengths(grid.top - i * grid.dy, grid.left, grid.dy, grid.dx, 0.0, &dx_m[i], &dy_m[i]);
+
+    for (k = 0; k < 6; k++) {
+        q[k].from[0] = grid.top - (k * 7 % ny) * grid.dy;
+        q[k].from[1] = grid.left + (k * 3 % nx) * grid.dx;
+        q[k].to[0] = grid.bottom + (k * 5 % ny) * grid.dy;
+        q[k].to[1] = grid.right - (k * 11 % nx) * grid.dx;
+    }
+
+    dist = (double *)malloc(n * sizeof(double));
+    for (m = GF_ROUTE_SLOPE; m <= GF_ROUTE_TOBLER; m++) {
+        gf_init_route_opts(&opts);
+        opts.cost = m;
+        opts.cache_blocks = 2;
+        for (k = 0; k < 6; k++)
+            check(gf_find_route(&sub, &opts, &q[k], &one[k]) == 0);
+        setenv("GF_THREADS", "3", 1);
+        check(gf_route_batch(&sub, &opts, 6, q, many) == 0);
+        unsetenv("GF_THREADS");
+
+        for (k = 0; k < 6; k++) {
+            s = lround((grid.top - q[k].from[0]) / grid.dy) * nx +
+                lround((q[k].from[1] - grid.left) / grid.dx);
+            t = lround((grid.top - q[k].to[0]) / grid.dy) * nx +
+                lround((q[k].to[1] - grid.left) / grid.dx);
+            for (p = 0; p < n; p++)
+                dist[p] = HUGE_VAL;
+            dist[s] = 0.0;
+            do {
+                changed = 0;
+                for (p = 0; p < n; p++) {
+                    if (dist[p] == HUGE_VAL)
+                        continue;
+                    for (v = 0; v < 8; v++) {
+                        ni = p / nx + di[v];
+                        nj = p % nx + dj[v];
+                        if (ni < 0 || ni >= ny || nj < 0 || nj >= nx || z[ni * nx + nj] == GF_NULL_VAL)
+                            continue;
+                        len = di[v] && dj[v] ? hypot(dx_m[p / nx], dy_m[p / nx]) :
+                            di[v] ? dy_m[p / nx] : dx_m[p / nx];
+                        c = dist[p] + route_move_cost(&opts, len, z[ni * nx + nj] - z[p]);
+                        if (c < dist[ni * nx + nj] * (1.0 - 1e-12)) {
+                            dist[ni * nx + nj] = c;
+                            changed = 1;
+                        }
+                    }
+                }
+            } while (changed);
+
+            /* Optimal, and the path costs what it claims. */
+            check(fabs(one[k].cost - dist[t]) <= 1e-4 * dist[t]);
+            check(one[k].n > 0);
+            for (v = 1, sum = 0.0; v < one[k].n; v++) {
+                i = lround((grid.top - one[k].latlng[2 * v - 2]) / grid.dy);
+                j = lround((one[k].latlng[2 * v - 1] - grid.left) / grid.dx);
+                ni = lround((grid.top - one[k].latlng[2 * v]) / grid.dy);
+                nj = lround((one[k].latlng[2 * v + 1] - grid.left) / grid.dx);
+                check(labs(ni - i) <= 1 && labs(nj - j) <= 1 && (ni != i || nj != j));
+                len = ni != i && nj != j ? hypot(dx_m[i], dy_m[i]) : ni != i ? dy_m[i] : dx_m[i];
+                sum += route_move_cost(&opts, len, z[ni * nx + nj] - z[i * nx + j]);
+            }
+            check(fabs(sum - dist[t]) <= 1e-4 * dist[t]);
+
+            /* Batches give the same routes. */
+            check(many[k].n == one[k].n && many[k].cost == one[k].cost);
+            check(memcmp(many[k].latlng, one[k].latlng, 2 * one[k].n * sizeof(double)) == 0);
+            gf_free_route(&one[k]);
+            gf_free_route(&many[k]);
+        }
+    }
+
+    free(dist);
+    free(dx_m);
+    free(dy_m);
+    free(z);
+    gf_close(&sub);
+    gf_close_db(&db);
+    return 0;
+}
+
+int test_calc() {
+    gf_db db;
+    gf_struct in[2], out;
+    gf_grid grid, *g;
+    gf_calc_prog prog;
+    gf_float *a, *r1, *r4, *saved;
+    char *names[2] = {"a", "b"};
+    long n, p;
+    float want;
+
+    check(gf_calc_compile("a +", 2, names, &prog) != 0);
+    check(gf_calc_compile("c * 2", 2, names, &prog) != 0);
+    check(gf_calc_compile("max(a)", 2, names, &prog) != 0);
+    check(gf_calc_compile("(a - b", 2, names, &prog) != 0);
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    in[0] = db.tiles[0];
+    in[1] = db.tiles[0];
+    g = &db.tiles[0].grid;
+    n = (long)g->nx * g->ny;
+
+    /* Aligned inputs come straight from the file. The buffers are
+    reused below for a 301x257 resampling. */
+    p = n > 301L * 257 ? n : 301L * 257;
+    a = (gf_float *)malloc(p * sizeof(gf_float));
+    r1 = (gf_float *)malloc(p * sizeof(gf_float));
+    r4 = (gf_float *)malloc(p * sizeof(gf_float));
+    check(gf_bilinear_interpolate(&db.tiles[0], g, a) == 0);
+    check(gf_calc_compile("isnull(a) ? -1 : (a > 1000 ? (a - b) * 3 + a / 2 : nodata)",
+        2, names, &prog) == 0);
+    check(gf_calc_run(&prog, in, g, 1, NULL, NULL, r1) == 0);
+    for (p = 0; p < n; p++) {
+        want = a[p] == GF_NULL_VAL ? -1.0f : a[p] > 1000.0f ? a[p] / 2 : GF_NULL_VAL;
+        check(r1[p] == want);
+    }
+    gf_free_calc_prog(&prog);
+
+    /* Resampling matches extraction, bands match one band, and the
+    streamed file matches both. The right and bottom edges stay off the
+    tile's, where gf_bilinear's accumulated longitude and latitude can
+    step past them and skip the last column or row. */
+    gf_init_grid_bounds(&grid, g->left + 0.3 * g->dx, g->right - 0.2 * g->dx,
+        g->bottom + 0.4 * g->dy, g->top - 0.7 * g->dy, 301, 257);
+    for (p = 0; p < (long)grid.nx * grid.ny; p++)
+        a[p] = -7.0f;
+    check(gf_bilinear_interpolate(&db.tiles[0], &grid, a) == 0);
+    check(gf_calc_compile("(a + b) / 2", 2, names, &prog) == 0);
+    check(gf_calc_run(&prog, in, &grid, 1, NULL, NULL, r1) == 0);
+    check(gf_calc_run(&prog, in, &grid, 4, NULL, NULL, r4) == 0);
+    check(gf_calc_save(&prog, in, &grid, "/tmp/gf-calc") == 0);
+    check((saved = read_flt("/tmp/gf-calc", &out)) != NULL);
+    gf_close(&out);
+    for (p = 0; p < (long)grid.nx * grid.ny; p++) {
+        check(r1[p] == r4[p] && r1[p] == saved[p] && a[p] != -7.0f);
+        check(r1[p] == GF_NULL_VAL || fabs(r1[p] - a[p]) <= 1e-3 * fabs(a[p]) + 1e-3);
+    }
+    gf_free_calc_prog(&prog);
+
+    /* A short .flt fails the run rather than yielding garbage. */
+    gf_init_grid_bounds(&grid, -120.0, -119.0, 40.0, 41.0, 6, 6);
+    for (p = 0; p < 36; p++)
+        a[p] = (gf_float)p;
+    gf_save(&grid, a, "/tmp/gf-calc-short");
+    check(truncate("/tmp/gf-calc-short.flt", 20 * sizeof(gf_float)) == 0);
+    check(gf_open("/tmp/gf-calc-short.hdr", "/tmp/gf-calc-short.flt", &in[0]) == 0);
+    in[1] = in[0];
+    check(gf_calc_compile("a + b", 2, names, &prog) == 0);
+    check(gf_calc_run(&prog, in, &grid, 1, NULL, NULL, r1) != 0);
+    gf_free_calc_prog(&prog);
+    gf_close(&in[0]);
+    unlink("/tmp/gf-calc-short.hdr");
+    unlink("/tmp/gf-calc-short.flt");
+
+    free(a);
+    free(r1);
+    free(r4);
+    free(saved);
+    gf_close_db(&db);
+    return 0;
+}
+
+int test_dem_difference() {
+    gf_db db;
+    gf_struct before, out;
+    gf_grid *g;
+    gf_volume_stats one, many;
+    gf_float *a, *b, *dod;
+    double dxm, dym, cut = 0.0, fill = 0.0;
+    long i, j, p, count = 0;
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+
+    /* Before: 2 m lower in the top half, 3 m higher below, with a hole
+    and a band of changes under the detection limit. */
+    a = (gf_float *)malloc((long)g->nx * g->ny * sizeof(gf_float));
+    b = (gf_float *)malloc((long)g->nx * g->ny * sizeof(gf_float));
+    check(gf_bilinear_interpolate(&db.tiles[0], g, a) == 0);
+    for (i = 0; i < g->ny; i++) {
+        gf_lengths(g->top - i * g->dy, g->left, g->dy, g->dx, 0.0, &dxm, &dym);
+        for (j = 0; j < g->nx; j++) {
+            p = i * g->nx + j;
+            if (i < 10 && j < 10)
+                b[p] = GF_NULL_VAL;
+            else if (j >= g->nx - 5)
+                b[p] = a[p] - 0.25f;
+            else
+                b[p] = i < g->ny / 2 ? a[p] - 2.0f : a[p] + 3.0f;
+            if (a[p] == GF_NULL_VAL || b[p] == GF_NULL_VAL)
+                continue;
+            count++;
+            if (j >= g->nx - 5)
+                continue;
+            if (i < g->ny / 2)
+                fill += 2.0 * dxm * dym;
+            else
+                cut += 3.0 * dxm * dym;
+        }
+    }
+    gf_save(g, b, "/tmp/gf-dod-before");
+    check(gf_open("/tmp/gf-dod-before.hdr", "/tmp/gf-dod-before.flt", &before) == 0);
+
+    setenv("GF_THREADS", "1", 1);
+    check(gf_dem_difference(&db.tiles[0], &before, NULL, 0.5, NULL, &one) == 0);
+    setenv("GF_THREADS", "3", 1);
+    check(gf_dem_difference(&db.tiles[0], &before, NULL, 0.5, "/tmp/gf-dod", &many) == 0);
+    unsetenv("GF_THREADS");
+
+    check(one.count == count && many.count == count);
+    check(one.changed == many.changed && one.changed < count);
+    check(fabs(one.cut - cut) <= 1e-4 * cut && fabs(one.fill - fill) <= 1e-4 * fill);
+    check(fabs(many.cut - one.cut) <= 1e-9 * cut && fabs(many.fill - one.fill) <= 1e-9 * fill);
+    check(fabs(one.min + 3.0) < 1e-3 && fabs(one.max - 2.0) < 1e-3);
+
+    /* The streamed difference is after - before, null where either is. */
+    check((dod = read_flt("/tmp/gf-dod", &out)) != NULL);
+    gf_close(&out);
+    for (p = 0; p < (long)g->nx * g->ny; p++)
+        check(dod[p] == (a[p] == GF_NULL_VAL || b[p] == GF_NULL_VAL ?
+            (gf_float)GF_NULL_VAL : a[p] - b[p]));
+
+    free(a);
+    free(b);
+    free(dod);
+    gf_close(&before);
+    gf_close_db(&db);
+    return 0;
+}
+
+/* A discrete harmonic surface: what filling must give back. */
+static
+double harmonic(int i, int j) {
+    return 100.0 + 0.002 * ((double)i * i - (double)j * j) + 0.003 * i * j - 0.3 * i + 0.1 * j;
+}
+
+int test_voids() {
+    gf_grid g;
+    gf_void_opts opts;
+    gf_float *a, *b, lo = 1e30f, hi = -1e30f;
+    long p;
+    int i, j, ni, nj;
+
+    memset(&g, 0, sizeof(g));
+    g.nx = 300;
+    g.ny = 200;
+    a = (gf_float *)malloc((long)g.nx * g.ny * sizeof(gf_float));
+    b = (gf_float *)malloc((long)g.nx * g.ny * sizeof(gf_float));
+
+    /* A disk and a ragged ring (one void, with data inside), single
+    nodes, a notch in the top edge, and a block too big to fill. */
+    for (i = 0; i < g.ny; i++) {
+        for (j = 0; j < g.nx; j++) {
+            p = (long)i * g.nx + j;
+            a[p] = harmonic(i, j);
+            if (a[p] < lo)
+                lo = a[p];
+            if (a[p] > hi)
+                hi = a[p];
+            ni = i - 100;
+            nj = j - 80;
+            if (ni * ni + nj * nj < 40 * 40)
+                a[p] = GF_NULL_VAL;
+            ni = i - 100;
+            nj = j - 200;
+            if (ni * ni + nj * nj < 30 * 30 && ni * ni + nj * nj >= 20 * 20 + (i % 3) * 50)
+                a[p] = GF_NULL_VAL;
+            if (i % 37 == 5 && j % 41 == 3)
+                a[p] = GF_NULL_VAL;
+            if (i < 4 && j >= 130 && j < 150)
+                a[p] = GF_NULL_VAL;
+            if (i >= 150 && j >= 150)
+                a[p] = GF_NULL_VAL;
+        }
+    }
+    memcpy(b, a, (long)g.nx * g.ny * sizeof(gf_float));
+
+    gf_init_void_opts(&opts);
+    opts.max_cells = 50 * 150 - 1;
+    opts.tol = 1e-5;
+    opts.nthreads = 1;
+    check(gf_fill_voids(&g, &opts, a) > 3);
+    opts.nthreads = 4;
+    gf_fill_voids(&g, &opts, b);
+
+    for (i = 0; i < g.ny; i++) {
+        for (j = 0; j < g.nx; j++) {
+            p = (long)i * g.nx + j;
+            check(a[p] == b[p]);
+            if (i >= 150 && j >= 150)
+                check(a[p] == GF_NULL_VAL);
+            else if (i < 4 && j >= 130 && j < 150)
+                /* No-flux at the edge: not harmonic(), but bounded. */
+                check(a[p] >= lo && a[p] <= hi);
+            else
+                check(fabs(a[p] - harmonic(i, j)) < 1e-3);
+        }
+    }
+
+    /* Nothing to fill from. */
+    for (p = 0; p < (long)g.nx * g.ny; p++)
+        a[p] = GF_NULL_VAL;
+    check(gf_fill_voids(&g, &opts, a) == 0 && a[0] == GF_NULL_VAL);
+
+    free(a);
+    free(b);
+    return 0;
+}
+
+int test_tint() {
+    FILE *fp;
+    gf_color_ramp ramp;
+    gf_db db;
+    gf_grid grid, *g;
+    gf_data data;
+    gf_data_xtras xtras;
+    unsigned char c[4];
+    double n_sun[3] = {0.5, 0.5, sqrt(0.5)};
+    long k, n, nulls = 0;
+
+    /* Stops out of order, a comment, commas and a translucent top. */
+    fp = fopen("/tmp/gf-ramp.txt", "w");
+    fprintf(fp, "# test ramp\n1000 0 0 255\n\n0, 0, 255, 0  # sea level\n"
+        "2000 255 255 255 128\nnv 10 20 30\n");
+    fclose(fp);
+    fp = fopen("/tmp/gf-ramp.txt", "r");
+    check(gf_read_color_ramp(fp, &ramp) == 0);
+    fclose(fp);
+    unlink("/tmp/gf-ramp.txt");
+
+    check(ramp.alpha);
+    check(ramp.nodata[0] == 10 && ramp.nodata[1] == 20 && ramp.nodata[2] == 30 &&
+        ramp.nodata[3] == 255);
+    gf_tint(&ramp, 500.0f, 255, 0.5f, c);
+    check(c[0] == 0 && abs(c[1] - 128) <= 1 && abs(c[2] - 128) <= 1 && c[3] == 255);
+    gf_tint(&ramp, -50.0f, 0, 0.5f, c);
+    check(c[0] == 0 && c[1] == 127 && c[2] == 0);
+    gf_tint(&ramp, 3000.0f, 255, 0.7f, c);
+    check(c[0] == 255 && c[3] == 128);
+
+    /* The fused pass colors exactly what a separate one would, and off
+    the source is nodata. */
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+    gf_init_grid_bounds(&grid, g->left, g->right + 0.1 * (g->right - g->left),
+        g->bottom, g->top, 60, 70);
+    n = (long)grid.nx * grid.ny;
+
+    memset((void *)&xtras, 0, sizeof(gf_data_xtras));
+    xtras.types = ELEVATION | SHADE | TINT;
+    xtras.n_sun = n_sun;
+    xtras.ramp = &ramp;
+    xtras.tint_shade = 0.6f;
+    gf_init_data(xtras.types, n, &data);
+    check(gf_biquadratic_data_opts(&db.tiles[0], &grid, &xtras, &data) == 0);
+    for (k = 0; k < n; k++) {
+        if (data.elev[k] == GF_NULL_VAL) {
+            check(memcmp(data.rgba + 4 * k, ramp.nodata, 4) == 0);
+            nulls++;
+            continue;
+        }
+        gf_tint(&ramp, data.elev[k], data.shade[k], 0.6f, c);
+        check(memcmp(data.rgba + 4 * k, c, 4) == 0);
+    }
+    check(nulls >= grid.ny && nulls < n);
+
+    gf_free_data(&data);
+    gf_close_db(&db);
+    return 0;
+}
+
+int test_png() {
+    const int nx = 301, ny = 257;
+    unsigned char *img, *back, *first = NULL;
+    png_byte *rows[257];
+    gf_png_opts opts;
+    FILE *fp;
+    long size, first_size = 0;
+    int i, j, c, f, w, h;
+
+    /* Smooth ramps plus noise, in RGBA. */
+    img = (unsigned char *)malloc(4 * nx * ny);
+    srand(7);
+    for (i = 0; i < ny; i++) {
+        rows[i] = img + 4 * i * nx;
+        for (j = 0; j < nx; j++) {
+            rows[i][4 * j] = (unsigned char)(i + j);
+            rows[i][4 * j + 1] = (unsigned char)(3 * i - j);
+            rows[i][4 * j + 2] = (unsigned char)(rand() & 15);
+            rows[i][4 * j + 3] = (unsigned char)(255 - (j & 63));
+        }
+    }
+
+    /* Every filter, in strips of a few rows on many threads, decodes
+    to what went in; the alpha-less encoding drops the alpha. */
+    gf_init_png_opts(&opts);
+    opts.strip_rows = 7;
+    opts.nthreads = 4;
+    for (f = GF_PNG_FILTER_NONE; f <= GF_PNG_FILTER_ADAPTIVE; f++) {
+        opts.filter = (gf_png_filter)f;
+        opts.level = f;
+        check(gf_save_png_opts(nx, ny, rows, 4, PNG_COLOR_TYPE_RGBA, &opts, "/tmp/gf-png.png") == 0);
+        check((back = read_png("/tmp/gf-png.png", PNG_FORMAT_RGBA, &w, &h)) != NULL);
+        check(w == nx && h == ny && memcmp(back, img, 4 * nx * ny) == 0);
+        free(back);
+
+        check(gf_save_png_opts(nx, ny, rows, 4, PNG_COLOR_TYPE_RGB, &opts, "/tmp/gf-png.png") == 0);
+        check((back = read_png("/tmp/gf-png.png", PNG_FORMAT_RGB, &w, &h)) != NULL);
+        for (i = 0; i < nx * ny; i++)
+            for (c = 0; c < 3; c++)
+                check(back[3 * i + c] == img[4 * i + c]);
+        free(back);
+    }
+
+    /* Output depends on the strips, not on the threads. */
+    opts.filter = GF_PNG_FILTER_ADAPTIVE;
+    opts.level = 6;
+    opts.strip_rows = 0;
+    for (i = 1; i <= 4; i += 3) {
+        opts.nthreads = i;
+        check(gf_save_png_opts(nx, ny, rows, 4, PNG_COLOR_TYPE_RGBA, &opts, "/tmp/gf-png.png") == 0);
+        fp = fopen("/tmp/gf-png.png", "rb");
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        rewind(fp);
+        back = (unsigned char *)malloc(size);
+        check(fread(back, 1, size, fp) == (size_t)size);
+        fclose(fp);
+        if (first == NULL) {
+            first = back;
+            first_size = size;
+        } else {
+            check(size == first_size && memcmp(back, first, size) == 0);
+            free(back);
+        }
+    }
+
+    unlink("/tmp/gf-png.png");
+    free(first);
+    free(img);
+    return 0;
+}
+
+int test_transpose() {
+    static const int sizes[][2] = {{8, 8}, {1, 5}, {131, 77}, {64, 200}, {203, 9}};
+    gf_db db;
+    gf_grid grid, *g;
+    gf_data data;
+    gf_float *in, *out, *xy;
+    int k, i, j, rows, cols, stride;
+
+    /* Ragged sizes, inside a wider array, against the plain loop. */
+    for (k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++) {
+        rows = sizes[k][0];
+        cols = sizes[k][1];
+        stride = cols + 3;
+        in = (gf_float *)malloc((long)rows * stride * sizeof(gf_float));
+        out = (gf_float *)malloc((long)cols * (rows + 2) * sizeof(gf_float));
+        for (i = 0; i < rows * stride; i++)
+            in[i] = (gf_float)i;
+        for (i = 0; i < cols * (rows + 2); i++)
+            out[i] = -1.0f;
+        gf_transpose_flip(in, stride, rows, cols, out, rows + 2);
+        for (i = 0; i < rows; i++)
+            for (j = 0; j < cols; j++)
+                check(out[j * (rows + 2) + rows - 1 - i] == in[i * stride + j]);
+        for (j = 0; j < cols; j++)
+            check(out[j * (rows + 2) + rows] == -1.0f && out[j * (rows + 2) + rows + 1] == -1.0f);
+        free(in);
+        free(out);
+    }
+
+    /* Interpolating straight into the xy layout. */
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+    gf_init_grid_bounds(&grid, g->left + 0.13 * (g->right - g->left),
+        g->right - 0.07 * (g->right - g->left), g->bottom + 0.05 * (g->top - g->bottom),
+        g->top - 0.21 * (g->top - g->bottom), 45, 67);
+    in = (gf_float *)malloc((long)grid.nx * grid.ny * sizeof(gf_float));
+    xy = (gf_float *)malloc((long)grid.nx * grid.ny * sizeof(gf_float));
+    check(gf_bilinear(&db.tiles[0], &grid, NULL, &gf_bilinear_interpolate_kernel,
+        (void *)in, sizeof(gf_float)) == 0);
+    check(gf_bilinear_interpolate_xy(&db.tiles[0], &grid, xy) == 0);
+    for (i = 0; i < grid.ny; i++)
+        for (j = 0; j < grid.nx; j++)
+            check(xy[(long)j * grid.ny + grid.ny - 1 - i] == in[(long)i * grid.nx + j]);
+
+    /* And the biquadratic surface, against gf_biquadratic_data. */
+    gf_init_data(ELEVATION, (size_t)grid.nx * grid.ny, &data);
+    check(gf_biquadratic_data(&db.tiles[0], &grid, ELEVATION, NULL, &data) == 0);
+    check(gf_biquadratic_interpolate_xy(&db.tiles[0], &grid, xy) == 0);
+    for (i = 0; i < grid.ny; i++)
+        for (j = 0; j < grid.nx; j++)
+            check(xy[(long)j * grid.ny + grid.ny - 1 - i] == data.elev[(long)i * grid.nx + j]);
+    gf_free_data(&data);
+
+    free(in);
+    free(xy);
+    gf_close_db(&db);
+    return 0;
+}
+
+int test_proj() {
+    static const char *specs[] = {"webmerc", "utm"};
+    gf_proj proj;
+    gf_proj_grid pg;
+    gf_bounds b;
+    gf_db db;
+    gf_grid *g, row;
+    gf_data data, row_data;
+    gf_data_xtras xtras;
+    gf_relief_opts ropts;
+    gf_float *elev, *exact, v;
+    double *latlng, x, y, lat, lng, n_sun[3] = {0.5, 0.5, sqrt(0.5)};
+    long k, n, valid;
+    int p, i, j, r;
+
+    /* Exact transforms: known values and round trips. */
+    check(gf_parse_proj("utm", -33.9, 151.2, &proj) == 0);
+    check(proj.type == GF_PROJ_UTM && proj.zone == 56 && proj.south);
+    check(gf_parse_proj("utm:10s", 0.0, 0.0, &proj) == 0 && proj.zone == 10 && proj.south);
+    check(gf_parse_proj("utm:61", 0.0, 0.0, &proj) != 0);
+    check(gf_parse_proj("lambert", 0.0, 0.0, &proj) != 0);
+
+    check(gf_parse_proj("utm:10", 0.0, 0.0, &proj) == 0 && !proj.south);
+    gf_proj_forward(&proj, 45.0, -123.0, &x, &y);
+    check(fabs(x - 500000.0) < 1e-6);
+    check(fabs(y - 4982950.4) < 0.1);   /* Meridian arc to 45N, times 0.9996 */
+    gf_proj_forward(&proj, 45.0, -120.0, &x, &y);
+    check(fabs(x - 736446.03) < 0.1 && fabs(y - 4987329.50) < 0.1);
+    for (lat = -80.0; lat <= 84.0; lat += 8.2) {
+        for (lng = -126.0; lng <= -120.0; lng += 0.75) {
+            proj.south = lat < 0.0;
+            gf_proj_forward(&proj, lat, lng, &x, &y);
+            gf_proj_inverse(&proj, x, y, &y, &x);
+            check(fabs(y - lat) < 1e-7 && fabs(x - lng) < 1e-7);
+        }
+    }
+
+    check(gf_parse_proj("3857", 0.0, 0.0, &proj) == 0 && proj.type == GF_PROJ_WEBMERC);
+    gf_proj_forward(&proj, 0.0, 180.0, &x, &y);
+    check(fabs(x - 20037508.342789) < 1e-3 && fabs(y) < 1e-9);
+    gf_proj_forward(&proj, 60.0, -120.5, &x, &y);
+    gf_proj_inverse(&proj, x, y, &lat, &lng);
+    check(fabs(lat - 60.0) < 1e-12 && fabs(lng + 120.5) < 1e-12);
+
+    gf_open_db(dbpath, &db);
+    check(db.count > 0);
+    g = &db.tiles[0].grid;
+    b.left = g->left;
+    b.right = g->right;
+    b.bottom = g->bottom;
+    b.top = g->top;
+
+    /* Tables and control grid against sampling at exactly inverted
+    nodes. The box's projection overhangs it, so some nodes are off
+    the source. */
+    for (p = 0; p < 2; p++) {
+        check(gf_parse_proj(specs[p], 0.5 * (b.bottom + b.top), 0.5 * (b.left + b.right), &proj) == 0);
+        gf_init_proj_grid(&pg, &proj, &b, 157, 203);
+        n = (long)pg.grid.nx * pg.grid.ny;
+        elev = (gf_float *)malloc(n * sizeof(gf_float));
+        exact = (gf_float *)malloc(n * sizeof(gf_float));
+        latlng = (double *)malloc(2 * n * sizeof(double));
+        for (i = 0; i < pg.grid.ny; i++) {
+            for (j = 0; j < pg.grid.nx; j++) {
+                k = (long)i * pg.grid.nx + j;
+                gf_proj_inverse(&proj, pg.grid.left + j * pg.grid.dx,
+                    pg.grid.top - i * pg.grid.dy, &latlng[2 * k], &latlng[2 * k + 1]);
+            }
+        }
+
+        check(gf_proj_interpolate(&db.tiles[0], &pg, elev) == 0);
+        gf_sample_points(&db.tiles[0], (int)n, latlng, exact);
+        for (k = 0, valid = 0; k < n; k++) {
+            if (elev[k] == GF_NULL_VAL || exact[k] == GF_NULL_VAL)
+                continue;
+            check(fabs(elev[k] - exact[k]) < 1e-2);
+            valid++;
+        }
+        check(valid > n / 2);
+
+        /* A Web Mercator row is a parallel with evenly spaced
+        longitudes, so biquadratic samples match a two-row geographic
+        grid through rows i and i + 1. */
+        if (proj.type == GF_PROJ_WEBMERC) {
+            memset((void *)&xtras, 0, sizeof(gf_data_xtras));
+            xtras.types = ELEVATION;
+            gf_init_data(ELEVATION, n, &data);
+            gf_init_data(ELEVATION, 2 * pg.grid.nx, &row_data);
+            check(gf_proj_biquadratic_data(&db.tiles[0], &pg, &xtras, &data) == 0);
+            for (i = 0, valid = 0; i < pg.grid.ny - 1; i += 39) {
+                k = 2 * (long)i * pg.grid.nx;
+                gf_init_grid_bounds(&row, latlng[k + 1], latlng[k + 2 * pg.grid.nx - 1],
+                    latlng[k + 2 * pg.grid.nx], latlng[k], 2, pg.grid.nx);
+                gf_biquadratic_data(&db.tiles[0], &row, ELEVATION, NULL, &row_data);
+                for (r = 0; r < 2; r++) {
+                    for (j = 0; j < pg.grid.nx; j++) {
+                        v = data.elev[(long)(i + r) * pg.grid.nx + j];
+                        if (v == GF_NULL_VAL || row_data.elev[r * pg.grid.nx + j] == GF_NULL_VAL)
+                            continue;
+                        check(fabs(v - row_data.elev[r * pg.grid.nx + j]) < 1e-3);
+                        valid++;
+                    }
+                }
+            }
+            check(valid > 0);
+            gf_free_data(&row_data);
+            gf_free_data(&data);
+        }
+
+        free(elev);
+        free(exact);
+        free(latlng);
+    }
+
+    /* A grid too narrow to sample fails before any PNG is written. */
+    gf_init_relief_opts(&ropts, n_sun);
+    pg.grid.nx = 1;
+    unlink("/tmp/gf-proj.png");
+    check(gf_relief_shade_proj(&db.tiles[0], &pg, &ropts, "/tmp/gf-proj.png") == -1);
+    check(access("/tmp/gf-proj.png", F_OK) != 0);
+
+    gf_close_db(&db);
+    return 0;
+}
+
+/* Write a 6x6 tile at /tmp/gf-cat/name whose nodes hold base + k. */
+static
+void catalog_tile(const char *name, double left, float base) {
+    char prefix[256];
+    gf_grid grid;
+    gf_float data[36];
+    int k;
+
+    for (k = 0; k < 36; k++)
+        data[k] = base + k;
+    gf_init_grid_bounds(&grid, left, left + 1.0, 40.0, 41.0, 6, 6);
+    snprintf(prefix, sizeof(prefix), "/tmp/gf-cat/%s", name);
+    gf_save(&grid, data, prefix);
+}
+
+/* Set a directory's mtime sec seconds into the past. */
+static
+void catalog_backdate(const char *dir, int sec) {
+    struct timespec times[2];
+
+    clock_gettime(CLOCK_REALTIME, &times[0]);
+    times[0].tv_sec -= sec;
+    times[1] = times[0];
+    utimensat(AT_FDCWD, dir, times, 0);
+}
+
+int test_catalog() {
+    static const char *files[] = {"r", "s/a", "s/u/b", "s/u/c", "s/u/d"};
+    char path[256], *long_path;
+    gf_db db, plain;
+    gf_rtree_node **leaves;
+    gf_bounds b = {-115.5, -113.5, 40.2, 40.8};
+    gf_float line[6];
+    FILE *fp;
+    int k, found;
+
+    mkdir("/tmp/gf-cat", 0755);
+    mkdir("/tmp/gf-cat/s", 0755);
+    mkdir("/tmp/gf-cat/s/u", 0755);
+    catalog_tile("r", -120.0, 0.0f);
+    catalog_tile("s/a", -118.0, 100.0f);
+    catalog_tile("s/u/b", -116.0, 200.0f);
+    catalog_backdate("/tmp/gf-cat/s/u", 30);
+    catalog_backdate("/tmp/gf-cat/s", 30);
+
+    /* Built, then served from the mapped catalog. */
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 3 && db.catalog != NULL && !db.catalog_mapped);
+    gf_close_db(&db);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 3 && db.catalog_mapped);
+
+    gf_init_db(&plain);
+    check(gf_db_load_tiles("/tmp/gf-cat", &plain) == 0 && plain.count == 3);
+    for (k = 0; k < db.count; k++) {
+        check(db.tiles[k].flt == NULL);
+        for (found = 0; found < plain.count; found++)
+            if (memcmp(&db.tiles[k].grid, &plain.tiles[found].grid, sizeof(gf_grid)) == 0)
+                break;
+        check(found < plain.count);
+        check(gf_get_line(2, 1, 4, &db.tiles[k], line) == 0);
+        check(line[0] == (gf_float)((db.tiles[k].grid.left + 120.0) * 50.0 + 13.0));
+    }
+    gf_close_db(&plain);
+
+    /* Each tile's .flt was opened by its first read. */
+    check(db.flts[0].fp != NULL);
+
+    leaves = (gf_rtree_node **)malloc(4 * sizeof(gf_rtree_node *));
+    gf_search_rtree(&b, db.tree, leaves, &found);
+    check(found == 1);
+    gf_close_db(&db);
+
+    /* A tile added deep down: only its directory is stale. */
+    catalog_tile("s/u/c", -114.0, 300.0f);
+    catalog_backdate("/tmp/gf-cat/s/u", 20);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 4 && !db.catalog_mapped);
+    gf_close_db(&db);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 4 && db.catalog_mapped);
+    gf_search_rtree(&b, db.tree, leaves, &found);
+    check(found == 2);
+    gf_close_db(&db);
+
+    /* A tile removed. */
+    unlink("/tmp/gf-cat/s/a.hdr");
+    unlink("/tmp/gf-cat/s/a.flt");
+    catalog_backdate("/tmp/gf-cat/s", 10);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 3);
+    for (k = 0; k < db.count; k++)
+        check(db.tiles[k].grid.left != -118.0);
+    gf_close_db(&db);
+
+    /* A damaged catalog is rebuilt. */
+    check((fp = fopen("/tmp/gf-cat/" GF_CATALOG_NAME, "r+b")) != NULL);
+    fputs("garbage", fp);
+    fclose(fp);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 3 && !db.catalog_mapped);
+    gf_close_db(&db);
+    check(gf_rebuild_catalog("/tmp/gf-cat", NULL) == 0);
+
+    /* A header that does not parse is left out, and its directory
+    rescanned until it is fixed. */
+    catalog_tile("s/u/d", -112.0, 400.0f);
+    check((fp = fopen("/tmp/gf-cat/s/u/d.hdr", "a")) != NULL);
+    fputs("\nbogus 1\n", fp);
+    fclose(fp);
+    catalog_backdate("/tmp/gf-cat/s/u", 5);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 3);
+    gf_close_db(&db);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 3 && !db.catalog_mapped);
+    gf_close_db(&db);
+    catalog_tile("s/u/d", -112.0, 400.0f);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 4 && !db.catalog_mapped);
+    gf_close_db(&db);
+    check(gf_open_db("/tmp/gf-cat", &db) == 0);
+    check(db.count == 4 && db.catalog_mapped);
+    gf_close_db(&db);
+
+    /* Paths too long for the catalog are refused, not cut short. */
+    memset(path, 'x', sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    long_path = (char *)malloc(20 * sizeof(path));
+    for (k = 0, long_path[0] = '\0'; k < 20; k++)
+        strcat(long_path, path);
+    check(gf_open_db_catalog(long_path, NULL, &db) != 0);
+    check(gf_rebuild_catalog("/tmp/gf-cat", long_path) != 0);
+    free(long_path);
+
+    free(leaves);
+    for (k = 0; k < 5; k++) {
+        snprintf(path, sizeof(path), "/tmp/gf-cat/%s.hdr", files[k]);
+        unlink(path);
+        snprintf(path, sizeof(path), "/tmp/gf-cat/%s.flt", files[k]);
+        unlink(path);
+    }
+    unlink("/tmp/gf-cat/" GF_CATALOG_NAME);
+    rmdir("/tmp/gf-cat/s/u");
+    rmdir("/tmp/gf-cat/s");
+    rmdir("/tmp/gf-cat");
+    return 0;
+}
+
+static
+void crawl_progress(long ndirs, long ntiles, void *arg) {
+    long *last = (long *)arg;
+
+    last[0] = ndirs;
+    last[1] = ntiles;
+}
+
+int test_parallel_load() {
+    char name[64], path[256];
+    gf_db one, many, cat;
+    gf_db_load_opts opts;
+    FILE *fp;
+    long last[2] = {0, 0};
+    int d, t, k;
+
+    mkdir("/tmp/gf-cat", 0755);
+    for (d = 0; d < 4; d++) {
+        snprintf(path, sizeof(path), "/tmp/gf-cat/d%d", d);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "/tmp/gf-cat/d%d/e", d);
+        mkdir(path, 0755);
+        for (t = 0; t < 6; t++) {
+            snprintf(name, sizeof(name), t < 3 ? "d%d/t%d" : "d%d/e/t%d", d, t);
+            catalog_tile(name, -120.0 + d * 6 + t, (float)(d * 6 + t));
+        }
+    }
+
+    /* Same tiles, in the same (path) order, on one thread or four. */
+    gf_init_db_load_opts(&opts);
+    opts.nthreads = 1;
+    gf_init_db(&one);
+    check(gf_db_load_tiles_opts("/tmp/gf-cat", &opts, &one) == 0);
+    opts.nthreads = 4;
+    opts.progress = crawl_progress;
+    opts.progress_arg = last;
+    gf_init_db(&many);
+    check(gf_db_load_tiles_opts("/tmp/gf-cat", &opts, &many) == 0);
+    check(one.count == 24 && many.count == 24);
+    check(last[0] == 9 && last[1] == 24);
+    for (k = 0; k < 24; k++) {
+        check(memcmp(&one.tiles[k].grid, &many.tiles[k].grid, sizeof(gf_grid)) == 0);
+        check(many.tiles[k].flt != NULL);
+    }
+    check(one.tiles[0].grid.left == -117.0 && one.tiles[3].grid.left == -120.0);
+
+    /* The catalog's crawl finds the same tiles. */
+    check(gf_open_db("/tmp/gf-cat", &cat) == 0 && cat.count == 24);
+    for (k = 0; k < cat.count; k++) {
+        for (t = 0; t < one.count; t++)
+            if (memcmp(&cat.tiles[k].grid, &one.tiles[t].grid, sizeof(gf_grid)) == 0)
+                break;
+        check(t < one.count);
+    }
+    gf_close_db(&cat);
+    unlink("/tmp/gf-cat/" GF_CATALOG_NAME);
+
+    /* Loading appends. */
+    check(gf_db_load_tiles("/tmp/gf-cat/d1", &many) == 0 && many.count == 30);
+    gf_close_db(&one);
+
+    /* A header without data fails the load and adds nothing. */
+    unlink("/tmp/gf-cat/d2/e/t4.flt");
+    check(gf_db_load_tiles("/tmp/gf-cat", &many) != 0 && many.count == 30);
+
+    /* So does a header that can't be parsed. */
+    fp = fopen("/tmp/gf-cat/d1/t0.hdr", "a");
+    fputs("\nbogus 1\n", fp);
+    fclose(fp);
+    check(gf_db_load_tiles("/tmp/gf-cat/d1", &many) != 0 && many.count == 30);
+    gf_close_db(&many);
+
+    for (d = 0; d < 4; d++) {
+        for (t = 0; t < 6; t++) {
+            snprintf(path, sizeof(path), t < 3 ? "/tmp/gf-cat/d%d/t%d.hdr" :
+                "/tmp/gf-cat/d%d/e/t%d.hdr", d, t);
+            unlink(path);
+            strcpy(path + strlen(path) - 4, ".flt");
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), "/tmp/gf-cat/d%d/e", d);
+        rmdir(path);
+        snprintf(path, sizeof(path), "/tmp/gf-cat/d%d", d);
+        rmdir(path);
+    }
+    rmdir("/tmp/gf-cat");
+    return 0;
+}
+
 static struct option options[] = {
 	{ "help",	no_argument,		NULL, 'h' },
 	{ "db",	required_argument,	NULL, 'd' },
@@ -238,6 +2653,32 @@ int main(int argc, char **argv)
     test(test_quad_interp, "smooth/interp four tiles to one at half resolution");
     test(test_tile_path, "get pathname from template");
     test(test_tile, "tile a database of gridfloat!");
+    test(test_aligned, "aligned extractions match interpolation, and fail on short reads");
+    test(test_fused_data, "fused gf_data pass matches one pass per product");
+    test(test_stencil_bands, "banded stencil run matches a single band");
+    test(test_terrain, "stencil biquadratic and terrain operators");
+    test(test_null_blocks, "null summaries skip all-NODATA blocks, read mixed and valid ones");
+    test(test_sat, "summed-area table window statistics match brute force");
+    test(test_zonal, "zonal statistics over polygons match a brute-force point test");
+    test(test_sample_points, "scattered point samples match gridded interpolation");
+    test(test_profile, "profiles sample polylines evenly and total the climb");
+    test(test_line_of_sight, "pyramid line of sight matches a fine ray march");
+    test(test_viewshed, "viewshed agrees with line of sight");
+    test(test_cast_shadows, "a wall casts a shadow as long as it is high");
+    test(test_sun_frames, "sun-angle frames match single renders, nested loops stay inline");
+    test(test_sky_view, "sky-view factor of flats and a trench floor");
+    test(test_contours, "banded contours stitch across seams like one band");
+    test(test_hydrology, "tiled depression filling and accumulation match one tile");
+    test(test_route, "A* routes match Bellman-Ford, alone and in batches");
+    test(test_calc, "raster algebra matches extraction, in bands and streamed");
+    test(test_dem_difference, "streamed DEM of difference volumes match brute force");
+    test(test_voids, "filled voids are harmonic, alike on any number of threads");
+    test(test_tint, "ramp colors, shaded in the fused pass");
+    test(test_png, "strip-parallel PNGs decode with libpng, any filter");
+    test(test_transpose, "blocked transpose-flip and xy interpolation match plain loops");
+    test(test_proj, "projected grids match sampling at exactly inverted nodes");
+    test(test_catalog, "catalog opens match a crawl and follow added and removed tiles");
+    test(test_parallel_load, "parallel crawls load the same tiles in path order, catalog or not");
 	printf("\nPASSED: %d\nFAILED: %d\n", test_passed, test_failed);
 
     return 0;